@@ -7,6 +7,7 @@
 #define __HEPNOS_H
 
 #include <hepnos/AsyncEngine.hpp>
+#include <hepnos/CollectiveLoader.hpp>
 #include <hepnos/DataStore.hpp>
 #include <hepnos/DataSet.hpp>
 #include <hepnos/Demangle.hpp>
@@ -15,10 +16,12 @@
 #include <hepnos/EventSet.hpp>
 #include <hepnos/Exception.hpp>
 #include <hepnos/KeyValueContainer.hpp>
+#include <hepnos/PackedWriter.hpp>
 #include <hepnos/ParallelEventProcessor.hpp>
 #include <hepnos/Prefetcher.hpp>
 #include <hepnos/ProductCache.hpp>
 #include <hepnos/Queue.hpp>
+#include <hepnos/EventDispatcher.hpp>
 #include <hepnos/Run.hpp>
 #include <hepnos/RunNumber.hpp>
 #include <hepnos/RunSet.hpp>
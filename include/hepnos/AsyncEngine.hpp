@@ -24,6 +24,7 @@ class PrefetcherImpl;
 class AsyncEngineImpl;
 class ParallelEventProcessor;
 class ParallelEventProcessorImpl;
+class Queue;
 
 /**
  * @brief The AsyncEngine class uses Argobots to provide a set
@@ -47,6 +48,7 @@ class AsyncEngine : public RawStorage {
     friend class Prefetcher;
     friend class ParallelEventProcessor;
     friend class ParallelEventProcessorImpl;
+    friend class Queue;
 
     private:
 
@@ -148,6 +150,11 @@ class AsyncEngine : public RawStorage {
      * @see RawStorage::loadRawData
      */
     bool loadRawData(const ProductID& key, char* value, size_t* vsize) const override;
+
+    /**
+     * @see RawStorage::assembleChunks
+     */
+    bool assembleChunks(const ProductID& key, std::string& buffer) const override;
 };
 
 }
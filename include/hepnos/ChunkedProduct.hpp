@@ -0,0 +1,57 @@
+/*
+ * (C) 2026 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#ifndef __HEPNOS_CHUNKED_PRODUCT_HPP
+#define __HEPNOS_CHUNKED_PRODUCT_HPP
+
+#include <string>
+#include <cstring>
+#include <cstdint>
+
+namespace hepnos {
+
+/**
+ * @brief Value stored under the key of a product that was split into
+ * chunks (see DataStore::setChunkSize). The chunks are stored under
+ * keys derived from the product's key, spread across product databases.
+ */
+struct ChunkManifest {
+
+    char     magic[8];
+    uint64_t total_size;
+    uint64_t chunk_size;
+    uint64_t num_chunks;
+
+    ChunkManifest(uint64_t total = 0, uint64_t chunk = 1)
+    : total_size(total)
+    , chunk_size(chunk)
+    , num_chunks((total + chunk - 1)/chunk) {
+        std::memcpy(magic, "HCHUNKED", sizeof(magic));
+    }
+
+    /**
+     * @brief Size of the i-th chunk.
+     */
+    size_t chunkSize(size_t i) const {
+        return i + 1 < num_chunks ? chunk_size : total_size - i*chunk_size;
+    }
+
+    /**
+     * @brief Reads a manifest from the loaded data of a product.
+     *
+     * @return false if the data is not a manifest.
+     */
+    static bool read(const char* data, size_t size, ChunkManifest& manifest) {
+        if(size != sizeof(ChunkManifest)) return false;
+        std::memcpy(&manifest, data, sizeof(manifest));
+        return std::memcmp(manifest.magic, "HCHUNKED", sizeof(manifest.magic)) == 0
+            && manifest.chunk_size != 0
+            && manifest.num_chunks == (manifest.total_size + manifest.chunk_size - 1)/manifest.chunk_size;
+    }
+};
+
+}
+
+#endif
@@ -0,0 +1,89 @@
+/*
+ * (C) 2026 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#ifndef __HEPNOS_COLLECTIVE_LOADER_HPP
+#define __HEPNOS_COLLECTIVE_LOADER_HPP
+
+#include <mpi.h>
+#include <hepnos/RawStorage.hpp>
+
+namespace hepnos {
+
+class KeyValueContainer;
+
+/**
+ * @brief The CollectiveLoader is a RawStorage used to load a product
+ * once and share it with all the processes of a communicator. The root
+ * process loads the raw data of the product from an underlying RawStorage
+ * (DataStore, Prefetcher, etc.) and broadcasts it to the other processes,
+ * which then deserialize it locally. Loads from a CollectiveLoader are
+ * collective across the communicator. The CollectiveLoader cannot be
+ * used to store products.
+ */
+class CollectiveLoader : public RawStorage {
+
+    friend class KeyValueContainer;
+
+    public:
+
+    /**
+     * @brief Constructor.
+     *
+     * @param source RawStorage from which the root process loads products.
+     * The source must outlive the CollectiveLoader.
+     * @param comm Communicator across which products are shared.
+     * @param root Rank of the process loading products.
+     */
+    CollectiveLoader(const RawStorage& source, MPI_Comm comm, int root=0);
+
+    /**
+     * @brief Copy constructor.
+     */
+    CollectiveLoader(const CollectiveLoader&) = default;
+
+    /**
+     * @brief Deleted copy-assignment operator.
+     */
+    CollectiveLoader& operator=(const CollectiveLoader&) = delete;
+
+    /**
+     * @brief Destructor.
+     */
+    ~CollectiveLoader() = default;
+
+    bool valid() const override;
+
+    protected:
+
+    /**
+     * @brief Throws an Exception, since a CollectiveLoader cannot store products.
+     */
+    ProductID storeRawData(const ProductID& key, const char* value, size_t vsize) override;
+
+    /**
+     * @see RawStorage::loadRawData
+     */
+    bool loadRawData(const ProductID& key, std::string& buffer) const override;
+
+    /**
+     * @see RawStorage::loadRawData
+     */
+    bool loadRawData(const ProductID& key, char* value, size_t* vsize) const override;
+
+    /**
+     * @see RawStorage::assembleChunks
+     */
+    bool assembleChunks(const ProductID& key, std::string& buffer) const override;
+
+    private:
+
+    const RawStorage& m_source;
+    MPI_Comm          m_comm;
+    int               m_root;
+};
+
+}
+
+#endif
@@ -0,0 +1,116 @@
+/*
+ * (C) 2026 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#ifndef __HEPNOS_COLUMN_LAYOUT_HPP
+#define __HEPNOS_COLUMN_LAYOUT_HPP
+
+#include <tuple>
+#include <string>
+#include <utility>
+#include <type_traits>
+#include <hepnos/Serializer.hpp>
+
+namespace hepnos {
+
+/**
+ * @brief Description of a field of a record type V stored as a column.
+ *
+ * @tparam V Record type.
+ * @tparam F Type of the field.
+ */
+template<typename V, typename F>
+struct Column {
+    using record_type = V;
+    using field_type  = F;
+
+    const char* name;
+    F V::*      member;
+};
+
+/**
+ * @brief Helper to build a Column.
+ */
+template<typename V, typename F>
+constexpr Column<V,F> column(const char* name, F V::* member) {
+    return Column<V,F>{ name, member };
+}
+
+/**
+ * @brief Describes the fields of a record type so that vectors of such
+ * records can be stored as columns (one product per field) with
+ * storeColumns and loaded field by field with loadColumn. Specialize it
+ * with a static columns() function returning a tuple of Column, e.g.:
+ *
+ * template<> struct ColumnLayout<Hit> {
+ *     static auto columns() {
+ *         return std::make_tuple(column("x", &Hit::x),
+ *                                column("energy", &Hit::energy));
+ *     }
+ * };
+ */
+template<typename V>
+struct ColumnLayout {};
+
+/**
+ * @brief Indicates whether ColumnLayout has been specialized for V.
+ */
+template<typename V, typename = void>
+struct HasColumnLayout : std::false_type {};
+
+template<typename V>
+struct HasColumnLayout<V, typename MakeVoid<
+        decltype(ColumnLayout<V>::columns())
+    >::type> : std::true_type {};
+
+namespace detail {
+
+template<typename Tuple, typename Func, size_t ... I>
+void forEachColumn(const Tuple& columns, Func&& func, std::index_sequence<I...>) {
+    int unused[] = { 0, (func(std::get<I>(columns)), 0)... };
+    (void)unused;
+}
+
+template<typename V, typename F, typename G>
+bool matchColumn(const Column<V,G>&, F V::*, const char**) {
+    return false;
+}
+
+template<typename V, typename F>
+bool matchColumn(const Column<V,F>& column, F V::* member, const char** name) {
+    if(column.member != member) return false;
+    *name = column.name;
+    return true;
+}
+
+}
+
+/**
+ * @brief Calls func on each Column of the ColumnLayout of V.
+ */
+template<typename V, typename Func>
+void forEachColumn(Func&& func) {
+    static_assert(HasColumnLayout<V>::value,
+            "ColumnLayout<V> must be specialized to store vectors of V as columns");
+    auto columns = ColumnLayout<V>::columns();
+    detail::forEachColumn(columns, std::forward<Func>(func),
+        std::make_index_sequence<std::tuple_size<decltype(columns)>::value>());
+}
+
+/**
+ * @brief Returns the name of the column corresponding to a member of V,
+ * or nullptr if the member is not part of the ColumnLayout of V.
+ */
+template<typename V, typename F>
+const char* columnName(F V::* member) {
+    const char* name = nullptr;
+    forEachColumn<V>([&](const auto& column) {
+        if(!name) detail::matchColumn(column, member, &name);
+    });
+    return name;
+}
+
+}
+
+#endif
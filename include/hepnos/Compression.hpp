@@ -0,0 +1,66 @@
+/*
+ * (C) 2026 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#ifndef __HEPNOS_COMPRESSION_HPP
+#define __HEPNOS_COMPRESSION_HPP
+
+#include <string>
+#include <cstdint>
+
+namespace hepnos {
+
+/**
+ * @brief Codec used to compress the products of a given label and type.
+ * ZLIB_FAST favors compression speed, ZLIB_BEST favors compression ratio.
+ */
+enum class CompressionCodec : uint8_t {
+    NONE      = 0,
+    ZLIB_FAST = 1,
+    ZLIB_BEST = 2
+};
+
+/**
+ * @brief Compression settings for the products of a given label and type.
+ * Products smaller than threshold bytes are stored uncompressed.
+ */
+struct CompressionOptions {
+    CompressionCodec codec     = CompressionCodec::NONE;
+    size_t           threshold = 4096;
+};
+
+/**
+ * @brief Compresses a buffer with the specified codec. The output
+ * starts with a header identifying the codec and the original size,
+ * so that compressed and uncompressed products can coexist.
+ *
+ * @param codec Codec to use.
+ * @param data Data to compress.
+ * @param size Size of the data.
+ * @param output Resulting compressed buffer.
+ *
+ * @return false if the data was not compressed (codec is NONE or
+ * compression did not reduce the size), in which case output
+ * should be ignored.
+ */
+bool compressBuffer(CompressionCodec codec, const char* data, size_t size, std::string& output);
+
+/**
+ * @brief Checks whether a buffer was produced by compressBuffer.
+ */
+bool isCompressedBuffer(const char* data, size_t size);
+
+/**
+ * @brief Decompresses a buffer produced by compressBuffer.
+ * Throws an Exception if the buffer is corrupted.
+ *
+ * @param data Compressed data.
+ * @param size Size of the compressed data.
+ * @param output Resulting decompressed buffer.
+ */
+void decompressBuffer(const char* data, size_t size, std::string& output);
+
+}
+
+#endif
@@ -10,9 +10,18 @@
 #include <string>
 #include <sstream>
 #include <memory>
+#include <functional>
+#include <typeinfo>
+#include <unordered_map>
+#include <mpi.h>
 #include <hepnos/ItemType.hpp>
 #include <hepnos/RawStorage.hpp>
 #include <hepnos/QueueAccessMode.hpp>
+#include <hepnos/QueueOptions.hpp>
+#include <hepnos/EventDispatcherOptions.hpp>
+#include <hepnos/Compression.hpp>
+#include <hepnos/ChunkedProduct.hpp>
+#include <hepnos/Demangle.hpp>
 
 namespace hepnos {
 
@@ -29,6 +38,8 @@ class RunSetImpl;
 class ItemImpl;
 template<typename T, typename C = std::vector<T>> class Ptr;
 class WriteBatch;
+class InputArchive;
+struct PtrTarget;
 class AsyncEngine;
 class ParallelEventProcessor;
 class ParallelEventProcessorImpl;
@@ -39,6 +50,27 @@ class ProductCacheImpl;
 class KeyValueContainer;
 class Queue;
 class QueueImpl;
+class EventDispatcher;
+class EventDispatcherImpl;
+
+/**
+ * @brief Statistics on the node-level product cache, for this process.
+ */
+struct NodeCacheStatistics {
+    size_t hits    = 0; // loads served by the cache
+    size_t misses  = 0; // loads of cacheable products not found in the cache
+    size_t entries = 0; // products in the cache (shared by the node)
+};
+
+/**
+ * @brief Statistics on the loads of packed products (see
+ * DataStore::setPacking), for this process.
+ */
+struct PackingStatistics {
+    size_t hits         = 0; // loads served by a packed record in memory
+    size_t misses       = 0; // loads of packable products not found in a packed record
+    size_t record_loads = 0; // packed records loaded from the storage
+};
 
 /**
  * The DataStore class is the main handle referencing an HEPnOS service.
@@ -65,6 +97,10 @@ class DataStore : public RawStorage {
     friend class ProductCacheImpl;
     friend class Queue;
     friend class QueueImpl;
+    friend class EventDispatcher;
+    friend class EventDispatcherImpl;
+    friend class InputArchive;
+    template<typename T, typename C> friend class Ptr;
 
     public:
 
@@ -178,6 +214,39 @@ class DataStore : public RawStorage {
     template<typename T>
     bool loadProduct(const ProductID& productID, std::vector<T>& t);
 
+    /**
+     * @brief Loads the data pointed to by the Ptrs of a vector that have
+     * not been resolved yet. Each distinct product is loaded only once,
+     * with one request per product database, and shared with all the
+     * Ptrs into it, including Ptrs resolved later while it is still in use.
+     * The Ptrs must have been created by (or loaded from) this DataStore.
+     * Throws an Exception if one of the products cannot be loaded.
+     *
+     * @tparam T Type of object pointed to.
+     * @tparam C Type of collection.
+     * @param ptrs Ptrs to resolve.
+     */
+    template<typename T, typename C>
+    void resolvePtrs(std::vector<Ptr<T,C>>& ptrs);
+
+    /**
+     * @brief Enables speculative prefetching of the products pointed to by
+     * Ptrs. When an object containing Ptrs is deserialized, the distinct
+     * products they point to are loaded in the background with one request
+     * per product database, so that dereferencing the Ptrs usually does not
+     * require contacting the service. At most capacity prefetched products
+     * are kept in memory until a Ptr uses them.
+     *
+     * @param capacity Number of prefetched products kept in memory.
+     */
+    void enablePtrPrefetching(size_t capacity = 64);
+
+    /**
+     * @brief Disables the speculative prefetching of Ptr targets
+     * and releases the products prefetched and not in use.
+     */
+    void disablePtrPrefetching();
+
     /**
      * @brief Shuts down the HEPnOS service.
      */
@@ -193,13 +262,123 @@ class DataStore : public RawStorage {
      */
     size_t numTargets(const ItemType& type) const;
 
+    /**
+     * @brief Enables a product cache shared by the processes of comm
+     * running on the same node. This function is collective across comm
+     * and all the processes must provide the same capacity. Products of
+     * DataSets, Runs, and SubRuns loaded by any of these processes are
+     * placed in a POSIX shared memory segment of the given capacity,
+     * from which the other processes of the node read them instead of
+     * sending requests to the service. This cache is used by all the
+     * load functions, including those going through a Prefetcher.
+     *
+     * @param comm Communicator of the processes sharing the cache.
+     * @param capacity Maximum number of bytes of products in the cache.
+     */
+    void enableNodeCache(MPI_Comm comm, size_t capacity=64*1024*1024);
+
+    /**
+     * @brief Stops using the node-level product cache. The shared memory
+     * segment is released once all the processes of the node have
+     * disabled the cache. This function should not be called while
+     * other threads are loading products.
+     */
+    void disableNodeCache();
+
+    /**
+     * @brief Fills the provided NodeCacheStatistics with statistics on
+     * the node-level product cache (all zeros if the cache is disabled).
+     *
+     * @param stats Statistics to fill.
+     */
+    void collectNodeCacheStatistics(NodeCacheStatistics& stats) const;
+
+    /**
+     * @brief Enables compression of the products stored with the given
+     * label, whatever their type. Products whose serialized size is below
+     * the threshold are stored uncompressed. Compressed products are
+     * decompressed transparently when loaded, regardless of the current
+     * compression settings. Settings for a specific type (see the
+     * templated version of this function) take precedence over settings
+     * for a label. This function should be called before the DataStore
+     * is used concurrently by multiple threads.
+     *
+     * @param label Label of the products.
+     * @param codec Codec to use (CompressionCodec::NONE to disable).
+     * @param threshold Minimum size of products to compress, in bytes.
+     */
+    void setCompression(const std::string& label, CompressionCodec codec, size_t threshold=4096);
+
+    /**
+     * @brief Enables compression of the products of type T stored
+     * with the given label.
+     *
+     * @tparam T Type of the products.
+     * @param label Label of the products.
+     * @param codec Codec to use (CompressionCodec::NONE to disable).
+     * @param threshold Minimum size of products to compress, in bytes.
+     */
+    template<typename T>
+    void setCompression(const std::string& label, CompressionCodec codec, size_t threshold=4096) {
+        setCompressionImpl(label, demangle<T>(), codec, threshold);
+    }
+
+    /**
+     * @brief Sets the size above which products are split into chunks of
+     * this size when stored. The chunks are spread across product databases
+     * and are loaded in parallel, and loading a range of a vector of raw
+     * values (see KeyValueContainer::load) only fetches the chunks covering
+     * this range. Chunked products are loaded transparently regardless of
+     * the current chunk size. A chunk size of 0 (the default) disables
+     * chunking. This function should be called before the DataStore is
+     * used concurrently by multiple threads.
+     *
+     * @param chunk_size Chunk size in bytes.
+     */
+    void setChunkSize(size_t chunk_size);
+
+    /**
+     * @brief Returns the chunk size set by setChunkSize.
+     */
+    size_t getChunkSize() const;
+
+    /**
+     * @brief Indicates that products of type T with the given label may be
+     * stored packed at the SubRun level (see SubRun::storePacked) rather
+     * than in each Event. When enabled, loading such a product from an
+     * Event first looks it up in the packed record of the Event's SubRun,
+     * and only then in the Event itself: a product found in the packed
+     * record takes precedence over one stored in the Event. The most
+     * recently used packed records are kept in memory, so that loading the
+     * product for consecutive events of a SubRun costs neither a reload of
+     * the record nor a lookup in the Event. This function should be called
+     * before the DataStore is used concurrently by multiple threads.
+     *
+     * @tparam T Type of the products.
+     * @param label Label of the products.
+     * @param enable Whether to look for packed products.
+     */
+    template<typename T>
+    void setPacking(const std::string& label, bool enable=true) {
+        setPackingImpl(label, demangle<T>(), enable);
+    }
+
+    /**
+     * @brief Fills the provided PackingStatistics with statistics on
+     * the loads of packed products.
+     *
+     * @param stats Statistics to fill.
+     */
+    void collectPackingStatistics(PackingStatistics& stats) const;
+
     /**
      * @brief Creates a queue with the specified name.
      *
      * @param name Name of the queue.
+     * @param options Options of the queue (e.g. number of shards).
      */
     template<typename T>
-    void createQueue(const std::string& name);
+    void createQueue(const std::string& name, const QueueOptions& options = QueueOptions());
 
     /**
      * @brief Opens a queue with the speficied name.
@@ -220,6 +399,42 @@ class DataStore : public RawStorage {
     template<typename T>
     void destroyQueue(const std::string& name);
 
+    /**
+     * @brief Creates an EventDispatcher with the specified name, handing
+     * out the events of the DataSet in batches to any client that opens it,
+     * whether or not it belongs to the same MPI job. The events are listed
+     * by the caller and submitted as they are found, so that clients can
+     * start processing them before this function returns. If listing or
+     * submitting the events fails, the dispatcher is destroyed and the
+     * exception is rethrown.
+     *
+     * @param name Name of the dispatcher.
+     * @param dataset DataSet whose events should be dispatched.
+     * @param options Options of the dispatcher (batch size, lease duration).
+     *
+     * @return an EventDispatcher instance.
+     */
+    EventDispatcher createEventDispatcher(const std::string& name,
+                                          const DataSet& dataset,
+                                          const EventDispatcherOptions& options = EventDispatcherOptions());
+
+    /**
+     * @brief Opens an existing EventDispatcher.
+     *
+     * @param name Name of the dispatcher.
+     *
+     * @return an EventDispatcher instance.
+     */
+    EventDispatcher openEventDispatcher(const std::string& name);
+
+    /**
+     * @brief Destroys the EventDispatcher with the specified name.
+     * Clients waiting in EventDispatcher::acquire get an exception.
+     *
+     * @param name Name of the dispatcher.
+     */
+    void destroyEventDispatcher(const std::string& name);
+
     private:
 
     std::shared_ptr<DataStoreImpl> m_impl; /*!< Pointer to implementation */
@@ -259,27 +474,152 @@ class DataStore : public RawStorage {
     bool loadRawData(const ProductID& productID, char* value, size_t* value_size) const;
 
     /**
-     * @brief Loads the raw data of a product directly into the product itself,
-     * with the product type T not a POD type.
+     * @brief Loads the raw data of a batch of products, with one request
+     * per product database.
+     */
+    void loadRawDataPacked(const std::vector<ProductID>& productIDs,
+            const std::function<void(const ProductID&, bool, std::string&&)>& callback) const;
+
+    /**
+     * @brief Looks up a product previously resolved as type info
+     * and still in use.
+     *
+     * @return the product, or nullptr if it isn't in use.
+     */
+    std::shared_ptr<void> findResolvedProduct(const ProductID& productID,
+                                                    const std::type_info& info) const;
+
+    /**
+     * @brief Registers a resolved product so that subsequent resolutions
+     * of the same product share it while it is in use.
+     *
+     * @return the registered product, which may be another instance of
+     * the product if it was resolved concurrently.
+     */
+    std::shared_ptr<void> addResolvedProduct(const ProductID& productID,
+                                                   const std::type_info& info,
+                                                   std::shared_ptr<void> product) const;
+
+    /**
+     * @brief Records in the archive the target of a deserialized Ptr,
+     * if Ptr prefetching is enabled.
+     */
+    template<typename T>
+    void addPtrTarget(InputArchive& ar, const ProductID& productID) const;
+
+    /**
+     * @brief Indicates whether Ptr prefetching is enabled.
+     */
+    bool ptrPrefetchingEnabled() const;
+
+    /**
+     * @brief Loads in the background the Ptr targets that are
+     * neither in use nor already being loaded.
+     */
+    void prefetchPtrTargets(const std::vector<PtrTarget>& targets) const;
+
+    /**
+     * @brief Decodes the loaded data of a product of type T into a new object.
+     *
+     * @return the object, or nullptr if the data could not be decoded.
+     */
+    template<typename T>
+    static std::shared_ptr<void> decodeSharedProduct(DataStore& datastore,
+            const ProductID& productID, std::string& buffer);
+
+    /**
+     * @brief Returns the product with the given id, shared with the other
+     * users of the same product, loading it if it isn't in use.
+     *
+     * @return the product, or nullptr if it does not exist.
+     */
+    template<typename T>
+    std::shared_ptr<T> resolveProduct(const ProductID& productID);
+
+    /**
+     * @brief Assembles, decompresses, and deserializes the loaded data of a product.
+     */
+    template<typename T>
+    bool decodeProduct(const ProductID& productID, std::string& buffer, T& t);
+
+    /**
+     * @brief Specialization of decodeProduct for vectors.
+     */
+    template<typename T>
+    bool decodeProduct(const ProductID& productID, std::string& buffer, std::vector<T>& t);
+
+    template<typename T>
+    bool decodeProductImpl(const ProductID& productID, std::string& buffer, T& t, const std::integral_constant<bool, false>&);
+
+    template<typename T>
+    bool decodeProductImpl(const ProductID& productID, std::string& buffer, T& t, const std::integral_constant<bool, true>&);
+
+    template<typename T>
+    bool decodeProductImpl(const ProductID& productID, std::string& buffer, std::vector<T>& t, const std::integral_constant<bool, false>&);
+
+    template<typename T>
+    bool decodeProductImpl(const ProductID& productID, std::string& buffer, std::vector<T>& t, const std::integral_constant<bool, true>&);
+
+    /**
+     * @brief Sets the compression options for a label and a type
+     * (an empty type applies to all the types).
+     */
+    void setCompressionImpl(const std::string& label, const std::string& type,
+                            CompressionCodec codec, size_t threshold);
+
+    /**
+     * @brief Creates the key of the index-th chunk of a product.
+     */
+    static ProductID makeChunkID(const ProductID& productID, uint64_t index);
+
+    /**
+     * @brief Loads the chunks [first, last) of a chunked product into
+     * output, in parallel across product databases. Throws an Exception
+     * if a chunk is missing.
+     */
+    void loadChunks(const ProductID& productID, const ChunkManifest& manifest,
+                    size_t first, size_t last, char* output) const;
+
+    /**
+     * @see RawStorage::assembleChunks
+     */
+    bool assembleChunks(const ProductID& productID, std::string& buffer) const override;
+
+    /**
+     * @brief Enables or disables packed loads for a label and a type.
+     */
+    void setPackingImpl(const std::string& label, const std::string& type, bool enable);
+
+    /**
+     * @brief Compresses the data of a product if compression is enabled
+     * for its label and type and the data is large enough.
      *
-     * @tparam T Type of the product.
      * @param productID Product id.
-     * @param t Product.
-     * @param std::integral_constant type trait indicating T is non-POD.
+     * @param data Serialized product.
+     * @param compressed Resulting compressed data.
      *
-     * @return true if the data was loaded successfuly, false otherwise.
+     * @return true if the data was compressed into compressed.
+     */
+    bool compressProduct(const ProductID& productID, const std::string& data,
+                         std::string& compressed) const;
+
+    /**
+     * @brief Decompresses in place the loaded data of a product,
+     * if it was stored compressed.
      */
+    static void decompressProduct(std::string& buffer);
+
     template<typename T>
     bool loadProductImpl(const ProductID& productID, T& t, const std::integral_constant<bool, false>&);
 
     /**
      * @brief Loads the raw data of a product directly into the product itself,
-     * with the product type T being a POD type.
+     * with the product type T stored in raw form (see UseRawStorage).
      *
      * @tparam T Type of the product.
      * @param productID Product id.
      * @param t Product.
-     * @param std::integral_constant type trait indicating T is POD.
+     * @param std::integral_constant type trait indicating T is stored in raw form.
      *
      * @return true if the data was loaded successfuly, false otherwise.
      */
@@ -288,12 +628,12 @@ class DataStore : public RawStorage {
 
     /**
      * @brief Loads the raw data of a product with the product type being an std::vector
-     * of non-POD type.
+     * of serialized type.
      *
      * @tparam T Type of vector elements.
      * @param productID Product id.
      * @param t Product.
-     * @param std::integral_constant type trait indicating T is non-POD.
+     * @param std::integral_constant type trait indicating T is serialized.
      *
      * @return true if the data was loaded successfuly, false otherwise.
      */
@@ -302,27 +642,53 @@ class DataStore : public RawStorage {
 
     /**
      * @brief Loads the raw data of a product with the product type being an std::vector
-     * of POD type.
+     * of a type stored in raw form.
      *
      * @tparam T Type of vector elements.
      * @param productID Product id.
      * @param t Product.
-     * @param std::integral_constant type trait indicating T is POD.
+     * @param std::integral_constant type trait indicating T is stored in raw form.
      *
      * @return true if the data was loaded successfuly, false otherwise.
      */
     template<typename T>
     bool loadProductImpl(const ProductID& productID, std::vector<T>& t, const std::integral_constant<bool, true>&);
 
+    /**
+     * @brief Deserializes a product using its custom Serializer.
+     */
+    template<typename T>
+    bool deserializeProduct(const std::string& buffer, T& t, const std::integral_constant<bool, true>&);
+
+    /**
+     * @brief Deserializes a product using Boost serialization.
+     */
+    template<typename T>
+    bool deserializeProduct(const std::string& buffer, T& t, const std::integral_constant<bool, false>&);
+
+    /**
+     * @brief Deserializes a vector of products using their custom Serializer.
+     */
+    template<typename T>
+    bool deserializeProduct(const std::string& buffer, std::vector<T>& t, const std::integral_constant<bool, true>&);
+
+    /**
+     * @brief Deserializes a vector of products using Boost serialization.
+     */
+    template<typename T>
+    bool deserializeProduct(const std::string& buffer, std::vector<T>& t, const std::integral_constant<bool, false>&);
+
     /**
      * @brief Creates a queue with the speficied name
      * for the give type of objects.
      *
      * @param name Name of the queue.
      * @param type_name Name of the type of objects stored
+     * @param options Options of the queue
      */
     void createQueueImpl(const std::string& name,
-                         const std::string& type_name);
+                         const std::string& type_name,
+                         const QueueOptions& options);
 
     /**
      * @brief Opens a queue with the speficied name.
@@ -353,6 +719,7 @@ class DataStore : public RawStorage {
 #include <hepnos/ProductID.hpp>
 #include <hepnos/Ptr.hpp>
 #include <hepnos/Queue.hpp>
+#include <hepnos/Serializer.hpp>
 
 namespace hepnos {
 
@@ -368,20 +735,34 @@ Ptr<T,C> DataStore::makePtr(const ProductID& productID, std::size_t index) {
 
 template<typename T>
 bool DataStore::loadProduct(const ProductID& productID, T& t) {
-    return loadProductImpl(productID, t, std::is_pod<T>());
+    return loadProductImpl(productID, t, UseRawStorage<T>());
 }
 
 template<typename T>
 bool DataStore::loadProduct(const ProductID& productID, std::vector<T>& t) {
-    return loadProductImpl(productID, t, std::is_pod<T>());
+    return loadProductImpl(productID, t, UseRawStorage<T>());
 }
 
 template<typename T>
-bool DataStore::loadProductImpl(const ProductID& productID, T& t, const std::integral_constant<bool, false>&) {
+bool DataStore::loadProductImpl(const ProductID& productID, T& t, const std::integral_constant<bool, false>& tag) {
     std::string buffer;
     if(!loadRawData(productID, buffer)) {
         return false;
     }
+    return decodeProductImpl(productID, buffer, t, tag);
+}
+
+template<typename T>
+bool DataStore::deserializeProduct(const std::string& buffer, T& t, const std::integral_constant<bool, true>&) {
+    try {
+        return Serializer<T>::deserialize(buffer.data(), buffer.size(), t);
+    } catch(const std::exception& e) {
+        throw Exception(std::string("Exception occured during deserialization: ") + e.what());
+    }
+}
+
+template<typename T>
+bool DataStore::deserializeProduct(const std::string& buffer, T& t, const std::integral_constant<bool, false>&) {
     try {
         InputStringWrapper value_wrapper(buffer.data(), buffer.size());
         InputStream value_stream(value_wrapper);
@@ -395,20 +776,35 @@ bool DataStore::loadProductImpl(const ProductID& productID, T& t, const std::int
 
 template<typename T>
 bool DataStore::loadProductImpl(const ProductID& productID, T& t, const std::integral_constant<bool, true>&) {
-    size_t value_size = sizeof(t);
-    if(loadRawData(productID, reinterpret_cast<char*>(&t), &value_size)) {
-        return value_size == sizeof(t);
+    alignas(T) char raw[rawValueSize<T>()];
+    size_t value_size = sizeof(raw);
+    if(loadRawData(productID, raw, &value_size)) {
+        return readRawValue(raw, value_size, t);
     } else {
         return false;
     }
 }
 
 template<typename T>
-bool DataStore::loadProductImpl(const ProductID& productID, std::vector<T>& t, const std::integral_constant<bool, false>&) {
+bool DataStore::loadProductImpl(const ProductID& productID, std::vector<T>& t, const std::integral_constant<bool, false>& tag) {
     std::string buffer;
     if(!loadRawData(productID, buffer)) {
         return false;
     }
+    return decodeProductImpl(productID, buffer, t, tag);
+}
+
+template<typename T>
+bool DataStore::deserializeProduct(const std::string& buffer, std::vector<T>& t, const std::integral_constant<bool, true>&) {
+    try {
+        return deserializeVectorWithSerializer(buffer.data(), buffer.size(), t);
+    } catch(const std::exception& e) {
+        throw Exception(std::string("Exception occured during deserialization: ") + e.what());
+    }
+}
+
+template<typename T>
+bool DataStore::deserializeProduct(const std::string& buffer, std::vector<T>& t, const std::integral_constant<bool, false>&) {
     try {
         InputStringWrapper value_wrapper(buffer.data(), buffer.size());
         InputStream value_stream(value_wrapper);
@@ -426,23 +822,120 @@ bool DataStore::loadProductImpl(const ProductID& productID, std::vector<T>& t, c
 }
 
 template<typename T>
-bool DataStore::loadProductImpl(const ProductID& productID, std::vector<T>& t, const std::integral_constant<bool, true>&) {
+bool DataStore::loadProductImpl(const ProductID& productID, std::vector<T>& t, const std::integral_constant<bool, true>& tag) {
     std::string buffer;
     if(!loadRawData(productID, buffer)) {
         return false;
     }
-    size_t count = 0;
-    if(buffer.size() < sizeof(count)) return false;
-    std::memcpy(&count, buffer.data(), sizeof(count));
-    if(buffer.size() != sizeof(count) + count*sizeof(T)) return false;
-    t.resize(count);
-    std::memcpy(t.data(), buffer.data() + sizeof(count), sizeof(T)*count);
-    return true;
+    return decodeProductImpl(productID, buffer, t, tag);
+}
+
+template<typename T>
+bool DataStore::decodeProduct(const ProductID& productID, std::string& buffer, T& t) {
+    return decodeProductImpl(productID, buffer, t, UseRawStorage<T>());
+}
+
+template<typename T>
+bool DataStore::decodeProduct(const ProductID& productID, std::string& buffer, std::vector<T>& t) {
+    return decodeProductImpl(productID, buffer, t, UseRawStorage<T>());
+}
+
+template<typename T>
+bool DataStore::decodeProductImpl(const ProductID& productID, std::string& buffer, T& t, const std::integral_constant<bool, false>&) {
+    assembleChunks(productID, buffer);
+    decompressProduct(buffer);
+    return deserializeProduct(buffer, t, HasCustomSerializer<T>());
+}
+
+template<typename T>
+bool DataStore::decodeProductImpl(const ProductID&, std::string& buffer, T& t, const std::integral_constant<bool, true>&) {
+    return readRawValue(buffer.data(), buffer.size(), t);
+}
+
+template<typename T>
+bool DataStore::decodeProductImpl(const ProductID& productID, std::string& buffer, std::vector<T>& t, const std::integral_constant<bool, false>&) {
+    assembleChunks(productID, buffer);
+    decompressProduct(buffer);
+    return deserializeProduct(buffer, t, HasCustomSerializer<T>());
+}
+
+template<typename T>
+bool DataStore::decodeProductImpl(const ProductID& productID, std::string& buffer, std::vector<T>& t, const std::integral_constant<bool, true>&) {
+    assembleChunks(productID, buffer);
+    decompressProduct(buffer);
+    return readRawVector(buffer.data(), buffer.size(), t);
+}
+
+template<typename T>
+std::shared_ptr<T> DataStore::resolveProduct(const ProductID& productID) {
+    auto resolved = findResolvedProduct(productID, typeid(T));
+    if(resolved) return std::static_pointer_cast<T>(resolved);
+    auto product = std::make_shared<T>();
+    if(!loadProduct(productID, *product)) return nullptr;
+    return std::static_pointer_cast<T>(
+        addResolvedProduct(productID, typeid(T), std::move(product)));
+}
+
+template<typename T>
+void DataStore::addPtrTarget(InputArchive& ar, const ProductID& productID) const {
+    if(!productID.valid() || !ptrPrefetchingEnabled()) return;
+    ar.addPtrTarget(productID.m_key, typeid(T), &DataStore::decodeSharedProduct<T>);
+}
+
+template<typename T>
+std::shared_ptr<void> DataStore::decodeSharedProduct(DataStore& datastore,
+        const ProductID& productID, std::string& buffer) {
+    auto product = std::make_shared<T>();
+    if(!datastore.decodeProduct(productID, buffer, *product)) return nullptr;
+    return product;
+}
+
+template<typename T, typename C>
+void DataStore::resolvePtrs(std::vector<Ptr<T,C>>& ptrs) {
+    // products pointed to, with whether they are containers
+    std::unordered_map<std::string, std::pair<bool, std::shared_ptr<void>>> products;
+    std::vector<ProductID> to_load;
+    for(auto& ptr : ptrs) {
+        if(ptr.resolved() || !ptr.valid()) continue;
+        auto inserted = products.emplace(ptr.m_product_id.m_key,
+                std::make_pair(ptr.m_is_in_container, std::shared_ptr<void>()));
+        if(!inserted.second) continue;
+        auto& entry = inserted.first->second;
+        entry.second = findResolvedProduct(ptr.m_product_id,
+                entry.first ? typeid(C) : typeid(T));
+        if(!entry.second) to_load.push_back(ptr.m_product_id);
+    }
+    loadRawDataPacked(to_load,
+        [this, &products](const ProductID& productID, bool found, std::string&& data) {
+            if(!found) return;
+            auto& entry = products[productID.m_key];
+            if(entry.first) {
+                auto container = std::make_shared<C>();
+                if(decodeProduct(productID, data, *container))
+                    entry.second = addResolvedProduct(productID, typeid(C), std::move(container));
+            } else {
+                auto object = std::make_shared<T>();
+                if(decodeProduct(productID, data, *object))
+                    entry.second = addResolvedProduct(productID, typeid(T), std::move(object));
+            }
+        });
+    for(auto& ptr : ptrs) {
+        if(ptr.resolved() || !ptr.valid()) continue;
+        auto& entry = products[ptr.m_product_id.m_key];
+        if(!entry.second)
+            throw Exception("Could not load product from DataStore");
+        if(entry.first != ptr.m_is_in_container)
+            ptr.loadData();
+        else if(entry.first)
+            ptr.setContainer(std::static_pointer_cast<C>(entry.second));
+        else
+            ptr.setObject(std::static_pointer_cast<T>(entry.second));
+    }
 }
 
 template<typename T>
-void DataStore::createQueue(const std::string& name) {
-    createQueueImpl(name, demangle<T>());
+void DataStore::createQueue(const std::string& name, const QueueOptions& options) {
+    createQueueImpl(name, demangle<T>(), options);
 }
 
 template<typename T>
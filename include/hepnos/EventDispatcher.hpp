@@ -0,0 +1,109 @@
+/*
+ * (C) 2026 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#ifndef __HEPNOS_EVENT_DISPATCHER_HPP
+#define __HEPNOS_EVENT_DISPATCHER_HPP
+
+#include <memory>
+#include <vector>
+#include <functional>
+#include <hepnos/Event.hpp>
+#include <hepnos/EventDispatcherOptions.hpp>
+
+namespace hepnos {
+
+class DataStore;
+class EventDispatcherImpl;
+
+/**
+ * @brief A batch of events handed out by an EventDispatcher.
+ */
+struct EventBatch {
+    uint64_t           id = 0; // identifier of the batch in the dispatcher
+    std::vector<Event> events;
+};
+
+/**
+ * @brief An EventDispatcher is a handle to a list of batches of events
+ * managed by an EventDispatchProvider (the "hed" Bedrock module).
+ * Any process connected to HEPnOS can open it and acquire batches
+ * from it, without the collective communications required by the
+ * ParallelEventProcessor, so processes can join or leave the processing
+ * of a DataSet at any time. A process acquiring a batch gets a lease on
+ * it, and a batch that is not completed before its lease expires (e.g.
+ * because the process died) is handed out again. Events may therefore be
+ * processed more than once, but no event is left unprocessed.
+ */
+class EventDispatcher {
+
+    friend class DataStore;
+
+    public:
+
+    typedef std::function<void(const Event&)> EventProcessingFn;
+
+    EventDispatcher();
+    EventDispatcher(const EventDispatcher&);
+    EventDispatcher(EventDispatcher&&);
+    EventDispatcher& operator=(const EventDispatcher&);
+    EventDispatcher& operator=(EventDispatcher&&);
+    ~EventDispatcher();
+
+    /**
+     * @brief Check that the internal state is valid.
+     */
+    bool valid() const;
+
+    /**
+     * @brief Acquires a batch of events. If no batch is available, this
+     * function blocks until a batch is submitted or a lease expires.
+     *
+     * @param batch Batch to fill.
+     *
+     * @return false if all the batches have been completed.
+     */
+    bool acquire(EventBatch& batch);
+
+    /**
+     * @brief Reports a batch as completed.
+     *
+     * @param batch Batch acquired by acquire.
+     */
+    void complete(const EventBatch& batch);
+
+    /**
+     * @brief Extends the lease on a batch that takes long to process.
+     *
+     * @param batch Batch acquired by acquire.
+     *
+     * @return false if the lease had already expired and the batch was
+     * handed out again or completed.
+     */
+    bool renew(const EventBatch& batch);
+
+    /**
+     * @brief Acquires batches and calls the function on their events
+     * until all the batches have been completed. The lease on a batch is
+     * renewed between events once half of it is spent; if it had already
+     * expired, the rest of the batch is left to the process it was handed
+     * out to. If the function throws, the batch being processed is not
+     * completed and will be handed out again when its lease expires.
+     *
+     * @param function Function to call on each event.
+     *
+     * @return The number of events processed by this call.
+     */
+    size_t process(const EventProcessingFn& function);
+
+    private:
+
+    EventDispatcher(std::shared_ptr<EventDispatcherImpl> impl);
+
+    std::shared_ptr<EventDispatcherImpl> m_impl;
+};
+
+}
+
+#endif
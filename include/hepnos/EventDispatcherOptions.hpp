@@ -0,0 +1,21 @@
+/*
+ * (C) 2026 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#ifndef __HEPNOS_EVENT_DISPATCHER_OPTIONS_HPP
+#define __HEPNOS_EVENT_DISPATCHER_OPTIONS_HPP
+
+namespace hepnos {
+
+/**
+ * @brief Options of an EventDispatcher, provided when creating it.
+ */
+struct EventDispatcherOptions {
+    unsigned batchSize     = 64;    // number of events per batch handed out to clients
+    double   leaseDuration = 300.0; // time (seconds) a client has to complete a batch before it is handed out again
+};
+
+}
+
+#endif
@@ -11,12 +11,27 @@
 #include <boost/archive/impl/basic_binary_iarchive.ipp>
 #include <boost/iostreams/stream.hpp>
 #include <boost/iostreams/device/array.hpp>
+#include <memory>
+#include <string>
+#include <vector>
+#include <typeinfo>
 
 namespace hepnos {
 
 class DataStore;
+class ProductID;
 class InputArchive;
 
+/**
+ * @brief Product pointed to by a Ptr found while deserializing an object
+ * (see DataStore::enablePtrPrefetching).
+ */
+struct PtrTarget {
+    std::string           key;    /*!< key of the product */
+    const std::type_info* type;   /*!< type as which the product is resolved */
+    std::shared_ptr<void> (*decode)(DataStore&, const ProductID&, std::string&); /*!< decodes the product */
+};
+
 using iarchive = boost::archive::binary_iarchive_impl<InputArchive, std::istream::char_type, std::istream::traits_type>;
 
 /**
@@ -29,10 +44,23 @@ class InputArchive : public iarchive {
     friend class boost::archive::detail::interface_iarchive<InputArchive>;
     friend class boost::archive::basic_binary_iarchive<InputArchive>;
     friend class boost::archive::load_access;
+    friend class DataStore;
 
     private:
 
-    DataStore m_datastore;
+    DataStore              m_datastore;
+    std::vector<PtrTarget> m_ptr_targets; // targets of the Ptrs deserialized, to prefetch
+
+    /**
+     * @brief Records the target of a deserialized Ptr.
+     */
+    void addPtrTarget(const std::string& key, const std::type_info& type,
+                      std::shared_ptr<void> (*decode)(DataStore&, const ProductID&, std::string&)) {
+        // Ptrs into the same container are usually deserialized one after the other
+        if(!m_ptr_targets.empty() && m_ptr_targets.back().key == key)
+            return;
+        m_ptr_targets.push_back(PtrTarget{ key, &type, decode });
+    }
 
     public:
 
@@ -71,6 +99,17 @@ class InputArchive : public iarchive {
         return m_datastore;
     }
 
+    /**
+     * @brief Destructor. Starts prefetching the targets of the
+     * Ptrs that were deserialized, if any.
+     */
+    ~InputArchive() {
+        if(m_ptr_targets.empty()) return;
+        try {
+            m_datastore.prefetchPtrTargets(m_ptr_targets);
+        } catch(...) {}
+    }
+
 };
 
 using InputStringWrapper = boost::iostreams::array_source;
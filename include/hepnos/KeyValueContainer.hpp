@@ -7,6 +7,7 @@
 #define __HEPNOS_KEYVAL_CONTAINER_H
 
 #include <memory>
+#include <algorithm>
 #include <string>
 #include <sstream>
 #include <boost/serialization/string.hpp>
@@ -17,6 +18,11 @@
 #include <hepnos/Demangle.hpp>
 #include <hepnos/Exception.hpp>
 #include <hepnos/DataStore.hpp>
+#include <hepnos/CollectiveLoader.hpp>
+#include <hepnos/Serializer.hpp>
+#include <hepnos/ColumnLayout.hpp>
+#include <hepnos/PackedProduct.hpp>
+#include <hepnos/ChunkedProduct.hpp>
 
 namespace hepnos {
 
@@ -28,11 +34,14 @@ class ProductCache;
 struct StoreStatistics {
     Statistics<double> raw_storage_time;
     Statistics<double> serialization_time;
+    Statistics<double> compression_time;  // only for compressed products
+    Statistics<double> compression_ratio; // uncompressed size / compressed size
 };
 
 struct LoadStatistics {
     Statistics<double> raw_loading_time;
     Statistics<double> deserialization_time;
+    Statistics<double> decompression_time; // only for compressed products
 };
 
 class KeyValueContainer {
@@ -139,7 +148,7 @@ class KeyValueContainer {
     std::enable_if_t<!IsVector<V>::value, ProductID>
     store(RawStorage& target, const L& label, const V& value,
                     StoreStatistics* stats = nullptr) {
-        return storeImpl(target, label, value, std::is_pod<std::remove_reference_t<V>>(), stats);
+        return storeImpl(target, label, value, UseRawStorage<std::remove_reference_t<V>>(), stats);
     }
 
     template<typename L, typename V>
@@ -165,21 +174,10 @@ class KeyValueContainer {
     template<typename L, typename V>
     ProductID store(RawStorage& target, const L& label, const std::vector<V>& value, int start=0, int end=-1,
                     StoreStatistics* stats = nullptr) {
-        auto t1 = wtime();
-        auto key = makeKey(label, value);
-        std::string val_str;
-        serializeValueVector(std::is_pod<std::remove_reference_t<V>>(), value, val_str, start, end);
-        auto t2 = wtime();
-        auto result = target.valid() ? target.storeRawData(key, val_str.data(), val_str.size())
-                                     : datastore().storeRawData(key, val_str.data(), val_str.size());
-        auto t3 = wtime();
-        if(stats) {
-            stats->serialization_time.updateWith(t2-t1);
-            stats->raw_storage_time.updateWith(t3-t2);
-        }
-        return result;
+        return storeVectorImpl(target, makeKey(label, value), value, start, end, stats);
     }
 
+
     /**
      * @brief Loads a value associated with a key from the
      * KeyValueContainer. The type of the key should have
@@ -219,7 +217,7 @@ class KeyValueContainer {
     std::enable_if_t<!IsVector<V>::value, bool>
     load(const Source& source, const L& label, V& value,
               LoadStatistics* stats = nullptr) const {
-        return loadImpl(source, label, value, std::is_pod<std::remove_reference_t<V>>(), stats);
+        return loadImpl(source, label, value, UseRawStorage<std::remove_reference_t<V>>(), stats);
     }
 
     /**
@@ -229,8 +227,205 @@ class KeyValueContainer {
     template<typename L, typename V, typename Source>
     bool load(const Source& source, const L& label, std::vector<V>& value,
               LoadStatistics* stats = nullptr) const {
-        return loadVectorImpl(source, label, value,
-                std::is_pod<std::remove_reference_t<V>>(), stats);
+        return loadVectorImpl(source, makeKey(label, value), value,
+                UseRawStorage<std::remove_reference_t<V>>(), stats);
+    }
+
+    /**
+     * @brief Loads the elements [start, end) of a stored vector, end = -1
+     * meaning the end of the vector. The range is clamped to the size of the
+     * stored vector. For vectors of values stored in raw form (see
+     * UseRawStorage) that were split into chunks (see DataStore::setChunkSize)
+     * and not compressed, only the chunks covering the range are fetched.
+     * Otherwise, the whole vector is loaded and the range is extracted.
+     *
+     * @tparam L type of the label.
+     * @tparam V type of the vector elements.
+     * @param label Label of the product.
+     * @param value Resulting elements.
+     * @param start Index of the first element to load.
+     * @param end Index after the last element to load.
+     * @param stats Statistics.
+     *
+     * @return true if the key exists and was loaded. False otherwise.
+     */
+    template<typename L, typename V>
+    bool load(const L& label, std::vector<V>& value, int start, int end,
+              LoadStatistics* stats = nullptr) const {
+        auto ds = datastore();
+        return load(ds, label, value, start, end, stats);
+    }
+
+    /**
+     * @brief Version of load for ranges of vectors, looking first into
+     * the Source argument for the requested key.
+     */
+    template<typename L, typename V, typename Source>
+    bool load(const Source& source, const L& label, std::vector<V>& value,
+              int start, int end, LoadStatistics* stats = nullptr) const {
+        return loadVectorRangeImpl(source, makeKey(label, value), value, start, end,
+                UseRawStorage<std::remove_reference_t<V>>(), stats);
+    }
+
+    /**
+     * @brief Loads a value collectively across the processes of a
+     * communicator. The value is loaded only by the root process, then its
+     * raw data is broadcast to the other processes, which deserialize it.
+     * This function must be called by all the processes of the communicator,
+     * with the same label and value type, on the same item.
+     *
+     * @tparam L type of the label.
+     * @tparam V type of the value.
+     * @param comm Communicator.
+     * @param label Label of the product.
+     * @param value Value to load.
+     * @param root Rank of the process loading the product.
+     * @param stats Statistics.
+     *
+     * @return true if the key exists and was loaded. False otherwise.
+     */
+    template<typename L, typename V>
+    bool loadCollective(MPI_Comm comm, const L& label, V& value, int root = 0,
+                        LoadStatistics* stats = nullptr) const {
+        auto ds = datastore();
+        return loadCollective(ds, comm, label, value, root, stats);
+    }
+
+    /**
+     * @brief Version of loadCollective in which the root process loads
+     * the product from the provided source (e.g. a Prefetcher).
+     */
+    template<typename L, typename V, typename Source>
+    bool loadCollective(const Source& source, MPI_Comm comm, const L& label, V& value,
+                        int root = 0, LoadStatistics* stats = nullptr) const {
+        CollectiveLoader loader(source, comm, root);
+        return load(loader, label, value, stats);
+    }
+
+    /**
+     * @brief Stores a vector of records as columns: each field described
+     * by ColumnLayout<V> is gathered into a vector and stored as a separate
+     * product, so that loadColumn can later fetch only the fields it needs.
+     *
+     * @tparam L type of the label.
+     * @tparam V type of the records.
+     * @param label Label of the product.
+     * @param value Records to store.
+     * @param stats Statistics (updated for each column).
+     *
+     * @return the ProductID of the first column, or an invalid
+     * ProductID if any column could not be stored.
+     */
+    template<typename L, typename V>
+    ProductID storeColumns(const L& label, const std::vector<V>& value,
+                           StoreStatistics* stats = nullptr) {
+        auto ds = datastore();
+        return storeColumns(ds, label, value, stats);
+    }
+
+    /**
+     * @brief Version of storeColumns storing into the Target
+     * (WriteBatch, AsyncEngine, etc.).
+     */
+    template<typename L, typename V>
+    ProductID storeColumns(RawStorage& target, const L& label, const std::vector<V>& value,
+                           StoreStatistics* stats = nullptr) {
+        auto l = std::string{label};
+        ProductID first;
+        bool ok = true;
+        forEachColumn<V>([&](const auto& column) {
+            using F = typename std::decay_t<decltype(column)>::field_type;
+            std::vector<F> field;
+            field.reserve(value.size());
+            for(const auto& record : value)
+                field.push_back(record.*(column.member));
+            auto id = storeVectorImpl(target, makeColumnKey<V>(l, column.name), field, 0, -1, stats);
+            if(!id.valid()) ok = false;
+            if(!first.valid()) first = id;
+        });
+        return ok ? first : ProductID();
+    }
+
+    /**
+     * @brief Loads a single column of a product stored with storeColumns,
+     * e.g. loadColumn("hits", &Hit::energy, energies).
+     *
+     * @tparam L type of the label.
+     * @tparam V type of the records.
+     * @tparam F type of the field.
+     * @param label Label of the product.
+     * @param member Member of V corresponding to the column.
+     * @param values Resulting values of the field, one per record.
+     * @param stats Statistics.
+     *
+     * @return true if the column exists and was loaded. False otherwise.
+     */
+    template<typename L, typename V, typename F>
+    bool loadColumn(const L& label, F V::* member, std::vector<F>& values,
+                    LoadStatistics* stats = nullptr) const {
+        auto ds = datastore();
+        return loadColumn(ds, label, member, values, stats);
+    }
+
+    /**
+     * @brief Version of loadColumn looking first into the
+     * Source argument for the requested column.
+     */
+    template<typename L, typename V, typename F, typename Source>
+    bool loadColumn(const Source& source, const L& label, F V::* member,
+                    std::vector<F>& values, LoadStatistics* stats = nullptr) const {
+        auto name = columnName<V>(member);
+        if(!name) {
+            throw Exception(std::string("Member is not part of the ColumnLayout of ")
+                + demangle<V>());
+        }
+        return loadVectorImpl(source, makeColumnKey<V>(std::string{label}, name),
+                              values, UseRawStorage<F>(), stats);
+    }
+
+    /**
+     * @brief Loads all the columns of a product stored with
+     * storeColumns and reassembles them into records.
+     *
+     * @return true if all the columns exist and were loaded. False otherwise.
+     */
+    template<typename L, typename V>
+    bool loadColumns(const L& label, std::vector<V>& value,
+                     LoadStatistics* stats = nullptr) const {
+        auto ds = datastore();
+        return loadColumns(ds, label, value, stats);
+    }
+
+    /**
+     * @brief Version of loadColumns looking first into the
+     * Source argument for the requested columns.
+     */
+    template<typename L, typename V, typename Source>
+    bool loadColumns(const Source& source, const L& label, std::vector<V>& value,
+                     LoadStatistics* stats = nullptr) const {
+        auto l = std::string{label};
+        bool ok = true;
+        bool first = true;
+        forEachColumn<V>([&](const auto& column) {
+            if(!ok) return;
+            using F = typename std::decay_t<decltype(column)>::field_type;
+            std::vector<F> field;
+            if(!loadVectorImpl(source, makeColumnKey<V>(l, column.name),
+                               field, UseRawStorage<F>(), stats)) {
+                ok = false;
+                return;
+            }
+            if(first) {
+                value.resize(field.size());
+                first = false;
+            } else if(field.size() != value.size()) {
+                ok = false;
+                return;
+            }
+            for(size_t i = 0; i < field.size(); i++)
+                value[i].*(column.member) = std::move(field[i]);
+        });
+        return ok;
     }
 
     /**
@@ -258,22 +453,95 @@ class KeyValueContainer {
     virtual ProductID makeProductID(const char* label, size_t label_size,
                                     const char* type, size_t type_size) const = 0;
 
+    /**
+     * @brief Stores the products of several events as a single packed
+     * record attached to this container (see SubRun::storePacked).
+     * Each product is encoded as it would be if stored in its event.
+     */
+    template<typename L, typename V>
+    ProductID storePackedImpl(RawStorage& target, const L& label,
+            const std::vector<EventNumber>& events, const std::vector<V>& values,
+            StoreStatistics* stats) {
+        if(events.size() != values.size())
+            throw Exception("Packed products require as many event numbers as values");
+        auto t1 = wtime();
+        PackedProductBuilder builder;
+        std::string product;
+        for(size_t i = 0; i < values.size(); i++) {
+            serializePackedValue(values[i], product, UseRawStorage<V>());
+            builder.append(events[i], product.data(), product.size());
+        }
+        auto key = makePackedKey<V>(std::string{label});
+        auto record = acquireSerializationBuffer();
+        builder.pack(record);
+        auto t2 = wtime();
+        std::string compressed;
+        auto& data = compressValue(key, record, compressed, stats);
+        auto result = storeData(target, key, data);
+        releaseSerializationBuffer(std::move(record));
+        auto t3 = wtime();
+        if(stats) {
+            stats->serialization_time.updateWith(t2-t1);
+            stats->raw_storage_time.updateWith(t3-t2);
+        }
+        return result;
+    }
+
+    /**
+     * @brief Loads all the products of a packed record attached
+     * to this container (see SubRun::loadPacked).
+     */
+    template<typename L, typename V, typename Source>
+    bool loadPackedImpl(const Source& source, const L& label,
+            std::vector<EventNumber>& events, std::vector<V>& values,
+            LoadStatistics* stats) const {
+        std::string buffer;
+        auto key = makePackedKey<V>(std::string{label});
+        auto t1 = wtime();
+        auto b = source.valid() ? source.loadRawData(key, buffer)
+                                : datastore().loadRawData(key, buffer);
+        if(!b) {
+            return false;
+        }
+        assembleChunks(source, key, buffer);
+        decompressValue(buffer, stats);
+        auto t2 = wtime();
+        events.clear();
+        values.clear();
+        bool ok = true;
+        unpackProducts(buffer.data(), buffer.size(),
+            [&](EventNumber event, const std::string& product) {
+                values.emplace_back();
+                events.push_back(event);
+                if(!deserializePackedValue(product, values.back(), UseRawStorage<V>()))
+                    ok = false;
+            });
+        auto t3 = wtime();
+        if(stats) {
+            stats->raw_loading_time.updateWith(t2-t1);
+            stats->deserialization_time.updateWith(t3-t2);
+        }
+        return ok;
+    }
+
     private:
 
     /**
      * @brief Implementation of the store function with WriteBatch
-     * and the value type is not am std::vector and not a POD.
+     * and the value type is not an std::vector and not stored in raw form.
      */
     template<typename L, typename V>
     ProductID storeImpl(RawStorage& target, const L& label, const V& value,
             const std::integral_constant<bool, false>&, StoreStatistics* stats) {
         auto t1 = wtime();
         auto key = makeKey(label, value);
-        std::string val_str;
+        auto val_str = acquireSerializationBuffer();
         serializeValue(value, val_str);
         auto t2 = wtime();
-        auto result = target.valid() ? target.storeRawData(key, val_str.data(), val_str.size())
-                                     : datastore().storeRawData(key, val_str.data(), val_str.size());
+        std::string compressed;
+        auto& data = compressValue(key, val_str, compressed, stats);
+        auto result = storeData(target, key, data);
+        releaseSerializationBuffer(std::move(val_str));
         auto t3 = wtime();
         if(stats) {
             stats->serialization_time.updateWith(t2-t1);
@@ -284,16 +552,41 @@ class KeyValueContainer {
 
     /**
      * @brief Implementation of the store function with WriteBatch
-     * when the value type is a POD.
+     * when the value type is stored in raw form (see UseRawStorage).
      */
     template<typename L, typename V>
     ProductID storeImpl(RawStorage& target, const L& label, const V& value,
             const std::integral_constant<bool, true>&, StoreStatistics* stats) {
         auto t1 = wtime();
         auto key = makeKey(label, value);
+        alignas(V) char raw[rawValueSize<V>()];
+        writeRawValue(value, raw);
+        auto t2 = wtime();
+        auto result = target.valid() ? target.storeRawData(key, raw, sizeof(raw))
+                                     : datastore().storeRawData(key, raw, sizeof(raw));
+        auto t3 = wtime();
+        if(stats) {
+            stats->serialization_time.updateWith(t2-t1);
+            stats->raw_storage_time.updateWith(t3-t2);
+        }
+        return result;
+    }
+
+    /**
+     * @brief Implementation of the store function for vectors,
+     * given the key of the product.
+     */
+    template<typename V>
+    ProductID storeVectorImpl(RawStorage& target, const ProductID& key, const std::vector<V>& value,
+                              int start, int end, StoreStatistics* stats) {
+        auto t1 = wtime();
+        auto val_str = acquireSerializationBuffer();
+        serializeValueVector(UseRawStorage<std::remove_reference_t<V>>(), value, val_str, start, end);
         auto t2 = wtime();
-        auto result = target.valid() ? target.storeRawData(key, reinterpret_cast<const char*>(&value), sizeof(value))
-                                     : datastore().storeRawData(key, reinterpret_cast<const char*>(&value), sizeof(value));
+        std::string compressed;
+        auto& data = compressValue(key, val_str, compressed, stats);
+        auto result = storeData(target, key, data);
+        releaseSerializationBuffer(std::move(val_str));
         auto t3 = wtime();
         if(stats) {
             stats->serialization_time.updateWith(t2-t1);
@@ -303,23 +596,24 @@ class KeyValueContainer {
     }
 
     /**
-     * @brief Implementation of the load function when the value type is a POD.
+     * @brief Implementation of the load function when the value type is stored in raw form.
      */
     template<typename L, typename V, typename Source>
     bool loadImpl(const Source& source, const L& label, V& value,
             const std::integral_constant<bool, true>&, LoadStatistics* stats) const {
-        std::string buffer;
         auto key = makeKey(label, value);
-        size_t vsize = sizeof(value);
+        alignas(V) char raw[rawValueSize<V>()];
+        size_t vsize = sizeof(raw);
         auto t1 = wtime();
-        auto b = source.valid() ? source.loadRawData(key, reinterpret_cast<char*>(&value), &vsize)
-                                : datastore().loadRawData(key, reinterpret_cast<char*>(&value), &vsize);
+        auto b = source.valid() ? source.loadRawData(key, raw, &vsize)
+                                : datastore().loadRawData(key, raw, &vsize);
         auto t2 = wtime();
+        b = b && readRawValue(raw, vsize, value);
         if(b && stats) {
             stats->deserialization_time.updateWith(0.0);
             stats->raw_loading_time.updateWith(t2-t1);
         }
-        return b && (vsize == sizeof(value));
+        return b;
     }
 
     /**
@@ -337,15 +631,11 @@ class KeyValueContainer {
         if(!b) {
             return false;
         }
+        assembleChunks(source, key, buffer);
+        decompressValue(buffer, stats);
         auto t2 = wtime();
-        try {
-            InputStringWrapper value_wrapper(buffer.data(), buffer.size());
-            InputStream value_stream(value_wrapper);
-            InputArchive ia(datastore(), value_stream);
-            ia >> value;
-        } catch(const std::exception& e) {
-            throw Exception(std::string("Exception occured during serialization: ") + e.what());
-        }
+        if(!deserializeValue(buffer, value, HasCustomSerializer<V>()))
+            return false;
         auto t3 = wtime();
         if(stats) {
             stats->deserialization_time.updateWith(t2-t1);
@@ -355,30 +645,52 @@ class KeyValueContainer {
     }
 
     /**
-     * @brief Implementation of the load function.
+     * @brief Implementation of the load function for vectors,
+     * given the key of the product.
      */
-    template<typename L, typename V, typename Source>
-    bool loadVectorImpl(const Source& source, const L& label, std::vector<V>& value,
+    template<typename V, typename Source>
+    bool loadVectorImpl(const Source& source, const ProductID& key, std::vector<V>& value,
             const std::integral_constant<bool, true>&, LoadStatistics* stats) const {
         std::string buffer;
-        auto key = makeKey(label, value);
         auto t1 = wtime();
         auto b = source.valid() ? source.loadRawData(key, buffer)
                                 : datastore().loadRawData(key, buffer);
         if(!b) {
             return false;
         }
+        assembleChunks(source, key, buffer);
+        decompressValue(buffer, stats);
         auto t2 = wtime();
-        size_t count = 0;
-        if(buffer.size() < sizeof(count)) {
+        if(!readRawVector(buffer.data(), buffer.size(), value)) {
             return false;
         }
-        std::memcpy(&count, buffer.data(), sizeof(count));
-        if(buffer.size() != sizeof(count) + count*sizeof(V)) {
+        auto t3 = wtime();
+        if(stats) {
+            stats->deserialization_time.updateWith(t2-t1);
+            stats->raw_loading_time.updateWith(t3-t2);
+        }
+        return true;
+    }
+
+    /**
+     * @brief Implementation of the load function for vectors,
+     * given the key of the product.
+     */
+    template<typename V, typename Source>
+    bool loadVectorImpl(const Source& source, const ProductID& key, std::vector<V>& value,
+            const std::integral_constant<bool, false>&, LoadStatistics* stats) const {
+        std::string buffer;
+        auto t1 = wtime();
+        auto b = source.valid() ? source.loadRawData(key, buffer)
+                                : datastore().loadRawData(key, buffer);
+        if(!b) {
             return false;
         }
-        value.resize(count);
-        std::memcpy(value.data(), buffer.data()+sizeof(count), count*sizeof(V));
+        assembleChunks(source, key, buffer);
+        decompressValue(buffer, stats);
+        auto t2 = wtime();
+        if(!deserializeValueVector(buffer, value, HasCustomSerializer<V>()))
+            return false;
         auto t3 = wtime();
         if(stats) {
             stats->deserialization_time.updateWith(t2-t1);
@@ -388,20 +700,142 @@ class KeyValueContainer {
     }
 
     /**
-     * @brief Implementation of the load function.
+     * @brief Clamps the range [start, end) of a vector of count elements.
      */
-    template<typename L, typename V, typename Source>
-    bool loadVectorImpl(const Source& source, const L& label, std::vector<V>& value,
-            const std::integral_constant<bool, false>&, LoadStatistics* stats) const {
+    static void clampRange(size_t count, int start, int end, size_t* s, size_t* e) {
+        *s = std::min<size_t>(start < 0 ? 0 : start, count);
+        *e = end < 0 ? count : std::min<size_t>(end, count);
+        if(*e < *s) *e = *s;
+    }
+
+    /**
+     * @brief Implementation of the range load function when the elements
+     * are serialized: the whole vector is loaded, then the range extracted.
+     */
+    template<typename V, typename Source>
+    bool loadVectorRangeImpl(const Source& source, const ProductID& key, std::vector<V>& value,
+            int start, int end, const std::integral_constant<bool, false>& raw, LoadStatistics* stats) const {
+        if(!loadVectorImpl(source, key, value, raw, stats))
+            return false;
+        size_t s, e;
+        clampRange(value.size(), start, end, &s, &e);
+        value.erase(value.begin() + e, value.end());
+        value.erase(value.begin(), value.begin() + s);
+        return true;
+    }
+
+    /**
+     * @brief Implementation of the range load function when the elements
+     * are stored in raw form. If the vector was chunked, only the chunks
+     * containing its header and the requested range are loaded.
+     */
+    template<typename V, typename Source>
+    bool loadVectorRangeImpl(const Source& source, const ProductID& key, std::vector<V>& value,
+            int start, int end, const std::integral_constant<bool, true>&, LoadStatistics* stats) const {
         std::string buffer;
-        auto key = makeKey(label, value);
         auto t1 = wtime();
         auto b = source.valid() ? source.loadRawData(key, buffer)
                                 : datastore().loadRawData(key, buffer);
         if(!b) {
             return false;
         }
+        auto ds = datastore();
+        ChunkManifest manifest;
+        if(ChunkManifest::read(buffer.data(), buffer.size(), manifest)) {
+            // the first chunk contains the header of the vector
+            std::string header(manifest.chunkSize(0), '\0');
+            ds.loadChunks(key, manifest, 0, 1, const_cast<char*>(header.data()));
+            size_t count = 0, offset = 0;
+            if(!isCompressedBuffer(header.data(), header.size())
+            && readRawVectorHeader<V>(header.data(), header.size(), &count, &offset)) {
+                if(offset + count*sizeof(V) != manifest.total_size)
+                    return false;
+                size_t s, e;
+                clampRange(count, start, end, &s, &e);
+                value.resize(e - s);
+                if(e > s) {
+                    size_t begin = offset + s*sizeof(V);
+                    size_t stop  = offset + e*sizeof(V);
+                    size_t first = begin / manifest.chunk_size;
+                    size_t last  = (stop + manifest.chunk_size - 1) / manifest.chunk_size;
+                    std::string chunks((last - first)*manifest.chunk_size, '\0');
+                    ds.loadChunks(key, manifest, first, last, const_cast<char*>(chunks.data()));
+                    std::memcpy(value.data(), chunks.data() + begin - first*manifest.chunk_size, stop - begin);
+                }
+                auto t2 = wtime();
+                if(stats) {
+                    stats->raw_loading_time.updateWith(t2-t1);
+                    stats->deserialization_time.updateWith(0.0);
+                }
+                return true;
+            }
+            assembleChunks(source, key, buffer);
+        }
+        decompressValue(buffer, stats);
         auto t2 = wtime();
+        if(!readRawVector(buffer.data(), buffer.size(), value))
+            return false;
+        size_t s, e;
+        clampRange(value.size(), start, end, &s, &e);
+        value.erase(value.begin() + e, value.end());
+        value.erase(value.begin(), value.begin() + s);
+        auto t3 = wtime();
+        if(stats) {
+            stats->raw_loading_time.updateWith(t2-t1);
+            stats->deserialization_time.updateWith(t3-t2);
+        }
+        return true;
+    }
+
+    /**
+     * @brief Deserializes a value using its custom Serializer.
+     */
+    template<typename V>
+    bool deserializeValue(const std::string& buffer, V& value,
+                          const std::integral_constant<bool, true>&) const {
+        try {
+            return Serializer<V>::deserialize(buffer.data(), buffer.size(), value);
+        } catch(const std::exception& e) {
+            throw Exception(std::string("Exception occured during deserialization: ") + e.what());
+        }
+    }
+
+    /**
+     * @brief Deserializes a value using Boost serialization.
+     */
+    template<typename V>
+    bool deserializeValue(const std::string& buffer, V& value,
+                          const std::integral_constant<bool, false>&) const {
+        try {
+            InputStringWrapper value_wrapper(buffer.data(), buffer.size());
+            InputStream value_stream(value_wrapper);
+            InputArchive ia(datastore(), value_stream);
+            ia >> value;
+        } catch(const std::exception& e) {
+            throw Exception(std::string("Exception occured during serialization: ") + e.what());
+        }
+        return true;
+    }
+
+    /**
+     * @brief Deserializes a vector of values using their custom Serializer.
+     */
+    template<typename V>
+    bool deserializeValueVector(const std::string& buffer, std::vector<V>& value,
+                                const std::integral_constant<bool, true>&) const {
+        try {
+            return deserializeVectorWithSerializer(buffer.data(), buffer.size(), value);
+        } catch(const std::exception& e) {
+            throw Exception(std::string("Exception occured during deserialization: ") + e.what());
+        }
+    }
+
+    /**
+     * @brief Deserializes a vector of values using Boost serialization.
+     */
+    template<typename V>
+    bool deserializeValueVector(const std::string& buffer, std::vector<V>& value,
+                                const std::integral_constant<bool, false>&) const {
         try {
             InputStringWrapper value_wrapper(buffer.data(), buffer.size());
             InputStream value_stream(value_wrapper);
@@ -415,11 +849,6 @@ class KeyValueContainer {
         } catch(const std::exception& e) {
             throw Exception(std::string("Exception occured during serialization: ") + e.what());
         }
-        auto t3 = wtime();
-        if(stats) {
-            stats->deserialization_time.updateWith(t2-t1);
-            stats->raw_loading_time.updateWith(t3-t2);
-        }
         return true;
     }
 
@@ -434,26 +863,188 @@ class KeyValueContainer {
         return makeProductID(label.data(), label.size(), type.data(), type.size());
     }
 
+    /**
+     * @brief Stores the data of a product into the target, splitting it
+     * into chunks if it is larger than the DataStore's chunk size. The
+     * chunks are stored first, then the manifest under the product's key.
+     */
+    ProductID storeData(RawStorage& target, const ProductID& key, const std::string& data) {
+        auto ds = datastore();
+        RawStorage& storage = target.valid() ? target : ds;
+        size_t chunk_size = ds.getChunkSize();
+        if(chunk_size == 0 || data.size() <= chunk_size)
+            return storage.storeRawData(key, data.data(), data.size());
+        ChunkManifest manifest(data.size(), chunk_size);
+        for(size_t i = 0; i < manifest.num_chunks; i++) {
+            auto chunk_id = DataStore::makeChunkID(key, i);
+            if(!storage.storeRawData(chunk_id, data.data() + i*chunk_size, manifest.chunkSize(i)).valid())
+                return ProductID();
+        }
+        return storage.storeRawData(key, reinterpret_cast<const char*>(&manifest), sizeof(manifest));
+    }
+
+    /**
+     * @brief Compresses a serialized value if compression is enabled
+     * for its label and type (see DataStore::setCompression).
+     *
+     * @return A reference to either value or compressed, whichever
+     * should be stored.
+     */
+    const std::string& compressValue(const ProductID& key, const std::string& value,
+                                     std::string& compressed, StoreStatistics* stats) const {
+        auto t1 = wtime();
+        if(!datastore().compressProduct(key, value, compressed))
+            return value;
+        auto t2 = wtime();
+        if(stats) {
+            stats->compression_time.updateWith(t2-t1);
+            stats->compression_ratio.updateWith((double)value.size()/(double)compressed.size());
+        }
+        return compressed;
+    }
+
+    /**
+     * @brief Replaces the manifest of a chunked product loaded from the
+     * source with the content of the product, fetching the chunks through
+     * the source (see RawStorage::assembleChunks).
+     */
+    template<typename Source>
+    void assembleChunks(const Source& source, const ProductID& key, std::string& buffer) const {
+        if(source.valid())
+            source.assembleChunks(key, buffer);
+        else
+            datastore().assembleChunks(key, buffer);
+    }
+
+    /**
+     * @brief Decompresses a loaded value in place if it was stored compressed.
+     */
+    static void decompressValue(std::string& buffer, LoadStatistics* stats) {
+        if(!isCompressedBuffer(buffer.data(), buffer.size()))
+            return;
+        auto t1 = wtime();
+        DataStore::decompressProduct(buffer);
+        auto t2 = wtime();
+        if(stats) {
+            stats->decompression_time.updateWith(t2-t1);
+        }
+    }
+
+    /**
+     * @brief Creates the key of the packed record of products of type V.
+     */
+    template<typename V>
+    ProductID makePackedKey(const std::string& label) const {
+        auto type = packedTypeName(demangle<V>());
+        return makeProductID(label.data(), label.size(), type.data(), type.size());
+    }
+
+    /**
+     * @brief Encodes a product of a packed record in raw form.
+     */
+    template<typename V>
+    static void serializePackedValue(const V& value, std::string& buffer,
+                                     const std::integral_constant<bool, true>&) {
+        buffer.resize(rawValueSize<V>());
+        writeRawValue(value, const_cast<char*>(buffer.data()));
+    }
+
+    /**
+     * @brief Encodes a product of a packed record by serializing it.
+     */
+    template<typename V>
+    static void serializePackedValue(const V& value, std::string& buffer,
+                                     const std::integral_constant<bool, false>&) {
+        serializeValue(value, buffer);
+    }
+
+    template<typename V>
+    bool deserializePackedValue(const std::string& buffer, V& value,
+                                const std::integral_constant<bool, true>&) const {
+        return readRawValue(buffer.data(), buffer.size(), value);
+    }
+
+    template<typename V>
+    bool deserializePackedValue(const std::string& buffer, V& value,
+                                const std::integral_constant<bool, false>&) const {
+        return deserializeValue(buffer, value, HasCustomSerializer<V>());
+    }
+
+    /**
+     * @brief Creates the key of a column of a product stored with
+     * storeColumns. The type part of the key is "V::column".
+     */
+    template<typename V>
+    ProductID makeColumnKey(const std::string& label, const char* column) const {
+        auto type = demangle<V>() + "::" + column;
+        return makeProductID(label.data(), label.size(), type.data(), type.size());
+    }
+
+    /**
+     * @brief Maximum capacity of a serialization buffer kept for reuse.
+     */
+    static constexpr size_t s_max_cached_buffer_size = 16*1024*1024;
+
+    static std::string& cachedSerializationBuffer() {
+        static thread_local std::string buffer;
+        return buffer;
+    }
+
+    /**
+     * @brief Takes the serialization buffer cached by the calling thread,
+     * so that its capacity is reused across store calls. The buffer is
+     * moved out rather than referenced, since storeRawData may yield to
+     * another user-level thread that would use the same cached buffer.
+     */
+    static std::string acquireSerializationBuffer() {
+        std::string buffer = std::move(cachedSerializationBuffer());
+        buffer.resize(0);
+        return buffer;
+    }
+
+    /**
+     * @brief Gives a serialization buffer back to the calling thread's cache
+     * if it is larger than the one currently cached.
+     */
+    static void releaseSerializationBuffer(std::string&& buffer) {
+        if(buffer.capacity() > s_max_cached_buffer_size) return;
+        auto& cached = cachedSerializationBuffer();
+        if(cached.capacity() < buffer.capacity())
+            cached = std::move(buffer);
+    }
+
     /**
      * @brief Creates the string key based on the provided key
      * and the type of the value. Serializes the value into a string.
      */
     template<typename V>
     static void serializeValue(const V& value, std::string& value_str) {
-        value_str.resize(0);
+        serializeValue(value, value_str, HasCustomSerializer<V>());
+    }
 
-        OutputSizer value_sizer;
-        OutputSizeEvaluator value_size_evaluator(value_sizer, 0);
-        OutputArchive sizing_oa(value_size_evaluator);
+    /**
+     * @brief Version of serializeValue for types with a custom Serializer.
+     */
+    template<typename V>
+    static void serializeValue(const V& value, std::string& value_str,
+                               const std::integral_constant<bool, true>&) {
+        value_str.resize(0);
         try {
-            sizing_oa << value;
-            value_size_evaluator.flush();
+            Serializer<V>::serialize(value, value_str);
         } catch(const std::exception& e) {
-            throw Exception(std::string("Exception occured during product size estimation: ") + e.what());
+            throw Exception(std::string("Exception occured during serialization: ") + e.what());
         }
+    }
 
-        value_str.reserve(value_sizer.size());
-
+    /**
+     * @brief Version of serializeValue using Boost serialization.
+     */
+    template<typename V>
+    static void serializeValue(const V& value, std::string& value_str,
+                               const std::integral_constant<bool, false>&) {
+        // single pass: the buffer grows geometrically as needed,
+        // and usually already has enough capacity from previous calls
+        value_str.resize(0);
         OutputStringWrapper value_wrapper(value_str);
         OutputStream value_stream(value_wrapper);
         OutputArchive output_oa(value_stream);
@@ -466,7 +1057,7 @@ class KeyValueContainer {
     }
 
     /**
-     * @brief Version of serializeValue for vectors of non-POD datatypes.
+     * @brief Version of serializeValue for vectors of serialized datatypes.
      */
     template<typename V>
     static void serializeValueVector(const std::integral_constant<bool, false>&,
@@ -475,19 +1066,30 @@ class KeyValueContainer {
             end = value.size();
         if(start < 0 || start > end || end > value.size())
             throw Exception("Invalid range when storing vector");
+        serializeValueVector(value, value_str, start, end, HasCustomSerializer<V>());
+    }
 
+    /**
+     * @brief Version of serializeValueVector for types with a custom Serializer.
+     */
+    template<typename V>
+    static void serializeValueVector(const std::vector<V>& value, std::string& value_str,
+            int start, int end, const std::integral_constant<bool, true>&) {
         value_str.resize(0);
-        OutputSizer value_sizer;
-        OutputSizeEvaluator value_size_evaluator(value_sizer, 0);
-        OutputArchive sizing_oa(value_size_evaluator);
         try {
-            sizing_oa << value;
-            value_size_evaluator.flush();
+            serializeVectorWithSerializer(value, value_str, start, end);
         } catch(const std::exception& e) {
-            throw Exception(std::string("Exception occured during product size estimation: ") + e.what());
+            throw Exception(std::string("Exception occured during serialization: ") + e.what());
         }
-        value_str.reserve(value_sizer.size());
+    }
 
+    /**
+     * @brief Version of serializeValueVector using Boost serialization.
+     */
+    template<typename V>
+    static void serializeValueVector(const std::vector<V>& value, std::string& value_str,
+            int start, int end, const std::integral_constant<bool, false>&) {
+        value_str.resize(0);
         OutputStringWrapper value_wrapper(value_str);
         OutputStream value_stream(value_wrapper);
         OutputArchive oa(value_stream);
@@ -503,7 +1105,7 @@ class KeyValueContainer {
     }
 
     /**
-     * @brief Version of serializeValue for vectors of POD datatypes.
+     * @brief Version of serializeValue for vectors of datatypes stored in raw form.
      */
     template<typename V>
     static void serializeValueVector(const std::integral_constant<bool, true>&,
@@ -512,10 +1114,7 @@ class KeyValueContainer {
             end = value.size();
         if(start < 0 || start > end || end > value.size())
             throw Exception("Invalid range when storing vector");
-        size_t count = end-start;
-        value_str.resize(sizeof(count) + count*sizeof(V));
-        std::memcpy(const_cast<char*>(value_str.data()), &count, sizeof(count));
-        std::memcpy(const_cast<char*>(value_str.data())+sizeof(count), &value[start], count*sizeof(V));
+        writeRawVector(value.data() + start, end - start, value_str);
     }
 };
 
@@ -0,0 +1,92 @@
+/*
+ * (C) 2026 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#ifndef __HEPNOS_PACKED_PRODUCT_HPP
+#define __HEPNOS_PACKED_PRODUCT_HPP
+
+#include <string>
+#include <vector>
+#include <functional>
+#include <hepnos/EventNumber.hpp>
+
+namespace hepnos {
+
+/**
+ * @brief Builds a packed record gathering the products of a given label
+ * and type for many events of a SubRun. Each product is provided in the
+ * form it would have if stored in its Event (i.e. serialized, or in raw
+ * form), so that it can be extracted and loaded as if it had been.
+ *
+ * The record starts with a header, followed by the bytes common to the
+ * start of all the products (e.g. the layout tag of products stored in
+ * raw form), the sorted event numbers, the offsets of the products if
+ * they don't all have the same size, and the remaining bytes of the
+ * products.
+ */
+class PackedProductBuilder {
+
+    public:
+
+    /**
+     * @brief Adds the product of an event.
+     */
+    void append(EventNumber event, const char* data, size_t size);
+
+    /**
+     * @brief Number of products added.
+     */
+    size_t size() const {
+        return m_events.size();
+    }
+
+    /**
+     * @brief Removes all the products.
+     */
+    void clear();
+
+    /**
+     * @brief Writes the packed record. Throws an Exception if the same
+     * event number was added more than once.
+     */
+    void pack(std::string& record) const;
+
+    private:
+
+    std::vector<EventNumber> m_events;
+    std::vector<size_t>      m_offsets = { 0 };
+    std::string              m_data;
+};
+
+/**
+ * @brief Name of the type under which the packed record of
+ * products of the given type is stored in a SubRun.
+ */
+inline std::string packedTypeName(const std::string& type) {
+    return "hepnos::Packed<" + type + ">";
+}
+
+/**
+ * @brief Checks whether a buffer is a packed record.
+ */
+bool isPackedRecord(const char* record, size_t size);
+
+/**
+ * @brief Extracts the product of an event from a packed record.
+ *
+ * @return false if the record does not contain a product for the event.
+ */
+bool unpackProduct(const char* record, size_t size, EventNumber event, std::string& product);
+
+/**
+ * @brief Calls the function on the product of each event of a packed
+ * record, by increasing event number. Throws an Exception if the
+ * record is corrupted.
+ */
+void unpackProducts(const char* record, size_t size,
+        const std::function<void(EventNumber, const std::string&)>& func);
+
+}
+
+#endif
@@ -0,0 +1,110 @@
+/*
+ * (C) 2026 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#ifndef __HEPNOS_PACKED_WRITER_HPP
+#define __HEPNOS_PACKED_WRITER_HPP
+
+#include <string>
+#include <vector>
+#include <hepnos/SubRun.hpp>
+#include <hepnos/Event.hpp>
+#include <hepnos/Exception.hpp>
+
+namespace hepnos {
+
+/**
+ * @brief Accumulates the products of type V with a given label for
+ * the events of a SubRun, and stores them as a single packed record
+ * (see SubRun::storePacked) when flushed. Since a packed record cannot
+ * be modified once stored, flush should be called only once all the
+ * events of the SubRun have been processed. The destructor flushes
+ * the products that haven't been flushed, ignoring errors.
+ *
+ * @tparam V Type of the products.
+ */
+template<typename V>
+class PackedWriter {
+
+    public:
+
+    /**
+     * @brief Constructor.
+     *
+     * @param subrun SubRun in which to store the packed record.
+     * @param label Label of the products.
+     */
+    PackedWriter(const SubRun& subrun, const std::string& label)
+    : m_subrun(subrun)
+    , m_label(label) {}
+
+    /**
+     * @brief Constructor. The packed record will be stored
+     * through the Target (WriteBatch, AsyncEngine, etc.).
+     */
+    PackedWriter(RawStorage& target, const SubRun& subrun, const std::string& label)
+    : m_subrun(subrun)
+    , m_label(label)
+    , m_target(&target) {}
+
+    PackedWriter(const PackedWriter&) = delete;
+    PackedWriter& operator=(const PackedWriter&) = delete;
+
+    ~PackedWriter() {
+        try {
+            flush();
+        } catch(...) {}
+    }
+
+    /**
+     * @brief Adds the product of an event.
+     */
+    void store(EventNumber event, const V& value) {
+        m_events.push_back(event);
+        m_values.push_back(value);
+    }
+
+    /**
+     * @brief Adds the product of an Event, which must belong to the SubRun.
+     */
+    void store(const Event& event, const V& value) {
+        if(event.subrun() != m_subrun)
+            throw Exception("Event does not belong to the SubRun of this PackedWriter");
+        store(event.number(), value);
+    }
+
+    /**
+     * @brief Number of products accumulated since the last flush.
+     */
+    size_t size() const {
+        return m_events.size();
+    }
+
+    /**
+     * @brief Stores the accumulated products as a packed record.
+     *
+     * @return The ProductID of the packed record, or an invalid
+     * ProductID if there was nothing to store.
+     */
+    ProductID flush(StoreStatistics* stats = nullptr) {
+        if(m_events.empty()) return ProductID();
+        auto result = m_target ? m_subrun.storePacked(*m_target, m_label, m_events, m_values, stats)
+                               : m_subrun.storePacked(m_label, m_events, m_values, stats);
+        m_events.clear();
+        m_values.clear();
+        return result;
+    }
+
+    private:
+
+    SubRun                   m_subrun;
+    std::string              m_label;
+    RawStorage*              m_target = nullptr;
+    std::vector<EventNumber> m_events;
+    std::vector<V>           m_values;
+};
+
+}
+
+#endif
@@ -18,22 +18,42 @@ namespace hepnos {
 
 struct ParallelEventProcessorImpl;
 
+/**
+ * @brief Level at which the ParallelEventProcessor keeps events together
+ * in the batches it sends to processes.
+ */
+enum class EventAffinity : int {
+    NONE   = 0, /*!< batches are cut regardless of SubRun boundaries */
+    SUBRUN = 1, /*!< events of a SubRun are sent in the same batch */
+    RUN    = 2  /*!< events of a Run are sent in the same batch */
+};
+
 struct ParallelEventProcessorOptions {
     unsigned cacheSize       = std::numeric_limits<unsigned>::max(); // cache size of internal prefetcher
     unsigned inputBatchSize  = 16;                                   // size of batches loaded from HEPnOS
     unsigned outputBatchSize = 16;                                   // size of batches sent over MPI to workers
     uint16_t providerID      = 0;                                    // provider id to use (if multiple ParallelEventProcessor instances are used)
     bool     use_rdma        = true;                                 // whether to use RDMA to exchange event descriptors
+    bool     localityAware   = false;                                // whether to prefer sending processes events whose products are on their node
+    EventAffinity affinity   = EventAffinity::NONE;                  // whether to keep the events of a SubRun (or Run) in the same batch
+    unsigned maxAffinityBatchSize = 1024;                            // with affinity, SubRuns (or Runs) with more events are split in batches of this size
+    bool     adaptiveBatchSize = false;                              // whether to adapt the size of output batches (starting from outputBatchSize) to processing and waiting times
+    unsigned minOutputBatchSize = 1;                                 // with adaptiveBatchSize, smallest size of output batches
+    unsigned maxOutputBatchSize = 1024;                              // with adaptiveBatchSize, largest size of output batches
 };
 
 struct ParallelEventProcessorStatistics {
     size_t                    total_events_processed = 0;   // total number of events processed by this process
     size_t                    local_events_processed = 0;   // total number of events that were loaded locally (not using MPI)
+    size_t                    colocated_events_processed = 0; // total number of events whose products are on this node (counted if localityAware)
+    size_t                    subruns_processed = 0;        // number of distinct SubRuns with events processed by this process (summed across processes and
+                                                            // divided by the number of SubRuns, gives the number of processes each SubRun is spread over)
     double                    total_time             = 0.0; // total time in the process function, in seconds
     double                    acc_event_processing_time = 0.0; // accumulated time, in the user callback function, in seconds
     double                    acc_product_loading_time  = 0.0; // accumulated product loading time, in seconds
     Statistics<double,double> processing_time_stats; // statistics on single-event processing times
     Statistics<double,double> waiting_time_stats; // statictics on time spent waiting for new events to be in the queue
+    Statistics<size_t,double> batch_size_stats; // statistics on the number of events in the batches received
 };
 
 /**
@@ -139,18 +159,24 @@ struct formatter<hepnos::ParallelEventProcessorStatistics> {
     auto format(const hepnos::ParallelEventProcessorStatistics& stats, FormatContext& ctx) {
         return format_to(ctx.out(), "{{ \"total_events_processed\" : {}, "
                                        "\"local_events_processed\" : {}, "
+                                       "\"colocated_events_processed\" : {}, "
+                                       "\"subruns_processed\" : {}, "
                                        "\"total_time\" : {}, "
                                        "\"acc_event_processing_time\" : {}, "
                                        "\"acc_product_loading_time\" : {}, "
                                        "\"processing_time_stats\" : {}, "
-                                       "\"waiting_time_stats\" : {} }}",
+                                       "\"waiting_time_stats\" : {}, "
+                                       "\"batch_size_stats\" : {} }}",
                                        stats.total_events_processed,
                                        stats.local_events_processed,
+                                       stats.colocated_events_processed,
+                                       stats.subruns_processed,
                                        stats.total_time,
                                        stats.acc_event_processing_time,
                                        stats.acc_product_loading_time,
                                        stats.processing_time_stats,
-                                       stats.waiting_time_stats);
+                                       stats.waiting_time_stats,
+                                       stats.batch_size_stats);
     }
 
 };
@@ -29,6 +29,9 @@ struct PrefetcherStatistics {
     Statistics<size_t,double> product_sizes;
     size_t                    product_cache_hit  = 0;
     size_t                    product_cache_miss = 0;
+    unsigned int              batch_size         = 0; // current batch size
+    unsigned int              cache_size         = 0; // current cache size
+    size_t                    adjustments        = 0; // number of adaptive adjustments
 };
 
 /**
@@ -117,6 +120,46 @@ class Prefetcher : public RawStorage {
      */
     void setBatchSize(unsigned int size);
 
+    /**
+     * @brief Enables or disables adaptive tuning of the batch size and
+     * cache size. When enabled, the Prefetcher measures the time taken to
+     * list items, the size of the prefetched products per item, and the
+     * rate at which items are consumed, and grows or shrinks the batch
+     * size and cache size accordingly, starting from their current values.
+     *
+     * @param adaptive Whether to enable adaptive tuning.
+     * @param memory_limit Maximum number of bytes of products the cache
+     * may hold (0 for no limit).
+     * @param max_batch_size Maximum batch size.
+     */
+    void setAdaptive(bool adaptive=true, size_t memory_limit=0,
+                     unsigned int max_batch_size=1024);
+
+    /**
+     * @return Whether adaptive tuning is enabled.
+     */
+    bool isAdaptive() const;
+
+    /**
+     * @brief Attaches a child Prefetcher used to iterate over the items
+     * contained in the items this Prefetcher iterates over (e.g. this
+     * Prefetcher iterates over the SubRuns of a Run, and the child iterates
+     * over the Events of each SubRun). Every time this Prefetcher fetches a
+     * batch of Runs or SubRuns, the child prefetches the first batch of items
+     * they contain, as well as their requested products, so that starting
+     * to iterate over them with the child does not have to wait.
+     * Prefetchers can be chained to walk a Run/SubRun/Event tree.
+     * Use removeChild to detach the child.
+     *
+     * @param child Prefetcher used for the nested loop.
+     */
+    void setChild(const Prefetcher& child);
+
+    /**
+     * @brief Detaches the child Prefetcher, if any.
+     */
+    void removeChild();
+
     /**
      * @brief Creates a Prefetachable container from a container.
      *
@@ -145,6 +188,24 @@ class Prefetcher : public RawStorage {
         fetchProductImpl(label, demangle<V>(), fetch);
     }
 
+    /**
+     * @brief If fetch is true, instruct the Prefetcher to prefetch products
+     * of a given type with the given label stored on the Run and SubRun
+     * containing the items iterated over (e.g. calibration or conditions
+     * products of the SubRun while iterating over its Events). These products
+     * are fetched once per parent and remain in the Prefetcher's cache,
+     * so they can be loaded any number of times through the Prefetcher,
+     * until the iteration leaves that parent.
+     *
+     * @tparam V Type of product.
+     * @param label Label of the product.
+     * @param fetch Whether to prefetch or not.
+     */
+    template<typename V>
+    void fetchParentProduct(const std::string& label, bool fetch=true) const {
+        fetchParentProductImpl(label, demangle<V>(), fetch);
+    }
+
     /**
      * @brief Activate statistics collection.
      *
@@ -178,12 +239,19 @@ class Prefetcher : public RawStorage {
      */
     bool loadRawData(const ProductID& key, char* value, size_t* vsize) const override;
 
+    /**
+     * @see RawStorage::assembleChunks
+     */
+    bool assembleChunks(const ProductID& key, std::string& buffer) const override;
+
     private:
 
     std::shared_ptr<PrefetcherImpl> m_impl;
 
     void fetchProductImpl(const std::string& label, const std::string& type, bool fetch) const;
 
+    void fetchParentProductImpl(const std::string& label, const std::string& type, bool fetch) const;
+
 };
 
 }
@@ -204,11 +272,17 @@ struct formatter<hepnos::PrefetcherStatistics> {
         return format_to(ctx.out(), "{{ \"batch_sizes\" : {}, "
                                        "\"product_sizes\" : {}, "
                                        "\"product_cache_hit\" : {}, "
-                                       "\"product_cache_miss\" : {} }}",
+                                       "\"product_cache_miss\" : {}, "
+                                       "\"batch_size\" : {}, "
+                                       "\"cache_size\" : {}, "
+                                       "\"adjustments\" : {} }}",
                                        stats.batch_sizes,
                                        stats.product_sizes,
                                        stats.product_cache_hit,
-                                       stats.product_cache_miss);
+                                       stats.product_cache_miss,
+                                       stats.batch_size,
+                                       stats.cache_size,
+                                       stats.adjustments);
     }
 
 };
@@ -18,6 +18,7 @@ class Run;
 class DataSet;
 struct ProductCacheImpl;
 struct ParallelEventProcessorImpl;
+class PrefetcherImpl;
 struct SyncPrefetcherImpl;
 struct AsyncPrefetcherImpl;
 class KeyValudContainer;
@@ -33,6 +34,7 @@ class ProductCache : public RawStorage {
     friend class SubRun;
     friend class Event;
     friend struct ParallelEventProcessorImpl;
+    friend class PrefetcherImpl;
     friend struct SyncPrefetcherImpl;
     friend struct AsyncPrefetcherImpl;
     friend class KeyValueContainer;
@@ -74,6 +76,11 @@ class ProductCache : public RawStorage {
      * @see RawStorage::loadRawData
      */
     bool loadRawData(const ProductID& key, char* value, size_t* vsize) const override;
+
+    /**
+     * @see RawStorage::assembleChunks
+     */
+    bool assembleChunks(const ProductID& key, std::string& buffer) const override;
 };
 
 }
@@ -32,6 +32,7 @@ class ProductID {
     friend class AsyncPrefetcherImpl;
     friend class SyncPrefetcherImpl;
     friend struct ProductCacheImpl;
+    friend class NodeProductCacheImpl;
     friend class ParallelEventProcessorImpl;
     friend class boost::serialization::access;
 
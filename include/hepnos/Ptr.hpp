@@ -42,45 +42,31 @@ class Ptr {
     ProductID   m_product_id       = ProductID();
     std::size_t m_index            = 0;
     bool        m_is_in_container  = false;
-    C*          m_container        = nullptr;
-    T*          m_data             = nullptr;
-    size_t*     m_refcount         = nullptr;
+    std::shared_ptr<void> m_holder; /* resolved product (container or object), shared with other Ptrs */
+    const T*    m_data             = nullptr;
 
     Ptr(const DataStore& datastore, const ProductID& product_id)
     : m_datastore(datastore)
     , m_product_id(product_id)
     , m_index(0)
-    , m_is_in_container(false)
-    , m_refcount(new size_t(1)) {}
+    , m_is_in_container(false) {}
 
     Ptr(const DataStore& datastore, const ProductID& product_id, std::size_t index)
     : m_datastore(datastore)
     , m_product_id(product_id)
     , m_index(index)
-    , m_is_in_container(true)
-    , m_refcount(new size_t(1)) {};
+    , m_is_in_container(true) {};
 
     public:
 
     Ptr() = default;
 
     /**
-     * @brief Copy constructor.
+     * @brief Copy constructor. The copy shares the loaded data, if any.
      *
      * @param other Ptr to copy.
      */
-    Ptr(const Ptr& other)
-    : m_datastore(other.m_datastore)
-    , m_product_id(other.m_product_id)
-    , m_index(other.m_index)
-    , m_is_in_container(other.m_is_in_container)
-    , m_data(other.m_data)
-    , m_container(other.m_container)
-    , m_refcount(other.m_refcount) {
-        if(m_refcount) {
-            *m_refcount += 1;
-        }
-    }
+    Ptr(const Ptr& other) = default;
 
     /**
      * @brief Move constructor.
@@ -92,12 +78,9 @@ class Ptr {
     , m_product_id(std::move(other.m_product_id))
     , m_index(other.m_index)
     , m_is_in_container(other.m_is_in_container)
-    , m_container(other.m_container)
-    , m_refcount(other.m_refcount) {
-        other.m_refcount = nullptr;
-        other.m_container = nullptr;
-        other.m_data = nullptr;
-        other.m_product_id = ProductID();
+    , m_holder(std::move(other.m_holder))
+    , m_data(other.m_data) {
+        other.reset();
     }
 
     /**
@@ -107,23 +90,7 @@ class Ptr {
      *
      * @return Reference to this Ptr.
      */
-    Ptr& operator=(const Ptr& other) {
-        if(&other == this) return *this;
-        if(other.m_data == m_data) return *this;
-        if(m_data) {
-            reset();
-        }
-        m_datastore       = other.m_datastore;
-        m_product_id      = other.m_product_id;
-        m_index           = other.m_index;
-        m_is_in_container = other.m_is_in_container;
-        m_container       = other.m_container;
-        m_refcount        = other.m_refcount;
-        if(m_refcount) {
-            *m_refcount += 1;
-        }
-        return *this;
-    }
+    Ptr& operator=(const Ptr& other) = default;
 
     /**
      * @brief Move-assignment operator.
@@ -134,50 +101,37 @@ class Ptr {
      */
     Ptr& operator=(Ptr&& other) {
         if(&other == this) return *this;
-        if(other.m_data == m_data) return *this;
-        if(m_data) {
-            reset();
-        }
         m_datastore       = other.m_datastore;
         m_product_id      = std::move(other.m_product_id);
         m_index           = other.m_index;
         m_is_in_container = other.m_is_in_container;
-        m_container       = other.m_container;
-        m_refcount        = other.m_refcount;
-        other.m_index     = 0;
-        other.m_container = nullptr;
-        other.m_refcount  = nullptr;
+        m_holder          = std::move(other.m_holder);
+        m_data            = other.m_data;
+        other.reset();
         return *this;
     }
 
     /**
      * @brief Destructor.
      */
-    ~Ptr() {
-        reset();
-    }
+    ~Ptr() = default;
 
     /**
      * @brief Reset the pointer to NULL.
      */
     void reset() {
-        if(m_refcount) {
-            *m_refcount -= 1;
-            if(*m_refcount == 0) {
-                delete m_refcount;
-                if(m_is_in_container) {
-                    delete m_container;
-                } else {
-                    delete m_data;
-                }
-            }
-        }
         m_product_id       = ProductID();
         m_index            = 0;
         m_is_in_container  = false;
-        m_container        = nullptr;
+        m_holder.reset();
         m_data             = nullptr;
-        m_refcount         = nullptr;
+    }
+
+    /**
+     * @brief Indicates whether the pointed data has already been loaded.
+     */
+    bool resolved() const {
+        return m_data != nullptr;
     }
 
     /**
@@ -274,11 +228,16 @@ class Ptr {
      */
     template<typename Archive>
     void load(Archive& ar, const unsigned int version) {
+        m_holder.reset();
+        m_data = nullptr;
         m_datastore = ar.datastore();
         ar & m_product_id;
         ar & m_is_in_container;
         if(m_is_in_container) {
             ar & m_index;
+            m_datastore.addPtrTarget<C>(ar, m_product_id);
+        } else {
+            m_datastore.addPtrTarget<T>(ar, m_product_id);
         }
     }
 
@@ -286,23 +245,41 @@ class Ptr {
 
     /**
      * @brief This function is called to load the actual data from storage.
+     * The loaded product is shared with the other Ptrs to the same product
+     * (see DataStore::resolvePtrs).
      */
     void loadData() {
         if(m_is_in_container) {
-            m_container = new C();
-            if(!(m_datastore.loadProduct(m_product_id, *m_container))) {
+            auto container = m_datastore.resolveProduct<C>(m_product_id);
+            if(!container) {
                 throw Exception("Could not load product from DataStore");
             }
-            m_data = &((*m_container)[m_index]);
+            setContainer(std::move(container));
         } else {
-            m_data = new T();
-            m_container = nullptr;
-            if(!(m_datastore.loadProduct(m_product_id, *m_data))) {
+            auto object = m_datastore.resolveProduct<T>(m_product_id);
+            if(!object) {
                 throw Exception("Could not load product from DataStore");
             }
+            setObject(std::move(object));
         }
     }
 
+    /**
+     * @brief Points this Ptr to its element in the loaded container.
+     */
+    void setContainer(std::shared_ptr<C> container) {
+        m_data   = &((*container)[m_index]);
+        m_holder = std::move(container);
+    }
+
+    /**
+     * @brief Points this Ptr to the loaded object.
+     */
+    void setObject(std::shared_ptr<T> object) {
+        m_data   = object.get();
+        m_holder = std::move(object);
+    }
+
 };
 
 }
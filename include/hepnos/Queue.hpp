@@ -6,13 +6,20 @@
 #ifndef __HEPNOS_QUEUE_HPP
 #define __HEPNOS_QUEUE_HPP
 
+#include <memory>
+#include <string>
+#include <vector>
+#include <functional>
 #include <hepnos/QueueAccessMode.hpp>
+#include <hepnos/QueuePopStatus.hpp>
+#include <hepnos/QueueFuture.hpp>
 
 namespace hepnos {
 
 class QueueImpl;
 class DataStore;
 class DataStoreImpl;
+class AsyncEngine;
 
 /**
  * @brief A Queue object is a handle for a queue
@@ -29,7 +36,9 @@ class Queue {
      * @brief Push an item into the queue.
      * The type of the item must match the type declared
      * when opening the queue and the queue must have been
-     * opened with PRODUCER mode.
+     * opened with PRODUCER mode. If the queue was created with a
+     * limited capacity and is full, this function blocks until
+     * consumers make space (see QueueOptions).
      *
      * @tparam T Type of object
      * @param object Object to push
@@ -37,6 +46,29 @@ class Queue {
     template<typename T>
     void push(const T& object);
 
+    /**
+     * @brief Push an item into the queue if it is not full.
+     * The items buffered by this producer (see setPushBuffering)
+     * are sent first, waiting for space if needed.
+     *
+     * @tparam T Type of object
+     * @param object Object to push
+     *
+     * @return false if the queue was full.
+     */
+    template<typename T>
+    bool tryPush(const T& object);
+
+    /**
+     * @brief Push a batch of items into the queue with a single RPC.
+     * Items previously buffered (see setPushBuffering) are sent first.
+     *
+     * @tparam T Type of object
+     * @param objects Objects to push
+     */
+    template<typename T>
+    void pushMany(const std::vector<T>& objects);
+
     /**
      * @brief Check if the queue is currently empty.
      *
@@ -62,6 +94,130 @@ class Queue {
     template<typename T>
     bool pop(T& object);
 
+    /**
+     * @brief Pop an item from the queue if one is available,
+     * without waiting for one to be pushed.
+     *
+     * @tparam T Type of object
+     * @param object Object to pop into
+     *
+     * @return POPPED if an object was popped, TIMEOUT if the queue
+     * was empty, FINISHED if it was empty and all the producers have
+     * closed it.
+     */
+    template<typename T>
+    QueuePopStatus tryPop(T& object);
+
+    /**
+     * @brief Pop an item from the queue, waiting at most timeout
+     * seconds for one to be available.
+     *
+     * @tparam T Type of object
+     * @param object Object to pop into
+     * @param timeout Timeout in seconds
+     *
+     * @return POPPED if an object was popped, TIMEOUT if none was
+     * available in time, FINISHED if the queue is empty and all the
+     * producers have closed it.
+     */
+    template<typename T>
+    QueuePopStatus timedPop(T& object, double timeout);
+
+    /**
+     * @brief Pop an item in a ULT running in the pool of the calling
+     * execution stream. The object must remain valid until the returned
+     * QueueFuture's wait function is called, and is filled by it.
+     * QueueFuture::wait returns false if the queue was empty and all
+     * the producers have closed it, as with pop.
+     *
+     * @tparam T Type of object
+     * @param object Object to pop into
+     *
+     * @return A QueueFuture to wait on.
+     */
+    template<typename T>
+    QueueFuture popAsync(T& object);
+
+    /**
+     * @brief Same as popAsync(object) with the ULT running in the
+     * pool of the AsyncEngine.
+     */
+    template<typename T>
+    QueueFuture popAsync(AsyncEngine& engine, T& object);
+
+    /**
+     * @brief Push an item in a ULT running in the pool of the calling
+     * execution stream. The object is serialized before this function
+     * returns.
+     *
+     * @tparam T Type of object
+     * @param object Object to push
+     *
+     * @return A QueueFuture to wait on.
+     */
+    template<typename T>
+    QueueFuture pushAsync(const T& object);
+
+    /**
+     * @brief Same as pushAsync(object) with the ULT running in the
+     * pool of the AsyncEngine.
+     */
+    template<typename T>
+    QueueFuture pushAsync(AsyncEngine& engine, const T& object);
+
+    /**
+     * @brief Pop up to max items from the queue with a single RPC.
+     * As with pop, this function blocks until at least one item
+     * is available or all the producers have closed the queue.
+     *
+     * @tparam T Type of object
+     * @param objects Vector in which to place the objects (cleared first)
+     * @param max Maximum number of objects to pop
+     *
+     * @return The number of objects popped, 0 if all the producers
+     * have closed the queue and it is empty.
+     */
+    template<typename T>
+    size_t popMany(std::vector<T>& objects, size_t max);
+
+    /**
+     * @brief Enables buffering of the items pushed by this producer.
+     * Items are then sent in batches, when max_items items have been
+     * buffered or when the oldest buffered item has been buffered for
+     * max_delay seconds (if max_delay is not 0, even if no other item is
+     * pushed), as well as when calling flush, empty, or close. Passing 0 as max_items
+     * sends the buffered items and disables buffering.
+     *
+     * @param max_items Number of items sent per batch.
+     * @param max_delay Maximum time an item stays buffered, in seconds.
+     */
+    void setPushBuffering(size_t max_items, double max_delay = 0.0);
+
+    /**
+     * @brief Sends the items buffered by this producer.
+     */
+    void flush();
+
+    /**
+     * @brief Makes pop request up to num_items items per RPC, keeping
+     * the extra items for subsequent calls to pop. Items received but
+     * not popped are returned to the queue when it is closed.
+     *
+     * @param num_items Number of items requested per RPC.
+     */
+    void setPopPrefetch(size_t num_items);
+
+    /**
+     * @brief Sets the size (in bytes) above which serialized items are
+     * moved between this Queue and the QueueProviders by RDMA instead
+     * of being copied into RPC arguments (64 KiB by default). RDMA
+     * transfers go through a buffer registered once and grown as
+     * needed. A threshold of 0 disables RDMA transfers.
+     *
+     * @param num_bytes Size threshold.
+     */
+    void setBulkThreshold(size_t num_bytes);
+
     /**
      * @brief Returns the DataStore owning the queue.
      */
@@ -90,8 +246,27 @@ class Queue {
 
     bool popImpl(std::string& data);
     void pushImpl(const std::string& data);
+    bool tryPushImpl(const std::string& data);
+    QueuePopStatus timedPopImpl(std::string& data, double timeout);
+    QueueFuture popAsyncImpl(AsyncEngine* engine,
+                             std::function<void(const std::string&)> deserialize);
+    QueueFuture pushAsyncImpl(AsyncEngine* engine, std::string&& data);
+
+    /**
+     * @brief Runs fn in a ULT in the pool of the AsyncEngine if provided,
+     * otherwise in that of the calling execution stream.
+     */
+    static void runAsync(AsyncEngine* engine, std::function<void()> fn);
+    size_t popManyImpl(std::vector<std::string>& data, size_t max);
+    void pushManyImpl(std::vector<std::string>& data);
     bool checkTypeImpl(const std::type_info& type_info);
 
+    template<typename T>
+    static void serializeItem(const T& object, std::string& data);
+
+    template<typename T>
+    void deserializeItem(const std::string& data, T& object) const;
+
     std::shared_ptr<QueueImpl> m_impl;
 };
 
@@ -106,25 +281,7 @@ class Queue {
 namespace hepnos {
 
 template<typename T>
-void Queue::push(const T& value) {
-    if(!checkTypeImpl(typeid(T))) {
-        throw Exception("Invalid object type");
-    }
-
-    auto value_str = std::string{};
-
-    OutputSizer value_sizer;
-    OutputSizeEvaluator value_size_evaluator(value_sizer, 0);
-    OutputArchive sizing_oa(value_size_evaluator);
-    try {
-        sizing_oa << value;
-    } catch(const std::exception& e) {
-        throw Exception(
-            std::string("Exception occured during object size estimation: ") + e.what());
-    }
-
-    value_str.reserve(value_sizer.size());
-
+void Queue::serializeItem(const T& value, std::string& value_str) {
     OutputStringWrapper value_wrapper(value_str);
     OutputStream value_stream(value_wrapper, 0);
     OutputArchive output_oa(value_stream);
@@ -135,10 +292,51 @@ void Queue::push(const T& value) {
         throw Exception(
             std::string("Exception occured during serialization: ") + e.what());
     }
+}
+
+template<typename T>
+void Queue::deserializeItem(const std::string& buffer, T& value) const {
+    try {
+        InputStringWrapper value_wrapper(buffer.data(), buffer.size());
+        InputStream value_stream(value_wrapper);
+        InputArchive ia(datastore(), value_stream);
+        ia >> value;
+    } catch(const std::exception& e) {
+        throw Exception(std::string("Exception occured during serialization: ") + e.what());
+    }
+}
 
+template<typename T>
+void Queue::push(const T& value) {
+    if(!checkTypeImpl(typeid(T))) {
+        throw Exception("Invalid object type");
+    }
+    auto value_str = std::string{};
+    serializeItem(value, value_str);
     pushImpl(value_str);
 }
 
+template<typename T>
+bool Queue::tryPush(const T& value) {
+    if(!checkTypeImpl(typeid(T))) {
+        throw Exception("Invalid object type");
+    }
+    auto value_str = std::string{};
+    serializeItem(value, value_str);
+    return tryPushImpl(value_str);
+}
+
+template<typename T>
+void Queue::pushMany(const std::vector<T>& values) {
+    if(!checkTypeImpl(typeid(T))) {
+        throw Exception("Invalid object type");
+    }
+    std::vector<std::string> data(values.size());
+    for(size_t i = 0; i < values.size(); i++)
+        serializeItem(values[i], data[i]);
+    pushManyImpl(data);
+}
+
 template<typename T>
 bool Queue::pop(T& value) {
     if(!checkTypeImpl(typeid(T))) {
@@ -147,17 +345,83 @@ bool Queue::pop(T& value) {
     std::string buffer;
     bool b = popImpl(buffer);
     if(!b) return false;
-    try {
-        InputStringWrapper value_wrapper(buffer.data(), buffer.size());
-        InputStream value_stream(value_wrapper);
-        InputArchive ia(datastore(), value_stream);
-        ia >> value;
-    } catch(const std::exception& e) {
-        throw Exception(std::string("Exception occured during serialization: ") + e.what());
-    }
+    deserializeItem(buffer, value);
     return true;
 }
 
+template<typename T>
+QueuePopStatus Queue::tryPop(T& value) {
+    return timedPop(value, 0.0);
+}
+
+template<typename T>
+QueuePopStatus Queue::timedPop(T& value, double timeout) {
+    if(!checkTypeImpl(typeid(T))) {
+        throw Exception("Invalid object type");
+    }
+    std::string buffer;
+    auto status = timedPopImpl(buffer, timeout < 0.0 ? 0.0 : timeout);
+    if(status == QueuePopStatus::POPPED)
+        deserializeItem(buffer, value);
+    return status;
+}
+
+template<typename T>
+QueueFuture Queue::popAsync(T& value) {
+    if(!checkTypeImpl(typeid(T))) {
+        throw Exception("Invalid object type");
+    }
+    Queue queue(m_impl);
+    return popAsyncImpl(nullptr, [queue, &value](const std::string& buffer) {
+        queue.deserializeItem(buffer, value);
+    });
+}
+
+template<typename T>
+QueueFuture Queue::popAsync(AsyncEngine& engine, T& value) {
+    if(!checkTypeImpl(typeid(T))) {
+        throw Exception("Invalid object type");
+    }
+    Queue queue(m_impl);
+    return popAsyncImpl(&engine, [queue, &value](const std::string& buffer) {
+        queue.deserializeItem(buffer, value);
+    });
+}
+
+template<typename T>
+QueueFuture Queue::pushAsync(const T& value) {
+    if(!checkTypeImpl(typeid(T))) {
+        throw Exception("Invalid object type");
+    }
+    auto value_str = std::string{};
+    serializeItem(value, value_str);
+    return pushAsyncImpl(nullptr, std::move(value_str));
+}
+
+template<typename T>
+QueueFuture Queue::pushAsync(AsyncEngine& engine, const T& value) {
+    if(!checkTypeImpl(typeid(T))) {
+        throw Exception("Invalid object type");
+    }
+    auto value_str = std::string{};
+    serializeItem(value, value_str);
+    return pushAsyncImpl(&engine, std::move(value_str));
+}
+
+template<typename T>
+size_t Queue::popMany(std::vector<T>& values, size_t max) {
+    if(!checkTypeImpl(typeid(T))) {
+        throw Exception("Invalid object type");
+    }
+    values.clear();
+    std::vector<std::string> data;
+    size_t count = popManyImpl(data, max);
+    values.resize(count);
+    for(size_t i = 0; i < count; i++)
+        deserializeItem(data[i], values[i]);
+    return count;
+}
+
 }
 
 #endif
@@ -0,0 +1,63 @@
+/*
+ * (C) 2026 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#ifndef __HEPNOS_QUEUE_FUTURE_HPP
+#define __HEPNOS_QUEUE_FUTURE_HPP
+
+#include <memory>
+
+namespace hepnos {
+
+class Queue;
+class QueueFutureImpl;
+
+/**
+ * @brief A QueueFuture tracks an asynchronous push or pop
+ * (see Queue::pushAsync and Queue::popAsync).
+ */
+class QueueFuture {
+
+    friend class Queue;
+
+    public:
+
+    QueueFuture();
+    QueueFuture(const QueueFuture&);
+    QueueFuture(QueueFuture&&);
+    QueueFuture& operator=(const QueueFuture&);
+    QueueFuture& operator=(QueueFuture&&);
+    ~QueueFuture();
+
+    /**
+     * @brief Check that the QueueFuture tracks an operation.
+     */
+    bool valid() const;
+
+    /**
+     * @brief Check, without blocking, whether the operation has completed.
+     */
+    bool completed() const;
+
+    /**
+     * @brief Blocks until the operation completes. For a pop, the
+     * popped item is then deserialized into the object passed to
+     * Queue::popAsync. Errors that occured during the operation are
+     * thrown as Exceptions.
+     *
+     * @return false if this is a pop and all the producers have
+     * closed the queue without an item being popped, true otherwise.
+     */
+    bool wait();
+
+    private:
+
+    QueueFuture(std::shared_ptr<QueueFutureImpl> impl);
+
+    std::shared_ptr<QueueFutureImpl> m_impl;
+};
+
+}
+
+#endif
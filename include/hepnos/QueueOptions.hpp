@@ -0,0 +1,74 @@
+/*
+ * (C) 2026 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#ifndef __HEPNOS_QUEUE_OPTIONS_HPP
+#define __HEPNOS_QUEUE_OPTIONS_HPP
+
+#include <cstddef>
+
+namespace hepnos {
+
+/**
+ * @brief How producers distribute items across the shards of a queue.
+ */
+enum class QueueShardingPolicy : int {
+    ROUND_ROBIN = 0, /*!< each producer sends its items to the shards in turn */
+    HASH        = 1  /*!< items are placed according to a hash of their content */
+};
+
+/**
+ * @brief Options of a queue, provided when creating it.
+ */
+struct QueueOptions {
+
+    /**
+     * @brief Number of shards over which the queue is spread. Each shard
+     * is managed by a different QueueProvider (shards are placed on the
+     * same providers again if there are fewer providers than shards).
+     */
+    size_t num_shards = 1;
+
+    /**
+     * @brief How producers distribute items across shards.
+     */
+    QueueShardingPolicy sharding = QueueShardingPolicy::ROUND_ROBIN;
+
+    /**
+     * @brief Maximum number of items held in memory (0 for no limit).
+     * Limits are split evenly among the shards of the queue. When the
+     * queue is full, Queue::push waits for consumers to make space and
+     * Queue::tryPush fails, unless spill is enabled.
+     */
+    size_t max_items = 0;
+
+    /**
+     * @brief Maximum number of bytes of items held in memory (0 for no limit).
+     */
+    size_t max_bytes = 0;
+
+    /**
+     * @brief Whether the items pushed while the queue is full are written
+     * to a file on the node of the QueueProvider (in the directory given
+     * by the "spill_directory" entry of the provider's configuration,
+     * $TMPDIR or /tmp by default) instead of making producers wait.
+     * They are read back, in order, as consumers make space.
+     */
+    bool spill = false;
+
+    /**
+     * @brief Whether the items are also written to a log on the node of
+     * the QueueProvider (in the directory given by the "persistent_directory"
+     * entry of the provider's configuration, which is required), so that
+     * the queue and its items survive a restart of the provider. Each push
+     * and each pop RPC is committed to the log with a single flush (and a
+     * sync if the provider's configuration sets "sync" to true). With spill,
+     * the overflow of a persistent queue is kept only in its log.
+     */
+    bool persistent = false;
+};
+
+}
+
+#endif
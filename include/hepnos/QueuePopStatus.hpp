@@ -0,0 +1,22 @@
+/*
+ * (C) 2026 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#ifndef __HEPNOS_QUEUE_POP_STATUS_HPP
+#define __HEPNOS_QUEUE_POP_STATUS_HPP
+
+namespace hepnos {
+
+/**
+ * @brief Outcome of a non-blocking or timed pop from a Queue.
+ */
+enum class QueuePopStatus : int {
+    POPPED   = 0, /*!< an item was popped */
+    TIMEOUT  = 1, /*!< no item was available in time */
+    FINISHED = 2  /*!< the queue is empty and all the producers have closed it */
+};
+
+}
+
+#endif
@@ -17,10 +17,12 @@
 namespace hepnos {
 
 class KeyValueContainer;
+class CollectiveLoader;
 
 class RawStorage {
 
     friend class KeyValueContainer;
+    friend class CollectiveLoader;
 
     public:
 
@@ -97,6 +99,19 @@ class RawStorage {
      */
     virtual bool loadRawData(const ProductID& key, char* value, size_t* vsize) const = 0;
 
+    /**
+     * @brief If the buffer filled by loadRawData holds the manifest of a
+     * chunked product, replaces it with the content of the product.
+     * RawStorage implementations that keep or share the products they
+     * load assemble them beforehand, so the chunks are fetched only once.
+     *
+     * @param key Key.
+     * @param buffer Buffer filled by loadRawData.
+     *
+     * @return true if the product was chunked.
+     */
+    virtual bool assembleChunks(const ProductID& key, std::string& buffer) const = 0;
+
 };
 
 }
@@ -0,0 +1,437 @@
+/*
+ * (C) 2026 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#ifndef __HEPNOS_SERIALIZER_HPP
+#define __HEPNOS_SERIALIZER_HPP
+
+#include <string>
+#include <vector>
+#include <cstddef>
+#include <cstring>
+#include <cstdint>
+#include <type_traits>
+#include <hepnos/Exception.hpp>
+
+namespace hepnos {
+
+/**
+ * @brief Serialization backend for products of type T. By default products
+ * are serialized using Boost archives (hepnos::OutputArchive and
+ * hepnos::InputArchive). A different backend can be selected for a type
+ * by specializing this class with the following static functions:
+ *
+ * @code
+ * template<> struct Serializer<MyType> {
+ *     // appends the serialized value to buffer
+ *     static void serialize(const MyType& value, std::string& buffer);
+ *     // deserializes the value from the size bytes at data
+ *     static bool deserialize(const char* data, size_t size, MyType& value);
+ * };
+ * @endcode
+ *
+ * deserialize is given the loaded buffer directly, without intermediate
+ * stream, so it can read the value in place (see FlatReader).
+ *
+ * @tparam T Type of product.
+ */
+template<typename T>
+struct Serializer {};
+
+template<typename ... Ts>
+struct MakeVoid { typedef void type; };
+
+/**
+ * @brief Indicates whether Serializer has been specialized for type T.
+ */
+template<typename T, typename _ = void>
+struct HasCustomSerializer : std::false_type {};
+
+template<typename T>
+struct HasCustomSerializer<T, typename MakeVoid<
+        decltype(Serializer<T>::serialize(std::declval<const T&>(), std::declval<std::string&>())),
+        decltype(Serializer<T>::deserialize(std::declval<const char*>(), size_t(), std::declval<T&>()))
+    >::type> : std::true_type {};
+
+/**
+ * @brief Version of the memory layout of type T, stored along with the raw
+ * data of products of type T. Specialize it and increment its value when the
+ * layout of a type stored in raw form changes, so that data stored with the
+ * old layout is rejected when loaded.
+ */
+template<typename T>
+struct RawLayoutVersion : std::integral_constant<uint32_t, 0> {};
+
+/**
+ * @brief Indicates whether products of type T are stored as a copy of their
+ * memory rather than serialized. This is the case by default for trivially
+ * copyable types (scalars, structs of scalars, std::array of those, etc.)
+ * that don't have a custom Serializer. Specialize it to opt a type out
+ * (e.g. if products of this type were stored with Boost by an earlier
+ * version of HEPnOS), or to opt in a type known to be safe to copy.
+ */
+template<typename T>
+struct UseRawStorage : std::integral_constant<bool,
+    std::is_trivially_copyable<T>::value
+    && !std::is_pointer<T>::value
+    && !HasCustomSerializer<T>::value> {};
+
+/**
+ * @brief Tag placed before the raw data of a product so that readers can
+ * check that the data was stored with the same layout as the type used
+ * to load it.
+ */
+struct RawLayoutTag {
+
+    static constexpr uint32_t s_magic = 0x57415248; // "HRAW"
+
+    uint32_t magic;
+    uint32_t version;
+    uint32_t type_size;
+    uint32_t type_alignment;
+
+    template<typename T>
+    static RawLayoutTag make() {
+        return RawLayoutTag{ s_magic, RawLayoutVersion<T>::value,
+                             (uint32_t)sizeof(T), (uint32_t)alignof(T) };
+    }
+
+    /**
+     * @brief Returns false if the data does not start with a tag,
+     * throws if it starts with a tag for a different layout of T.
+     */
+    template<typename T>
+    static bool check(const char* data, size_t size) {
+        if(size < sizeof(RawLayoutTag)) return false;
+        RawLayoutTag tag;
+        std::memcpy(&tag, data, sizeof(tag));
+        if(tag.magic != s_magic) return false;
+        auto expected = make<T>();
+        if(tag.version != expected.version
+        || tag.type_size != expected.type_size
+        || tag.type_alignment != expected.type_alignment)
+            throw Exception("Product was stored with a memory layout different from that of the type used to load it");
+        return true;
+    }
+};
+
+/**
+ * @brief Offset of the value in the raw layout of a product of type T.
+ */
+template<typename T>
+constexpr size_t rawValueOffset() {
+    return (sizeof(RawLayoutTag) + alignof(T) - 1) / alignof(T) * alignof(T);
+}
+
+/**
+ * @brief Size of the raw layout of a product of type T.
+ */
+template<typename T>
+constexpr size_t rawValueSize() {
+    return rawValueOffset<T>() + sizeof(T);
+}
+
+/**
+ * @brief Offset of the elements in the raw layout of a vector of T
+ * (the tag is followed by the number of elements, then the elements).
+ */
+template<typename T>
+constexpr size_t rawVectorOffset() {
+    return (sizeof(RawLayoutTag) + sizeof(size_t) + alignof(T) - 1) / alignof(T) * alignof(T);
+}
+
+/**
+ * @brief Writes the raw layout of value into a buffer of rawValueSize<T>() bytes.
+ */
+template<typename T>
+void writeRawValue(const T& value, char* buffer) {
+    auto tag = RawLayoutTag::make<T>();
+    std::memset(buffer, 0, rawValueOffset<T>());
+    std::memcpy(buffer, &tag, sizeof(tag));
+    std::memcpy(buffer + rawValueOffset<T>(), &value, sizeof(T));
+}
+
+/**
+ * @brief Reads a value from its raw layout. Data stored without
+ * tag (by earlier versions of HEPnOS) is accepted if its size is that of T.
+ *
+ * @return false if the data does not have the layout of a T.
+ */
+template<typename T>
+bool readRawValue(const char* data, size_t size, T& value) {
+    if(size == sizeof(T)) {
+        std::memcpy(&value, data, sizeof(T));
+        return true;
+    }
+    if(size != rawValueSize<T>() || !RawLayoutTag::check<T>(data, size))
+        return false;
+    std::memcpy(&value, data + rawValueOffset<T>(), sizeof(T));
+    return true;
+}
+
+/**
+ * @brief Writes the raw layout of an array of values into a buffer.
+ */
+template<typename T>
+void writeRawVector(const T* values, size_t count, std::string& buffer) {
+    auto tag = RawLayoutTag::make<T>();
+    buffer.assign(rawVectorOffset<T>() + count*sizeof(T), '\0');
+    char* data = const_cast<char*>(buffer.data());
+    std::memcpy(data, &tag, sizeof(tag));
+    std::memcpy(data + sizeof(tag), &count, sizeof(count));
+    if(count) std::memcpy(data + rawVectorOffset<T>(), values, count*sizeof(T));
+}
+
+/**
+ * @brief Reads the number of elements and the offset of the first element
+ * from the raw layout of a vector. Only the beginning of the data is needed.
+ * Data stored without tag (by earlier versions of HEPnOS) is accepted.
+ *
+ * @return false if the data is too short to contain the header.
+ */
+template<typename T>
+bool readRawVectorHeader(const char* data, size_t size, size_t* count, size_t* offset) {
+    if(RawLayoutTag::check<T>(data, size)) {
+        if(size < sizeof(RawLayoutTag) + sizeof(*count)) return false;
+        std::memcpy(count, data + sizeof(RawLayoutTag), sizeof(*count));
+        *offset = rawVectorOffset<T>();
+    } else {
+        if(size < sizeof(*count)) return false;
+        std::memcpy(count, data, sizeof(*count));
+        *offset = sizeof(*count);
+    }
+    return true;
+}
+
+/**
+ * @brief Reads a vector of values from its raw layout. Data stored without
+ * tag (by earlier versions of HEPnOS) is accepted if its size is consistent.
+ *
+ * @return false if the data does not have the layout of a vector of T.
+ */
+template<typename T>
+bool readRawVector(const char* data, size_t size, std::vector<T>& values) {
+    size_t count = 0;
+    size_t offset = 0;
+    if(!readRawVectorHeader<T>(data, size, &count, &offset))
+        return false;
+    if(size < offset || (size - offset) / sizeof(T) != count || (size - offset) % sizeof(T) != 0)
+        return false;
+    values.resize(count);
+    if(count) std::memcpy(values.data(), data + offset, count*sizeof(T));
+    return true;
+}
+
+/**
+ * @brief Padding to insert at the given offset of a vector serialized with a
+ * custom Serializer, so that the element data following the size of the
+ * element starts on a multiple of alignof(std::max_align_t). This lets a
+ * FlatReader access the elements in place as it would a single value.
+ */
+inline size_t vectorElementPadding(size_t offset) {
+    constexpr size_t alignment = alignof(std::max_align_t);
+    return (alignment - (offset + sizeof(size_t)) % alignment) % alignment;
+}
+
+/**
+ * @brief Serializes the elements [start, end) of a vector of values with a
+ * custom Serializer. The layout is the number of elements followed, for each
+ * element, by padding (see vectorElementPadding), its size, and its
+ * serialized data.
+ */
+template<typename T>
+void serializeVectorWithSerializer(const std::vector<T>& value, std::string& buffer,
+                                   size_t start, size_t end) {
+    size_t base = buffer.size();
+    size_t count = end-start;
+    buffer.append(reinterpret_cast<const char*>(&count), sizeof(count));
+    for(auto i = start; i < end; i++) {
+        buffer.append(vectorElementPadding(buffer.size() - base), '\0');
+        size_t offset = buffer.size();
+        size_t size = 0;
+        buffer.append(reinterpret_cast<const char*>(&size), sizeof(size));
+        Serializer<T>::serialize(value[i], buffer);
+        size = buffer.size() - offset - sizeof(size);
+        std::memcpy(const_cast<char*>(buffer.data())+offset, &size, sizeof(size));
+    }
+}
+
+/**
+ * @brief Deserializes a vector serialized by serializeVectorWithSerializer.
+ */
+template<typename T>
+bool deserializeVectorWithSerializer(const char* data, size_t size, std::vector<T>& value) {
+    size_t count = 0;
+    if(size < sizeof(count)) return false;
+    std::memcpy(&count, data, sizeof(count));
+    size_t offset = sizeof(count);
+    value.resize(count);
+    for(size_t i = 0; i < count; i++) {
+        size_t element_size = 0;
+        size_t padding = vectorElementPadding(offset);
+        if(size - offset < padding) return false;
+        offset += padding;
+        if(size - offset < sizeof(element_size)) return false;
+        std::memcpy(&element_size, data+offset, sizeof(element_size));
+        offset += sizeof(element_size);
+        if(size - offset < element_size) return false;
+        if(!Serializer<T>::deserialize(data+offset, element_size, value[i]))
+            return false;
+        offset += element_size;
+    }
+    return true;
+}
+
+/**
+ * @brief Helper to write a flat, offset-based layout into a buffer.
+ * Trivially copyable values and arrays of them are copied as is,
+ * aligned on their natural alignment, so that a FlatReader can
+ * access them in place in the loaded buffer.
+ */
+class FlatWriter {
+
+    public:
+
+    /**
+     * @brief Constructor. The content is appended to the provided buffer.
+     */
+    FlatWriter(std::string& buffer)
+    : m_buffer(buffer)
+    , m_start(buffer.size()) {}
+
+    template<typename T>
+    void write(const T& value) {
+        static_assert(std::is_trivially_copyable<T>::value,
+                      "FlatWriter::write requires a trivially copyable type");
+        write(&value, 1);
+    }
+
+    template<typename T>
+    void write(const T* values, size_t count) {
+        static_assert(std::is_trivially_copyable<T>::value,
+                      "FlatWriter::write requires a trivially copyable type");
+        align(alignof(T));
+        m_buffer.append(reinterpret_cast<const char*>(values), count*sizeof(T));
+    }
+
+    template<typename T>
+    void write(const std::vector<T>& values) {
+        write<size_t>(values.size());
+        write(values.data(), values.size());
+    }
+
+    void write(const std::string& value) {
+        write<size_t>(value.size());
+        m_buffer.append(value);
+    }
+
+    private:
+
+    void align(size_t alignment) {
+        size_t offset = m_buffer.size() - m_start;
+        size_t padding = (alignment - offset % alignment) % alignment;
+        m_buffer.append(padding, '\0');
+    }
+
+    std::string& m_buffer;
+    size_t       m_start;
+};
+
+/**
+ * @brief Helper to read a flat layout written by a FlatWriter.
+ * The read functions copy values out of the buffer and work regardless of
+ * its alignment. The view functions return pointers into the buffer itself,
+ * without copy; they remain valid as long as the buffer does, and require
+ * the buffer to be aligned at least as much as the types read from it
+ * (buffers given to a Serializer by HEPnOS are, including the elements of
+ * a vector).
+ */
+class FlatReader {
+
+    public:
+
+    FlatReader(const char* data, size_t size)
+    : m_data(data)
+    , m_size(size) {}
+
+    template<typename T>
+    void read(T& value) {
+        std::memcpy(&value, skip<T>(1), sizeof(T));
+    }
+
+    template<typename T>
+    void read(std::vector<T>& values) {
+        size_t count = 0;
+        read(count);
+        const char* ptr = skip<T>(count);
+        values.resize(count);
+        if(count) std::memcpy(values.data(), ptr, count*sizeof(T));
+    }
+
+    void read(std::string& value) {
+        size_t count = 0;
+        read(count);
+        check(count);
+        value.assign(m_data + m_offset, count);
+        m_offset += count;
+    }
+
+    /**
+     * @brief Returns a pointer to count values of type T in the buffer.
+     */
+    template<typename T>
+    const T* view(size_t count) {
+        static_assert(std::is_trivially_copyable<T>::value,
+                      "FlatReader::view requires a trivially copyable type");
+        const char* ptr = skip<T>(count);
+        if(reinterpret_cast<uintptr_t>(ptr) % alignof(T) != 0)
+            throw Exception("FlatReader: buffer is not aligned for in-place access, use read instead");
+        return reinterpret_cast<const T*>(ptr);
+    }
+
+    /**
+     * @brief Returns a pointer to the elements of an array written from
+     * an std::vector<T>, and sets count to the number of elements.
+     */
+    template<typename T>
+    const T* view(size_t* count) {
+        read(*count);
+        return view<T>(*count);
+    }
+
+    size_t remaining() const {
+        return m_size - m_offset;
+    }
+
+    private:
+
+    /**
+     * @brief Skips the padding a FlatWriter put before count values of
+     * type T (relative to the start of the layout), and then the values.
+     * Returns a pointer to the first value.
+     */
+    template<typename T>
+    const char* skip(size_t count) {
+        static_assert(std::is_trivially_copyable<T>::value,
+                      "FlatReader::read requires a trivially copyable type");
+        m_offset += (alignof(T) - m_offset % alignof(T)) % alignof(T);
+        check(count*sizeof(T));
+        const char* ptr = m_data + m_offset;
+        m_offset += count*sizeof(T);
+        return ptr;
+    }
+
+    void check(size_t n) const {
+        if(m_offset > m_size || n > m_size - m_offset)
+            throw Exception("FlatReader: attempting to read past the end of the buffer");
+    }
+
+    const char* m_data;
+    size_t      m_size;
+    size_t      m_offset = 0;
+};
+
+}
+
+#endif
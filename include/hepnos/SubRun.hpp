@@ -110,6 +110,70 @@ class SubRun : public KeyValueContainer {
      */
     std::vector<ProductID> listProducts(const std::string& label="") const;
 
+    /**
+     * @brief Stores the products of type V with the given label for many
+     * events of this SubRun as a single packed record, instead of one
+     * product per Event. The events don't need to exist. If
+     * DataStore::setPacking<V>(label) has been called, such products
+     * can be loaded from their Event as if they had been stored in it.
+     * They can also all be loaded at once with loadPacked.
+     *
+     * @tparam L type of the label.
+     * @tparam V type of the products.
+     * @param label Label of the products.
+     * @param events Event numbers.
+     * @param values Products, one per event number.
+     * @param stats Statistics.
+     *
+     * @return The ProductID of the packed record.
+     */
+    template<typename L, typename V>
+    ProductID storePacked(const L& label, const std::vector<EventNumber>& events,
+                          const std::vector<V>& values, StoreStatistics* stats = nullptr) {
+        auto ds = datastore();
+        return storePackedImpl(ds, label, events, values, stats);
+    }
+
+    /**
+     * @brief Version of storePacked storing into the Target
+     * (WriteBatch, AsyncEngine, etc.).
+     */
+    template<typename L, typename V>
+    ProductID storePacked(RawStorage& target, const L& label, const std::vector<EventNumber>& events,
+                          const std::vector<V>& values, StoreStatistics* stats = nullptr) {
+        return storePackedImpl(target, label, events, values, stats);
+    }
+
+    /**
+     * @brief Loads all the products of a packed record stored with
+     * storePacked, sorted by event number.
+     *
+     * @tparam L type of the label.
+     * @tparam V type of the products.
+     * @param label Label of the products.
+     * @param events Resulting event numbers.
+     * @param values Resulting products, one per event number.
+     * @param stats Statistics.
+     *
+     * @return true if the packed record exists and was loaded. False otherwise.
+     */
+    template<typename L, typename V>
+    bool loadPacked(const L& label, std::vector<EventNumber>& events,
+                    std::vector<V>& values, LoadStatistics* stats = nullptr) const {
+        auto ds = datastore();
+        return loadPackedImpl(ds, label, events, values, stats);
+    }
+
+    /**
+     * @brief Version of loadPacked looking first into the
+     * Source argument for the packed record.
+     */
+    template<typename L, typename V, typename Source>
+    bool loadPacked(const Source& source, const L& label, std::vector<EventNumber>& events,
+                    std::vector<V>& values, LoadStatistics* stats = nullptr) const {
+        return loadPackedImpl(source, label, events, values, stats);
+    }
+
     /**
      * @brief Compares this SubRun with another SubRun. The SubRuns must point to
      * the same subrun number within the same container.
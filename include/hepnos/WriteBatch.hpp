@@ -148,6 +148,11 @@ class WriteBatch : public RawStorage {
      */
     bool loadRawData(const ProductID& key, char* value, size_t* vsize) const override;
 
+    /**
+     * @see RawStorage::assembleChunks
+     */
+    bool assembleChunks(const ProductID& key, std::string& buffer) const override;
+
 };
 
 }
@@ -43,6 +43,10 @@ bool AsyncEngine::loadRawData(const ProductID& key, char* value, size_t* vsize)
     return m_impl->m_datastore->loadRawProduct(key, value, vsize);
 }
 
+bool AsyncEngine::assembleChunks(const ProductID& key, std::string& buffer) const {
+    return m_impl->m_datastore->assembleChunks(key, buffer);
+}
+
 bool AsyncEngine::valid() const {
     return static_cast<bool>(m_impl);
 }
@@ -59,6 +59,7 @@ class AsyncEngineImpl {
     ProductID storeRawProduct(const ProductID& product_id,
                               const char* value, size_t vsize)
     {
+        m_datastore->invalidateCachedProduct(product_id);
         // make a thread that will store the data
         m_pool.make_thread([this,
                             product_id,
@@ -2,6 +2,7 @@
 #define __HEPNOS_ASYNC_PREFETCHER_IMPL_HPP
 
 #include <set>
+#include <algorithm>
 #include <unordered_set>
 #include <unordered_map>
 #include <thallium.hpp>
@@ -31,48 +32,70 @@ class AsyncPrefetcherImpl : public PrefetcherImpl {
     , m_async_engine(async) {}
 
     /**
-     * This ULT will fetch the requested product, then notify anyone waiting on
-     * m_product_cache_cv that a new product is available.
+     * This ULT will fetch the requested products using one packed get per
+     * product database, then notify anyone waiting on m_product_cache_cv
+     * that new products are available.
      */
-    void _product_prefetcher_thread(tl::pool& p, const ProductID& product_id) const {
-        // load the product
-        std::string data;
-        bool ok = m_datastore->loadRawProduct(product_id, data);
-        // update the cache
-        {
-            std::unique_lock<tl::mutex> lock(m_product_cache_mtx);
-            if(ok) {
-                m_product_cache.m_impl->addRawProduct(product_id, std::move(data));
+    void _product_prefetcher_thread(tl::pool& p, const std::vector<ProductID>& product_ids,
+                                    size_t num_items) const {
+        size_t num_bytes = 0;
+        try {
+            m_datastore->loadRawProductsPacked(product_ids,
+                [this, &num_bytes](const ProductID& product_id, bool found, std::string&& data) {
+                    // fetching the chunks of a large product must not
+                    // block the consumers waiting on m_product_cache_mtx
+                    if(found)
+                        m_datastore->assembleChunks(product_id, data);
+                    {
+                        std::unique_lock<tl::mutex> lock(m_product_cache_mtx);
+                        if(found) {
+                            num_bytes += data.size();
+                            update_product_statistics(data.size());
+                            m_product_cache.m_impl->addRawProduct(product_id, std::move(data));
+                        } else {
+                            m_product_cache.m_impl->addNotFound(product_id);
+                        }
+                        m_products_loading.erase(product_id.m_key);
+                    }
+                    m_product_cache_cv.notify_all();
+                });
+            record_product_bytes(num_items, num_bytes);
+        } catch(const Exception&) {
+            // products that could not be prefetched will be
+            // loaded directly from the DataStore by the consumer
+            {
+                std::unique_lock<tl::mutex> lock(m_product_cache_mtx);
+                for(auto& product_id : product_ids)
+                    m_products_loading.erase(product_id.m_key);
             }
-            m_products_loading.erase(product_id.m_key);
+            m_product_cache_cv.notify_all();
         }
-        // notify other ULTs of this update
-        m_product_cache_cv.notify_one();
     }
 
     /**
-     * This function spawns the _product_prefetcher_thread and an anonymous ULT.
+     * This function spawns a _product_prefetcher_thread as an anonymous ULT
+     * for the products of a whole batch of items.
      */
     void _spawn_product_prefetcher_threads(tl::pool& pool,
-                                           const std::shared_ptr<ItemImpl>& item) const {
-        auto& descriptor = item->m_descriptor;
-        for(auto& key : m_active_product_keys) {
-            auto product_id = DataStoreImpl::makeProductID(
-                descriptor, key.label.c_str(), key.label.size(),
-                key.type.c_str(), key.type.size());
-            {
-                std::unique_lock<tl::mutex> lock(m_product_cache_mtx);
-                auto it = m_products_loading.find(product_id.m_key);
-                if(it != m_products_loading.end())
-                    continue;
-                // indicate that product is being loaded
-                m_products_loading.insert(product_id.m_key);
-            }
-            // spawn a thread to load the product, but don't wait for it to complete
-            pool.make_thread([pid=std::move(product_id), &pool, this]() {
-                _product_prefetcher_thread(pool, pid);
-                }, tl::anonymous());
+                                           const std::vector<std::shared_ptr<ItemImpl>>& items) const {
+        std::vector<ProductID> product_ids;
+        makeRequestedProductIDs(items, product_ids);
+        {
+            std::unique_lock<tl::mutex> lock(m_product_cache_mtx);
+            // only keep the products that aren't already being loaded,
+            // and indicate that the others are being loaded
+            product_ids.erase(
+                std::remove_if(product_ids.begin(), product_ids.end(),
+                    [this](const ProductID& product_id) {
+                        return !m_products_loading.insert(product_id.m_key).second;
+                    }),
+                product_ids.end());
         }
+        if(product_ids.empty()) return;
+        // spawn a thread to load the products, but don't wait for it to complete
+        pool.make_thread([pids=std::move(product_ids), num_items=items.size(), &pool, this]() {
+            _product_prefetcher_thread(pool, pids, num_items);
+            }, tl::anonymous());
     }
 
     /**
@@ -90,25 +113,32 @@ class AsyncPrefetcherImpl : public PrefetcherImpl {
             // wait for space to be available in the cache
             {
                 std::unique_lock<tl::mutex> lock(m_item_cache_mtx);
-                while(m_item_cache.size() == m_cache_size) {
+                while(m_item_cache.size() >= m_cache_size) {
                     m_item_cache_cv.wait(lock);
                 }
             }
             // we have space in the cache, fetch a batch of items
             std::vector<std::shared_ptr<ItemImpl>> items;
-            size_t s = m_datastore->nextItems(item_type, prefix_type, last, items, m_batch_size, target);
+            size_t batch_size = m_batch_size;
+            double t1 = wtime();
+            size_t s = m_datastore->nextItems(item_type, prefix_type, last, items, batch_size, target);
+            record_item_fetch(s, wtime()-t1);
             if(s != 0)
                 last = items[items.size()-1];
+            // make the products of their parents resident before handing them out
+            fetchParentProducts(items);
+            // start prefetching products of the whole batch (asynchronously)
+            if(!m_active_product_keys.empty())
+                _spawn_product_prefetcher_threads(p, items);
+            // walk ahead into the children of these items
+            prefetchChildren(items);
             for(auto& item : items) {
-                // start prefetching products (asynchronously)
-                if(!m_active_product_keys.empty())
-                    _spawn_product_prefetcher_threads(p, item);
                 // lock the item cache and insert the item into it
                 std::unique_lock<tl::mutex> lock(m_item_cache_mtx);
                 m_item_cache.insert(std::move(item));
             }
             // notify anyone waiting that new items are available
-            if(s < m_batch_size) {
+            if(s < batch_size) {
                 // no more items to get, no need to continue running this thread
                 m_item_prefetcher_active = false;
             }
@@ -131,12 +161,46 @@ class AsyncPrefetcherImpl : public PrefetcherImpl {
                 }, tl::anonymous());
     }
 
+    using PrefetcherImpl::fetchRequestedProducts;
+
     /**
-     * Initiates fetching products associated with an item.
+     * Initiates fetching products associated with a batch of items.
      */
-    void fetchRequestedProducts(const std::shared_ptr<ItemImpl>& itemImpl) const override {
+    void fetchRequestedProducts(const std::vector<std::shared_ptr<ItemImpl>>& items) const override {
+        if(m_active_product_keys.empty()) return;
         tl::pool& pool = m_async_engine->m_pool;
-        _spawn_product_prefetcher_threads(pool, itemImpl);
+        _spawn_product_prefetcher_threads(pool, items);
+    }
+
+    /**
+     * Places items prefetched ahead in the item cache and spawns the item
+     * prefetcher thread after them if needed.
+     */
+    void startFromItems(const std::shared_ptr<ItemImpl>& first,
+                        std::vector<std::shared_ptr<ItemImpl>>&& items,
+                        bool complete) const override
+    {
+        auto last = items.empty() ? first : items.back();
+        {
+            std::unique_lock<tl::mutex> lock(m_item_cache_mtx);
+            m_item_cache.clear();
+            for(auto& item : items) {
+                m_item_cache.insert(std::move(item));
+            }
+        }
+        if(complete) {
+            m_item_prefetcher_active = false;
+            return;
+        }
+        auto& descriptor = first->m_descriptor;
+        ItemType item_type   = ItemType::EVENT;
+        ItemType prefix_type = ItemType::SUBRUN;
+        if(descriptor.event == InvalidEventNumber) {
+            item_type   = ItemType::SUBRUN;
+            prefix_type = ItemType::RUN;
+        }
+        tl::pool& pool = m_async_engine->m_pool;
+        _spawn_item_prefetcher_thread(pool, item_type, prefix_type, last, -1);
     }
 
     /**
@@ -163,6 +227,7 @@ class AsyncPrefetcherImpl : public PrefetcherImpl {
             size_t maxItems,
             int target=-1) const override
     {
+        record_consumption_start();
         result.clear();
         auto last = current;
         while(result.size() < maxItems) {
@@ -187,6 +252,9 @@ class AsyncPrefetcherImpl : public PrefetcherImpl {
             m_item_cache.erase(ub, it);
         }
         m_item_cache_cv.notify_one();
+        if(!result.empty())
+            evictParentProducts(result.front()->m_descriptor);
+        record_consumption_end(result.size());
         return result.size();
     }
 
@@ -196,6 +264,10 @@ class AsyncPrefetcherImpl : public PrefetcherImpl {
         if(m_product_cache.m_impl->loadRawProduct(product_id, data)) {
             // product found right away
             m_product_cache.m_impl->removeRawProduct(product_id);
+        } else if(m_product_cache.m_impl->checkNotFound(product_id)) {
+            // product was prefetched and is known not to exist
+            m_product_cache.m_impl->removeRawProduct(product_id);
+            return false;
         } else {
             // product not found, check if prefetching is pending
             if(m_products_loading.count(product_id.m_key) == 0) {
@@ -214,6 +286,7 @@ class AsyncPrefetcherImpl : public PrefetcherImpl {
                     return true;
                 } else{
                     // product not found
+                    m_product_cache.m_impl->removeRawProduct(product_id);
                     return false;
                 }
             }
@@ -230,6 +303,10 @@ class AsyncPrefetcherImpl : public PrefetcherImpl {
             m_product_cache.m_impl->removeRawProduct(product_id);
             *vsize = data.size();
             std::memcpy(value, data.data(), *vsize);
+        } else if(m_product_cache.m_impl->checkNotFound(product_id)) {
+            // product was prefetched and is known not to exist
+            m_product_cache.m_impl->removeRawProduct(product_id);
+            return false;
         } else {
             // product not found, check if prefetching is pending
             if(m_products_loading.count(product_id.m_key) == 0) {
@@ -250,6 +327,7 @@ class AsyncPrefetcherImpl : public PrefetcherImpl {
                     return true;
                 } else{
                     // product not found
+                    m_product_cache.m_impl->removeRawProduct(product_id);
                     return false;
                 }
             }
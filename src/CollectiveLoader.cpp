@@ -0,0 +1,117 @@
+/*
+ * (C) 2026 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#include <limits>
+#include <algorithm>
+#include "hepnos/CollectiveLoader.hpp"
+#include "hepnos/Exception.hpp"
+
+namespace hepnos {
+
+/**
+ * @brief Broadcasts a buffer of any size (MPI_Bcast takes an int count).
+ */
+static void bcastBuffer(char* data, size_t size, int root, MPI_Comm comm) {
+    const size_t max_chunk = std::numeric_limits<int>::max();
+    for(size_t offset = 0; offset < size; offset += max_chunk) {
+        int count = (int)std::min(max_chunk, size - offset);
+        if(MPI_Bcast(data + offset, count, MPI_BYTE, root, comm) != MPI_SUCCESS)
+            throw Exception("MPI_Bcast failed in CollectiveLoader");
+    }
+}
+
+static constexpr uint64_t s_not_found = 0;
+static constexpr uint64_t s_found     = 1;
+static constexpr uint64_t s_error     = 2;
+
+/**
+ * @brief Throws on all the processes if the root failed to load the product.
+ */
+static void checkError(uint64_t status, const std::string& error) {
+    if(status != s_error) return;
+    if(!error.empty())
+        throw Exception(error);
+    throw Exception("Collective load failed on the root process");
+}
+
+CollectiveLoader::CollectiveLoader(const RawStorage& source, MPI_Comm comm, int root)
+: m_source(source)
+, m_comm(comm)
+, m_root(root) {}
+
+bool CollectiveLoader::valid() const {
+    return m_source.valid();
+}
+
+ProductID CollectiveLoader::storeRawData(const ProductID& key, const char* value, size_t vsize) {
+    (void)key;
+    (void)value;
+    (void)vsize;
+    throw Exception("CollectiveLoader cannot be used to store products");
+}
+
+bool CollectiveLoader::loadRawData(const ProductID& key, std::string& buffer) const {
+    int rank;
+    MPI_Comm_rank(m_comm, &rank);
+    // header[0] indicates whether the product was found, header[1] is its size
+    uint64_t header[2] = { s_not_found, 0 };
+    std::string error;
+    if(rank == m_root) {
+        try {
+            header[0] = m_source.loadRawData(key, buffer) ? s_found : s_not_found;
+            // chunks are fetched by the root only, the other processes
+            // receive the assembled product
+            if(header[0] == s_found)
+                m_source.assembleChunks(key, buffer);
+            header[1] = header[0] == s_found ? buffer.size() : 0;
+        } catch(const std::exception& ex) {
+            header[0] = s_error;
+            error = ex.what();
+        }
+    }
+    MPI_Bcast(header, 2, MPI_UINT64_T, m_root, m_comm);
+    checkError(header[0], error);
+    if(header[0] == s_not_found) return false;
+    if(rank != m_root)
+        buffer.resize(header[1]);
+    bcastBuffer(const_cast<char*>(buffer.data()), header[1], m_root, m_comm);
+    return true;
+}
+
+bool CollectiveLoader::loadRawData(const ProductID& key, char* value, size_t* vsize) const {
+    int rank;
+    MPI_Comm_rank(m_comm, &rank);
+    // the root loads with the smallest buffer size of all the processes
+    // so that the outcome it broadcasts holds on every process
+    uint64_t capacity = *vsize;
+    MPI_Allreduce(MPI_IN_PLACE, &capacity, 1, MPI_UINT64_T, MPI_MIN, m_comm);
+    uint64_t header[2] = { s_not_found, 0 };
+    std::string error;
+    if(rank == m_root) {
+        try {
+            size_t size = capacity;
+            header[0] = m_source.loadRawData(key, value, &size) ? s_found : s_not_found;
+            header[1] = header[0] == s_found ? size : 0;
+        } catch(const std::exception& ex) {
+            header[0] = s_error;
+            error = ex.what();
+        }
+    }
+    MPI_Bcast(header, 2, MPI_UINT64_T, m_root, m_comm);
+    checkError(header[0], error);
+    if(header[0] == s_not_found) return false;
+    *vsize = header[1];
+    bcastBuffer(value, header[1], m_root, m_comm);
+    return true;
+}
+
+bool CollectiveLoader::assembleChunks(const ProductID& key, std::string& buffer) const {
+    (void)key;
+    (void)buffer;
+    // loadRawData already broadcasts assembled products
+    return false;
+}
+
+}
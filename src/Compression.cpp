@@ -0,0 +1,75 @@
+/*
+ * (C) 2026 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#include "hepnos/Compression.hpp"
+#include "hepnos/Exception.hpp"
+#include <zlib.h>
+#include <cstring>
+#include <limits>
+
+namespace hepnos {
+
+namespace {
+
+/**
+ * @brief Header placed in front of compressed products.
+ */
+struct CompressionHeader {
+    char     magic[7];
+    uint8_t  codec;
+    uint64_t size; // size of the uncompressed data
+};
+
+constexpr char s_compression_magic[7] = { 'H', 'E', 'P', 'n', 'O', 'S', 'Z' };
+
+}
+
+bool compressBuffer(CompressionCodec codec, const char* data, size_t size, std::string& output) {
+    int level;
+    switch(codec) {
+        case CompressionCodec::ZLIB_FAST: level = Z_BEST_SPEED; break;
+        case CompressionCodec::ZLIB_BEST: level = Z_BEST_COMPRESSION; break;
+        default: return false;
+    }
+    if(size > std::numeric_limits<uLong>::max()) return false;
+    CompressionHeader header;
+    std::memcpy(header.magic, s_compression_magic, sizeof(header.magic));
+    header.codec = static_cast<uint8_t>(codec);
+    header.size  = size;
+    uLongf bound = compressBound(size);
+    output.resize(sizeof(header) + bound);
+    char* out = const_cast<char*>(output.data());
+    std::memcpy(out, &header, sizeof(header));
+    int ret = compress2(reinterpret_cast<Bytef*>(out + sizeof(header)), &bound,
+                        reinterpret_cast<const Bytef*>(data), size, level);
+    if(ret != Z_OK || sizeof(header) + bound >= size)
+        return false;
+    output.resize(sizeof(header) + bound);
+    return true;
+}
+
+bool isCompressedBuffer(const char* data, size_t size) {
+    if(size < sizeof(CompressionHeader)) return false;
+    if(std::memcmp(data, s_compression_magic, sizeof(s_compression_magic)) != 0) return false;
+    auto codec = static_cast<uint8_t>(data[sizeof(s_compression_magic)]);
+    return codec == static_cast<uint8_t>(CompressionCodec::ZLIB_FAST)
+        || codec == static_cast<uint8_t>(CompressionCodec::ZLIB_BEST);
+}
+
+void decompressBuffer(const char* data, size_t size, std::string& output) {
+    if(!isCompressedBuffer(data, size))
+        throw Exception("Buffer is not a compressed product");
+    CompressionHeader header;
+    std::memcpy(&header, data, sizeof(header));
+    output.resize(header.size);
+    uLongf dest_size = header.size;
+    int ret = uncompress(reinterpret_cast<Bytef*>(const_cast<char*>(output.data())), &dest_size,
+                         reinterpret_cast<const Bytef*>(data + sizeof(header)),
+                         size - sizeof(header));
+    if(ret != Z_OK || dest_size != header.size)
+        throw Exception("Could not decompress product (corrupted data)");
+}
+
+}
@@ -4,15 +4,18 @@
  * See COPYRIGHT in top-level directory.
  */
 #include <vector>
+#include <algorithm>
 #include <functional>
 #include <iostream>
 #include "hepnos/Exception.hpp"
 #include "hepnos/DataStore.hpp"
 #include "hepnos/DataSet.hpp"
 #include "hepnos/WriteBatch.hpp"
+#include "hepnos/EventDispatcher.hpp"
 #include "DataSetImpl.hpp"
 #include "DataStoreImpl.hpp"
 #include "WriteBatchImpl.hpp"
+#include "EventDispatcherImpl.hpp"
 
 namespace hepnos {
 
@@ -72,6 +75,279 @@ bool DataStore::loadRawData(const ProductID& productID, char* data, size_t* size
     return m_impl->loadRawProduct(productID, data, size);
 }
 
+void DataStore::loadRawDataPacked(const std::vector<ProductID>& productIDs,
+        const std::function<void(const ProductID&, bool, std::string&&)>& callback) const {
+    if(!m_impl) {
+        throw Exception("Calling DataStore member function on an invalid DataStore object");
+    }
+    m_impl->loadRawProductsPacked(productIDs, callback);
+}
+
+std::shared_ptr<void> DataStore::findResolvedProduct(const ProductID& productID,
+                                                           const std::type_info& info) const {
+    if(!m_impl) {
+        throw Exception("Calling DataStore member function on an invalid DataStore object");
+    }
+    auto key = productID.m_key + info.name();
+    std::unique_lock<tl::mutex> lock(m_impl->m_resolved_products_mtx);
+    auto it = m_impl->m_resolved_products.find(key);
+    if(it != m_impl->m_resolved_products.end()) {
+        auto product = it->second.lock();
+        if(product) return product;
+    }
+    // wait for the product if it is being prefetched
+    auto pending = m_impl->m_pending_ptr_targets.find(key);
+    if(pending == m_impl->m_pending_ptr_targets.end())
+        return nullptr;
+    auto done = pending->second;
+    lock.unlock();
+    done->wait();
+    lock.lock();
+    it = m_impl->m_resolved_products.find(key);
+    if(it == m_impl->m_resolved_products.end())
+        return nullptr;
+    return it->second.lock();
+}
+
+std::shared_ptr<void> DataStore::addResolvedProduct(const ProductID& productID,
+                                                          const std::type_info& info,
+                                                          std::shared_ptr<void> product) const {
+    if(!m_impl) {
+        throw Exception("Calling DataStore member function on an invalid DataStore object");
+    }
+    auto key = productID.m_key + info.name();
+    std::unique_lock<tl::mutex> lock(m_impl->m_resolved_products_mtx);
+    auto& products = m_impl->m_resolved_products;
+    auto& entry = products[key];
+    auto existing = entry.lock();
+    if(existing) return existing;
+    entry = product;
+    if(products.size() > m_impl->m_resolved_products_sweep) {
+        // products are only kept while in use, remove the expired entries
+        for(auto it = products.begin(); it != products.end();) {
+            if(it->second.expired()) it = products.erase(it);
+            else ++it;
+        }
+        m_impl->m_resolved_products_sweep = std::max<size_t>(1024, 2*products.size());
+    }
+    return product;
+}
+
+void DataStore::enablePtrPrefetching(size_t capacity) {
+    if(!m_impl) {
+        throw Exception("Calling DataStore member function on an invalid DataStore object");
+    }
+    std::unique_lock<tl::mutex> lock(m_impl->m_resolved_products_mtx);
+    m_impl->m_ptr_prefetch_capacity = capacity;
+    auto& prefetched = m_impl->m_prefetched_ptr_targets;
+    while(prefetched.size() > capacity)
+        prefetched.pop_front();
+}
+
+void DataStore::disablePtrPrefetching() {
+    enablePtrPrefetching(0);
+}
+
+bool DataStore::ptrPrefetchingEnabled() const {
+    return m_impl && m_impl->m_ptr_prefetch_capacity != 0;
+}
+
+void DataStore::prefetchPtrTargets(const std::vector<PtrTarget>& targets) const {
+    if(!ptrPrefetchingEnabled()) return;
+    auto impl = m_impl;
+    auto done = std::make_shared<tl::eventual<void>>();
+    auto to_load = std::make_shared<std::unordered_map<std::string, const PtrTarget*>>();
+    std::vector<ProductID> product_ids;
+    {
+        std::unique_lock<tl::mutex> lock(impl->m_resolved_products_mtx);
+        for(auto& target : targets) {
+            if(product_ids.size() == impl->m_ptr_prefetch_capacity) break;
+            auto key = target.key + target.type->name();
+            if(impl->m_pending_ptr_targets.count(key)) continue;
+            auto it = impl->m_resolved_products.find(key);
+            if(it != impl->m_resolved_products.end() && !it->second.expired()) continue;
+            if(!to_load->emplace(target.key, &target).second) continue;
+            impl->m_pending_ptr_targets.emplace(key, done);
+            product_ids.push_back(ProductID(target.key));
+        }
+    }
+    if(product_ids.empty()) return;
+    // the targets are copied since the ULT may run after the archive is gone
+    auto copies = std::make_shared<std::vector<PtrTarget>>();
+    copies->reserve(to_load->size());
+    for(auto& entry : *to_load) {
+        copies->push_back(*entry.second);
+        entry.second = &copies->back();
+    }
+    std::weak_ptr<DataStoreImpl> weak_impl = impl;
+    auto ids = std::make_shared<std::vector<ProductID>>(std::move(product_ids));
+    auto prefetch = [weak_impl, ids, to_load, copies, done]() {
+        auto impl = weak_impl.lock();
+        if(!impl) {
+            done->set_value();
+            return;
+        }
+        DataStore datastore(impl);
+        std::vector<std::shared_ptr<void>> prefetched;
+        try {
+            datastore.loadRawDataPacked(*ids,
+                [&](const ProductID& productID, bool found, std::string&& data) {
+                    if(!found) return;
+                    auto& target = *(*to_load)[productID.m_key];
+                    try {
+                        auto product = target.decode(datastore, productID, data);
+                        if(product)
+                            prefetched.push_back(
+                                datastore.addResolvedProduct(productID, *target.type, std::move(product)));
+                    } catch(...) {}
+                });
+        } catch(...) {}
+        {
+            std::unique_lock<tl::mutex> lock(impl->m_resolved_products_mtx);
+            auto& kept = impl->m_prefetched_ptr_targets;
+            for(auto& product : prefetched)
+                kept.push_back(std::move(product));
+            while(kept.size() > impl->m_ptr_prefetch_capacity)
+                kept.pop_front();
+            for(auto& entry : *to_load)
+                impl->m_pending_ptr_targets.erase(entry.first + entry.second->type->name());
+        }
+        done->set_value();
+    };
+    // if no ULT can be spawned (e.g. outside of an Argobots execution stream),
+    // prefetch inline rather than leave the targets pending forever
+    try {
+        auto pools = tl::xstream::self().get_main_pools(1);
+        if(pools.size() == 1) {
+            pools[0].make_thread(prefetch, tl::anonymous());
+            return;
+        }
+    } catch(...) {}
+    prefetch();
+}
+
+void DataStore::enableNodeCache(MPI_Comm comm, size_t capacity) {
+    if(!m_impl) {
+        throw Exception("Calling DataStore member function on an invalid DataStore object");
+    }
+    m_impl->m_node_cache = std::make_unique<NodeProductCacheImpl>(comm, capacity);
+}
+
+void DataStore::disableNodeCache() {
+    if(!m_impl) {
+        throw Exception("Calling DataStore member function on an invalid DataStore object");
+    }
+    m_impl->m_node_cache.reset();
+}
+
+void DataStore::collectNodeCacheStatistics(NodeCacheStatistics& stats) const {
+    if(!m_impl) {
+        throw Exception("Calling DataStore member function on an invalid DataStore object");
+    }
+    stats = NodeCacheStatistics();
+    auto& cache = m_impl->m_node_cache;
+    if(!cache) return;
+    stats.hits    = cache->numHits();
+    stats.misses  = cache->numMisses();
+    stats.entries = cache->numEntries();
+}
+
+void DataStore::setCompression(const std::string& label, CompressionCodec codec, size_t threshold) {
+    setCompressionImpl(label, std::string(), codec, threshold);
+}
+
+void DataStore::setCompressionImpl(const std::string& label, const std::string& type,
+                                   CompressionCodec codec, size_t threshold) {
+    if(!m_impl) {
+        throw Exception("Calling DataStore member function on an invalid DataStore object");
+    }
+    auto key = label + "#" + type;
+    if(codec == CompressionCodec::NONE && type.empty()) {
+        m_impl->m_compression.erase(key);
+        return;
+    }
+    // a type-specific NONE entry is kept to override label-wide settings
+    auto& options = m_impl->m_compression[key];
+    options.codec     = codec;
+    options.threshold = threshold;
+}
+
+void DataStore::setChunkSize(size_t chunk_size) {
+    if(!m_impl) {
+        throw Exception("Calling DataStore member function on an invalid DataStore object");
+    }
+    m_impl->m_chunk_size = chunk_size;
+}
+
+size_t DataStore::getChunkSize() const {
+    if(!m_impl) {
+        throw Exception("Calling DataStore member function on an invalid DataStore object");
+    }
+    return m_impl->m_chunk_size;
+}
+
+ProductID DataStore::makeChunkID(const ProductID& productID, uint64_t index) {
+    return DataStoreImpl::makeChunkID(productID, index);
+}
+
+void DataStore::loadChunks(const ProductID& productID, const ChunkManifest& manifest,
+                           size_t first, size_t last, char* output) const {
+    m_impl->loadChunks(productID, manifest, first, last, output);
+}
+
+bool DataStore::assembleChunks(const ProductID& productID, std::string& buffer) const {
+    if(!m_impl) {
+        throw Exception("Calling DataStore member function on an invalid DataStore object");
+    }
+    return m_impl->assembleChunks(productID, buffer);
+}
+
+void DataStore::setPackingImpl(const std::string& label, const std::string& type, bool enable) {
+    if(!m_impl) {
+        throw Exception("Calling DataStore member function on an invalid DataStore object");
+    }
+    if(enable)
+        m_impl->m_packed_products.insert(label + "#" + type);
+    else
+        m_impl->m_packed_products.erase(label + "#" + type);
+}
+
+void DataStore::collectPackingStatistics(PackingStatistics& stats) const {
+    if(!m_impl) {
+        throw Exception("Calling DataStore member function on an invalid DataStore object");
+    }
+    stats.hits         = m_impl->m_packed_hits;
+    stats.misses       = m_impl->m_packed_misses;
+    stats.record_loads = m_impl->m_packed_record_loads;
+}
+
+bool DataStore::compressProduct(const ProductID& productID, const std::string& data,
+                                std::string& compressed) const {
+    auto& settings = m_impl->m_compression;
+    if(settings.empty()) return false;
+    auto& key = productID.m_key;
+    if(key.size() <= sizeof(ItemDescriptor)) return false;
+    // the key is the item descriptor followed by "label#type"
+    auto label_and_type = key.substr(sizeof(ItemDescriptor));
+    auto it = settings.find(label_and_type);
+    if(it == settings.end()) {
+        auto p = label_and_type.find('#');
+        if(p == std::string::npos) return false;
+        it = settings.find(label_and_type.substr(0, p+1));
+        if(it == settings.end()) return false;
+    }
+    auto& options = it->second;
+    if(data.size() < options.threshold) return false;
+    return compressBuffer(options.codec, data.data(), data.size(), compressed);
+}
+
+void DataStore::decompressProduct(std::string& buffer) {
+    if(!isCompressedBuffer(buffer.data(), buffer.size())) return;
+    std::string output;
+    decompressBuffer(buffer.data(), buffer.size(), output);
+    buffer.swap(output);
+}
+
 size_t DataStore::numTargets(const ItemType& type) const {
     if(!m_impl) {
         throw Exception("Calling DataStore member function on an invalid DataStore object");
@@ -80,11 +356,12 @@ size_t DataStore::numTargets(const ItemType& type) const {
 }
 
 void DataStore::createQueueImpl(const std::string& name,
-                                const std::string& type_name) {
+                                const std::string& type_name,
+                                const QueueOptions& options) {
     if(!m_impl) {
         throw Exception("Calling DataStore member function on an invalid DataStore object");
     }
-    m_impl->createQueue(name, type_name);
+    m_impl->createQueue(name, type_name, options);
 }
 
 Queue DataStore::openQueueImpl(const std::string& name,
@@ -105,5 +382,38 @@ void DataStore::destroyQueueImpl(const std::string& name,
     return m_impl->destroyQueue(name, type_name);
 }
 
+EventDispatcher DataStore::createEventDispatcher(const std::string& name,
+                                                 const DataSet& dataset,
+                                                 const EventDispatcherOptions& options) {
+    if(!m_impl) {
+        throw Exception("Calling DataStore member function on an invalid DataStore object");
+    }
+    auto impl = std::make_shared<EventDispatcherImpl>(m_impl, name);
+    impl->create(options);
+    try {
+        impl->submitEvents(dataset, options.batchSize);
+    } catch(...) {
+        // don't leave a dispatcher that will never be sealed
+        try {
+            impl->destroy();
+        } catch(...) {}
+        throw;
+    }
+    return EventDispatcher(std::move(impl));
+}
+
+EventDispatcher DataStore::openEventDispatcher(const std::string& name) {
+    if(!m_impl) {
+        throw Exception("Calling DataStore member function on an invalid DataStore object");
+    }
+    return EventDispatcher(std::make_shared<EventDispatcherImpl>(m_impl, name));
 }
 
+void DataStore::destroyEventDispatcher(const std::string& name) {
+    if(!m_impl) {
+        throw Exception("Calling DataStore member function on an invalid DataStore object");
+    }
+    EventDispatcherImpl(m_impl, name).destroy();
+}
+
+}
@@ -10,6 +10,8 @@
 #include <fstream>
 #include <unordered_set>
 #include <unordered_map>
+#include <deque>
+#include <atomic>
 #include <functional>
 #include <iostream>
 #include <nlohmann/json.hpp>
@@ -27,6 +29,8 @@
 #include "DataSetImpl.hpp"
 #include "ItemImpl.hpp"
 #include "QueueImpl.hpp"
+#include "NodeProductCacheImpl.hpp"
+#include "hepnos/PackedProduct.hpp"
 
 namespace hepnos {
 
@@ -53,6 +57,7 @@ inline size_t object_size(const hepnos::UUID& uuid) {
 
 struct DistributedDBInfo {
     std::vector<DatabaseAdaptor>  dbs;
+    std::vector<std::string>      addrs; // address of the server of each database
     struct ch_placement_instance* chi = nullptr;
 };
 
@@ -78,6 +83,22 @@ class DataStoreImpl : public std::enable_shared_from_this<DataStoreImpl> {
     DistributedDBInfo                            m_event_dbs;    // list of Yokan databases for Events
     DistributedDBInfo                            m_product_dbs;  // list of Yokan databases for Products
     QueueProvidersInfo                           m_queue_providers; // list of provider handles to QueueProviders
+    std::vector<tl::provider_handle>             m_dispatch_providers; // list of provider handles to EventDispatchProviders
+    std::unique_ptr<NodeProductCacheImpl>        m_node_cache;   // product cache shared within the node (optional)
+    std::unordered_map<std::string,CompressionOptions> m_compression; // compression options per "label#type" or "label#"
+    size_t                                       m_chunk_size = 0; // products larger than this are chunked (0 to disable)
+    std::unordered_set<std::string>              m_packed_products; // "label#type" of products that may be packed per SubRun
+    mutable tl::mutex                            m_packed_cache_mtx;
+    mutable std::deque<std::pair<std::string, std::shared_ptr<const std::string>>> m_packed_cache; // recently loaded packed records
+    mutable std::atomic<size_t>                  m_packed_hits{0};         // per-event loads served by a packed record in memory
+    mutable std::atomic<size_t>                  m_packed_misses{0};       // per-event loads of packable products not found in a packed record
+    mutable std::atomic<size_t>                  m_packed_record_loads{0}; // packed records loaded from the product databases
+    mutable tl::mutex                            m_resolved_products_mtx;
+    mutable std::unordered_map<std::string, std::weak_ptr<void>> m_resolved_products; // products resolved by Ptrs, per key and type
+    mutable size_t                               m_resolved_products_sweep = 1024; // size above which expired entries are removed
+    size_t                                       m_ptr_prefetch_capacity = 0; // prefetched Ptr targets kept alive (0 to disable prefetching)
+    mutable std::deque<std::shared_ptr<void>>    m_prefetched_ptr_targets; // prefetched Ptr targets, oldest first
+    mutable std::unordered_map<std::string, std::shared_ptr<tl::eventual<void>>> m_pending_ptr_targets; // Ptr targets being prefetched
 
     tl::remote_procedure                         m_queue_create_rpc;
     tl::remote_procedure                         m_queue_open_rpc;
@@ -86,6 +107,16 @@ class DataStoreImpl : public std::enable_shared_from_this<DataStoreImpl> {
     tl::remote_procedure                         m_queue_push_rpc;
     tl::remote_procedure                         m_queue_pop_rpc;
     tl::remote_procedure                         m_queue_empty_rpc;
+    tl::remote_procedure                         m_queue_push_many_rpc;
+    tl::remote_procedure                         m_queue_pop_many_rpc;
+    tl::remote_procedure                         m_queue_push_bulk_rpc;
+
+    tl::remote_procedure                         m_dispatch_create_rpc;
+    tl::remote_procedure                         m_dispatch_destroy_rpc;
+    tl::remote_procedure                         m_dispatch_submit_rpc;
+    tl::remote_procedure                         m_dispatch_acquire_rpc;
+    tl::remote_procedure                         m_dispatch_complete_rpc;
+    tl::remote_procedure                         m_dispatch_renew_rpc;
 
     DataStoreImpl()
     {}
@@ -122,13 +153,23 @@ class DataStoreImpl : public std::enable_shared_from_this<DataStoreImpl> {
             throw Exception("Could not create Yokan client: "+std::string(ex.what()));
         }
         // initialize RPCs for Queue management
-        m_queue_create_rpc  = m_engine.define("hepnos_create_queue");
-        m_queue_open_rpc    = m_engine.define("hepnos_open_queue");
-        m_queue_close_rpc   = m_engine.define("hepnos_close_queue");
-        m_queue_destroy_rpc = m_engine.define("hepnos_destroy_queue");
-        m_queue_push_rpc    = m_engine.define("hepnos_queue_push");
-        m_queue_pop_rpc     = m_engine.define("hepnos_queue_pop");
-        m_queue_empty_rpc   = m_engine.define("hepnos_queue_empty");
+        m_queue_create_rpc    = m_engine.define("hepnos_create_queue");
+        m_queue_open_rpc      = m_engine.define("hepnos_open_queue");
+        m_queue_close_rpc     = m_engine.define("hepnos_close_queue");
+        m_queue_destroy_rpc   = m_engine.define("hepnos_destroy_queue");
+        m_queue_push_rpc      = m_engine.define("hepnos_queue_push");
+        m_queue_pop_rpc       = m_engine.define("hepnos_queue_pop");
+        m_queue_empty_rpc     = m_engine.define("hepnos_queue_empty");
+        m_queue_push_many_rpc = m_engine.define("hepnos_queue_push_many");
+        m_queue_pop_many_rpc  = m_engine.define("hepnos_queue_pop_many");
+        m_queue_push_bulk_rpc = m_engine.define("hepnos_queue_push_bulk");
+        // initialize RPCs for event dispatchers
+        m_dispatch_create_rpc   = m_engine.define("hepnos_dispatch_create");
+        m_dispatch_destroy_rpc  = m_engine.define("hepnos_dispatch_destroy");
+        m_dispatch_submit_rpc   = m_engine.define("hepnos_dispatch_submit");
+        m_dispatch_acquire_rpc  = m_engine.define("hepnos_dispatch_acquire");
+        m_dispatch_complete_rpc = m_engine.define("hepnos_dispatch_complete");
+        m_dispatch_renew_rpc    = m_engine.define("hepnos_dispatch_renew");
         // parse hepnosFile
         json serviceConfig;
         {
@@ -149,6 +190,7 @@ class DataStoreImpl : public std::enable_shared_from_this<DataStoreImpl> {
         //       "events" : [ ... ],
         //       "products" : [ ... ]
         //       "queues" : [ ... ]
+        //       "dispatchers" : [ ... ]
         //   },
         //   "address2" : ...
         // }
@@ -168,7 +210,7 @@ class DataStoreImpl : public std::enable_shared_from_this<DataStoreImpl> {
                 }
             }
 
-            auto populate_db_entries = [this, &addr](const json& cfg, DistributedDBInfo& db_info) {
+            auto populate_db_entries = [this, &addr, &address](const json& cfg, DistributedDBInfo& db_info) {
                 for(auto& entry : cfg) {
                     auto provider_id = entry["provider_id"].get<uint16_t>();
                     auto database_id_str = entry["database_id"].get<std::string>();
@@ -176,6 +218,7 @@ class DataStoreImpl : public std::enable_shared_from_this<DataStoreImpl> {
                     yk_database_id_from_string(database_id_str.c_str(), &database_id);
                     db_info.dbs.push_back(
                         m_yokan_client.makeDatabaseHandle(addr.get_addr(), provider_id, database_id));
+                    db_info.addrs.push_back(address);
                 }
             };
 
@@ -189,6 +232,10 @@ class DataStoreImpl : public std::enable_shared_from_this<DataStoreImpl> {
                 auto provider_id = entry.get<uint16_t>();
                 m_queue_providers.qps.emplace_back(addr, provider_id);
             }
+            for(auto& entry : nodeConfig["dispatchers"]) {
+                auto provider_id = entry.get<uint16_t>();
+                m_dispatch_providers.emplace_back(addr, provider_id);
+            }
         }
         // Build ch-placement instances
         if (m_dataset_dbs.dbs.empty()) {
@@ -233,6 +280,11 @@ class DataStoreImpl : public std::enable_shared_from_this<DataStoreImpl> {
         m_subrun_dbs.dbs.clear();
         m_event_dbs.dbs.clear();
         m_product_dbs.dbs.clear();
+        m_dataset_dbs.addrs.clear();
+        m_run_dbs.addrs.clear();
+        m_subrun_dbs.addrs.clear();
+        m_event_dbs.addrs.clear();
+        m_product_dbs.addrs.clear();
         m_queue_providers.qps.clear();
         m_yokan_client = yokan::Client();
         if(m_dataset_dbs.chi) ch_placement_finalize(m_dataset_dbs.chi);
@@ -242,6 +294,7 @@ class DataStoreImpl : public std::enable_shared_from_this<DataStoreImpl> {
         if(m_product_dbs.chi) ch_placement_finalize(m_product_dbs.chi);
         if(m_queue_providers.chi) ch_placement_finalize(m_queue_providers.chi);
         m_queue_providers.qps.clear();
+        m_dispatch_providers.clear();
         m_addrs.clear();
         if(m_engine_initialized) m_engine.finalize();
         m_engine_initialized = false;
@@ -299,10 +352,36 @@ class DataStoreImpl : public std::enable_shared_from_this<DataStoreImpl> {
         return result;
     }
 
+    /**
+     * @brief Suffix appended to the key of a chunked product,
+     * followed by the chunk index, to form the key of a chunk.
+     */
+    static constexpr const char* s_chunk_suffix = "\0HCHUNK";
+    static constexpr size_t s_chunk_suffix_size = 8;
+
+    static ProductID makeChunkID(const ProductID& productID, uint64_t index) {
+        ProductID result = productID;
+        result.m_key.append(s_chunk_suffix, s_chunk_suffix_size);
+        result.m_key.append(reinterpret_cast<const char*>(&index), sizeof(index));
+        return result;
+    }
+
+    static bool isChunkKey(const char* key, size_t size) {
+        constexpr size_t suffix_size = s_chunk_suffix_size + sizeof(uint64_t);
+        return size > sizeof(ItemDescriptor) + suffix_size
+            && std::memcmp(key + size - suffix_size, s_chunk_suffix, s_chunk_suffix_size) == 0;
+    }
+
     long unsigned computeProductDbIndex(const ProductID& productID) const {
         // hash the name to get the provider id
         long unsigned db_idx = 0;
         uint64_t hash;
+        if(isChunkKey(productID.m_key.data(), productID.m_key.size())) {
+            // chunks are spread across databases using their whole key
+            hash = hashString(productID.m_key.data(), productID.m_key.size());
+            ch_placement_find_closest(m_product_dbs.chi, hash, 1, &db_idx);
+            return db_idx;
+        }
         // we are taking only the dataset+run+subrun part of the productID
         hash = hashString(productID.m_key.c_str(), SubRunDescriptorLength);
         ch_placement_find_closest(m_product_dbs.chi, hash, 1, &db_idx);
@@ -317,8 +396,43 @@ class DataStoreImpl : public std::enable_shared_from_this<DataStoreImpl> {
         return m_product_dbs.dbs[index];
     }
 
+    /**
+     * @brief Returns the host part of a Mercury address
+     * (e.g. "10.0.0.1" for "ofi+tcp;ofi_rxm://10.0.0.1:1234").
+     */
+    static std::string hostOfAddress(const std::string& address) {
+        auto pos = address.find("://");
+        auto host = pos == std::string::npos ? address : address.substr(pos+3);
+        auto colon = host.rfind(':');
+        if(colon != std::string::npos)
+            host.resize(colon);
+        return host;
+    }
+
+    /**
+     * @brief Returns the indices of the product databases whose server
+     * runs on the same node as this process, that is, whose address has
+     * the same host as ours or uses shared memory.
+     */
+    std::vector<uint64_t> colocatedProductDatabases() const {
+        std::vector<uint64_t> result;
+        auto self_host = hostOfAddress(static_cast<std::string>(m_engine.self()));
+        for(size_t i = 0; i < m_product_dbs.addrs.size(); i++) {
+            const auto& address = m_product_dbs.addrs[i];
+            if(address.compare(0, 5, "na+sm") == 0
+            || hostOfAddress(address) == self_host)
+                result.push_back(i);
+        }
+        return result;
+    }
+
     bool loadRawProduct(const ProductID& key,
                         std::string& data) const {
+        bool use_node_cache = m_node_cache && NodeProductCacheImpl::accepts(key);
+        if(use_node_cache && m_node_cache->loadRawProduct(key, data))
+            return true;
+        if(loadPackedRawProduct(key, data))
+            return true;
         // find out which DB to access
         auto& db =  locateProductDb(key);
         // read the value
@@ -344,11 +458,27 @@ class DataStoreImpl : public std::enable_shared_from_this<DataStoreImpl> {
                 throw Exception("yokan::Database::get(): "+std::string(ex.what()));
             }
         }
+        if(use_node_cache)
+            m_node_cache->storeRawProduct(key, data.data(), data.size());
         return true;
     }
 
     bool loadRawProduct(const ProductID& key,
                         char* value, size_t* vsize) const {
+        bool use_node_cache = m_node_cache && NodeProductCacheImpl::accepts(key);
+        bool found = false;
+        if(use_node_cache && m_node_cache->loadRawProduct(key, value, vsize, found))
+            return found;
+        {
+            std::string data;
+            if(loadPackedRawProduct(key, data)) {
+                if(data.size() > *vsize)
+                    return false;
+                *vsize = data.size();
+                if(*vsize) std::memcpy(value, data.data(), *vsize);
+                return true;
+            }
+        }
         // find out which DB to access
         auto& db =  locateProductDb(key);
         try {
@@ -361,11 +491,248 @@ class DataStoreImpl : public std::enable_shared_from_this<DataStoreImpl> {
             else
                 throw Exception("yokan::Database::get(): "+std::string(ex.what()));
         }
+        if(use_node_cache)
+            m_node_cache->storeRawProduct(key, value, *vsize);
+        return true;
+    }
+
+    /**
+     * @brief Loads a batch of products. The ProductIDs are grouped by
+     * product database so that each database is accessed with a single
+     * lengthPacked/getPacked pair. The callback is invoked once per
+     * product with a flag indicating whether the product was found.
+     */
+    void loadRawProductsPacked(const std::vector<ProductID>& product_ids,
+            const std::function<void(const ProductID&, bool, std::string&&)>& callback) const {
+        if(product_ids.empty()) return;
+        // group the products by database index
+        std::unordered_map<long unsigned, std::vector<size_t>> groups;
+        for(size_t i = 0; i < product_ids.size(); i++) {
+            if(m_node_cache && NodeProductCacheImpl::accepts(product_ids[i])) {
+                std::string data;
+                if(m_node_cache->loadRawProduct(product_ids[i], data)) {
+                    callback(product_ids[i], true, std::move(data));
+                    continue;
+                }
+            }
+            {
+                std::string data;
+                if(loadPackedRawProduct(product_ids[i], data)) {
+                    callback(product_ids[i], true, std::move(data));
+                    continue;
+                }
+            }
+            groups[computeProductDbIndex(product_ids[i])].push_back(i);
+        }
+        std::string         packed_keys;
+        std::vector<size_t> key_sizes;
+        std::vector<size_t> value_sizes;
+        std::vector<char>   value_buffer;
+        for(const auto& group : groups) {
+            auto& db = getProductDatabase(group.first);
+            auto& indices = group.second;
+            size_t count = indices.size();
+            packed_keys.resize(0);
+            key_sizes.resize(0);
+            for(auto i : indices) {
+                const auto& key = product_ids[i].m_key;
+                packed_keys.append(key);
+                key_sizes.push_back(key.size());
+            }
+            value_sizes.assign(count, 0);
+            try {
+                db.lengthPacked(count, packed_keys.data(),
+                                key_sizes.data(), value_sizes.data());
+                size_t buffer_size = 0;
+                for(auto s : value_sizes) {
+                    if(s <= YOKAN_LAST_VALID_SIZE) buffer_size += s;
+                }
+                if(buffer_size != 0) {
+                    value_buffer.resize(buffer_size);
+                    db.getPacked(count, packed_keys.data(), key_sizes.data(),
+                                 buffer_size, value_buffer.data(), value_sizes.data());
+                }
+            } catch(yokan::Exception& ex) {
+                throw Exception("yokan::Database::getPacked(): "+std::string(ex.what()));
+            }
+            size_t offset = 0;
+            for(size_t j = 0; j < count; j++) {
+                const auto& product_id = product_ids[indices[j]];
+                auto s = value_sizes[j];
+                if(s == YOKAN_SIZE_TOO_SMALL) {
+                    // the value changed size between the two calls,
+                    // fall back to loading it individually
+                    std::string data;
+                    bool found = loadRawProduct(product_id, data);
+                    callback(product_id, found, std::move(data));
+                } else if(s > YOKAN_LAST_VALID_SIZE) {
+                    callback(product_id, false, std::string());
+                } else {
+                    if(m_node_cache && NodeProductCacheImpl::accepts(product_id))
+                        m_node_cache->storeRawProduct(product_id, value_buffer.data()+offset, s);
+                    callback(product_id, true, std::string(value_buffer.data()+offset, s));
+                    offset += s;
+                }
+            }
+        }
+    }
+
+    void loadChunks(const ProductID& productID, const ChunkManifest& manifest,
+                    size_t first, size_t last, char* output) const {
+        last = std::min<size_t>(last, manifest.num_chunks);
+        if(first >= last) return;
+        // one user-level thread per product database
+        std::unordered_map<long unsigned, std::vector<size_t>> groups;
+        for(size_t i = first; i < last; i++)
+            groups[computeProductDbIndex(makeChunkID(productID, i))].push_back(i);
+        std::vector<tl::managed<tl::thread>> threads;
+        std::vector<Exception> exceptions(groups.size());
+        std::vector<char>      oks(groups.size(), 1);
+        auto pool = tl::xstream::self().get_main_pools(1)[0];
+        size_t j = 0;
+        for(auto& group : groups) {
+            auto& chunks = group.second;
+            char* ok = &oks[j];
+            Exception* ex = &exceptions[j];
+            threads.push_back(pool.make_thread([this, &productID, &manifest, &chunks, first, output, ok, ex]() {
+                for(auto i : chunks) {
+                    size_t size = manifest.chunkSize(i);
+                    size_t vsize = size;
+                    char* chunk = output + (i - first)*manifest.chunk_size;
+                    try {
+                        if(!loadRawProduct(makeChunkID(productID, i), chunk, &vsize) || vsize != size) {
+                            *ok = 0;
+                            *ex = Exception("Missing or corrupted chunk of a chunked product");
+                            return;
+                        }
+                    } catch(const Exception& e) {
+                        *ok = 0;
+                        *ex = e;
+                        return;
+                    }
+                }
+            }));
+            j += 1;
+        }
+        for(auto& t : threads) {
+            t->join();
+        }
+        for(size_t k = 0; k < oks.size(); k++) {
+            if(!oks[k]) throw exceptions[k];
+        }
+    }
+
+    bool assembleChunks(const ProductID& productID, std::string& buffer) const {
+        ChunkManifest manifest;
+        if(!ChunkManifest::read(buffer.data(), buffer.size(), manifest))
+            return false;
+        std::string content(manifest.total_size, '\0');
+        loadChunks(productID, manifest, 0, manifest.num_chunks, const_cast<char*>(content.data()));
+        buffer.swap(content);
+        return true;
+    }
+
+    /**
+     * @brief Number of packed records kept in memory, so that loading
+     * the products of consecutive events doesn't reload the record.
+     */
+    static constexpr size_t s_packed_cache_size = 8;
+
+    /**
+     * @brief Computes the key of the packed record in which the product
+     * of an Event may be found, if products of this label and type may be
+     * packed (see DataStore::setPacking).
+     *
+     * @return false if the product cannot be packed.
+     */
+    bool packedRecordID(const ProductID& key, ProductID& packed_key, EventNumber& event) const {
+        if(m_packed_products.empty()) return false;
+        auto& k = key.m_key;
+        if(k.size() <= sizeof(ItemDescriptor)) return false;
+        ItemDescriptor descriptor;
+        std::memcpy(&descriptor, k.data(), sizeof(descriptor));
+        if(descriptor.event == InvalidEventNumber) return false;
+        auto label_and_type = k.substr(sizeof(descriptor));
+        if(m_packed_products.count(label_and_type) == 0) return false;
+        auto p = label_and_type.find('#');
+        event = descriptor.event;
+        descriptor.event = InvalidEventNumber;
+        auto type = packedTypeName(label_and_type.substr(p+1));
+        packed_key = makeProductID(descriptor, label_and_type.data(), p,
+                                   type.data(), type.size());
         return true;
     }
 
+    /**
+     * @brief Looks for the product of an Event in the packed record of its
+     * SubRun. This is tried before the Event's own key, so a product found
+     * in the packed record takes precedence whether or not the record is
+     * already in memory, and loading a packed product for consecutive
+     * events costs neither a reload of the record nor a failed lookup.
+     */
+    bool loadPackedRawProduct(const ProductID& key, std::string& data) const {
+        ProductID packed_key;
+        EventNumber event;
+        if(!packedRecordID(key, packed_key, event)) return false;
+        bool in_memory = false;
+        auto record = loadPackedRecord(packed_key, &in_memory);
+        if(!record || !unpackProduct(record->data(), record->size(), event, data)) {
+            m_packed_misses += 1;
+            return false;
+        }
+        if(in_memory) m_packed_hits += 1;
+        return true;
+    }
+
+    std::shared_ptr<const std::string> loadPackedRecord(const ProductID& packed_key,
+                                                        bool* in_memory = nullptr) const {
+        {
+            std::unique_lock<tl::mutex> lock(m_packed_cache_mtx);
+            for(auto& entry : m_packed_cache) {
+                if(entry.first == packed_key.m_key) {
+                    if(in_memory) *in_memory = true;
+                    return entry.second;
+                }
+            }
+        }
+        // records that don't exist are not remembered,
+        // since they may be stored later on
+        auto record = std::make_shared<std::string>();
+        if(!loadRawProduct(packed_key, *record))
+            return nullptr;
+        m_packed_record_loads += 1;
+        assembleChunks(packed_key, *record);
+        DataStore::decompressProduct(*record);
+        if(!isPackedRecord(record->data(), record->size()))
+            return nullptr;
+        std::unique_lock<tl::mutex> lock(m_packed_cache_mtx);
+        m_packed_cache.emplace_back(packed_key.m_key, record);
+        if(m_packed_cache.size() > s_packed_cache_size)
+            m_packed_cache.pop_front();
+        return record;
+    }
+
+    /**
+     * @brief Removes a product that is being stored from the node cache
+     * and from the packed records in memory, so that the processes of this
+     * node do not read its previous value.
+     */
+    void invalidateCachedProduct(const ProductID& key) const {
+        if(m_node_cache && NodeProductCacheImpl::accepts(key))
+            m_node_cache->invalidate(key);
+        if(m_packed_products.empty()) return;
+        std::unique_lock<tl::mutex> lock(m_packed_cache_mtx);
+        for(auto it = m_packed_cache.begin(); it != m_packed_cache.end(); it++) {
+            if(it->first == key.m_key) {
+                m_packed_cache.erase(it);
+                break;
+            }
+        }
+    }
+
     ProductID storeRawProduct(const ProductID& key,
                               const char* value, size_t vsize) const {
+        invalidateCachedProduct(key);
         // find out which DB to access
         auto& db =  locateProductDb(key);
         // read the value
@@ -393,9 +760,10 @@ class DataStoreImpl : public std::enable_shared_from_this<DataStoreImpl> {
         std::vector<ProductID> result;
         std::vector<char> buffer(10240);
         std::vector<size_t> ksizes(128);
+        ProductID last = prefix;
         try {
             while(true) {
-                const auto& start = result.empty() ? prefix : result.back();
+                const auto& start = last;
                 db.listKeysPacked(start.m_key.data(), start.m_key.size(),
                                   prefix.m_key.data(), prefix.m_key.size(),
                                   128, buffer.data(), buffer.size(), ksizes.data());
@@ -409,8 +777,10 @@ class DataStoreImpl : public std::enable_shared_from_this<DataStoreImpl> {
                     if(ksizes[i] == YOKAN_SIZE_TOO_SMALL) {
                         break;
                     }
-                    result.emplace_back();
-                    result.back().m_key.assign(buffer.data()+offset, ksizes[i]);
+                    last.m_key.assign(buffer.data()+offset, ksizes[i]);
+                    // chunks of chunked products are not products
+                    if(!isChunkKey(last.m_key.data(), last.m_key.size()))
+                        result.push_back(last);
                     offset += ksizes[i];
                 }
                 if(done)
@@ -681,6 +1051,44 @@ class DataStoreImpl : public std::enable_shared_from_this<DataStoreImpl> {
         return result.size();
     }
 
+    /**
+     * @brief Fills the result vector with up to maxItems items contained
+     * in the provided parent item (e.g. the first Events of a SubRun).
+     * Returns the number of items read.
+     */
+    size_t firstItems(
+            const ItemType& item_type,
+            const ItemType& prefix_type,
+            const std::shared_ptr<ItemImpl>& parent,
+            std::vector<std::shared_ptr<ItemImpl>>& result,
+            size_t maxItems) const {
+        const ItemDescriptor& start_key = parent->m_descriptor;
+        // using only the prefix as start key makes the listing
+        // start before the first item of the parent
+        auto prefix_size = ItemImpl::descriptorSize(prefix_type);
+        auto& db = locateItemDb(item_type, start_key);
+        std::vector<ItemDescriptor> descriptors(maxItems);
+        std::vector<size_t> ksizes(maxItems, sizeof(ItemDescriptor));
+        size_t numItems = 0;
+        try {
+            db.listKeysPacked(&start_key, prefix_size,
+                         &start_key, prefix_size,
+                         maxItems, descriptors.data(), descriptors.size()*sizeof(ItemDescriptor),
+                         ksizes.data());
+            for(numItems=0; numItems < maxItems; numItems++) {
+                if(ksizes[numItems] > YOKAN_LAST_VALID_SIZE) break;
+            }
+        } catch(yokan::Exception& ex) {
+            throw Exception("yokan::Database::listKeysPacked(): "+std::string(ex.what()));
+        }
+        result.resize(0);
+        result.reserve(numItems);
+        for(size_t i = 0; i < numItems; i++) {
+            result.push_back(std::make_shared<ItemImpl>(parent->m_datastore, descriptors[i]));
+        }
+        return numItems;
+    }
+
     /**
      * @brief Checks if a particular Run/SubRun/Event exists.
      */
@@ -754,56 +1162,135 @@ class DataStoreImpl : public std::enable_shared_from_this<DataStoreImpl> {
         return true;
     }
 
-    void createQueue(const std::string& name,
-                     const std::string& type_name) {
+    /**
+     * @brief Places the shards of a queue on the QueueProviders.
+     * Shard 0 is on the provider the full name of the queue hashes to.
+     */
+    std::vector<QueueShard> placeQueueShards(const std::string& full_name,
+                                             size_t num_shards) const {
         if(!m_queue_providers.chi) {
             throw Exception("No queue provider found in HEPnOS deployment");
         }
-        auto full_name = name + "#" + type_name;
-        long unsigned db_idx = 0;
+        size_t num_placed = std::min(num_shards, m_queue_providers.qps.size());
+        std::vector<long unsigned> indices(num_placed);
         auto hash = hashString(full_name.c_str(), full_name.size());
-        ch_placement_find_closest(m_queue_providers.chi, hash, 1, &db_idx);
-        const auto& provider_handle = m_queue_providers.qps[db_idx];
+        ch_placement_find_closest(m_queue_providers.chi, hash, num_placed, indices.data());
+        std::vector<QueueShard> shards;
+        shards.reserve(num_shards);
+        for(size_t i = 0; i < num_shards; i++) {
+            shards.push_back(QueueShard{
+                i == 0 ? full_name : full_name + "#" + std::to_string(i),
+                m_queue_providers.qps[indices[i % num_placed]] });
+        }
+        return shards;
+    }
+
+    /**
+     * @brief Returns the EventDispatchProvider managing the dispatcher
+     * with the specified name.
+     */
+    const tl::provider_handle& locateDispatchProvider(const std::string& name) const {
+        if(m_dispatch_providers.empty()) {
+            throw Exception("No event dispatch provider found in HEPnOS deployment");
+        }
+        auto hash = hashString(name.c_str(), name.size());
+        return m_dispatch_providers[hash % m_dispatch_providers.size()];
+    }
+
+    static std::string queueConfig(const QueueOptions& options) {
+        json config;
+        config["num_shards"] = options.num_shards;
+        config["sharding"]   = static_cast<int>(options.sharding);
+        config["max_items"]  = options.max_items;
+        config["max_bytes"]  = options.max_bytes;
+        config["spill"]      = options.spill;
+        config["persistent"] = options.persistent;
+        return config.dump();
+    }
+
+    static QueueOptions parseQueueConfig(const std::string& config_str) {
+        QueueOptions options;
+        // queues created by older versions have no configuration
+        if(config_str.empty()) return options;
+        try {
+            auto config = json::parse(config_str);
+            options.num_shards = config.value("num_shards", options.num_shards);
+            options.sharding   = static_cast<QueueShardingPolicy>(
+                config.value("sharding", static_cast<int>(options.sharding)));
+            options.max_items  = config.value("max_items", options.max_items);
+            options.max_bytes  = config.value("max_bytes", options.max_bytes);
+            options.spill      = config.value("spill", options.spill);
+            options.persistent = config.value("persistent", options.persistent);
+        } catch(const std::exception& ex) {
+            throw Exception("Invalid queue configuration: "s + ex.what());
+        }
+        if(options.num_shards == 0)
+            throw Exception("Invalid queue configuration: no shard");
+        return options;
+    }
+
+    /**
+     * @brief Retrieves the options of a queue from its first shard.
+     */
+    QueueOptions openQueueShard(const QueueShard& shard, bool as_producer) const {
         std::pair<bool, std::string> response
-            = m_queue_create_rpc.on(provider_handle)(full_name);
+            = m_queue_open_rpc.on(shard.m_provider_handle)(shard.m_name, as_producer);
         if(!response.first)
             throw Exception(response.second);
+        return parseQueueConfig(response.second);
+    }
+
+    void createQueue(const std::string& name,
+                     const std::string& type_name,
+                     const QueueOptions& options) {
+        if(options.num_shards == 0) {
+            throw Exception("A queue needs at least one shard");
+        }
+        auto full_name = name + "#" + type_name;
+        auto config = queueConfig(options);
+        for(const auto& shard : placeQueueShards(full_name, options.num_shards)) {
+            std::pair<bool, std::string> response
+                = m_queue_create_rpc.on(shard.m_provider_handle)(shard.m_name, config);
+            if(!response.first)
+                throw Exception(response.second);
+        }
     }
 
     std::shared_ptr<QueueImpl> openQueue(const std::string& name,
                                          const std::string& type_name,
                                          const std::type_info& type_info,
                                          QueueAccessMode mode) {
-        if(!m_queue_providers.chi) {
-            throw Exception("No queue provider found in HEPnOS deployment");
-        }
         auto full_name = name + "#" + type_name;
-        long unsigned db_idx = 0;
-        auto hash = hashString(full_name.c_str(), full_name.size());
-        ch_placement_find_closest(m_queue_providers.chi, hash, 1, &db_idx);
-        const auto& provider_handle = m_queue_providers.qps[db_idx];
-        std::pair<bool, std::string> response
-            = m_queue_open_rpc.on(provider_handle)(full_name, static_cast<bool>(mode));
-        if(!response.first)
-            throw Exception(response.second);
+        bool as_producer = static_cast<bool>(mode);
+        auto shards = placeQueueShards(full_name, 1);
+        auto options = openQueueShard(shards[0], as_producer);
+        if(options.num_shards > 1) {
+            shards = placeQueueShards(full_name, options.num_shards);
+            // producers are registered with every shard so that each
+            // shard knows when all of them have closed the queue
+            if(as_producer) {
+                for(size_t i = 1; i < shards.size(); i++)
+                    openQueueShard(shards[i], true);
+            }
+        }
         return std::make_shared<QueueImpl>(
-            shared_from_this(), full_name, type_info, mode, provider_handle);
+            shared_from_this(), full_name, type_info, mode,
+            std::move(shards), options.sharding);
     }
 
     void destroyQueue(const std::string& name,
                       const std::string& type_name) {
-        if(!m_queue_providers.chi) {
-            throw Exception("No queue provider found in HEPnOS deployment");
-        }
         auto full_name = name + "#" + type_name;
-        long unsigned db_idx = 0;
-        auto hash = hashString(full_name.c_str(), full_name.size());
-        ch_placement_find_closest(m_queue_providers.chi, hash, 1, &db_idx);
-        const auto& provider_handle = m_queue_providers.qps[db_idx];
-        std::pair<bool, std::string> response
-            = m_queue_destroy_rpc.on(provider_handle)(full_name);
-        if(!response.first)
-            throw Exception(response.second);
+        auto shards = placeQueueShards(full_name, 1);
+        auto options = openQueueShard(shards[0], false);
+        if(options.num_shards > 1)
+            shards = placeQueueShards(full_name, options.num_shards);
+        for(const auto& shard : shards) {
+            std::pair<bool, std::string> response
+                = m_queue_destroy_rpc.on(shard.m_provider_handle)(shard.m_name);
+            if(!response.first)
+                throw Exception(response.second);
+        }
     }
 };
 
@@ -0,0 +1,412 @@
+/*
+ * (C) 2026 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#include <bedrock/AbstractServiceFactory.hpp>
+#include <thallium.hpp>
+#include <thallium/serialization/stl/string.hpp>
+#include <thallium/serialization/stl/pair.hpp>
+#include <thallium/serialization/stl/tuple.hpp>
+#include <thallium/serialization/stl/vector.hpp>
+#include <unordered_map>
+#include <algorithm>
+#include <memory>
+#include <mutex>
+#include <deque>
+#include <tuple>
+#include <vector>
+#include <string>
+#include <ctime>
+
+namespace tl = thallium;
+
+namespace hepnos {
+
+/**
+ * The EventDispatchProvider hands out batches of events to any client
+ * that asks for them, so that independent processes (that don't share
+ * an MPI communicator) can share the processing of a DataSet. Batches
+ * are opaque to the provider: they are filled with EventDescriptors by
+ * the client that creates a dispatcher. A client acquiring a batch gets
+ * a lease on it, and a batch whose lease expires before the client
+ * reports it as completed is handed out again.
+ */
+class EventDispatchProvider : public tl::provider<EventDispatchProvider> {
+
+    enum class batch_state : uint8_t {
+        PENDING,
+        LEASED,
+        COMPLETED
+    };
+
+    struct dispatcher_t {
+
+        tl::mutex                            m_mutex;
+        tl::condition_variable               m_cv; // signaled when batches are added, completed, or sealed
+        double                               m_lease_duration = 0.0;
+        std::vector<std::string>             m_batches;
+        std::vector<batch_state>             m_states;
+        std::deque<uint64_t>                 m_pending; // batches to hand out
+        std::unordered_map<uint64_t, double> m_leases;  // leased batches and the time their lease expires
+        size_t                               m_num_completed = 0;
+        bool                                 m_sealed = false; // no more batches will be submitted
+        bool                                 m_destroyed = false; // the dispatcher was removed from the provider
+
+        bool finished() const {
+            return m_sealed && m_num_completed == m_batches.size();
+        }
+
+        /**
+         * Puts the batches with an expired lease back
+         * at the front of the pending batches.
+         */
+        void reclaimExpiredLeases(double now) {
+            for(auto it = m_leases.begin(); it != m_leases.end();) {
+                if(it->second <= now) {
+                    m_states[it->first] = batch_state::PENDING;
+                    m_pending.push_front(it->first);
+                    it = m_leases.erase(it);
+                } else {
+                    ++it;
+                }
+            }
+        }
+
+        /**
+         * Marks the dispatcher as destroyed and wakes up
+         * the clients waiting for a batch.
+         */
+        void destroy() {
+            {
+                std::unique_lock<tl::mutex> lock(m_mutex);
+                m_destroyed = true;
+            }
+            m_cv.notify_all();
+        }
+
+        double nextExpiration() const {
+            double t = -1.0;
+            for(const auto& lease : m_leases)
+                if(t < 0.0 || lease.second < t) t = lease.second;
+            return t;
+        }
+    };
+
+    /**
+     * Current time, in seconds, on the clock used by condition variables.
+     */
+    static double now() {
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        return ts.tv_sec + ts.tv_nsec*1e-9;
+    }
+
+    public:
+
+    EventDispatchProvider(const tl::engine& engine, uint16_t provider_id,
+                          const tl::pool& pool)
+    : tl::provider<EventDispatchProvider>(engine, provider_id)
+    , m_rpc_create(define("hepnos_dispatch_create", &EventDispatchProvider::createDispatcher, pool))
+    , m_rpc_destroy(define("hepnos_dispatch_destroy", &EventDispatchProvider::destroyDispatcher, pool))
+    , m_rpc_submit(define("hepnos_dispatch_submit", &EventDispatchProvider::submitBatches, pool))
+    , m_rpc_acquire(define("hepnos_dispatch_acquire", &EventDispatchProvider::acquireBatch, pool))
+    , m_rpc_complete(define("hepnos_dispatch_complete", &EventDispatchProvider::completeBatch, pool))
+    , m_rpc_renew(define("hepnos_dispatch_renew", &EventDispatchProvider::renewLease, pool))
+    {}
+
+    ~EventDispatchProvider() {
+        m_rpc_create.deregister();
+        m_rpc_destroy.deregister();
+        m_rpc_submit.deregister();
+        m_rpc_acquire.deregister();
+        m_rpc_complete.deregister();
+        m_rpc_renew.deregister();
+    }
+
+    private:
+
+    void createDispatcher(const tl::request& req,
+                          const std::string& name,
+                          double lease_duration) {
+        auto result = std::make_pair<bool, std::string>(true, "");
+        m_dispatchers_lock.wrlock();
+        std::unique_lock<tl::rwlock> guard(m_dispatchers_lock, std::adopt_lock);
+        if(lease_duration <= 0.0) {
+            result.first = false;
+            result.second = "Invalid lease duration";
+        } else if(m_dispatchers.find(name) != m_dispatchers.end()) {
+            result.first = false;
+            result.second = "Event dispatcher already exists";
+        } else {
+            auto dispatcher = std::make_shared<dispatcher_t>();
+            dispatcher->m_lease_duration = lease_duration;
+            m_dispatchers.emplace(name, std::move(dispatcher));
+        }
+        req.respond(result);
+    }
+
+    /**
+     * Returns the dispatcher with the given name, or nullptr. The map
+     * lock is released on return, so that handlers waiting on a
+     * dispatcher don't prevent others from being created or destroyed.
+     */
+    std::shared_ptr<dispatcher_t> findDispatcher(const std::string& name) {
+        m_dispatchers_lock.rdlock();
+        std::unique_lock<tl::rwlock> guard(m_dispatchers_lock, std::adopt_lock);
+        auto it = m_dispatchers.find(name);
+        if(it == m_dispatchers.end()) return nullptr;
+        return it->second;
+    }
+
+    void destroyDispatcher(const tl::request& req,
+                           const std::string& name) {
+        std::shared_ptr<dispatcher_t> dispatcher;
+        {
+            m_dispatchers_lock.wrlock();
+            std::unique_lock<tl::rwlock> guard(m_dispatchers_lock, std::adopt_lock);
+            auto it = m_dispatchers.find(name);
+            if(it != m_dispatchers.end()) {
+                dispatcher = std::move(it->second);
+                m_dispatchers.erase(it);
+            }
+        }
+        auto result = std::make_pair<bool, std::string>(true, "");
+        if(!dispatcher) {
+            result.first = false;
+            result.second = "Event dispatcher does not exist";
+        } else {
+            dispatcher->destroy();
+        }
+        req.respond(result);
+    }
+
+    /**
+     * Adds batches to hand out. seal indicates that these are the
+     * last batches, after which clients are told that all the batches
+     * have been processed once they are completed.
+     */
+    void submitBatches(const tl::request& req,
+                       const std::string& name,
+                       std::vector<std::string>& batches,
+                       bool seal) {
+        auto result = std::make_pair<bool, std::string>(true, "");
+        auto found = findDispatcher(name);
+        if(!found) {
+            result.first = false;
+            result.second = "Event dispatcher does not exist";
+        } else {
+            auto& dispatcher = *found;
+            {
+                std::unique_lock<tl::mutex> lock(dispatcher.m_mutex);
+                if(dispatcher.m_destroyed) {
+                    result.first = false;
+                    result.second = "Event dispatcher was destroyed";
+                } else if(dispatcher.m_sealed) {
+                    result.first = false;
+                    result.second = "Event dispatcher does not accept batches anymore";
+                } else {
+                    for(auto& batch : batches) {
+                        dispatcher.m_pending.push_back(dispatcher.m_batches.size());
+                        dispatcher.m_states.push_back(batch_state::PENDING);
+                        dispatcher.m_batches.push_back(std::move(batch));
+                    }
+                    dispatcher.m_sealed = seal;
+                }
+            }
+            dispatcher.m_cv.notify_all();
+        }
+        req.respond(result);
+    }
+
+    /**
+     * Responds with the id and content of a batch, leased to the caller,
+     * and the duration of the lease. If no batch is available, waits until
+     * one is submitted or a lease expires. A false flag with an empty
+     * message means that all the batches have been completed. Waiting
+     * clients get an error if the dispatcher is destroyed.
+     */
+    void acquireBatch(const tl::request& req,
+                      const std::string& name) {
+        std::tuple<bool, uint64_t, std::string, double> result{true, 0, "", 0.0};
+        auto found = findDispatcher(name);
+        if(!found) {
+            std::get<0>(result) = false;
+            std::get<2>(result) = "Event dispatcher does not exist";
+            req.respond(result);
+            return;
+        }
+        auto& dispatcher = *found;
+        std::unique_lock<tl::mutex> lock(dispatcher.m_mutex);
+        while(true) {
+            if(dispatcher.m_destroyed) {
+                std::get<0>(result) = false;
+                std::get<2>(result) = "Event dispatcher was destroyed";
+                break;
+            }
+            double t = now();
+            dispatcher.reclaimExpiredLeases(t);
+            // skip the batches completed by the holder of an expired lease
+            while(!dispatcher.m_pending.empty()
+               && dispatcher.m_states[dispatcher.m_pending.front()] != batch_state::PENDING)
+                dispatcher.m_pending.pop_front();
+            if(!dispatcher.m_pending.empty()) {
+                auto id = dispatcher.m_pending.front();
+                dispatcher.m_pending.pop_front();
+                dispatcher.m_states[id] = batch_state::LEASED;
+                dispatcher.m_leases[id] = t + dispatcher.m_lease_duration;
+                std::get<1>(result) = id;
+                std::get<2>(result) = dispatcher.m_batches[id];
+                std::get<3>(result) = dispatcher.m_lease_duration;
+                break;
+            }
+            if(dispatcher.finished()) {
+                std::get<0>(result) = false;
+                break;
+            }
+            double expiration = dispatcher.nextExpiration();
+            if(expiration < 0.0) {
+                dispatcher.m_cv.wait(lock);
+            } else {
+                struct timespec ts;
+                ts.tv_sec  = static_cast<time_t>(expiration);
+                ts.tv_nsec = static_cast<long>((expiration - ts.tv_sec)*1e9);
+                dispatcher.m_cv.wait_until(lock, &ts);
+            }
+        }
+        lock.unlock();
+        req.respond(result);
+    }
+
+    /**
+     * Marks a batch as completed. Completing a batch whose lease
+     * expired is accepted, as long as no other client completed it.
+     */
+    void completeBatch(const tl::request& req,
+                       const std::string& name,
+                       uint64_t id) {
+        auto result = std::make_pair<bool, std::string>(true, "");
+        auto found = findDispatcher(name);
+        if(!found) {
+            result.first = false;
+            result.second = "Event dispatcher does not exist";
+        } else {
+            auto& dispatcher = *found;
+            bool finished = false;
+            {
+                std::unique_lock<tl::mutex> lock(dispatcher.m_mutex);
+                if(id >= dispatcher.m_batches.size()) {
+                    result.first = false;
+                    result.second = "Invalid batch";
+                } else if(dispatcher.m_states[id] != batch_state::COMPLETED) {
+                    dispatcher.m_states[id] = batch_state::COMPLETED;
+                    dispatcher.m_leases.erase(id);
+                    std::string().swap(dispatcher.m_batches[id]);
+                    dispatcher.m_num_completed += 1;
+                    finished = dispatcher.finished();
+                }
+            }
+            if(finished)
+                dispatcher.m_cv.notify_all();
+        }
+        req.respond(result);
+    }
+
+    /**
+     * Extends the lease on a batch. A false flag with an empty message
+     * means that the lease had expired and the batch was handed out
+     * again or completed.
+     */
+    void renewLease(const tl::request& req,
+                    const std::string& name,
+                    uint64_t id) {
+        auto result = std::make_pair<bool, std::string>(true, "");
+        auto found = findDispatcher(name);
+        if(!found) {
+            result.first = false;
+            result.second = "Event dispatcher does not exist";
+        } else {
+            auto& dispatcher = *found;
+            std::unique_lock<tl::mutex> lock(dispatcher.m_mutex);
+            auto lease = dispatcher.m_leases.find(id);
+            if(lease == dispatcher.m_leases.end())
+                result.first = false;
+            else
+                lease->second = now() + dispatcher.m_lease_duration;
+        }
+        req.respond(result);
+    }
+
+    tl::remote_procedure m_rpc_create;
+    tl::remote_procedure m_rpc_destroy;
+    tl::remote_procedure m_rpc_submit;
+    tl::remote_procedure m_rpc_acquire;
+    tl::remote_procedure m_rpc_complete;
+    tl::remote_procedure m_rpc_renew;
+
+    std::unordered_map<std::string, std::shared_ptr<dispatcher_t>> m_dispatchers;
+    tl::rwlock                                                     m_dispatchers_lock;
+};
+
+}
+
+class HEPnOSEventDispatchProviderFactory : public bedrock::AbstractServiceFactory {
+
+    public:
+
+    HEPnOSEventDispatchProviderFactory() = default;
+
+    void *registerProvider(const bedrock::FactoryArgs &args) override {
+        auto engine = tl::engine(args.mid);
+        auto provider = new hepnos::EventDispatchProvider(
+            engine, args.provider_id, tl::pool(args.pool));
+        return static_cast<void *>(provider);
+    }
+
+    void deregisterProvider(void *p) override {
+        auto provider = static_cast<hepnos::EventDispatchProvider *>(p);
+        delete provider;
+    }
+
+    std::string getProviderConfig(void *p) override {
+        (void)p;
+        return "{}";
+    }
+
+    void *initClient(const bedrock::FactoryArgs& args) override {
+        (void)args;
+        return nullptr;
+    }
+
+    void finalizeClient(void *client) override {
+        (void)client;
+    }
+
+    std::string getClientConfig(void* c) override {
+        (void)c;
+        return "{}";
+    }
+
+    void *createProviderHandle(void *c, hg_addr_t address, uint16_t provider_id) override {
+        (void)c;
+        (void)address;
+        (void)provider_id;
+        return nullptr;
+    }
+
+    void destroyProviderHandle(void *providerHandle) override {
+        (void)providerHandle;
+    }
+
+    const std::vector<bedrock::Dependency> &getProviderDependencies() override {
+        static const std::vector<bedrock::Dependency> no_dependency;
+        return no_dependency;
+    }
+
+    const std::vector<bedrock::Dependency> &getClientDependencies() override {
+        static const std::vector<bedrock::Dependency> no_dependency;
+        return no_dependency;
+    }
+};
+
+BEDROCK_REGISTER_MODULE_FACTORY(hed, HEPnOSEventDispatchProviderFactory)
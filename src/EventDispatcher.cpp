@@ -0,0 +1,209 @@
+/*
+ * (C) 2026 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#include <memory>
+#include <string>
+#include <tuple>
+#include <cstring>
+#include <thallium.hpp>
+#include <thallium/serialization/stl/vector.hpp>
+#include <thallium/serialization/stl/tuple.hpp>
+#include "hepnos/DataStore.hpp"
+#include "hepnos/EventSet.hpp"
+#include "hepnos/EventDispatcher.hpp"
+#include "EventDispatcherImpl.hpp"
+#include "DataStoreImpl.hpp"
+
+namespace hepnos {
+
+/**
+ * @brief Number of batches sent per submit RPC when creating a dispatcher.
+ */
+static constexpr size_t s_batches_per_submit = 64;
+
+EventDispatcher::EventDispatcher() = default;
+EventDispatcher::EventDispatcher(const EventDispatcher&) = default;
+EventDispatcher::EventDispatcher(EventDispatcher&&) = default;
+EventDispatcher& EventDispatcher::operator=(const EventDispatcher&) = default;
+EventDispatcher& EventDispatcher::operator=(EventDispatcher&&) = default;
+EventDispatcher::~EventDispatcher() = default;
+
+EventDispatcher::EventDispatcher(std::shared_ptr<EventDispatcherImpl> impl)
+: m_impl(std::move(impl)) {}
+
+bool EventDispatcher::valid() const {
+    return m_impl && m_impl->m_datastore;
+}
+
+bool EventDispatcher::acquire(EventBatch& batch) {
+    if(!valid()) {
+        throw Exception("Calling EventDispatcher member function on an invalid EventDispatcher object");
+    }
+    auto& rpc = m_impl->m_datastore->m_dispatch_acquire_rpc;
+    std::tuple<bool, uint64_t, std::string, double> result;
+    try {
+        result = static_cast<decltype(result)>(
+            rpc.on(m_impl->m_provider_handle)(m_impl->m_name));
+    } catch(std::exception& e) {
+        throw Exception(e.what());
+    }
+    const auto& content = std::get<2>(result);
+    if(!std::get<0>(result)) {
+        if(content.empty())
+            return false;
+        else
+            throw Exception(content);
+    }
+    batch.id = std::get<1>(result);
+    m_impl->m_lease_duration = std::get<3>(result);
+    batch.events.clear();
+    batch.events.reserve(content.size() / EventDescriptorLength);
+    DataStore datastore(m_impl->m_datastore);
+    EventDescriptor descriptor;
+    for(size_t offset = 0; offset + EventDescriptorLength <= content.size();
+        offset += EventDescriptorLength) {
+        std::memcpy(descriptor.data, content.data() + offset, EventDescriptorLength);
+        batch.events.push_back(Event::fromDescriptor(datastore, descriptor, false));
+    }
+    return true;
+}
+
+void EventDispatcher::complete(const EventBatch& batch) {
+    if(!valid()) {
+        throw Exception("Calling EventDispatcher member function on an invalid EventDispatcher object");
+    }
+    auto& rpc = m_impl->m_datastore->m_dispatch_complete_rpc;
+    std::pair<bool, std::string> result;
+    try {
+        result = static_cast<decltype(result)>(
+            rpc.on(m_impl->m_provider_handle)(m_impl->m_name, batch.id));
+    } catch(std::exception& e) {
+        throw Exception(e.what());
+    }
+    if(!result.first)
+        throw Exception(result.second);
+}
+
+bool EventDispatcher::renew(const EventBatch& batch) {
+    if(!valid()) {
+        throw Exception("Calling EventDispatcher member function on an invalid EventDispatcher object");
+    }
+    auto& rpc = m_impl->m_datastore->m_dispatch_renew_rpc;
+    std::pair<bool, std::string> result;
+    try {
+        result = static_cast<decltype(result)>(
+            rpc.on(m_impl->m_provider_handle)(m_impl->m_name, batch.id));
+    } catch(std::exception& e) {
+        throw Exception(e.what());
+    }
+    if(!result.first && !result.second.empty())
+        throw Exception(result.second);
+    return result.first;
+}
+
+size_t EventDispatcher::process(const EventProcessingFn& function) {
+    size_t num_events = 0;
+    EventBatch batch;
+    while(acquire(batch)) {
+        // the lease is renewed between events once half of it is spent
+        double renew_interval = 0.5*m_impl->m_lease_duration;
+        double last_renewal = tl::timer::wtime();
+        bool leased = true;
+        for(const auto& event : batch.events) {
+            if(tl::timer::wtime() - last_renewal >= renew_interval) {
+                // a batch handed out again is left to its new holder
+                if(!(leased = renew(batch)))
+                    break;
+                last_renewal = tl::timer::wtime();
+            }
+            function(event);
+            num_events += 1;
+        }
+        if(leased)
+            complete(batch);
+    }
+    return num_events;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////
+// EventDispatcherImpl implementation
+////////////////////////////////////////////////////////////////////////////////////////////
+
+EventDispatcherImpl::EventDispatcherImpl(const std::shared_ptr<DataStoreImpl>& ds,
+                                         const std::string& name)
+: m_datastore(ds)
+, m_name(name)
+, m_provider_handle(ds->locateDispatchProvider(name)) {}
+
+void EventDispatcherImpl::create(const EventDispatcherOptions& options) {
+    auto& rpc = m_datastore->m_dispatch_create_rpc;
+    std::pair<bool, std::string> result;
+    try {
+        result = static_cast<decltype(result)>(
+            rpc.on(m_provider_handle)(m_name, options.leaseDuration));
+    } catch(std::exception& e) {
+        throw Exception(e.what());
+    }
+    if(!result.first)
+        throw Exception(result.second);
+}
+
+void EventDispatcherImpl::submitEvents(const DataSet& dataset, unsigned batch_size) {
+    if(batch_size == 0)
+        throw Exception("Invalid batch size");
+    std::vector<std::string> batches;
+    std::string batch;
+    batch.reserve(batch_size*EventDescriptorLength);
+    EventDescriptor descriptor;
+    DataStore datastore(m_datastore);
+    auto num_targets = datastore.numTargets(ItemType::EVENT);
+    for(size_t target = 0; target < num_targets; target++) {
+        auto events = dataset.events(target);
+        for(auto it = events.begin(); it != events.end(); it++) {
+            it->toDescriptor(descriptor);
+            batch.append(descriptor.data, EventDescriptorLength);
+            if(batch.size() < batch_size*EventDescriptorLength)
+                continue;
+            batches.push_back(std::move(batch));
+            batch = std::string();
+            batch.reserve(batch_size*EventDescriptorLength);
+            if(batches.size() == s_batches_per_submit) {
+                submit(batches, false);
+                batches.clear();
+            }
+        }
+    }
+    if(!batch.empty())
+        batches.push_back(std::move(batch));
+    submit(batches, true);
+}
+
+void EventDispatcherImpl::submit(std::vector<std::string>& batches, bool seal) {
+    auto& rpc = m_datastore->m_dispatch_submit_rpc;
+    std::pair<bool, std::string> result;
+    try {
+        result = static_cast<decltype(result)>(
+            rpc.on(m_provider_handle)(m_name, batches, seal));
+    } catch(std::exception& e) {
+        throw Exception(e.what());
+    }
+    if(!result.first)
+        throw Exception(result.second);
+}
+
+void EventDispatcherImpl::destroy() {
+    auto& rpc = m_datastore->m_dispatch_destroy_rpc;
+    std::pair<bool, std::string> result;
+    try {
+        result = static_cast<decltype(result)>(
+            rpc.on(m_provider_handle)(m_name));
+    } catch(std::exception& e) {
+        throw Exception(e.what());
+    }
+    if(!result.first)
+        throw Exception(result.second);
+}
+
+}
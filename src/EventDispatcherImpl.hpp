@@ -0,0 +1,59 @@
+/*
+ * (C) 2026 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#ifndef __HEPNOS_PRIVATE_EVENT_DISPATCHER_IMPL_H
+#define __HEPNOS_PRIVATE_EVENT_DISPATCHER_IMPL_H
+
+#include <memory>
+#include <string>
+#include <vector>
+#include <atomic>
+#include <thallium.hpp>
+#include "hepnos/DataSet.hpp"
+#include "hepnos/EventDispatcherOptions.hpp"
+
+namespace hepnos {
+
+class DataStoreImpl;
+
+namespace tl = thallium;
+
+class EventDispatcherImpl {
+
+    public:
+
+    std::shared_ptr<DataStoreImpl> m_datastore;
+    std::string                    m_name;
+    tl::provider_handle            m_provider_handle; // EventDispatchProvider managing the batches
+    std::atomic<double>            m_lease_duration{0.0}; // lease duration reported by the last acquire
+
+    EventDispatcherImpl(const std::shared_ptr<DataStoreImpl>& ds,
+                        const std::string& name);
+
+    /**
+     * @brief Creates the dispatcher in its provider.
+     */
+    void create(const EventDispatcherOptions& options);
+
+    /**
+     * @brief Lists the events of the DataSet and submits them in
+     * batches of batch_size events. The batches are submitted as they
+     * are filled, so clients can start processing them right away.
+     */
+    void submitEvents(const DataSet& dataset, unsigned batch_size);
+
+    /**
+     * @brief Destroys the dispatcher in its provider.
+     */
+    void destroy();
+
+    private:
+
+    void submit(std::vector<std::string>& batches, bool seal);
+};
+
+}
+
+#endif
@@ -0,0 +1,304 @@
+/*
+ * (C) 2026 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#ifndef __HEPNOS_NODE_PRODUCT_CACHE_IMPL_HPP
+#define __HEPNOS_NODE_PRODUCT_CACHE_IMPL_HPP
+
+#include <mpi.h>
+#include <atomic>
+#include <string>
+#include <cstring>
+#include <cstdint>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "hepnos/Exception.hpp"
+#include "hepnos/ProductID.hpp"
+#include "hepnos/ItemDescriptor.hpp"
+
+namespace hepnos {
+
+/**
+ * @brief Product cache shared by the processes running on the same node.
+ * The cache is a POSIX shared memory segment created by the first process
+ * of the node and mapped by all the others. It contains an open-addressing
+ * hash table of slots pointing to keys and values stored in a data area
+ * that is filled linearly. Entries are only ever added: the first process
+ * that loads a product from the DataStore publishes it, and the other
+ * processes read it from the segment instead of contacting the product
+ * databases. When the data area is full, new products are simply not cached.
+ *
+ * Only the products of DataSets, Runs, and SubRuns are cached, since these
+ * are the ones likely to be read by several processes. A product stored by
+ * a process of the node is invalidated, but products overwritten from other
+ * nodes are not, so the cache assumes that products shared across nodes are
+ * not modified while it is enabled.
+ *
+ * Values are copied out of the segment when loaded, since the callers
+ * deserialize products from buffers they own.
+ */
+class NodeProductCacheImpl {
+
+    enum SlotState : uint32_t {
+        SLOT_EMPTY   = 0,
+        SLOT_WRITING = 1,
+        SLOT_READY   = 2,
+        SLOT_INVALID = 3  // the product was overwritten
+    };
+
+    struct Slot {
+        std::atomic<uint32_t> state;
+        uint32_t              key_size;
+        uint64_t              hash;
+        uint64_t              offset;     // offset of the key in the data area
+        uint64_t              value_size; // the value follows the key
+    };
+
+    struct Header {
+        uint64_t              num_slots;
+        uint64_t              data_size;
+        std::atomic<uint64_t> data_used;
+        std::atomic<uint64_t> num_entries;
+    };
+
+    static constexpr size_t s_max_probes = 64;
+
+    void*   m_segment      = MAP_FAILED;
+    size_t  m_segment_size = 0;
+    Header* m_header       = nullptr;
+    Slot*   m_slots        = nullptr;
+    char*   m_data         = nullptr;
+
+    mutable std::atomic<size_t> m_hits{0};   // lookups of this process served by the cache
+    mutable std::atomic<size_t> m_misses{0}; // lookups of this process not served by the cache
+
+    static uint64_t hash(const std::string& key) {
+        // FNV-1a, so that all the processes agree on the hash
+        uint64_t h = 14695981039346656037ULL;
+        for(unsigned char c : key) {
+            h ^= c;
+            h *= 1099511628211ULL;
+        }
+        return h;
+    }
+
+    const Slot* find(const ProductID& product_id) const {
+        auto& key = product_id.m_key;
+        uint64_t h = hash(key);
+        uint64_t mask = m_header->num_slots - 1;
+        for(size_t i = 0; i < s_max_probes; i++) {
+            const Slot& slot = m_slots[(h + i) & mask];
+            uint32_t state = slot.state.load(std::memory_order_acquire);
+            if(state == SLOT_EMPTY) return nullptr;
+            if(state != SLOT_READY || slot.hash != h || slot.key_size != key.size())
+                continue;
+            if(std::memcmp(m_data + slot.offset, key.data(), key.size()) == 0)
+                return &slot;
+        }
+        return nullptr;
+    }
+
+    /**
+     * @brief Reserves size bytes in the data area and sets offset to
+     * their position. Returns false, without using any space, if they
+     * don't fit in the space left.
+     */
+    bool reserve(uint64_t size, uint64_t* offset) {
+        uint64_t used = m_header->data_used.load();
+        do {
+            if(size > m_header->data_size - used) return false;
+        } while(!m_header->data_used.compare_exchange_weak(used, used + size));
+        *offset = used;
+        return true;
+    }
+
+    public:
+
+    /**
+     * @brief Creates the cache, collectively across the processes of comm.
+     * comm is split into one communicator per node, the first process of each
+     * node creates a segment of the requested size, and the others map it.
+     */
+    NodeProductCacheImpl(MPI_Comm comm, size_t capacity) {
+        MPI_Comm node_comm;
+        MPI_Comm_split_type(comm, MPI_COMM_TYPE_SHARED, 0, MPI_INFO_NULL, &node_comm);
+        int rank;
+        MPI_Comm_rank(node_comm, &rank);
+        // one slot per KB of data, rounded to a power of 2
+        uint64_t num_slots = 1024;
+        while(num_slots < capacity/1024) num_slots *= 2;
+        m_segment_size = sizeof(Header) + num_slots*sizeof(Slot) + capacity;
+        char name[64];
+        int ok = 1;
+        if(rank == 0) {
+            std::snprintf(name, sizeof(name), "/hepnos-node-cache-%d", (int)getpid());
+            int fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0600);
+            if(fd == -1 || ftruncate(fd, m_segment_size) != 0) ok = 0;
+            if(ok) {
+                m_segment = mmap(nullptr, m_segment_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+                if(m_segment == MAP_FAILED) ok = 0;
+            }
+            if(fd != -1) close(fd);
+            if(ok) {
+                // the segment is zero-filled, so all the slots are SLOT_EMPTY
+                m_header = new (m_segment) Header;
+                m_header->num_slots = num_slots;
+                m_header->data_size = capacity;
+                m_header->data_used = 0;
+                m_header->num_entries = 0;
+            }
+        }
+        MPI_Bcast(&ok, 1, MPI_INT, 0, node_comm);
+        MPI_Bcast(name, sizeof(name), MPI_CHAR, 0, node_comm);
+        if(ok && rank != 0) {
+            int fd = shm_open(name, O_RDWR, 0600);
+            if(fd == -1) ok = 0;
+            else {
+                m_segment = mmap(nullptr, m_segment_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+                if(m_segment == MAP_FAILED) ok = 0;
+                close(fd);
+            }
+        }
+        MPI_Allreduce(MPI_IN_PLACE, &ok, 1, MPI_INT, MPI_MIN, node_comm);
+        // the segment is destroyed once all the processes have unmapped it
+        if(rank == 0 && m_segment != MAP_FAILED) shm_unlink(name);
+        MPI_Comm_free(&node_comm);
+        if(!ok) {
+            if(m_segment != MAP_FAILED) munmap(m_segment, m_segment_size);
+            m_segment = MAP_FAILED;
+            throw Exception("Could not create node-level shared product cache");
+        }
+        m_header = static_cast<Header*>(m_segment);
+        m_slots  = reinterpret_cast<Slot*>(m_header + 1);
+        m_data   = reinterpret_cast<char*>(m_slots + m_header->num_slots);
+    }
+
+    ~NodeProductCacheImpl() {
+        if(m_segment != MAP_FAILED)
+            munmap(m_segment, m_segment_size);
+    }
+
+    NodeProductCacheImpl(const NodeProductCacheImpl&) = delete;
+    NodeProductCacheImpl& operator=(const NodeProductCacheImpl&) = delete;
+
+    /**
+     * @brief Whether the product is one the cache should hold,
+     * i.e. it is not attached to an Event.
+     */
+    static bool accepts(const ProductID& product_id) {
+        auto& key = product_id.m_key;
+        if(key.size() < sizeof(ItemDescriptor)) return false;
+        ItemDescriptor descriptor;
+        std::memcpy(&descriptor, key.data(), sizeof(descriptor));
+        return descriptor.event == InvalidEventNumber;
+    }
+
+    /**
+     * @brief Returns a pointer to the cached value of the product
+     * (nullptr if it is not cached) and sets its size. The pointer
+     * remains valid for the lifetime of the cache.
+     */
+    const char* lookup(const ProductID& product_id, size_t* vsize) const {
+        auto slot = find(product_id);
+        if(!slot) {
+            m_misses += 1;
+            return nullptr;
+        }
+        m_hits += 1;
+        *vsize = slot->value_size;
+        return m_data + slot->offset + slot->key_size;
+    }
+
+    bool loadRawProduct(const ProductID& product_id, std::string& data) const {
+        size_t vsize;
+        auto value = lookup(product_id, &vsize);
+        if(!value) return false;
+        data.assign(value, vsize);
+        return true;
+    }
+
+    /**
+     * @brief Copies the cached product into the provided buffer. Returns
+     * false if the product is not cached. found is set to false if the
+     * product is cached but the buffer is too small for it.
+     */
+    bool loadRawProduct(const ProductID& product_id, char* value, size_t* vsize, bool& found) const {
+        size_t size;
+        auto data = lookup(product_id, &size);
+        if(!data) return false;
+        found = size <= *vsize;
+        if(found) {
+            *vsize = size;
+            if(size) std::memcpy(value, data, size);
+        }
+        return true;
+    }
+
+    /**
+     * @brief Publishes a product in the cache. Does nothing if the
+     * product is already cached or if there is no space left.
+     */
+    void storeRawProduct(const ProductID& product_id, const char* value, size_t vsize) {
+        auto& key = product_id.m_key;
+        uint64_t h = hash(key);
+        uint64_t mask = m_header->num_slots - 1;
+        for(size_t i = 0; i < s_max_probes; i++) {
+            Slot& slot = m_slots[(h + i) & mask];
+            uint32_t state = slot.state.load(std::memory_order_acquire);
+            if(state == SLOT_READY && slot.hash == h && slot.key_size == key.size()
+            && std::memcmp(m_data + slot.offset, key.data(), key.size()) == 0)
+                return;
+            if(state != SLOT_EMPTY) continue;
+            if(!slot.state.compare_exchange_strong(state, SLOT_WRITING, std::memory_order_acq_rel))
+                continue;
+            uint64_t size = key.size() + vsize;
+            uint64_t offset;
+            if(!reserve(size, &offset)) {
+                // give the slot back, smaller products may still fit
+                slot.state.store(SLOT_EMPTY, std::memory_order_release);
+                return;
+            }
+            std::memcpy(m_data + offset, key.data(), key.size());
+            if(vsize) std::memcpy(m_data + offset + key.size(), value, vsize);
+            slot.hash       = h;
+            slot.key_size   = key.size();
+            slot.offset     = offset;
+            slot.value_size = vsize;
+            slot.state.store(SLOT_READY, std::memory_order_release);
+            m_header->num_entries += 1;
+            return;
+        }
+    }
+
+    /**
+     * @brief Removes a product from the cache (e.g. because it is being
+     * overwritten). Its slot is left as a tombstone and the space used by
+     * its value is not reclaimed.
+     */
+    void invalidate(const ProductID& product_id) {
+        auto slot = const_cast<Slot*>(find(product_id));
+        if(!slot) return;
+        uint32_t state = SLOT_READY;
+        if(slot->state.compare_exchange_strong(state, SLOT_INVALID, std::memory_order_acq_rel))
+            m_header->num_entries -= 1;
+    }
+
+    size_t numEntries() const {
+        return m_header->num_entries;
+    }
+
+    size_t numHits() const {
+        return m_hits;
+    }
+
+    size_t numMisses() const {
+        return m_misses;
+    }
+};
+
+}
+
+#endif
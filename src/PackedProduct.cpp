@@ -0,0 +1,194 @@
+/*
+ * (C) 2026 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#include "hepnos/PackedProduct.hpp"
+#include "hepnos/Exception.hpp"
+#include <algorithm>
+#include <numeric>
+#include <cstring>
+#include <limits>
+
+namespace hepnos {
+
+namespace {
+
+struct PackedHeader {
+    uint32_t magic;
+    uint32_t reserved;
+    uint64_t count;
+    uint64_t prefix_size;
+    uint64_t value_size; // size of each product minus the prefix, or s_variable_size
+};
+
+constexpr uint32_t s_packed_magic = 0x4b415048; // "HPAK"
+constexpr uint64_t s_variable_size = std::numeric_limits<uint64_t>::max();
+
+/**
+ * @brief Read-only view of a packed record.
+ */
+struct PackedView {
+
+    PackedHeader header;
+    const char*  prefix  = nullptr;
+    const char*  events  = nullptr;
+    const char*  offsets = nullptr;
+    const char*  data    = nullptr;
+    size_t       data_size = 0;
+
+    bool parse(const char* record, size_t size) {
+        if(size < sizeof(header)) return false;
+        std::memcpy(&header, record, sizeof(header));
+        if(header.magic != s_packed_magic) return false;
+        size_t pos = sizeof(header);
+        auto take = [&](size_t n) -> const char* {
+            if(n > size - pos) throw Exception("Corrupted packed product record");
+            auto p = record + pos;
+            pos += n;
+            return p;
+        };
+        if(header.count > size / sizeof(uint64_t))
+            throw Exception("Corrupted packed product record");
+        prefix = take(header.prefix_size);
+        events = take(header.count*sizeof(uint64_t));
+        if(header.value_size == s_variable_size)
+            offsets = take((header.count+1)*sizeof(uint64_t));
+        data = record + pos;
+        data_size = size - pos;
+        if(!offsets && header.value_size*header.count != data_size)
+            throw Exception("Corrupted packed product record");
+        return true;
+    }
+
+    EventNumber event(size_t i) const {
+        uint64_t e;
+        std::memcpy(&e, events + i*sizeof(e), sizeof(e));
+        return e;
+    }
+
+    void product(size_t i, std::string& result) const {
+        size_t begin, end;
+        if(offsets) {
+            uint64_t o[2];
+            std::memcpy(o, offsets + i*sizeof(uint64_t), sizeof(o));
+            begin = o[0];
+            end   = o[1];
+            if(begin > end || end > data_size)
+                throw Exception("Corrupted packed product record");
+        } else {
+            begin = i*header.value_size;
+            end   = begin + header.value_size;
+        }
+        result.resize(header.prefix_size + end - begin);
+        char* out = const_cast<char*>(result.data());
+        if(header.prefix_size) std::memcpy(out, prefix, header.prefix_size);
+        if(end > begin) std::memcpy(out + header.prefix_size, data + begin, end - begin);
+    }
+};
+
+}
+
+void PackedProductBuilder::append(EventNumber event, const char* data, size_t size) {
+    m_events.push_back(event);
+    m_data.append(data, size);
+    m_offsets.push_back(m_data.size());
+}
+
+void PackedProductBuilder::clear() {
+    m_events.clear();
+    m_offsets.assign(1, 0);
+    m_data.clear();
+}
+
+void PackedProductBuilder::pack(std::string& record) const {
+    size_t count = m_events.size();
+    std::vector<size_t> order(count);
+    std::iota(order.begin(), order.end(), 0);
+    if(!std::is_sorted(m_events.begin(), m_events.end())) {
+        std::stable_sort(order.begin(), order.end(), [this](size_t a, size_t b) {
+            return m_events[a] < m_events[b];
+        });
+    }
+    for(size_t i = 1; i < count; i++) {
+        if(m_events[order[i]] == m_events[order[i-1]])
+            throw Exception("Event number added more than once to a packed product");
+    }
+    // find the bytes common to the start of all the products,
+    // and whether they all have the same size
+    size_t prefix_size = count ? m_offsets[1] : 0;
+    bool fixed_size = true;
+    for(size_t i = 1; i < count; i++) {
+        size_t size = m_offsets[i+1] - m_offsets[i];
+        if(size != m_offsets[1]) fixed_size = false;
+        prefix_size = std::min(prefix_size, size);
+        size_t j = 0;
+        while(j < prefix_size && m_data[m_offsets[i]+j] == m_data[j]) j++;
+        prefix_size = j;
+    }
+    PackedHeader header;
+    header.magic       = s_packed_magic;
+    header.reserved    = 0;
+    header.count       = count;
+    header.prefix_size = prefix_size;
+    header.value_size  = fixed_size ? (count ? m_offsets[1] - prefix_size : 0) : s_variable_size;
+
+    size_t data_size = m_data.size() - count*prefix_size;
+    record.clear();
+    record.reserve(sizeof(header) + prefix_size + count*sizeof(uint64_t)
+                 + (fixed_size ? 0 : (count+1)*sizeof(uint64_t)) + data_size);
+    record.append(reinterpret_cast<const char*>(&header), sizeof(header));
+    record.append(m_data.data(), prefix_size);
+    for(auto i : order) {
+        uint64_t e = m_events[i];
+        record.append(reinterpret_cast<const char*>(&e), sizeof(e));
+    }
+    if(!fixed_size) {
+        uint64_t offset = 0;
+        record.append(reinterpret_cast<const char*>(&offset), sizeof(offset));
+        for(auto i : order) {
+            offset += m_offsets[i+1] - m_offsets[i] - prefix_size;
+            record.append(reinterpret_cast<const char*>(&offset), sizeof(offset));
+        }
+    }
+    for(auto i : order) {
+        record.append(m_data.data() + m_offsets[i] + prefix_size,
+                      m_offsets[i+1] - m_offsets[i] - prefix_size);
+    }
+}
+
+bool isPackedRecord(const char* record, size_t size) {
+    uint32_t magic;
+    if(size < sizeof(PackedHeader)) return false;
+    std::memcpy(&magic, record, sizeof(magic));
+    return magic == s_packed_magic;
+}
+
+bool unpackProduct(const char* record, size_t size, EventNumber event, std::string& product) {
+    PackedView view;
+    if(!view.parse(record, size)) return false;
+    size_t lo = 0, hi = view.header.count;
+    while(lo < hi) {
+        size_t mid = lo + (hi - lo)/2;
+        if(view.event(mid) < event) lo = mid + 1;
+        else hi = mid;
+    }
+    if(lo == view.header.count || view.event(lo) != event)
+        return false;
+    view.product(lo, product);
+    return true;
+}
+
+void unpackProducts(const char* record, size_t size,
+        const std::function<void(EventNumber, const std::string&)>& func) {
+    PackedView view;
+    if(!view.parse(record, size))
+        throw Exception("Buffer is not a packed product record");
+    std::string product;
+    for(size_t i = 0; i < view.header.count; i++) {
+        view.product(i, product);
+        func(view.event(i), product);
+    }
+}
+
+}
@@ -7,7 +7,10 @@
 #define __HEPNOS_PARALLEL_EVENT_PROCESSOR_IMPL_HPP
 
 #include <numeric>
-#include <queue>
+#include <algorithm>
+#include <cstring>
+#include <deque>
+#include <unordered_set>
 #include <thallium.hpp>
 #include <spdlog/spdlog.h>
 #include "ProductKey.hpp"
@@ -48,7 +51,9 @@ struct ParallelEventProcessorImpl : public tl::provider<ParallelEventProcessorIm
     std::vector<tl::provider_handle>  m_provider_handles;
 
     bool                              m_loader_running = false;
-    std::queue<EventDescriptor>       m_event_queue;
+    std::vector<std::deque<EventDescriptor>> m_event_queues; // one queue per product database if localityAware, a single one otherwise
+    size_t                            m_num_queued_events = 0;
+    std::vector<uint64_t>             m_colocated_dbs; // product databases on this node, in which events are taken first
     tl::mutex                         m_event_queue_mtx;
     tl::condition_variable            m_event_queue_cv;
 
@@ -62,6 +67,10 @@ struct ParallelEventProcessorImpl : public tl::provider<ParallelEventProcessorIm
 
     tl::mutex                         m_stats_mtx;
     ParallelEventProcessorStatistics* m_stats = nullptr;
+    size_t                            m_batch_size = 0; // size of the next output batch to request
+    double                            m_recent_waiting_time = 0.0; // moving average of the time spent waiting for a batch
+    double                            m_recent_processing_time = 0.0; // moving average of the time spent processing an event (protected by m_stats_mtx)
+    std::unordered_set<std::string>   m_subruns_processed; // SubRuns (descriptor prefixes) with events processed by this process
 
     ParallelEventProcessorImpl(
             std::shared_ptr<DataStoreImpl> ds,
@@ -90,6 +99,14 @@ struct ParallelEventProcessorImpl : public tl::provider<ParallelEventProcessorIm
             m_provider_handles[j] = tl::provider_handle(std::move(ep), options.providerID);
         }
         spdlog::trace("ParallelEventProcessorImpl: address exchange done, found {} participants", size);
+        if(m_options.localityAware) {
+            m_event_queues.resize(m_datastore->m_product_dbs.dbs.size());
+            m_colocated_dbs = m_datastore->colocatedProductDatabases();
+            spdlog::trace("ParallelEventProcessorImpl: {} product databases are on this node",
+                          m_colocated_dbs.size());
+        } else {
+            m_event_queues.resize(1);
+        }
     }
 
     ~ParallelEventProcessorImpl() {
@@ -153,15 +170,24 @@ struct ParallelEventProcessorImpl : public tl::provider<ParallelEventProcessorIm
                     m_options.inputBatchSize);
             // XXX instead of waking up all the threads at every event,
             // we should try to fill up batches of the appropriate size in the queue
+            // with affinity, the events of a group (SubRun or Run) are only
+            // queued once the group is complete, so that it is not split
+            // across batches taken while it is being loaded
+            auto prefix_length = affinityPrefixLength();
+            std::vector<EventDescriptor> group;
             for(auto it = evset.begin(prefetcher); it != evset.end(); it++) {
                 EventDescriptor descriptor;
                 it->toDescriptor(descriptor);
-                {
-                    std::lock_guard<tl::mutex> lock(m_event_queue_mtx);
-                    m_event_queue.push(descriptor);
-                }
-                m_event_queue_cv.notify_all();
+                if(!group.empty()
+                && (group.size() >= maxGroupSize(m_options.outputBatchSize)
+                   || !sameGroup(group.front(), descriptor, prefix_length)))
+                    queueEvents(group);
+                group.push_back(descriptor);
+                if(prefix_length == 0)
+                    queueEvents(group);
             }
+            if(!group.empty())
+                queueEvents(group);
         }
         {
             std::lock_guard<tl::mutex> lock(m_event_queue_mtx);
@@ -171,22 +197,173 @@ struct ParallelEventProcessorImpl : public tl::provider<ParallelEventProcessorIm
         m_event_queue_cv.notify_all();
     }
 
-    void requestEventsRDMA(const tl::request& req, size_t max, tl::bulk& remote_mem) {
+    /**
+     * Returns the index of the queue in which to place an event, that is,
+     * the index of the database holding its products if localityAware.
+     */
+    size_t queueIndex(const EventDescriptor& descriptor) const {
+        if(m_event_queues.size() == 1) return 0;
+        auto fake_product_id = DataStoreImpl::makeProductIDprefix(descriptor);
+        return m_datastore->computeProductDbIndex(fake_product_id);
+    }
+
+    /**
+     * Returns the length of the descriptor prefix that events of the
+     * same group share (0 if events are not grouped).
+     */
+    size_t affinityPrefixLength() const {
+        switch(m_options.affinity) {
+            case EventAffinity::SUBRUN: return SubRunDescriptorLength;
+            case EventAffinity::RUN:    return RunDescriptorLength;
+            default:                    return 0;
+        }
+    }
+
+    static bool sameGroup(const EventDescriptor& a, const EventDescriptor& b, size_t prefix_length) {
+        return prefix_length != 0 && std::memcmp(a.data, b.data, prefix_length) == 0;
+    }
+
+    /**
+     * Returns the number of events of a group above which it is split
+     * across batches, given the size of the batches requested.
+     */
+    size_t maxGroupSize(size_t batch_size) const {
+        return std::max<size_t>(m_options.maxAffinityBatchSize, batch_size);
+    }
+
+    /**
+     * Moves the events into their queue and notifies the waiting requesters.
+     */
+    void queueEvents(std::vector<EventDescriptor>& events) {
+        {
+            std::lock_guard<tl::mutex> lock(m_event_queue_mtx);
+            for(const auto& descriptor : events)
+                m_event_queues[queueIndex(descriptor)].push_back(descriptor);
+            m_num_queued_events += events.size();
+        }
+        events.clear();
+        m_event_queue_cv.notify_all();
+    }
+
+    /**
+     * Takes up to max events from the queues. All the events are taken
+     * from the same queue, so they have their products in the same
+     * database: the first non-empty queue among the preferred ones
+     * (the databases co-located with the requester), or else the
+     * fullest queue. With affinity, only whole groups are taken, and
+     * the batch may exceed max to hold the first one, up to capacity.
+     * Must be called with m_event_queue_mtx held.
+     */
+    void takeEvents(size_t max, size_t capacity, const std::vector<uint64_t>& preferred,
+                    std::vector<EventDescriptor>& descriptors) {
+        descriptors.clear();
+        if(m_num_queued_events == 0) return;
+        size_t queue_idx = m_event_queues.size();
+        for(auto i : preferred) {
+            if(i < m_event_queues.size() && !m_event_queues[i].empty()) {
+                queue_idx = i;
+                break;
+            }
+        }
+        if(queue_idx == m_event_queues.size()) {
+            queue_idx = 0;
+            for(size_t i = 1; i < m_event_queues.size(); i++) {
+                if(m_event_queues[i].size() > m_event_queues[queue_idx].size())
+                    queue_idx = i;
+            }
+        }
+        auto& queue = m_event_queues[queue_idx];
+        auto prefix_length = affinityPrefixLength();
+        if(prefix_length == 0) {
+            while(descriptors.size() < max && !queue.empty()) {
+                descriptors.push_back(queue.front());
+                queue.pop_front();
+            }
+        } else {
+            auto max_group_size = std::min(maxGroupSize(max), capacity);
+            while(!queue.empty()) {
+                size_t group_size = 1;
+                while(group_size < queue.size() && group_size < max_group_size
+                   && sameGroup(queue.front(), queue[group_size], prefix_length))
+                    group_size += 1;
+                if(!descriptors.empty() && descriptors.size() + group_size > max)
+                    break;
+                descriptors.insert(descriptors.end(), queue.begin(), queue.begin() + group_size);
+                queue.erase(queue.begin(), queue.begin() + group_size);
+            }
+        }
+        m_num_queued_events -= descriptors.size();
+    }
+
+    /**
+     * Updates an exponential moving average with a new sample, so that
+     * the batch size follows recent rather than cumulative timings.
+     * An average of 0 means that no sample was taken yet.
+     */
+    static void updateMovingAverage(double& average, double sample) {
+        constexpr double weight = 0.25;
+        average = average == 0.0 ? sample : (1.0-weight)*average + weight*sample;
+    }
+
+    /**
+     * Returns the number of events to request. With adaptiveBatchSize,
+     * the size is doubled while waiting for a batch takes more than
+     * 10% of the time it takes to process it (dispatch overhead dominates)
+     * and halved when it takes less than 1% (finer batches balance the
+     * load better at no cost). Both times are moving averages over
+     * the recent batches.
+     */
+    size_t nextBatchSize() {
+        if(!m_options.adaptiveBatchSize) return m_options.outputBatchSize;
+        size_t min_size = std::max<size_t>(m_options.minOutputBatchSize, 1);
+        size_t max_size = std::max<size_t>(m_options.maxOutputBatchSize, min_size);
+        double processing_time;
+        {
+            std::lock_guard<tl::mutex> lock(m_stats_mtx);
+            processing_time = m_recent_processing_time;
+        }
+        if(processing_time != 0.0 && m_recent_waiting_time != 0.0) {
+            double batch_processing_time = processing_time * m_batch_size;
+            if(m_recent_waiting_time > 0.1 * batch_processing_time)
+                m_batch_size *= 2;
+            else if(m_recent_waiting_time < 0.01 * batch_processing_time)
+                m_batch_size /= 2;
+        }
+        m_batch_size = std::min(std::max(m_batch_size, min_size), max_size);
+        return m_batch_size;
+    }
+
+    /**
+     * With adaptiveBatchSize, once all the events have been loaded,
+     * caps the number of events handed out to a share of the remaining
+     * ones (guided self-scheduling), so that batches get smaller toward
+     * the end and processes finish at about the same time.
+     * Must be called with m_event_queue_mtx held.
+     */
+    size_t guidedBatchSize(size_t max) const {
+        if(!m_options.adaptiveBatchSize || m_loader_running) return max;
+        size_t num_consumers = m_num_active_consumers + 1;
+        size_t share = (m_num_queued_events + num_consumers - 1) / num_consumers;
+        share = std::max<size_t>(share, std::max<size_t>(m_options.minOutputBatchSize, 1));
+        return std::min(max, share);
+    }
+
+    void requestEventsRDMA(const tl::request& req, size_t max,
+                           const std::vector<uint64_t>& preferred,
+                           tl::bulk& remote_mem) {
         spdlog::trace("ParallelEventProcessorImpl: (req={}) received request for up to {} events via RDMA",
                       (void*)(&req), max);
         std::vector<EventDescriptor> descriptorsToSend;
         descriptorsToSend.reserve(max);
         {
             std::unique_lock<tl::mutex> lock(m_event_queue_mtx);
-            while(m_loader_running && m_event_queue.empty()) {
+            while(m_loader_running && m_num_queued_events == 0) {
                 spdlog::trace("ParallelEventProcessorImpl: (req={}) waiting for more events to be available...",
                               (void*)(&req));
                 m_event_queue_cv.wait(lock);
             }
-            for(unsigned i = 0; i < max && !m_event_queue.empty(); i++) {
-                descriptorsToSend.push_back(m_event_queue.front());
-                m_event_queue.pop();
-            }
+            takeEvents(guidedBatchSize(max), remote_mem.size()/sizeof(EventDescriptor),
+                       preferred, descriptorsToSend);
         }
 
         spdlog::trace("ParallelEventProcessorImpl: (req={}) sending {} events via RDMA",
@@ -212,22 +389,21 @@ struct ParallelEventProcessorImpl : public tl::provider<ParallelEventProcessorIm
         }
     }
 
-    void requestEventsNoRDMA(const tl::request& req, size_t max) {
+    void requestEventsNoRDMA(const tl::request& req, size_t max,
+                             const std::vector<uint64_t>& preferred) {
         spdlog::trace("ParallelEventProcessorImpl: (req={}) received request for up to {} events via RPC",
                       (void*)(&req), max);
         std::vector<EventDescriptor> descriptorsToSend;
         descriptorsToSend.reserve(max);
         {
             std::unique_lock<tl::mutex> lock(m_event_queue_mtx);
-            while(m_loader_running && m_event_queue.empty()) {
+            while(m_loader_running && m_num_queued_events == 0) {
                 spdlog::trace("ParallelEventProcessorImpl: (req={}) waiting for more events to be available...",
                               (void*)(&req));
                 m_event_queue_cv.wait(lock);
             }
-            for(unsigned i = 0; i < max && !m_event_queue.empty(); i++) {
-                descriptorsToSend.push_back(m_event_queue.front());
-                m_event_queue.pop();
-            }
+            takeEvents(guidedBatchSize(max), std::numeric_limits<size_t>::max(),
+                       preferred, descriptorsToSend);
         }
 
         spdlog::trace("ParallelEventProcessorImpl: (req={}) sending {} events via RPC",
@@ -256,62 +432,66 @@ struct ParallelEventProcessorImpl : public tl::provider<ParallelEventProcessorIm
         double t1 = tl::timer::wtime();
         double t2;
         spdlog::trace("Requesting batch of events");
+        size_t batch_size = nextBatchSize();
         while(m_loader_ranks.size() != 0) {
             int loader_rank = m_loader_ranks[0];
             if(loader_rank == m_my_rank) {
                 std::unique_lock<tl::mutex> lock(m_event_queue_mtx);
-                while(m_event_queue.empty() && m_loader_running) {
+                while(m_num_queued_events == 0 && m_loader_running) {
                     spdlog::trace("Waiting for events to appear in local queue");
                     m_event_queue_cv.wait(lock);
                 }
-                size_t num_events_requested = m_options.outputBatchSize;
-                descriptors.resize(num_events_requested);
-                size_t num_actual_events = 0;
-                for(unsigned i = 0; i < num_events_requested && !m_event_queue.empty(); i++) {
-                    descriptors[i] = m_event_queue.front();
-                    m_event_queue.pop();
-                    num_actual_events += 1;
-                    // no need to lock m_stats_mtx, this is the only ULT modifying local_events_processed
-                    if(m_stats) {
-                        m_stats->total_events_processed += 1;
-                        m_stats->local_events_processed += 1;
-                    }
-                }
+                takeEvents(guidedBatchSize(batch_size), std::numeric_limits<size_t>::max(),
+                           m_colocated_dbs, descriptors);
+                size_t num_actual_events = descriptors.size();
                 if(num_actual_events != 0) {
                     spdlog::trace("Loaded {} events from local queue", num_actual_events);
-                    descriptors.resize(num_actual_events);
                     t2 = tl::timer::wtime();
-                    // no need to lock m_stats_mtx, this is the only ULT modifying waiting_time_stats
-                    if(m_stats) m_stats->waiting_time_stats.updateWith(t2-t1);
+                    updateMovingAverage(m_recent_waiting_time, t2-t1);
+                    // no need to lock m_stats_mtx, this is the only ULT modifying
+                    // local_events_processed and waiting_time_stats
+                    if(m_stats) {
+                        m_stats->total_events_processed += num_actual_events;
+                        m_stats->local_events_processed += num_actual_events;
+                        m_stats->waiting_time_stats.updateWith(t2-t1);
+                        m_stats->batch_size_stats.updateWith(descriptors.size());
+                        countColocatedEvents(descriptors);
+                        countSubRuns(descriptors);
+                    }
                     return true;
                 } else {
                     spdlog::trace("No more events in local queue, erasing self from loader ranks");
                     m_loader_ranks.erase(m_loader_ranks.begin());
                 }
             } else {
-                size_t max = m_options.outputBatchSize;
+                size_t max = batch_size;
                 if(!m_options.use_rdma) {
                     spdlog::trace("Loading events from loader rank {} via RPC", loader_rank);
                     descriptors = m_req_events_rpc_no_rdma
-                        .on(m_provider_handles[loader_rank])(max).as<std::vector<EventDescriptor>>();
+                        .on(m_provider_handles[loader_rank])(max, m_colocated_dbs).as<std::vector<EventDescriptor>>();
                 } else {
                     spdlog::trace("Loading events from loader rank {} via RDMA", loader_rank);
-                    descriptors.resize(max);
+                    // with affinity, the loader may send more than max events to keep a group together
+                    descriptors.resize(affinityPrefixLength() ? maxGroupSize(max) : max);
                     std::vector<std::pair<void*, size_t>> segment =
                         {{ descriptors.data(), sizeof(descriptors[0])*descriptors.size() }};
                     auto local_mem = m_datastore->m_engine.expose(segment, tl::bulk_mode::write_only);
 
                     size_t num_actual_events = m_req_events_rpc_rdma
-                        .on(m_provider_handles[loader_rank])(max, local_mem);
+                        .on(m_provider_handles[loader_rank])(max, m_colocated_dbs, local_mem);
                     descriptors.resize(num_actual_events);
                 }
                 spdlog::trace("Obtained {} events from loader rank {}", descriptors.size(), loader_rank);
                 if(descriptors.size() != 0) {
                     t2 = tl::timer::wtime();
+                    updateMovingAverage(m_recent_waiting_time, t2-t1);
                     // no need to lock m_stats_mtx, this is the only ULT modifying waiting_time_stats
                     if(m_stats) {
                         m_stats->total_events_processed += descriptors.size();
                         m_stats->waiting_time_stats.updateWith(t2-t1);
+                        m_stats->batch_size_stats.updateWith(descriptors.size());
+                        countColocatedEvents(descriptors);
+                        countSubRuns(descriptors);
                     }
                     return true;
                 } else {
@@ -327,6 +507,29 @@ struct ParallelEventProcessorImpl : public tl::provider<ParallelEventProcessorIm
         return false;
     }
 
+    /**
+     * Counts the events whose products are in a database on this node.
+     */
+    void countColocatedEvents(const std::vector<EventDescriptor>& descriptors) {
+        if(m_colocated_dbs.empty()) return;
+        for(const auto& descriptor : descriptors) {
+            auto db_idx = queueIndex(descriptor);
+            if(std::find(m_colocated_dbs.begin(), m_colocated_dbs.end(), db_idx)
+               != m_colocated_dbs.end())
+                m_stats->colocated_events_processed += 1;
+        }
+    }
+
+    /**
+     * Records the SubRuns of the events, to count the number of
+     * distinct SubRuns processed by this process.
+     */
+    void countSubRuns(const std::vector<EventDescriptor>& descriptors) {
+        for(const auto& descriptor : descriptors)
+            m_subruns_processed.emplace(descriptor.data, SubRunDescriptorLength);
+        m_stats->subruns_processed = m_subruns_processed.size();
+    }
+
     void preloadProductsForDescriptors(const std::vector<EventDescriptor>& descriptors,
                                        ProductCache& cache) {
         if(m_product_keys.size() == 0) return;
@@ -406,7 +609,7 @@ struct ParallelEventProcessorImpl : public tl::provider<ParallelEventProcessorIm
                         std::string data(value_buffer.data() + offset, packed_value_sizes[i]);
                         //spdlog::trace("Adding product to cache (product id = {})",
                         //              product_ids[i].toJSON());
-                        cache.m_impl->addRawProduct(product_ids[i], std::move(data));
+                        cache.m_impl->assembleAndAddRawProduct(product_ids[i], std::move(data));
                         offset += packed_value_sizes[i];
                     }
                 }
@@ -486,7 +689,7 @@ struct ParallelEventProcessorImpl : public tl::provider<ParallelEventProcessorIm
                     std::string data(value_buffer.data() + offset, packed_value_sizes[i]);
                     //spdlog::trace("Adding product to cache (product_id = {})",
                     //              product_ids[i].toJSON());
-                    cache.m_impl->addRawProduct(product_ids[i], std::move(data));
+                    cache.m_impl->assembleAndAddRawProduct(product_ids[i], std::move(data));
                     offset += packed_value_sizes[i];
                 }
             }
@@ -505,10 +708,13 @@ struct ParallelEventProcessorImpl : public tl::provider<ParallelEventProcessorIm
         Event event = Event::fromDescriptor(DataStore(m_datastore), d, false);
         user_function(event, cache);
         t2 = tl::timer::wtime();
-        if(m_stats) {
+        if(m_stats || m_options.adaptiveBatchSize) {
             std::lock_guard<tl::mutex> lock(m_stats_mtx);
-            m_stats->processing_time_stats.updateWith(t2-t1);
-            m_stats->acc_event_processing_time += t2-t1;
+            updateMovingAverage(m_recent_processing_time, t2-t1);
+            if(m_stats) {
+                m_stats->processing_time_stats.updateWith(t2-t1);
+                m_stats->acc_event_processing_time += t2-t1;
+            }
         }
         if(m_async) {
             {
@@ -525,6 +731,10 @@ struct ParallelEventProcessorImpl : public tl::provider<ParallelEventProcessorIm
     void processEvents(const ParallelEventProcessor::EventProcessingWithCacheFn& user_function) {
         spdlog::trace("Entering processEvents");
         if(m_stats) *m_stats = ParallelEventProcessorStatistics();
+        m_subruns_processed.clear();
+        m_batch_size = std::max<size_t>(m_options.outputBatchSize, 1);
+        m_recent_waiting_time = 0.0;
+        m_recent_processing_time = 0.0;
         double t_start = tl::timer::wtime();
         std::vector<EventDescriptor> descriptors;
         auto max_ults = m_async ? m_async->m_xstreams.size()*2 : 0;
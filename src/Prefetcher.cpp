@@ -40,6 +40,31 @@ void Prefetcher::setBatchSize(unsigned int size) {
     m_impl->m_batch_size = size;
 }
 
+void Prefetcher::setAdaptive(bool adaptive, size_t memory_limit, unsigned int max_batch_size) {
+    std::unique_lock<tl::mutex> lock(m_impl->m_adaptive_mtx);
+    auto& a = m_impl->m_adaptive;
+    a = PrefetcherImpl::AdaptiveState();
+    a.enabled        = adaptive;
+    a.memory_limit   = memory_limit;
+    a.max_batch_size = std::max(max_batch_size, 1u);
+}
+
+bool Prefetcher::isAdaptive() const {
+    return m_impl->m_adaptive.enabled;
+}
+
+void Prefetcher::setChild(const Prefetcher& child) {
+    for(auto p = child.m_impl; p; p = p->m_child) {
+        if(p == m_impl)
+            throw Exception("Setting this child Prefetcher would create a cycle");
+    }
+    m_impl->m_child = child.m_impl;
+}
+
+void Prefetcher::removeChild() {
+    m_impl->m_child.reset();
+}
+
 void Prefetcher::fetchProductImpl(const std::string& label, const std::string& type, bool fetch) const {
     auto& v = m_impl->m_active_product_keys;
     auto product_key = ProductKey{label, type};
@@ -53,6 +78,19 @@ void Prefetcher::fetchProductImpl(const std::string& label, const std::string& t
     }
 }
 
+void Prefetcher::fetchParentProductImpl(const std::string& label, const std::string& type, bool fetch) const {
+    auto& v = m_impl->m_parent_product_keys;
+    auto product_key = ProductKey{label, type};
+    auto it = std::find(v.begin(), v.end(), product_key);
+    if(fetch) {
+        if(it == v.end())
+            v.push_back(product_key);
+    } else {
+        if(it != v.end())
+            v.erase(it);
+    }
+}
+
 void Prefetcher::activateStatistics(bool activate) {
     if(activate) {
         if(m_impl->m_stats) return;
@@ -71,13 +109,23 @@ ProductID Prefetcher::storeRawData(const ProductID& key, const char* value, size
 }
 
 bool Prefetcher::loadRawData(const ProductID& key, std::string& buffer) const {
+    bool found = false;
+    if(m_impl->loadParentProduct(key, buffer, found))
+        return found;
     return m_impl->loadRawProduct(key, buffer);
 }
 
 bool Prefetcher::loadRawData(const ProductID& key, char* value, size_t* vsize) const {
+    bool found = false;
+    if(m_impl->loadParentProduct(key, value, vsize, found))
+        return found;
     return m_impl->loadRawProduct(key, value, vsize);
 }
 
+bool Prefetcher::assembleChunks(const ProductID& key, std::string& buffer) const {
+    return m_impl->m_datastore->assembleChunks(key, buffer);
+}
+
 bool Prefetcher::valid() const {
     return static_cast<bool>(m_impl);
 }
@@ -2,11 +2,15 @@
 #define __HEPNOS_PREFETCHER_IMPL_HPP
 
 #include <set>
+#include <map>
+#include <atomic>
+#include <algorithm>
 #include <unordered_set>
 #include <unordered_map>
 #include "hepnos/Prefetcher.hpp"
 #include "hepnos/ProductCache.hpp"
 #include "ProductKey.hpp"
+#include "ProductCacheImpl.hpp"
 #include "DataStoreImpl.hpp"
 #include "AsyncEngineImpl.hpp"
 
@@ -23,20 +27,68 @@ class PrefetcherImpl {
         }
     };
 
+    /**
+     * State used to adaptively tune the batch size and cache size.
+     * Times are exponential moving averages, in seconds per item.
+     */
+    struct AdaptiveState {
+        bool         enabled                = false;
+        size_t       memory_limit           = 0;
+        unsigned int max_batch_size         = 1024;
+        double       fetch_time_per_item    = 0.0;
+        double       consume_time_per_item  = 0.0;
+        double       bytes_per_item         = 0.0;
+        double       last_delivery_time     = 0.0;
+        size_t       last_delivered         = 0;
+        size_t       samples                = 0;
+        size_t       adjustments            = 0;
+    };
+
+    static constexpr double s_ema_weight       = 0.25; // weight of a new sample
+    static constexpr double s_grow_threshold   = 0.1;  // fetch/consume ratio above which to grow
+    static constexpr double s_shrink_threshold = 0.01; // fetch/consume ratio below which to shrink
+    static constexpr size_t s_min_samples      = 2;    // samples needed between adjustments
+
     mutable std::unique_ptr<PrefetcherStatistics> m_stats;
     mutable tl::mutex                             m_stats_mtx;
+    mutable AdaptiveState                         m_adaptive;
+    mutable tl::mutex                             m_adaptive_mtx;
 
     std::shared_ptr<DataStoreImpl>   m_datastore;
-    unsigned int                     m_cache_size = 16;
-    unsigned int                     m_batch_size = 1;
+    mutable std::atomic<unsigned int> m_cache_size{16}; // atomic since adapt() changes it while other ULTs read it
+    mutable std::atomic<unsigned int> m_batch_size{1};
     bool                             m_associated = false;
     std::vector<ProductKey>          m_active_product_keys;
     mutable std::set<std::shared_ptr<ItemImpl>, ItemPtrComparator> m_item_cache;
     mutable ProductCache m_product_cache;
 
+    /**
+     * Products stored on the Runs and SubRuns containing the items iterated
+     * over. They are fetched once per parent and kept resident (not erased
+     * on load) until the iteration leaves that parent.
+     */
+    std::vector<ProductKey>          m_parent_product_keys;
+    mutable ProductCache             m_parent_product_cache;
+    mutable std::set<ItemDescriptor> m_resident_parents;
+    mutable tl::mutex                m_parent_mtx;
+
+    /**
+     * Items (and their products) prefetched ahead of time by a parent
+     * prefetcher for a given Run or SubRun, before iteration reaches it.
+     */
+    struct LookaheadEntry {
+        std::vector<std::shared_ptr<ItemImpl>> items;
+        bool                                   complete = false; // all the children were listed
+    };
+
+    std::shared_ptr<PrefetcherImpl>                  m_child;
+    mutable std::map<ItemDescriptor, LookaheadEntry> m_lookahead;
+    mutable tl::mutex                                m_lookahead_mtx;
+
     PrefetcherImpl(const std::shared_ptr<DataStoreImpl>& ds)
     : m_datastore(ds)
-    , m_product_cache(DataStore(ds)) {}
+    , m_product_cache(DataStore(ds))
+    , m_parent_product_cache(DataStore(ds)) {}
 
     virtual ~PrefetcherImpl() = default;
 
@@ -50,7 +102,338 @@ class PrefetcherImpl {
         m_stats->product_sizes.updateWith(psize);
     }
 
-    virtual void fetchRequestedProducts(const std::shared_ptr<ItemImpl>& itemImpl) const = 0;
+    static void update_moving_average(double& avg, double value) {
+        if(avg == 0.0) avg = value;
+        else avg = (1.0 - s_ema_weight)*avg + s_ema_weight*value;
+    }
+
+    /**
+     * Records the time taken to list a batch of items from the DataStore.
+     */
+    void record_item_fetch(size_t num_items, double duration) const {
+        if(!m_adaptive.enabled || num_items == 0) return;
+        std::unique_lock<tl::mutex> lock(m_adaptive_mtx);
+        update_moving_average(m_adaptive.fetch_time_per_item, duration/num_items);
+        m_adaptive.samples += 1;
+        adapt();
+    }
+
+    /**
+     * Records the amount of product data prefetched for a batch of items.
+     */
+    void record_product_bytes(size_t num_items, size_t num_bytes) const {
+        if(!m_adaptive.enabled || num_items == 0) return;
+        std::unique_lock<tl::mutex> lock(m_adaptive_mtx);
+        update_moving_average(m_adaptive.bytes_per_item, ((double)num_bytes)/num_items);
+    }
+
+    /**
+     * Called by nextItems when the consumer requests new items. The time since
+     * the previous delivery is the time the consumer spent processing them.
+     */
+    void record_consumption_start() const {
+        if(!m_adaptive.enabled) return;
+        std::unique_lock<tl::mutex> lock(m_adaptive_mtx);
+        if(m_adaptive.last_delivered == 0) return;
+        double t = wtime() - m_adaptive.last_delivery_time;
+        update_moving_average(m_adaptive.consume_time_per_item, t/m_adaptive.last_delivered);
+    }
+
+    /**
+     * Called by nextItems when items are handed to the consumer.
+     */
+    void record_consumption_end(size_t num_items) const {
+        if(!m_adaptive.enabled) return;
+        std::unique_lock<tl::mutex> lock(m_adaptive_mtx);
+        m_adaptive.last_delivery_time = wtime();
+        m_adaptive.last_delivered = num_items;
+    }
+
+    /**
+     * Grows the batch size when listing items takes a significant fraction
+     * of the time the consumer spends on them, shrinks it when listing is
+     * negligible, then sizes the cache to hold two batches within the
+     * configured memory limit. Must be called with m_adaptive_mtx locked.
+     */
+    void adapt() const {
+        auto& a = m_adaptive;
+        if(a.samples < s_min_samples) return;
+        if(a.fetch_time_per_item == 0.0 || a.consume_time_per_item == 0.0) return;
+        double ratio = a.fetch_time_per_item / a.consume_time_per_item;
+        unsigned int batch_size = m_batch_size;
+        if(ratio > s_grow_threshold)
+            batch_size = std::min(2*batch_size, a.max_batch_size);
+        else if(ratio < s_shrink_threshold)
+            batch_size = std::max(batch_size/2, 1u);
+        unsigned int cache_size = 2*batch_size;
+        if(a.memory_limit != 0 && a.bytes_per_item > 0.0) {
+            double max_items = a.memory_limit / a.bytes_per_item;
+            if(cache_size > max_items) {
+                cache_size = std::max((unsigned int)max_items, 1u);
+                batch_size = std::max(cache_size/2, 1u);
+            }
+        }
+        if(batch_size != m_batch_size || cache_size != m_cache_size) {
+            m_batch_size = batch_size;
+            m_cache_size = cache_size;
+            a.adjustments += 1;
+            a.samples = 0;
+        }
+    }
+
+    /**
+     * Builds the ProductIDs of all the active product keys
+     * for all the items in the provided batch.
+     */
+    void makeRequestedProductIDs(const std::vector<std::shared_ptr<ItemImpl>>& items,
+                                 std::vector<ProductID>& product_ids) const {
+        product_ids.clear();
+        product_ids.reserve(items.size()*m_active_product_keys.size());
+        for(auto& item : items) {
+            auto& descriptor = item->m_descriptor;
+            for(auto& key : m_active_product_keys) {
+                product_ids.push_back(DataStoreImpl::makeProductID(
+                    descriptor, key.label.c_str(), key.label.size(),
+                    key.type.c_str(), key.type.size()));
+            }
+        }
+    }
+
+    /**
+     * Returns the descriptors of the Run and SubRun containing the item
+     * with the provided descriptor.
+     */
+    static void getParentDescriptors(const ItemDescriptor& descriptor,
+                                     std::vector<ItemDescriptor>& parents) {
+        if(descriptor.subrun == InvalidSubRunNumber) return;
+        parents.emplace_back(descriptor.dataset, descriptor.run);
+        if(descriptor.event == InvalidEventNumber) return;
+        parents.emplace_back(descriptor.dataset, descriptor.run, descriptor.subrun);
+    }
+
+    /**
+     * Builds the ProductIDs of all the parent-level product keys for a parent.
+     */
+    void makeParentProductIDs(const ItemDescriptor& parent,
+                              std::vector<ProductID>& product_ids) const {
+        for(auto& key : m_parent_product_keys) {
+            product_ids.push_back(DataStoreImpl::makeProductID(
+                parent, key.label.c_str(), key.label.size(),
+                key.type.c_str(), key.type.size()));
+        }
+    }
+
+    /**
+     * Fetches the parent-level products of the Runs and SubRuns containing
+     * the provided items, for the parents that are not already resident.
+     */
+    void fetchParentProducts(const std::vector<std::shared_ptr<ItemImpl>>& items) const {
+        if(m_parent_product_keys.empty() || items.empty()) return;
+        std::vector<ProductID> product_ids;
+        {
+            std::unique_lock<tl::mutex> lock(m_parent_mtx);
+            std::vector<ItemDescriptor> parents;
+            for(auto& item : items) {
+                parents.clear();
+                getParentDescriptors(item->m_descriptor, parents);
+                for(auto& parent : parents) {
+                    if(m_resident_parents.insert(parent).second)
+                        makeParentProductIDs(parent, product_ids);
+                }
+            }
+        }
+        if(product_ids.empty()) return;
+        auto cache = m_parent_product_cache.m_impl;
+        m_datastore->loadRawProductsPacked(product_ids,
+            [this, &cache](const ProductID& product_id, bool found, std::string&& data) {
+                if(found) {
+                    update_product_statistics(data.size());
+                    cache->assembleAndAddRawProduct(product_id, std::move(data));
+                } else {
+                    cache->addNotFound(product_id);
+                }
+            });
+    }
+
+    /**
+     * Evicts the products of the parents that the iteration has left,
+     * i.e. the parents that come before the parent of the current item
+     * at the same level.
+     */
+    void evictParentProducts(const ItemDescriptor& current) const {
+        if(m_parent_product_keys.empty()) return;
+        std::vector<ItemDescriptor> parents;
+        getParentDescriptors(current, parents);
+        if(parents.empty()) return;
+        std::vector<ProductID> product_ids;
+        {
+            std::unique_lock<tl::mutex> lock(m_parent_mtx);
+            for(auto it = m_resident_parents.begin(); it != m_resident_parents.end();) {
+                // operator< only orders descriptors of the same level,
+                // so compare with the current item's parent at that level
+                bool is_run = it->subrun == InvalidSubRunNumber;
+                bool left = false;
+                if(is_run)
+                    left = *it < parents.front();
+                else if(parents.size() == 2)
+                    left = *it < parents.back();
+                if(left) {
+                    makeParentProductIDs(*it, product_ids);
+                    it = m_resident_parents.erase(it);
+                } else {
+                    ++it;
+                }
+            }
+        }
+        for(auto& product_id : product_ids)
+            m_parent_product_cache.m_impl->removeRawProduct(product_id);
+    }
+
+    /**
+     * Looks up a product in the parent-level cache. Returns true if the
+     * product is handled by this cache, in which case found indicates
+     * whether the product exists. Resident products are not erased on load.
+     */
+    bool loadParentProduct(const ProductID& product_id, std::string& data, bool& found) const {
+        if(m_parent_product_keys.empty()) return false;
+        auto& cache = *m_parent_product_cache.m_impl;
+        if(cache.hasProduct(product_id)) {
+            found = cache.loadRawProduct(product_id, data);
+        } else if(cache.checkNotFound(product_id)) {
+            found = false;
+        } else {
+            return false;
+        }
+        if(m_stats) m_stats->product_cache_hit += 1;
+        return true;
+    }
+
+    bool loadParentProduct(const ProductID& product_id, char* value, size_t* vsize, bool& found) const {
+        if(m_parent_product_keys.empty()) return false;
+        auto& cache = *m_parent_product_cache.m_impl;
+        if(cache.hasProduct(product_id)) {
+            found = cache.loadRawProduct(product_id, value, vsize);
+        } else if(cache.checkNotFound(product_id)) {
+            found = false;
+        } else {
+            return false;
+        }
+        if(m_stats) m_stats->product_cache_hit += 1;
+        return true;
+    }
+
+    void fetchRequestedProducts(const std::shared_ptr<ItemImpl>& itemImpl) const {
+        std::vector<std::shared_ptr<ItemImpl>> items{itemImpl};
+        // called when starting a new iteration from this item
+        evictParentProducts(itemImpl->m_descriptor);
+        fetchParentProducts(items);
+        fetchRequestedProducts(items);
+    }
+
+    virtual void fetchRequestedProducts(const std::vector<std::shared_ptr<ItemImpl>>& items) const = 0;
+
+    /**
+     * Called by prefetchFrom on each batch of items fetched. If a child prefetcher
+     * is attached, it will prefetch the first items contained in each of these
+     * items (e.g. the first Events of each SubRun), along with their products.
+     */
+    void prefetchChildren(const std::vector<std::shared_ptr<ItemImpl>>& parents) const {
+        if(!m_child || parents.empty()) return;
+        m_child->lookahead(parents, 2*m_cache_size);
+    }
+
+    /**
+     * Lists the first batch of children of each of the provided parents
+     * and requests their products, keeping at most max_entries parents.
+     * The products of all the children listed are requested in a single
+     * batch, so that they are fetched with one packed get per database.
+     */
+    void lookahead(const std::vector<std::shared_ptr<ItemImpl>>& parents, size_t max_entries) const {
+        std::vector<std::pair<ItemDescriptor, LookaheadEntry>> entries;
+        std::vector<std::shared_ptr<ItemImpl>> children;
+        for(auto& parent : parents) {
+            auto& descriptor = parent->m_descriptor;
+            if(descriptor.event != InvalidEventNumber) break; // events have no children
+            ItemType item_type   = ItemType::EVENT;
+            ItemType prefix_type = ItemType::SUBRUN;
+            if(descriptor.subrun == InvalidSubRunNumber) {
+                item_type   = ItemType::SUBRUN;
+                prefix_type = ItemType::RUN;
+            }
+            {
+                std::unique_lock<tl::mutex> lock(m_lookahead_mtx);
+                if(m_lookahead.count(descriptor)) continue;
+            }
+            LookaheadEntry entry;
+            size_t batch_size = m_batch_size;
+            size_t s = m_datastore->firstItems(item_type, prefix_type, parent, entry.items, batch_size);
+            update_batch_statistics(s);
+            entry.complete = s < batch_size;
+            children.insert(children.end(), entry.items.begin(), entry.items.end());
+            entries.emplace_back(descriptor, std::move(entry));
+        }
+        if(entries.empty()) return;
+        fetchParentProducts(children);
+        fetchRequestedProducts(children);
+        std::unique_lock<tl::mutex> lock(m_lookahead_mtx);
+        for(auto& entry : entries) {
+            // iteration goes in increasing order, so the first entries are the oldest
+            while(!m_lookahead.empty() && m_lookahead.size() >= max_entries)
+                dropLookahead(m_lookahead.begin());
+            m_lookahead.emplace(entry.first, std::move(entry.second));
+        }
+    }
+
+    /**
+     * Erases a lookahead entry and the products prefetched for it.
+     * Must be called with m_lookahead_mtx locked.
+     */
+    void dropLookahead(std::map<ItemDescriptor, LookaheadEntry>::iterator it) const {
+        std::vector<ProductID> product_ids;
+        makeRequestedProductIDs(it->second.items, product_ids);
+        for(auto& product_id : product_ids)
+            m_product_cache.m_impl->removeRawProduct(product_id);
+        m_lookahead.erase(it);
+    }
+
+    /**
+     * Called when starting to iterate over the children of a parent.
+     * If the children were prefetched ahead, they are placed in the item
+     * cache, first is set to the first of them (nullptr if the parent has
+     * no children), and the function returns true. Returns false if
+     * nothing was prefetched for this parent.
+     */
+    bool takeLookahead(const std::shared_ptr<ItemImpl>& parent,
+                       std::shared_ptr<ItemImpl>& first) const {
+        LookaheadEntry entry;
+        {
+            std::unique_lock<tl::mutex> lock(m_lookahead_mtx);
+            auto it = m_lookahead.find(parent->m_descriptor);
+            if(it == m_lookahead.end()) return false;
+            entry = std::move(it->second);
+            m_lookahead.erase(it);
+            // entries of parents before this one will not be used anymore
+            while(!m_lookahead.empty() && m_lookahead.begin()->first < parent->m_descriptor)
+                dropLookahead(m_lookahead.begin());
+        }
+        first.reset();
+        if(entry.items.empty()) return true;
+        first = entry.items.front();
+        evictParentProducts(first->m_descriptor);
+        // these items were not fetched by prefetchFrom, so walk ahead from them here
+        prefetchChildren(entry.items);
+        entry.items.erase(entry.items.begin());
+        startFromItems(first, std::move(entry.items), entry.complete);
+        return true;
+    }
+
+    /**
+     * Places items prefetched ahead in the item cache and continues
+     * prefetching after them if they are not all the children of their parent.
+     */
+    virtual void startFromItems(const std::shared_ptr<ItemImpl>& first,
+                                std::vector<std::shared_ptr<ItemImpl>>&& items,
+                                bool complete) const = 0;
 
     virtual void prefetchFrom(const ItemType& item_type,
             const ItemType& prefix_type,
@@ -73,9 +456,15 @@ class PrefetcherImpl {
                         char* value, size_t* vsize) const = 0;
 
     void collectStatistics(PrefetcherStatistics& stats) const {
-        std::unique_lock<tl::mutex> lock(m_stats_mtx);
-        if(m_stats)
-            stats = *m_stats;
+        {
+            std::unique_lock<tl::mutex> lock(m_stats_mtx);
+            if(m_stats)
+                stats = *m_stats;
+        }
+        std::unique_lock<tl::mutex> lock(m_adaptive_mtx);
+        stats.batch_size  = m_batch_size;
+        stats.cache_size  = m_cache_size;
+        stats.adjustments = m_adaptive.adjustments;
     }
 };
 
@@ -52,6 +52,10 @@ bool ProductCache::loadRawData(const ProductID& key, char* value, size_t* vsize)
     return m_impl->loadRawProduct(key, value, vsize);
 }
 
+bool ProductCache::assembleChunks(const ProductID& key, std::string& buffer) const {
+    return m_impl->m_datastore->assembleChunks(key, buffer);
+}
+
 bool ProductCache::valid() const {
     return static_cast<bool>(m_impl);
 }
@@ -3,6 +3,9 @@
  *
  * See COPYRIGHT in top-level directory.
  */
+#ifndef __HEPNOS_PRODUCT_CACHE_IMPL_HPP
+#define __HEPNOS_PRODUCT_CACHE_IMPL_HPP
+
 #include "hepnos/ProductCache.hpp"
 #include "hepnos/ItemDescriptor.hpp"
 #include "DataStoreImpl.hpp"
@@ -115,6 +118,18 @@ struct ProductCacheImpl {
         m_lock.unlock();
     }
 
+    /**
+     * Chunked products are assembled before being cached,
+     * so that their chunks are fetched once for all the
+     * users of the cache. Callers holding a lock should
+     * assemble the product themselves beforehand.
+     */
+    void assembleAndAddRawProduct(const ProductID& product_id,
+                                  std::string&& data) {
+        m_datastore->assembleChunks(product_id, data);
+        addRawProduct(product_id, std::move(data));
+    }
+
     void removeRawProduct(const ProductID& product_id) {
         m_lock.wrlock();
         m_map.erase(product_id.m_key);
@@ -124,3 +139,5 @@ struct ProductCacheImpl {
 };
 
 }
+
+#endif
@@ -5,11 +5,20 @@
  */
 #include <memory>
 #include <string>
+#include <random>
+#include <algorithm>
+#include <cstring>
+#include <ctime>
+#include <tuple>
 #include <thallium.hpp>
+#include <thallium/serialization/stl/vector.hpp>
+#include <thallium/serialization/stl/tuple.hpp>
 #include "hepnos/DataStore.hpp"
 #include "hepnos/Queue.hpp"
+#include "hepnos/AsyncEngine.hpp"
 #include "QueueImpl.hpp"
 #include "DataStoreImpl.hpp"
+#include "AsyncEngineImpl.hpp"
 
 namespace hepnos {
 
@@ -33,18 +42,13 @@ bool Queue::empty() const {
     if(!valid()) {
         throw Exception("Calling Queue member function on an invalid Queue object");
     }
-    const auto& full_name = m_impl->m_full_name;
-    const auto& provider_handle = m_impl->m_provider_handle;
-    auto& rpc = m_impl->m_datastore->m_queue_empty_rpc;
-    std::pair<bool, std::string> result;
-    try {
-        result = static_cast<decltype(result)>(rpc.on(provider_handle)(full_name));
-    } catch(std::exception& e) {
-        throw Exception(e.what());
+    {
+        std::unique_lock<tl::mutex> lock(m_impl->m_buffer_mutex);
+        m_impl->flushPushBuffer();
+        if(!m_impl->m_pop_buffer.empty())
+            return false;
     }
-    if(!result.second.empty())
-        throw Exception(result.second);
-    return result.first;
+    return m_impl->shardsEmpty();
 }
 
 DataStore Queue::datastore() const {
@@ -58,31 +62,51 @@ void Queue::close() {
     if(!valid()) {
         throw Exception("Calling Queue member function on an invalid Queue object");
     }
-    if(m_impl->m_mode == QueueAccessMode::CONSUMER)
+    if(m_impl->m_mode == QueueAccessMode::CONSUMER) {
+        // return the items received and not popped
+        std::unique_lock<tl::mutex> lock(m_impl->m_buffer_mutex);
+        if(!m_impl->m_pop_buffer.empty()) {
+            std::vector<std::string> items(
+                std::make_move_iterator(m_impl->m_pop_buffer.begin()),
+                std::make_move_iterator(m_impl->m_pop_buffer.end()));
+            m_impl->m_pop_buffer.clear();
+            m_impl->sendItems(items);
+        }
         return;
-    const auto& full_name = m_impl->m_full_name;
-    const auto& provider_handle = m_impl->m_provider_handle;
-    auto& rpc = m_impl->m_datastore->m_queue_close_rpc;
-    std::pair<bool, std::string> result;
-    try {
-        result = static_cast<decltype(result)>(rpc.on(provider_handle)(full_name, true));
-    } catch(std::exception& e) {
-        throw Exception(e.what());
     }
-    if(!result.first)
-        throw Exception(result.second);
+    flush();
+    m_impl->closeShards();
 }
 
 bool Queue::popImpl(std::string& data) {
     if(!valid()) {
         throw Exception("Calling Queue member function on an invalid Queue object");
     }
-    const auto& full_name = m_impl->m_full_name;
-    const auto& provider_handle = m_impl->m_provider_handle;
+    std::unique_lock<tl::mutex> lock(m_impl->m_buffer_mutex);
+    auto& buffer = m_impl->m_pop_buffer;
+    if(buffer.empty() && (m_impl->m_pop_prefetch > 1 || m_impl->m_shards.size() > 1
+                          || m_impl->m_bulk_threshold != 0)) {
+        // the buffer is not locked while waiting for items
+        size_t max = m_impl->m_pop_prefetch;
+        lock.unlock();
+        std::vector<std::string> items;
+        if(m_impl->receiveItems(max, -1.0, items) != QueuePopStatus::POPPED)
+            return false;
+        lock.lock();
+        for(auto& item : items)
+            buffer.push_back(std::move(item));
+    }
+    if(!buffer.empty()) {
+        data = std::move(buffer.front());
+        buffer.pop_front();
+        return true;
+    }
+    lock.unlock();
+    const auto& shard = m_impl->m_shards[0];
     auto& rpc = m_impl->m_datastore->m_queue_pop_rpc;
     std::pair<bool, std::string> result;
     try {
-        result = static_cast<decltype(result)>(rpc.on(provider_handle)(full_name));
+        result = static_cast<decltype(result)>(rpc.on(shard.m_provider_handle)(shard.m_name));
     } catch(std::exception& e) {
         throw Exception(e.what());
     }
@@ -96,30 +120,636 @@ bool Queue::popImpl(std::string& data) {
     return true;
 }
 
+size_t Queue::popManyImpl(std::vector<std::string>& data, size_t max) {
+    if(!valid()) {
+        throw Exception("Calling Queue member function on an invalid Queue object");
+    }
+    data.clear();
+    if(max == 0) return 0;
+    std::unique_lock<tl::mutex> lock(m_impl->m_buffer_mutex);
+    auto& buffer = m_impl->m_pop_buffer;
+    if(buffer.empty()) {
+        size_t num_items = std::max(max, m_impl->m_pop_prefetch);
+        lock.unlock();
+        std::vector<std::string> items;
+        if(m_impl->receiveItems(num_items, -1.0, items) != QueuePopStatus::POPPED)
+            return 0;
+        lock.lock();
+        for(auto& item : items)
+            buffer.push_back(std::move(item));
+    }
+    size_t count = std::min(max, buffer.size());
+    data.reserve(count);
+    for(size_t i = 0; i < count; i++) {
+        data.push_back(std::move(buffer.front()));
+        buffer.pop_front();
+    }
+    return count;
+}
+
 void Queue::pushImpl(const std::string& data) {
     if(!valid()) {
         throw Exception("Calling Queue member function on an invalid Queue object");
     }
     if(m_impl->m_mode != QueueAccessMode::PRODUCER)
         throw Exception("Queue was open in consumer mode");
-    const auto& full_name = m_impl->m_full_name;
-    const auto& provider_handle = m_impl->m_provider_handle;
-    auto& rpc = m_impl->m_datastore->m_queue_push_rpc;
+    if(m_impl->m_push_buffer_size != 0) {
+        std::unique_lock<tl::mutex> lock(m_impl->m_buffer_mutex);
+        m_impl->checkPushError();
+        auto& buffer = m_impl->m_push_buffer;
+        double now = tl::timer::wtime();
+        if(buffer.empty())
+            m_impl->m_push_buffer_start = now;
+        buffer.push_back(data);
+        if(buffer.size() >= m_impl->m_push_buffer_size
+        || (m_impl->m_push_buffer_delay != 0
+            && now - m_impl->m_push_buffer_start >= m_impl->m_push_buffer_delay)) {
+            m_impl->flushPushBuffer();
+        } else if(m_impl->m_push_buffer_delay != 0 && !m_impl->m_push_flusher_running) {
+            m_impl->m_push_flusher_running = true;
+            try {
+                runAsync(nullptr, [impl=m_impl]() { impl->flushPushBufferAfterDelay(); });
+            } catch(...) {
+                // without a ULT, the delay is only checked by the next push
+                m_impl->m_push_flusher_running = false;
+            }
+        }
+        return;
+    }
+    m_impl->sendItem(data);
+}
+
+bool Queue::tryPushImpl(const std::string& data) {
+    if(!valid()) {
+        throw Exception("Calling Queue member function on an invalid Queue object");
+    }
+    if(m_impl->m_mode != QueueAccessMode::PRODUCER)
+        throw Exception("Queue was open in consumer mode");
+    std::unique_lock<tl::mutex> lock(m_impl->m_buffer_mutex);
+    m_impl->flushPushBuffer();
+    return m_impl->trySendItem(data);
+}
+
+QueuePopStatus Queue::timedPopImpl(std::string& data, double timeout) {
+    if(!valid()) {
+        throw Exception("Calling Queue member function on an invalid Queue object");
+    }
+    std::unique_lock<tl::mutex> lock(m_impl->m_buffer_mutex);
+    auto& buffer = m_impl->m_pop_buffer;
+    if(buffer.empty()) {
+        size_t max = m_impl->m_pop_prefetch;
+        lock.unlock();
+        std::vector<std::string> items;
+        auto status = m_impl->receiveItems(max, timeout, items);
+        if(status != QueuePopStatus::POPPED)
+            return status;
+        lock.lock();
+        for(auto& item : items)
+            buffer.push_back(std::move(item));
+    }
+    data = std::move(buffer.front());
+    buffer.pop_front();
+    return QueuePopStatus::POPPED;
+}
+
+void Queue::runAsync(AsyncEngine* engine, std::function<void()> fn) {
+    tl::pool pool;
+    if(engine) {
+        if(!engine->valid())
+            throw Exception("Invalid AsyncEngine");
+        pool = engine->m_impl->m_pool;
+    } else {
+        auto pools = tl::xstream::self().get_main_pools(1);
+        if(pools.size() != 1)
+            throw Exception("Could not get current execution stream's main Argobots pool");
+        pool = pools[0];
+    }
+    pool.make_thread(std::move(fn), tl::anonymous());
+}
+
+QueueFuture Queue::popAsyncImpl(AsyncEngine* engine,
+                                std::function<void(const std::string&)> deserialize) {
+    if(!valid()) {
+        throw Exception("Calling Queue member function on an invalid Queue object");
+    }
+    auto future = std::make_shared<QueueFutureImpl>();
+    future->m_deserialize = std::move(deserialize);
+    runAsync(engine, [queue=*this, future]() mutable {
+        try {
+            future->m_result = queue.popImpl(future->m_item);
+        } catch(const std::exception& ex) {
+            future->m_error = ex.what();
+        }
+        future->m_completed.set_value();
+    });
+    return QueueFuture(std::move(future));
+}
+
+QueueFuture Queue::pushAsyncImpl(AsyncEngine* engine, std::string&& data) {
+    if(!valid()) {
+        throw Exception("Calling Queue member function on an invalid Queue object");
+    }
+    auto future = std::make_shared<QueueFutureImpl>();
+    runAsync(engine, [queue=*this, future, data=std::move(data)]() mutable {
+        try {
+            queue.pushImpl(data);
+        } catch(const std::exception& ex) {
+            future->m_error = ex.what();
+        }
+        future->m_completed.set_value();
+    });
+    return QueueFuture(std::move(future));
+}
+
+void Queue::pushManyImpl(std::vector<std::string>& data) {
+    if(!valid()) {
+        throw Exception("Calling Queue member function on an invalid Queue object");
+    }
+    if(m_impl->m_mode != QueueAccessMode::PRODUCER)
+        throw Exception("Queue was open in consumer mode");
+    std::unique_lock<tl::mutex> lock(m_impl->m_buffer_mutex);
+    auto& buffer = m_impl->m_push_buffer;
+    if(!buffer.empty()) {
+        // send the buffered items first to preserve the order
+        buffer.insert(buffer.end(),
+            std::make_move_iterator(data.begin()),
+            std::make_move_iterator(data.end()));
+        m_impl->flushPushBuffer();
+    } else if(!data.empty()) {
+        m_impl->sendItems(data);
+    }
+}
+
+void Queue::setPushBuffering(size_t max_items, double max_delay) {
+    if(!valid()) {
+        throw Exception("Calling Queue member function on an invalid Queue object");
+    }
+    std::unique_lock<tl::mutex> lock(m_impl->m_buffer_mutex);
+    m_impl->m_push_buffer_size  = max_items;
+    m_impl->m_push_buffer_delay = max_delay;
+    if(max_items == 0 || m_impl->m_push_buffer.size() >= max_items)
+        m_impl->flushPushBuffer();
+    // a running flusher waits for the new delay
+    m_impl->m_push_buffer_cv.notify_all();
+}
+
+void Queue::flush() {
+    if(!valid()) {
+        throw Exception("Calling Queue member function on an invalid Queue object");
+    }
+    std::unique_lock<tl::mutex> lock(m_impl->m_buffer_mutex);
+    m_impl->checkPushError();
+    m_impl->flushPushBuffer();
+}
+
+void Queue::setPopPrefetch(size_t num_items) {
+    if(!valid()) {
+        throw Exception("Calling Queue member function on an invalid Queue object");
+    }
+    std::unique_lock<tl::mutex> lock(m_impl->m_buffer_mutex);
+    m_impl->m_pop_prefetch = std::max<size_t>(num_items, 1);
+}
+
+void Queue::setBulkThreshold(size_t num_bytes) {
+    if(!valid()) {
+        throw Exception("Calling Queue member function on an invalid Queue object");
+    }
+    std::unique_lock<tl::mutex> lock(m_impl->m_bulk_mutex);
+    m_impl->m_bulk_threshold = num_bytes;
+}
+
+bool Queue::checkTypeImpl(const std::type_info& type_info) {
+    if(!valid()) {
+        throw Exception("Calling Queue member function on an invalid Queue object");
+    }
+    return type_info == m_impl->m_type_info.get();
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////
+// QueueFuture implementation
+////////////////////////////////////////////////////////////////////////////////////////////
+
+QueueFuture::QueueFuture() = default;
+QueueFuture::QueueFuture(const QueueFuture&) = default;
+QueueFuture::QueueFuture(QueueFuture&&) = default;
+QueueFuture& QueueFuture::operator=(const QueueFuture&) = default;
+QueueFuture& QueueFuture::operator=(QueueFuture&&) = default;
+QueueFuture::~QueueFuture() = default;
+
+QueueFuture::QueueFuture(std::shared_ptr<QueueFutureImpl> impl)
+: m_impl(std::move(impl)) {}
+
+bool QueueFuture::valid() const {
+    return static_cast<bool>(m_impl);
+}
+
+bool QueueFuture::completed() const {
+    if(!valid()) {
+        throw Exception("Calling QueueFuture member function on an invalid QueueFuture object");
+    }
+    return m_impl->m_completed.test();
+}
+
+bool QueueFuture::wait() {
+    if(!valid()) {
+        throw Exception("Calling QueueFuture member function on an invalid QueueFuture object");
+    }
+    m_impl->m_completed.wait();
+    std::unique_lock<tl::mutex> lock(m_impl->m_mutex);
+    if(!m_impl->m_error.empty())
+        throw Exception(m_impl->m_error);
+    if(m_impl->m_result && m_impl->m_deserialize) {
+        auto deserialize = std::move(m_impl->m_deserialize);
+        m_impl->m_deserialize = nullptr;
+        deserialize(m_impl->m_item);
+        m_impl->m_item.clear();
+    }
+    return m_impl->m_result;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////
+// QueueImpl implementation
+////////////////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * @brief Time (in seconds) a consumer of a sharded queue waits on one shard
+ * before looking for items to steal from the other shards again.
+ */
+static constexpr double s_steal_interval = 0.05;
+
+/**
+ * @brief Default size (in bytes) above which items are moved by RDMA.
+ */
+static constexpr size_t s_default_bulk_threshold = 64*1024;
+
+QueueImpl::QueueImpl(const std::shared_ptr<DataStoreImpl>& ds,
+                     const std::string& full_name,
+                     const std::type_info& type_info,
+                     QueueAccessMode mode,
+                     std::vector<QueueShard> shards,
+                     QueueShardingPolicy sharding)
+: m_datastore(ds)
+, m_full_name(full_name)
+, m_type_info(type_info)
+, m_mode(mode)
+, m_shards(std::move(shards))
+, m_sharding(sharding)
+, m_next_shard(0)
+, m_home_shard(0)
+, m_finished_shards(m_shards.size())
+, m_bulk_threshold(s_default_bulk_threshold) {
+    if(m_shards.size() > 1) {
+        // spread producers and consumers over the shards
+        std::random_device rd;
+        m_home_shard = rd() % m_shards.size();
+        m_next_shard = m_home_shard;
+    }
+}
+
+QueueImpl::~QueueImpl() {
+    try {
+        std::unique_lock<tl::mutex> lock(m_buffer_mutex);
+        flushPushBuffer();
+        if(!m_pop_buffer.empty()) {
+            std::vector<std::string> items(
+                std::make_move_iterator(m_pop_buffer.begin()),
+                std::make_move_iterator(m_pop_buffer.end()));
+            m_pop_buffer.clear();
+            sendItems(items);
+        }
+    } catch(...) {}
+}
+
+void QueueImpl::flushPushBuffer() {
+    if(m_push_buffer.empty()) return;
+    std::vector<std::string> items;
+    items.swap(m_push_buffer);
+    m_push_buffer_cv.notify_all();
+    sendItems(items);
+}
+
+void QueueImpl::flushPushBufferAfterDelay() {
+    std::unique_lock<tl::mutex> lock(m_buffer_mutex);
+    try {
+        while(!m_push_buffer.empty() && m_push_buffer_delay != 0) {
+            double remaining = m_push_buffer_start + m_push_buffer_delay - tl::timer::wtime();
+            if(remaining <= 0) {
+                flushPushBuffer();
+                break;
+            }
+            struct timespec ts;
+            clock_gettime(CLOCK_REALTIME, &ts);
+            long nsec = ts.tv_nsec + static_cast<long>((remaining - static_cast<time_t>(remaining))*1e9);
+            ts.tv_sec += static_cast<time_t>(remaining) + nsec / 1000000000L;
+            ts.tv_nsec = nsec % 1000000000L;
+            m_push_buffer_cv.wait_until(lock, &ts);
+        }
+    } catch(const std::exception& ex) {
+        m_push_error = ex.what();
+    }
+    m_push_flusher_running = false;
+}
+
+void QueueImpl::checkPushError() {
+    if(m_push_error.empty()) return;
+    std::string error;
+    error.swap(m_push_error);
+    throw Exception(error);
+}
+
+size_t QueueImpl::selectShard(const std::string& item) {
+    if(m_shards.size() == 1) return 0;
+    if(m_sharding == QueueShardingPolicy::HASH)
+        return std::hash<std::string>()(item) % m_shards.size();
+    return m_next_shard++ % m_shards.size();
+}
+
+size_t QueueImpl::acquireBulkBuffer(std::vector<char>& buffer, tl::bulk& handle) {
+    std::unique_lock<tl::mutex> lock(m_bulk_mutex);
+    buffer.swap(m_bulk_buffer);
+    std::swap(handle, m_bulk_handle);
+    return m_bulk_threshold;
+}
+
+void QueueImpl::releaseBulkBuffer(std::vector<char>& buffer, tl::bulk& handle) {
+    std::unique_lock<tl::mutex> lock(m_bulk_mutex);
+    if(buffer.size() <= m_bulk_buffer.size()) return;
+    buffer.swap(m_bulk_buffer);
+    std::swap(handle, m_bulk_handle);
+}
+
+void QueueImpl::reserveBulkBuffer(std::vector<char>& buffer, tl::bulk& handle, size_t size) const {
+    if(size <= buffer.size()) return;
+    std::vector<char> larger(std::max(size, 2*buffer.size()));
+    std::vector<std::pair<void*, size_t>> segment = {{ larger.data(), larger.size() }};
+    try {
+        handle = m_datastore->m_engine.expose(segment, tl::bulk_mode::read_write);
+    } catch(std::exception& e) {
+        throw Exception(e.what());
+    }
+    buffer.swap(larger);
+}
+
+std::pair<bool, std::string> QueueImpl::pushToShard(size_t index, const std::string& item, bool wait) {
+    const auto& shard = m_shards[index];
     std::pair<bool, std::string> result;
+    size_t threshold;
+    {
+        std::unique_lock<tl::mutex> lock(m_bulk_mutex);
+        threshold = m_bulk_threshold;
+    }
+    if(threshold == 0 || item.size() < threshold) {
+        auto& rpc = m_datastore->m_queue_push_rpc;
+        try {
+            result = static_cast<decltype(result)>(rpc.on(shard.m_provider_handle)(shard.m_name, item, wait));
+        } catch(std::exception& e) {
+            throw Exception(e.what());
+        }
+        return result;
+    }
+    // the provider pulls the item from the registered buffer, which
+    // this call keeps for itself while the push may be waiting for space
+    std::vector<char> buffer;
+    tl::bulk handle;
+    acquireBulkBuffer(buffer, handle);
+    auto& rpc = m_datastore->m_queue_push_bulk_rpc;
     try {
-        result = static_cast<decltype(result)>(rpc.on(provider_handle)(full_name, data));
+        reserveBulkBuffer(buffer, handle, item.size());
+        std::memcpy(buffer.data(), item.data(), item.size());
+        result = static_cast<decltype(result)>(rpc.on(shard.m_provider_handle)(
+                    shard.m_name, item.size(), handle, wait));
     } catch(std::exception& e) {
+        releaseBulkBuffer(buffer, handle);
         throw Exception(e.what());
     }
+    releaseBulkBuffer(buffer, handle);
+    return result;
+}
+
+void QueueImpl::sendItem(const std::string& item) {
+    auto result = pushToShard(selectShard(item), item, true);
     if(!result.first)
         throw Exception(result.second);
 }
 
-bool Queue::checkTypeImpl(const std::type_info& type_info) {
-    if(!valid()) {
-        throw Exception("Calling Queue member function on an invalid Queue object");
+bool QueueImpl::trySendItem(const std::string& item) {
+    auto first = selectShard(item);
+    for(size_t i = 0; i < m_shards.size(); i++) {
+        auto result = pushToShard((first + i) % m_shards.size(), item, false);
+        if(result.first)
+            return true;
+        if(!result.second.empty())
+            throw Exception(result.second);
     }
-    return type_info == m_impl->m_type_info.get();
+    return false;
+}
+
+void QueueImpl::sendItems(std::vector<std::string>& items) {
+    std::vector<std::vector<std::string>> groups;
+    if(m_shards.size() == 1) {
+        groups.resize(1);
+        groups[0].swap(items);
+    } else {
+        groups.resize(m_shards.size());
+        for(auto& item : items) {
+            auto shard = selectShard(item);
+            groups[shard].push_back(std::move(item));
+        }
+        items.clear();
+    }
+    size_t threshold;
+    {
+        std::unique_lock<tl::mutex> lock(m_bulk_mutex);
+        threshold = m_bulk_threshold;
+    }
+    auto isLarge = [threshold](const std::string& item) {
+        return threshold != 0 && item.size() >= threshold;
+    };
+    // groups without large items are sent in parallel, the others
+    // are sent afterward, splitting them around their large items
+    auto& rpc = m_datastore->m_queue_push_many_rpc;
+    std::vector<tl::async_response> requests;
+    std::vector<size_t> groups_with_large_items;
+    requests.reserve(groups.size());
+    try {
+        for(size_t i = 0; i < groups.size(); i++) {
+            if(groups[i].empty()) continue;
+            if(std::any_of(groups[i].begin(), groups[i].end(), isLarge)) {
+                groups_with_large_items.push_back(i);
+                continue;
+            }
+            const auto& shard = m_shards[i];
+            requests.push_back(rpc.on(shard.m_provider_handle).async(shard.m_name, groups[i]));
+        }
+    } catch(std::exception& e) {
+        throw Exception(e.what());
+    }
+    std::string error;
+    for(auto& request : requests) {
+        std::pair<bool, std::string> result;
+        try {
+            result = static_cast<decltype(result)>(request.wait());
+        } catch(std::exception& e) {
+            result = std::make_pair(false, std::string(e.what()));
+        }
+        if(!result.first && error.empty())
+            error = result.second;
+    }
+    if(!error.empty())
+        throw Exception(error);
+    for(auto i : groups_with_large_items) {
+        const auto& shard = m_shards[i];
+        auto& group = groups[i];
+        auto it = group.begin();
+        while(it != group.end()) {
+            std::pair<bool, std::string> result;
+            if(isLarge(*it)) {
+                result = pushToShard(i, *it, true);
+                ++it;
+            } else {
+                auto end = std::find_if(it, group.end(), isLarge);
+                std::vector<std::string> run(std::make_move_iterator(it),
+                                             std::make_move_iterator(end));
+                it = end;
+                try {
+                    result = static_cast<decltype(result)>(
+                        rpc.on(shard.m_provider_handle)(shard.m_name, run));
+                } catch(std::exception& e) {
+                    throw Exception(e.what());
+                }
+            }
+            if(!result.first)
+                throw Exception(result.second);
+        }
+    }
+}
+
+QueuePopStatus QueueImpl::popFromShard(size_t index, size_t max, double timeout,
+                                       std::vector<std::string>& items) {
+    const auto& shard = m_shards[index];
+    auto& rpc = m_datastore->m_queue_pop_many_rpc;
+    // the provider pushes the large items into the registered buffer
+    // and lists their sizes, the other items are in the response
+    std::tuple<bool, std::vector<std::string>, std::vector<uint64_t>> result;
+    // the registered buffer is kept by this call while the pop may be
+    // waiting for items; concurrent pops receive their items in the response
+    std::vector<char> buffer;
+    tl::bulk handle;
+    size_t threshold = acquireBulkBuffer(buffer, handle);
+    try {
+        result = static_cast<decltype(result)>(
+            rpc.on(shard.m_provider_handle)(shard.m_name, max, timeout,
+                                            buffer.empty() ? 0 : threshold, handle));
+    } catch(std::exception& e) {
+        releaseBulkBuffer(buffer, handle);
+        throw Exception(e.what());
+    }
+    auto& received = std::get<1>(result);
+    auto& bulk_sizes = std::get<2>(result);
+    if(!std::get<0>(result)) {
+        releaseBulkBuffer(buffer, handle);
+        if(received.empty())
+            return QueuePopStatus::FINISHED;
+        else
+            throw Exception(received[0]);
+    }
+    if(received.empty()) {
+        releaseBulkBuffer(buffer, handle);
+        return QueuePopStatus::TIMEOUT;
+    }
+    size_t offset = 0;
+    size_t largest = 0;
+    for(size_t i = 0; i < received.size(); i++) {
+        if(i < bulk_sizes.size() && bulk_sizes[i] != 0) {
+            received[i].assign(buffer.data() + offset, bulk_sizes[i]);
+            offset += bulk_sizes[i];
+        } else if(threshold != 0 && received[i].size() >= threshold) {
+            largest = std::max(largest, received[i].size());
+        }
+    }
+    // large items that did not fit will fit next time
+    try {
+        if(largest != 0)
+            reserveBulkBuffer(buffer, handle, largest);
+    } catch(const Exception&) {
+        // the items were received, the buffer will grow next time
+    }
+    releaseBulkBuffer(buffer, handle);
+    items = std::move(received);
+    return QueuePopStatus::POPPED;
+}
+
+QueuePopStatus QueueImpl::receiveItems(size_t max, double timeout,
+                                       std::vector<std::string>& items) {
+    if(m_shards.size() == 1)
+        return popFromShard(0, max, timeout, items);
+    auto num_shards = m_shards.size();
+    double deadline = tl::timer::wtime() + timeout;
+    while(true) {
+        // look at the home shard, then steal from the others
+        size_t waiting_shard = num_shards;
+        for(size_t i = 0; i < num_shards; i++) {
+            size_t s = (m_home_shard + i) % num_shards;
+            if(m_finished_shards[s]) continue;
+            auto status = popFromShard(s, max, 0.0, items);
+            if(status == QueuePopStatus::POPPED)
+                return status;
+            if(status == QueuePopStatus::FINISHED)
+                m_finished_shards[s] = true;
+            else if(waiting_shard == num_shards)
+                waiting_shard = s;
+        }
+        // no producer left and all the shards are empty
+        if(waiting_shard == num_shards)
+            return QueuePopStatus::FINISHED;
+        // wait for an item on one shard for a while, then look again
+        double interval = s_steal_interval;
+        if(timeout >= 0.0) {
+            double remaining = deadline - tl::timer::wtime();
+            if(remaining <= 0.0)
+                return QueuePopStatus::TIMEOUT;
+            interval = std::min(interval, remaining);
+        }
+        auto status = popFromShard(waiting_shard, max, interval, items);
+        if(status == QueuePopStatus::POPPED)
+            return status;
+        if(status == QueuePopStatus::FINISHED)
+            m_finished_shards[waiting_shard] = true;
+    }
+}
+
+bool QueueImpl::shardsEmpty() const {
+    auto& rpc = m_datastore->m_queue_empty_rpc;
+    for(const auto& shard : m_shards) {
+        std::pair<bool, std::string> result;
+        try {
+            result = static_cast<decltype(result)>(rpc.on(shard.m_provider_handle)(shard.m_name));
+        } catch(std::exception& e) {
+            throw Exception(e.what());
+        }
+        if(!result.second.empty())
+            throw Exception(result.second);
+        if(!result.first)
+            return false;
+    }
+    return true;
+}
+
+void QueueImpl::closeShards() {
+    auto& rpc = m_datastore->m_queue_close_rpc;
+    std::string error;
+    for(const auto& shard : m_shards) {
+        std::pair<bool, std::string> result;
+        try {
+            result = static_cast<decltype(result)>(rpc.on(shard.m_provider_handle)(shard.m_name, true));
+        } catch(std::exception& e) {
+            result = std::make_pair(false, std::string(e.what()));
+        }
+        if(!result.first && error.empty())
+            error = result.second;
+    }
+    if(!error.empty())
+        throw Exception(error);
 }
 
 }
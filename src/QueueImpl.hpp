@@ -8,8 +8,14 @@
 
 #include <memory>
 #include <string>
+#include <vector>
+#include <deque>
+#include <atomic>
+#include <functional>
 #include <thallium.hpp>
 #include "hepnos/QueueAccessMode.hpp"
+#include "hepnos/QueueOptions.hpp"
+#include "hepnos/QueuePopStatus.hpp"
 
 namespace hepnos {
 
@@ -17,6 +23,27 @@ class DataStoreImpl;
 
 namespace tl = thallium;
 
+/**
+ * @brief Part of a queue managed by a QueueProvider.
+ */
+struct QueueShard {
+    std::string         m_name;            // name of the queue in the provider
+    tl::provider_handle m_provider_handle; // provider managing the shard
+};
+
+/**
+ * @brief State shared between a QueueFuture and the ULT
+ * performing the operation.
+ */
+struct QueueFutureImpl {
+    tl::eventual<void>                      m_completed;
+    tl::mutex                               m_mutex;
+    bool                                    m_result = true; // false if a pop found no producer left
+    std::string                             m_item;          // item popped
+    std::string                             m_error;         // error that occured, if any
+    std::function<void(const std::string&)> m_deserialize;   // deserializes m_item (null for pushes or once done)
+};
+
 class QueueImpl {
 
     public:
@@ -25,19 +52,133 @@ class QueueImpl {
     std::string                                  m_full_name;
     std::reference_wrapper<const std::type_info> m_type_info;
     QueueAccessMode                              m_mode;
-    tl::provider_handle                          m_provider_handle;
+    std::vector<QueueShard>                      m_shards;     // shard 0 is on the provider the name hashes to
+    QueueShardingPolicy                          m_sharding;
+    std::atomic<size_t>                          m_next_shard; // next shard for round-robin pushes
+    size_t                                       m_home_shard; // shard consumers look at first
+    std::vector<std::atomic<bool>>               m_finished_shards; // shards found empty with no producer left
+    tl::mutex                                    m_buffer_mutex;
+    std::vector<std::string>                     m_push_buffer;           // items pushed but not sent yet
+    size_t                                       m_push_buffer_size = 0;  // items buffered before sending (0 to disable)
+    double                                       m_push_buffer_delay = 0; // max time (seconds) an item stays buffered (0 for none)
+    double                                       m_push_buffer_start = 0; // time at which the oldest buffered item was pushed
+    bool                                         m_push_flusher_running = false; // whether a ULT will flush the buffer after m_push_buffer_delay
+    tl::condition_variable                       m_push_buffer_cv;        // signaled when the push buffer is flushed
+    std::string                                  m_push_error;            // error of a delayed flush, reported by the next push or flush
+    std::deque<std::string>                      m_pop_buffer;            // items received but not popped yet
+    size_t                                       m_pop_prefetch = 1;      // items requested per pop RPC
+    size_t                                       m_bulk_threshold;        // items of this size or more are moved by RDMA (0 to disable)
+    tl::mutex                                    m_bulk_mutex;
+    std::vector<char>                            m_bulk_buffer;           // registered buffer reused across RDMA transfers (empty while in use)
+    tl::bulk                                     m_bulk_handle;           // exposes m_bulk_buffer
 
     QueueImpl(const std::shared_ptr<DataStoreImpl>& ds,
               const std::string& full_name,
               const std::type_info& type_info,
               QueueAccessMode mode,
-              tl::provider_handle ph)
-    : m_datastore(ds)
-    , m_full_name(full_name)
-    , m_type_info(type_info)
-    , m_mode(mode)
-    , m_provider_handle(std::move(ph)) {}
+              std::vector<QueueShard> shards,
+              QueueShardingPolicy sharding);
+
+    ~QueueImpl();
+
+    /**
+     * @brief Sends the buffered items to the provider.
+     * Must be called with m_buffer_mutex held.
+     */
+    void flushPushBuffer();
+
+    /**
+     * @brief Waits until the oldest buffered item has been buffered for
+     * m_push_buffer_delay seconds and sends the buffered items, unless
+     * they were sent in the meantime. Run in a ULT spawned by the push
+     * that starts filling the buffer, so that items are sent on time even
+     * if the producer stops pushing.
+     */
+    void flushPushBufferAfterDelay();
+
+    /**
+     * @brief Throws the error of the last delayed flush, if any.
+     * Must be called with m_buffer_mutex held.
+     */
+    void checkPushError();
+
+    /**
+     * @brief Sends an item to the shard selected by the sharding policy.
+     */
+    void sendItem(const std::string& item);
+
+    /**
+     * @brief Tries to send an item without waiting for space, starting
+     * with the shard selected by the sharding policy.
+     *
+     * @return false if all the shards are full.
+     */
+    bool trySendItem(const std::string& item);
+
+    /**
+     * @brief Sends a batch of items, distributed across shards
+     * according to the sharding policy.
+     */
+    void sendItems(std::vector<std::string>& items);
+
+    /**
+     * @brief Receives up to max items, waiting at most timeout seconds
+     * (forever if timeout is negative) until at least one is available
+     * or all the producers have closed the queue. Consumers of a sharded
+     * queue look at their home shard first, then steal from the other
+     * shards.
+     */
+    QueuePopStatus receiveItems(size_t max, double timeout,
+                                std::vector<std::string>& items);
+
+    /**
+     * @brief Requests up to max items from a shard, waiting at most
+     * timeout seconds for one to arrive (forever if timeout is negative).
+     */
+    QueuePopStatus popFromShard(size_t shard, size_t max, double timeout,
+                                std::vector<std::string>& items);
+
+    /**
+     * @brief Checks whether all the shards are empty.
+     */
+    bool shardsEmpty() const;
+
+    /**
+     * @brief Unregisters this producer from all the shards.
+     */
+    void closeShards();
+
+    private:
+
+    size_t selectShard(const std::string& item);
+
+    /**
+     * @brief Sends an item to a shard, by RDMA if it is large enough.
+     * A false flag with an empty message means that the shard was full
+     * and wait was false.
+     */
+    std::pair<bool, std::string> pushToShard(size_t shard, const std::string& item, bool wait);
+
+    /**
+     * @brief Moves the registered buffer out of the QueueImpl for the
+     * duration of an RPC, so that concurrent RPCs neither wait for it
+     * nor share it. The buffer is empty if another RPC is using it.
+     *
+     * @return the bulk threshold.
+     */
+    size_t acquireBulkBuffer(std::vector<char>& buffer, tl::bulk& handle);
+
+    /**
+     * @brief Gives back a buffer obtained with acquireBulkBuffer,
+     * keeping the largest one if another was given back meanwhile.
+     */
+    void releaseBulkBuffer(std::vector<char>& buffer, tl::bulk& handle);
 
+    /**
+     * @brief Makes a registered buffer hold at least size bytes,
+     * exposing a larger buffer if needed.
+     */
+    void reserveBulkBuffer(std::vector<char>& buffer, tl::bulk& handle, size_t size) const;
 };
 
 }
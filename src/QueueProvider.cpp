@@ -7,12 +7,25 @@
 #include <thallium.hpp>
 #include <thallium/serialization/stl/string.hpp>
 #include <thallium/serialization/stl/pair.hpp>
+#include <thallium/serialization/stl/vector.hpp>
+#include <thallium/serialization/stl/tuple.hpp>
 #include <nlohmann/json.hpp>
 #include <unordered_map>
+#include <memory>
+#include <algorithm>
 #include <mutex>
-#include <queue>
-#include <list>
+#include <vector>
 #include <string>
+#include <tuple>
+#include <ctime>
+#include <cstdio>
+#include <cstdlib>
+#include <stdexcept>
+#include <cstring>
+#include <cstddef>
+#include <unistd.h>
+#include <dirent.h>
+#include "QueueProviderImpl.hpp"
 
 namespace tl = thallium;
 
@@ -21,42 +34,8 @@ namespace hepnos {
 class QueueProvider : public tl::provider<QueueProvider> {
 
     using json = nlohmann::json;
-
-    struct no_producer : public std::exception {};
-
-    struct queue_t {
-
-        std::queue<std::string, std::list<std::string>> m_content;
-        mutable tl::mutex                               m_mutex;
-        tl::condition_variable                          m_cv;
-        std::atomic<uint64_t>                           m_producers{0};
-
-        bool empty() const {
-            std::unique_lock<tl::mutex> guard(m_mutex);
-            return m_content.empty();
-        }
-
-        void push(std::string&& value) {
-            bool notify = false;
-            {
-                std::unique_lock<tl::mutex> guard(m_mutex);
-                if(m_content.empty()) notify = true;
-                m_content.push(std::move(value));
-            }
-            if(notify) m_cv.notify_one();
-        }
-
-        std::string pop() {
-            std::unique_lock<tl::mutex> guard(m_mutex);
-            while(m_content.empty() && m_producers != 0)
-                m_cv.wait(guard);
-            if(m_producers == 0 && m_content.empty())
-                throw no_producer{};
-            auto result = std::move(m_content.front());
-            m_content.pop();
-            return result;
-        }
-    };
+    using no_producer = queue_provider::no_producer;
+    using queue_t = queue_provider::queue_t;
 
     public:
 
@@ -71,7 +50,21 @@ class QueueProvider : public tl::provider<QueueProvider> {
     , m_rpc_queue_empty(define("hepnos_queue_empty", &QueueProvider::queueEmpty, pool))
     , m_rpc_queue_push(define("hepnos_queue_push", &QueueProvider::queuePush, pool))
     , m_rpc_queue_pop(define("hepnos_queue_pop", &QueueProvider::queuePop, pool))
-    {}
+    , m_rpc_queue_push_many(define("hepnos_queue_push_many", &QueueProvider::queuePushMany, pool))
+    , m_rpc_queue_pop_many(define("hepnos_queue_pop_many", &QueueProvider::queuePopMany, pool))
+    , m_rpc_queue_push_bulk(define("hepnos_queue_push_bulk", &QueueProvider::queuePushBulk, pool))
+    {
+        auto tmpdir = std::getenv("TMPDIR");
+        m_spill_directory = tmpdir ? tmpdir : "/tmp";
+        if(config && config[0]) {
+            auto json_config = json::parse(config);
+            m_spill_directory = json_config.value("spill_directory", m_spill_directory);
+            m_persistent_directory = json_config.value("persistent_directory", m_persistent_directory);
+            m_sync = json_config.value("sync", m_sync);
+        }
+        if(!m_persistent_directory.empty())
+            loadQueues();
+    }
 
     ~QueueProvider() {
         m_rpc_create_queue.deregister();
@@ -81,11 +74,29 @@ class QueueProvider : public tl::provider<QueueProvider> {
         m_rpc_queue_empty.deregister();
         m_rpc_queue_push.deregister();
         m_rpc_queue_pop.deregister();
+        m_rpc_queue_push_many.deregister();
+        m_rpc_queue_pop_many.deregister();
+        m_rpc_queue_push_bulk.deregister();
+    }
+
+    /**
+     * Returns the configuration of the provider.
+     */
+    std::string getConfig() const {
+        json config;
+        config["spill_directory"] = m_spill_directory;
+        if(!m_persistent_directory.empty()) {
+            config["persistent_directory"] = m_persistent_directory;
+            config["sync"] = m_sync;
+        }
+        return config.dump();
     }
 
     private:
 
-    void createQueue(const tl::request& req, const std::string& queue_name) {
+    void createQueue(const tl::request& req,
+                     const std::string& queue_name,
+                     const std::string& config) {
         auto result = std::make_pair<bool, std::string>(true, "");
         m_queues_lock.wrlock();
         std::unique_lock<tl::rwlock> guard(m_queues_lock, std::adopt_lock);
@@ -93,25 +104,124 @@ class QueueProvider : public tl::provider<QueueProvider> {
             result.first = false;
             result.second = "Queue already exists";
         } else {
-            m_queues[queue_name];
+            auto queue = std::make_shared<queue_t>();
+            try {
+                queue->m_config = config;
+                configureQueue(*queue, queue_name, true);
+                m_queues.emplace(queue_name, std::move(queue));
+            } catch(const std::exception& ex) {
+                queue->m_keep_file = false;
+                result.first = false;
+                result.second = std::string("Invalid queue configuration: ") + ex.what();
+            }
         }
         req.respond(result);
     }
 
+    /**
+     * Sets the capacity of a queue from its configuration. The
+     * capacity of a sharded queue is split evenly among its shards.
+     * For a new persistent queue, create_log makes this function
+     * create its log.
+     */
+    void configureQueue(queue_t& queue, const std::string& queue_name, bool create_log) {
+        if(queue.m_config.empty()) return;
+        auto config = json::parse(queue.m_config);
+        size_t num_shards = std::max<size_t>(config.value("num_shards", 1), 1);
+        size_t max_items  = config.value("max_items", 0);
+        size_t max_bytes  = config.value("max_bytes", 0);
+        queue.m_max_items = (max_items + num_shards - 1) / num_shards;
+        queue.m_max_bytes = (max_bytes + num_shards - 1) / num_shards;
+        queue.m_spill     = config.value("spill", false);
+        if(config.value("persistent", false)) {
+            // the overflow of a persistent queue stays in its log
+            if(m_persistent_directory.empty())
+                throw std::runtime_error("QueueProvider has no persistent_directory");
+            queue.m_sync = m_sync;
+            if(create_log) {
+                queue.m_file_path = logPath(queue_name);
+                queue.createLog();
+            }
+        } else if(queue.m_spill) {
+            queue.m_file_path = m_spill_directory + "/hepnos-queue-"
+                + std::to_string(getpid()) + "-" + std::to_string(get_provider_id())
+                + "-" + std::to_string(m_num_spill_files++) + ".spill";
+        }
+    }
+
+    /**
+     * Path of the log of a persistent queue. The name of the
+     * queue is hex-encoded to form a valid file name.
+     */
+    std::string logPath(const std::string& queue_name) const {
+        return m_persistent_directory + "/" + s_log_prefix
+            + std::to_string(get_provider_id()) + "-"
+            + queue_provider::encodeQueueName(queue_name) + s_log_suffix;
+    }
+
+    /**
+     * Reloads the persistent queues of this provider
+     * from the logs in its persistent_directory.
+     */
+    void loadQueues() {
+        auto dir = opendir(m_persistent_directory.c_str());
+        if(!dir) return;
+        auto prefix = std::string(s_log_prefix) + std::to_string(get_provider_id()) + "-";
+        std::string suffix = s_log_suffix;
+        while(auto entry = readdir(dir)) {
+            std::string file_name = entry->d_name;
+            if(file_name.size() <= prefix.size() + suffix.size()
+            || file_name.compare(0, prefix.size(), prefix) != 0
+            || file_name.compare(file_name.size() - suffix.size(), suffix.size(), suffix) != 0)
+                continue;
+            auto encoded = file_name.substr(prefix.size(),
+                    file_name.size() - prefix.size() - suffix.size());
+            std::string queue_name;
+            if(!queue_provider::decodeQueueName(encoded, queue_name))
+                continue;
+            auto queue = std::make_shared<queue_t>();
+            try {
+                queue->m_file_path = m_persistent_directory + "/" + file_name;
+                queue->openLog();
+                configureQueue(*queue, queue_name, false);
+                queue->recover();
+                m_queues[queue_name] = std::move(queue);
+            } catch(const std::exception&) {
+                // leave the log for inspection
+            }
+        }
+        closedir(dir);
+    }
+
+    /**
+     * Looks up a queue. The lock on the queues is released before
+     * returning, so that callers may block on the queue without
+     * preventing queues from being created or destroyed.
+     */
+    std::shared_ptr<queue_t> findQueue(const std::string& queue_name) {
+        m_queues_lock.rdlock();
+        std::unique_lock<tl::rwlock> guard(m_queues_lock, std::adopt_lock);
+        auto it = m_queues.find(queue_name);
+        if(it == m_queues.end()) return nullptr;
+        return it->second;
+    }
+
+    /**
+     * Responds with the configuration of the queue on success.
+     */
     void openQueue(const tl::request& req,
                    const std::string& queue_name,
                    bool as_producer) {
-        m_queues_lock.rdlock();
-        std::unique_lock<tl::rwlock> guard(m_queues_lock, std::adopt_lock);
+        auto queue = findQueue(queue_name);
         auto result = std::make_pair<bool, std::string>(true, "");
-        auto it = m_queues.find(queue_name);
-        if(it == m_queues.end()) {
+        if(!queue) {
             result.first = false;
             result.second = "Queue does not exist";
         } else {
             if(as_producer) {
-                it->second.m_producers += 1;
+                queue->m_producers += 1;
             }
+            result.second = queue->m_config;
         }
         req.respond(result);
     }
@@ -119,17 +229,19 @@ class QueueProvider : public tl::provider<QueueProvider> {
     void closeQueue(const tl::request& req,
                     const std::string& queue_name,
                     bool as_producer) {
-        m_queues_lock.rdlock();
-        std::unique_lock<tl::rwlock> guard(m_queues_lock, std::adopt_lock);
+        auto queue = findQueue(queue_name);
         auto result = std::make_pair<bool, std::string>(true, "");
-        auto it = m_queues.find(queue_name);
-        if(it == m_queues.end()) {
+        if(!queue) {
             result.first = false;
             result.second = "Queue does not exist";
         } else {
             if(as_producer) {
-                it->second.m_producers -= 1;
-                it->second.m_cv.notify_all();
+                {
+                    std::unique_lock<tl::mutex> lock(queue->m_mutex);
+                    if(!queue->m_destroyed)
+                        queue->m_producers -= 1;
+                }
+                queue->m_cv.notify_all();
             }
         }
         req.respond(result);
@@ -137,62 +249,106 @@ class QueueProvider : public tl::provider<QueueProvider> {
 
     void destroyQueue(const tl::request& req,
                       const std::string& queue_name) {
-        m_queues_lock.wrlock();
-        std::unique_lock<tl::rwlock> guard(m_queues_lock, std::adopt_lock);
+        std::shared_ptr<queue_t> queue;
+        {
+            m_queues_lock.wrlock();
+            std::unique_lock<tl::rwlock> guard(m_queues_lock, std::adopt_lock);
+            auto it = m_queues.find(queue_name);
+            if(it != m_queues.end()) {
+                queue = std::move(it->second);
+                m_queues.erase(it);
+            }
+        }
         auto result = std::make_pair<bool, std::string>(true, "");
-        auto it = m_queues.find(queue_name);
-        if(it == m_queues.end()) {
+        if(!queue) {
             result.first = false;
             result.second = "Queue does not exist";
         } else {
-            m_queues.erase(it);
+            queue->destroy();
         }
         req.respond(result);
     }
 
     void queueEmpty(const tl::request& req,
                     const std::string& queue_name) {
-        m_queues_lock.rdlock();
-        std::unique_lock<tl::rwlock> guard(m_queues_lock, std::adopt_lock);
+        auto queue = findQueue(queue_name);
         auto result = std::make_pair<bool, std::string>(false, "");
-        auto it = m_queues.find(queue_name);
-        if(it == m_queues.end()) {
+        if(!queue) {
             result.first = false;
             result.second = "Queue does not exist";
         } else {
-            result.first = it->second.empty();
+            result.first = queue->empty();
         }
         req.respond(result);
     }
 
+    /**
+     * Pushes an item, waiting for space if the queue is full and wait
+     * is true. A false flag with an empty message means that the queue
+     * was full and wait was false.
+     */
     void queuePush(const tl::request& req,
                    const std::string& queue_name,
-                   std::string& value) {
-        m_queues_lock.rdlock();
-        std::unique_lock<tl::rwlock> guard(m_queues_lock, std::adopt_lock);
+                   std::string& value,
+                   bool wait) {
+        auto queue = findQueue(queue_name);
         auto result = std::make_pair<bool, std::string>(true, "");
-        auto it = m_queues.find(queue_name);
-        if(it == m_queues.end()) {
+        if(!queue) {
             result.first = false;
             result.second = "Queue does not exist";
         } else {
-            it->second.push(std::move(value));
+            try {
+                result.first = queue->push(std::move(value), wait);
+            } catch(const std::exception& ex) {
+                result.first = false;
+                result.second = ex.what();
+            }
+        }
+        req.respond(result);
+    }
+
+    /**
+     * Same as queuePush for an item that this function pulls from
+     * the client's memory.
+     */
+    void queuePushBulk(const tl::request& req,
+                       const std::string& queue_name,
+                       size_t size,
+                       tl::bulk& remote_mem,
+                       bool wait) {
+        auto queue = findQueue(queue_name);
+        auto result = std::make_pair<bool, std::string>(true, "");
+        if(!queue) {
+            result.first = false;
+            result.second = "Queue does not exist";
+        } else {
+            try {
+                std::string value(size, '\0');
+                if(size != 0) {
+                    std::vector<std::pair<void*, size_t>> segment =
+                        {{ const_cast<char*>(value.data()), size }};
+                    auto local_mem = m_engine.expose(segment, tl::bulk_mode::write_only);
+                    remote_mem.select(0, size).on(req.get_endpoint()) >> local_mem;
+                }
+                result.first = queue->push(std::move(value), wait);
+            } catch(const std::exception& ex) {
+                result.first = false;
+                result.second = ex.what();
+            }
         }
         req.respond(result);
     }
 
     void queuePop(const tl::request& req,
                   const std::string& queue_name) {
-        m_queues_lock.rdlock();
-        std::unique_lock<tl::rwlock> guard(m_queues_lock, std::adopt_lock);
+        auto queue = findQueue(queue_name);
         auto result = std::make_pair<bool, std::string>(true, "");
-        auto it = m_queues.find(queue_name);
-        if(it == m_queues.end()) {
+        if(!queue) {
             result.first = false;
             result.second = "Queue does not exist";
         } else {
             try {
-                result.second = it->second.pop();
+                result.second = queue->pop();
             } catch(const no_producer&) {
                 result.first = false;
             }
@@ -200,6 +356,98 @@ class QueueProvider : public tl::provider<QueueProvider> {
         req.respond(result);
     }
 
+    void queuePushMany(const tl::request& req,
+                       const std::string& queue_name,
+                       std::vector<std::string>& values) {
+        auto queue = findQueue(queue_name);
+        auto result = std::make_pair<bool, std::string>(true, "");
+        if(!queue) {
+            result.first = false;
+            result.second = "Queue does not exist";
+        } else {
+            try {
+                queue->pushMany(values);
+            } catch(const std::exception& ex) {
+                result.first = false;
+                result.second = ex.what();
+            }
+        }
+        req.respond(result);
+    }
+
+    /**
+     * Responds with up to max items, waiting at most timeout seconds
+     * (forever if negative) for one to arrive. As with queuePop, a false
+     * flag with no items means that all the producers have closed the
+     * queue, and a false flag with one item means that this item is an
+     * error message. A true flag with no items means that none arrived
+     * in time. Items of bulk_threshold bytes or more that fit in the
+     * client's buffer are pushed into it, one after the other; the
+     * third element of the response gives their sizes (0 for the items
+     * sent in the response).
+     */
+    void queuePopMany(const tl::request& req,
+                      const std::string& queue_name,
+                      size_t max,
+                      double timeout,
+                      size_t bulk_threshold,
+                      tl::bulk& remote_mem) {
+        auto queue = findQueue(queue_name);
+        std::tuple<bool, std::vector<std::string>, std::vector<uint64_t>> result;
+        std::get<0>(result) = true;
+        auto& values = std::get<1>(result);
+        auto& bulk_sizes = std::get<2>(result);
+        if(!queue) {
+            std::get<0>(result) = false;
+            values.push_back("Queue does not exist");
+        } else {
+            try {
+                queue->popMany(std::max<size_t>(max, 1), timeout, values);
+            } catch(const no_producer&) {
+                std::get<0>(result) = false;
+            }
+        }
+        if(std::get<0>(result) && bulk_threshold != 0 && !remote_mem.is_null()) {
+            try {
+                sendLargeItems(req, values, bulk_threshold, remote_mem, bulk_sizes);
+            } catch(const std::exception&) {
+                // the items are sent in the response instead
+                bulk_sizes.clear();
+            }
+        }
+        req.respond(result);
+    }
+
+    /**
+     * Pushes the large items into the client's buffer and clears them.
+     */
+    void sendLargeItems(const tl::request& req,
+                        std::vector<std::string>& values,
+                        size_t bulk_threshold,
+                        tl::bulk& remote_mem,
+                        std::vector<uint64_t>& bulk_sizes) {
+        std::vector<std::pair<void*, size_t>> segments;
+        size_t capacity = remote_mem.size();
+        size_t offset = 0;
+        bulk_sizes.assign(values.size(), 0);
+        for(size_t i = 0; i < values.size(); i++) {
+            auto size = values[i].size();
+            if(size < bulk_threshold || offset + size > capacity) continue;
+            segments.emplace_back(const_cast<char*>(values[i].data()), size);
+            bulk_sizes[i] = size;
+            offset += size;
+        }
+        if(segments.empty()) {
+            bulk_sizes.clear();
+            return;
+        }
+        auto local_mem = m_engine.expose(segments, tl::bulk_mode::read_only);
+        remote_mem.select(0, offset).on(req.get_endpoint()) << local_mem;
+        for(size_t i = 0; i < values.size(); i++) {
+            if(bulk_sizes[i] != 0) std::string().swap(values[i]);
+        }
+    }
+
     tl::engine           m_engine;
     tl::remote_procedure m_rpc_create_queue;
     tl::remote_procedure m_rpc_open_queue;
@@ -208,9 +456,19 @@ class QueueProvider : public tl::provider<QueueProvider> {
     tl::remote_procedure m_rpc_queue_empty;
     tl::remote_procedure m_rpc_queue_push;
     tl::remote_procedure m_rpc_queue_pop;
-
-    std::unordered_map<std::string, queue_t> m_queues;
-    tl::rwlock                               m_queues_lock;
+    tl::remote_procedure m_rpc_queue_push_many;
+    tl::remote_procedure m_rpc_queue_pop_many;
+    tl::remote_procedure m_rpc_queue_push_bulk;
+
+    std::unordered_map<std::string, std::shared_ptr<queue_t>> m_queues;
+    tl::rwlock                                                m_queues_lock;
+    std::string                              m_spill_directory; // where queues write their overflow
+    std::atomic<uint64_t>                    m_num_spill_files{0};
+    std::string                              m_persistent_directory; // where persistent queues keep their log (empty to disable them)
+    bool                                     m_sync = false;         // sync logs to disk on each commit
+
+    static constexpr const char* s_log_prefix = "hepnos-queue-";
+    static constexpr const char* s_log_suffix = ".log";
 };
 
 }
@@ -235,8 +493,8 @@ class HEPnOSQueueProviderFactory : public bedrock::AbstractServiceFactory {
     }
 
     std::string getProviderConfig(void *p) override {
-        (void)p;
-        return "{}";
+        auto provider = static_cast<hepnos::QueueProvider *>(p);
+        return provider->getConfig();
     }
 
     void *initClient(const bedrock::FactoryArgs& args) override {
@@ -0,0 +1,508 @@
+/*
+ * (C) 2026 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#ifndef __HEPNOS_QUEUE_PROVIDER_IMPL_HPP
+#define __HEPNOS_QUEUE_PROVIDER_IMPL_HPP
+
+#include <thallium.hpp>
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <vector>
+#include <string>
+#include <ctime>
+#include <cstdio>
+#include <stdexcept>
+#include <cstring>
+#include <cstddef>
+#include <unistd.h>
+
+namespace hepnos {
+
+/**
+ * Internals of the QueueProvider, kept in a header so that the
+ * logs of persistent queues can be tested without a provider.
+ */
+namespace queue_provider {
+
+namespace tl = thallium;
+
+/**
+ * Hex-encodes the name of a queue to form a valid file name.
+ */
+inline std::string encodeQueueName(const std::string& queue_name) {
+    static const char digits[] = "0123456789abcdef";
+    std::string encoded;
+    encoded.reserve(2*queue_name.size());
+    for(unsigned char c : queue_name) {
+        encoded += digits[c >> 4];
+        encoded += digits[c & 0xf];
+    }
+    return encoded;
+}
+
+/**
+ * Decodes a name encoded with encodeQueueName.
+ * Returns false if encoded is not a valid encoding.
+ */
+inline bool decodeQueueName(const std::string& encoded, std::string& queue_name) {
+    if(encoded.size() % 2 != 0) return false;
+    auto value = [](char c) {
+        if(c >= '0' && c <= '9') return c - '0';
+        if(c >= 'a' && c <= 'f') return c - 'a' + 10;
+        if(c >= 'A' && c <= 'F') return c - 'A' + 10;
+        return -1;
+    };
+    queue_name.clear();
+    queue_name.reserve(encoded.size()/2);
+    for(size_t i = 0; i < encoded.size(); i += 2) {
+        int high = value(encoded[i]);
+        int low  = value(encoded[i+1]);
+        if(high < 0 || low < 0) return false;
+        queue_name += static_cast<char>((high << 4) | low);
+    }
+    return true;
+}
+
+struct no_producer : public std::exception {};
+
+/**
+ * Contiguous ring buffer of items, doubling its capacity when full.
+ */
+struct ring_buffer_t {
+
+    std::vector<std::string> m_items;
+    size_t                   m_head = 0;
+    size_t                   m_size = 0;
+
+    bool empty() const {
+        return m_size == 0;
+    }
+
+    size_t size() const {
+        return m_size;
+    }
+
+    void push(std::string&& value) {
+        if(m_size == m_items.size()) grow();
+        m_items[(m_head + m_size) % m_items.size()] = std::move(value);
+        m_size += 1;
+    }
+
+    std::string pop() {
+        std::string result;
+        result.swap(m_items[m_head]);
+        m_head = (m_head + 1) % m_items.size();
+        m_size -= 1;
+        return result;
+    }
+
+    void grow() {
+        std::vector<std::string> items(std::max<size_t>(16, 2*m_items.size()));
+        for(size_t i = 0; i < m_size; i++)
+            items[i].swap(m_items[(m_head + i) % m_items.size()]);
+        m_items.swap(items);
+        m_head = 0;
+    }
+};
+
+/**
+ * Header of the log of a persistent queue. It is followed by the
+ * configuration of the queue, then by the items, each preceded by
+ * its size.
+ */
+struct log_header_t {
+    char     magic[8];    // "HQUEUELG"
+    uint64_t head;        // offset of the oldest item not popped
+    uint64_t config_size; // size of the configuration
+};
+
+struct queue_t {
+
+    ring_buffer_t                                   m_content;
+    mutable tl::mutex                               m_mutex;
+    tl::condition_variable                          m_cv;          // signaled when items are added
+    tl::condition_variable                          m_cv_not_full; // signaled when items are removed
+    std::atomic<uint64_t>                           m_producers{0};
+    bool                                            m_destroyed = false; // set when the queue is destroyed while in use
+    std::string                                     m_config; // options provided by the creator
+    size_t                                          m_bytes = 0;     // size of the items in memory
+    size_t                                          m_max_items = 0; // items kept in memory (0 for no limit)
+    size_t                                          m_max_bytes = 0; // bytes kept in memory (0 for no limit)
+    bool                                            m_spill = false;      // keep the overflow in the file instead of making producers wait
+    bool                                            m_persistent = false; // write every item to the file, kept across restarts
+    bool                                            m_keep_file = false;  // keep the file when the queue is deleted
+    bool                                            m_sync = false;       // sync the log to disk on each commit
+    std::string                                     m_file_path; // spill file, or log of a persistent queue
+    std::FILE*                                      m_file = nullptr;
+    long                                            m_file_start = 0; // offset of the first item in the file
+    long                                            m_file_head = 0;  // offset of the oldest item not popped (persistent queues)
+    long                                            m_file_read = 0;  // offset of the oldest item not in memory
+    long                                            m_file_write = 0; // offset at which to append items
+    size_t                                          m_unloaded = 0;   // number of items in the file but not in memory
+
+    ~queue_t() {
+        if(m_file)
+            std::fclose(m_file);
+        if(!m_file_path.empty() && !m_keep_file)
+            std::remove(m_file_path.c_str());
+    }
+
+    bool empty() const {
+        std::unique_lock<tl::mutex> guard(m_mutex);
+        return m_content.empty();
+    }
+
+    /**
+     * Wakes up the producers and consumers still waiting on a queue
+     * that has been removed from the provider: producers get an
+     * error and consumers are told that there is no producer left.
+     */
+    void destroy() {
+        {
+            std::unique_lock<tl::mutex> guard(m_mutex);
+            m_destroyed = true;
+            m_keep_file = false;
+            m_producers = 0;
+        }
+        m_cv.notify_all();
+        m_cv_not_full.notify_all();
+    }
+
+    /**
+     * Pushes a value, waiting for space if the queue is full and
+     * wait is true. Returns false if the queue is full and wait is false.
+     */
+    bool push(std::string&& value, bool wait) {
+        {
+            std::unique_lock<tl::mutex> guard(m_mutex);
+            if(!store(std::move(value), guard, wait))
+                return false;
+            commit();
+        }
+        m_cv.notify_one();
+        return true;
+    }
+
+    void pushMany(std::vector<std::string>& values) {
+        if(values.empty()) return;
+        {
+            std::unique_lock<tl::mutex> guard(m_mutex);
+            for(auto& value : values)
+                store(std::move(value), guard, true);
+            commit();
+        }
+        m_cv.notify_all();
+    }
+
+    std::string pop() {
+        std::unique_lock<tl::mutex> guard(m_mutex);
+        while(m_content.empty() && m_producers != 0)
+            m_cv.wait(guard);
+        if(m_producers == 0 && m_content.empty())
+            throw no_producer{};
+        auto result = take();
+        tryCommit();
+        guard.unlock();
+        m_cv_not_full.notify_all();
+        return result;
+    }
+
+    /**
+     * Pops up to max values, waiting at most timeout seconds for
+     * one to arrive (forever if timeout is negative). values is
+     * left empty if none arrived in time.
+     */
+    void popMany(size_t max, double timeout, std::vector<std::string>& values) {
+        std::unique_lock<tl::mutex> guard(m_mutex);
+        if(timeout < 0) {
+            while(m_content.empty() && m_producers != 0)
+                m_cv.wait(guard);
+        } else if(timeout > 0 && m_content.empty() && m_producers != 0) {
+            struct timespec ts;
+            clock_gettime(CLOCK_REALTIME, &ts);
+            long nsec = ts.tv_nsec + static_cast<long>((timeout - static_cast<time_t>(timeout))*1e9);
+            ts.tv_sec += static_cast<time_t>(timeout) + nsec / 1000000000L;
+            ts.tv_nsec = nsec % 1000000000L;
+            while(m_content.empty() && m_producers != 0) {
+                if(!m_cv.wait_until(guard, &ts)) break;
+            }
+        }
+        if(m_producers == 0 && m_content.empty())
+            throw no_producer{};
+        while(values.size() < max && !m_content.empty())
+            values.push_back(take());
+        if(!values.empty()) tryCommit();
+        guard.unlock();
+        if(!values.empty()) m_cv_not_full.notify_all();
+    }
+
+    /**
+     * Creates the log of a persistent queue.
+     */
+    void createLog() {
+        m_persistent = m_keep_file = true;
+        m_file = std::fopen(m_file_path.c_str(), "w+b");
+        if(!m_file)
+            throw std::runtime_error("Could not create queue log " + m_file_path);
+        m_file_start = sizeof(log_header_t) + m_config.size();
+        m_file_head = m_file_read = m_file_write = m_file_start;
+        if(!writeLogHeader(m_file, m_config, m_file_head) || std::fflush(m_file) != 0)
+            throw std::runtime_error("Could not write to queue log " + m_file_path);
+    }
+
+    /**
+     * Opens the log of a persistent queue left by a previous
+     * run of the provider and reads its configuration.
+     */
+    void openLog() {
+        m_persistent = m_keep_file = true;
+        m_file = std::fopen(m_file_path.c_str(), "r+b");
+        if(!m_file)
+            throw std::runtime_error("Could not open queue log " + m_file_path);
+        log_header_t header;
+        if(std::fread(&header, sizeof(header), 1, m_file) != 1
+        || std::memcmp(header.magic, "HQUEUELG", sizeof(header.magic)) != 0)
+            throw std::runtime_error("Invalid queue log " + m_file_path);
+        m_config.resize(header.config_size);
+        if(header.config_size
+        && std::fread(const_cast<char*>(m_config.data()), header.config_size, 1, m_file) != 1)
+            throw std::runtime_error("Invalid queue log " + m_file_path);
+        m_file_start = sizeof(header) + header.config_size;
+        m_file_head = std::max<long>(header.head, m_file_start);
+    }
+
+    /**
+     * Reloads the items of a persistent queue from its log, once
+     * its capacity is configured. An item truncated by a crash is
+     * dropped.
+     */
+    void recover() {
+        if(std::fseek(m_file, 0, SEEK_END) != 0)
+            throw std::runtime_error("Could not read from queue log " + m_file_path);
+        long file_size = std::ftell(m_file);
+        long offset = std::min(m_file_head, file_size);
+        m_file_head = m_file_read = offset;
+        while(offset + static_cast<long>(sizeof(uint64_t)) <= file_size) {
+            uint64_t size;
+            if(std::fseek(m_file, offset, SEEK_SET) != 0
+            || std::fread(&size, sizeof(size), 1, m_file) != 1)
+                throw std::runtime_error("Could not read from queue log " + m_file_path);
+            long next = offset + sizeof(size) + size;
+            if(next > file_size) break;
+            if(m_unloaded == 0 && !full(size)) {
+                std::string value(size, '\0');
+                if(size && std::fread(const_cast<char*>(value.data()), size, 1, m_file) != 1)
+                    throw std::runtime_error("Could not read from queue log " + m_file_path);
+                m_bytes += value.size();
+                m_content.push(std::move(value));
+                m_file_read = next;
+            } else {
+                m_unloaded += 1;
+            }
+            offset = next;
+        }
+        m_file_write = offset;
+        if(m_file_write < file_size) {
+            std::fflush(m_file);
+            if(ftruncate(fileno(m_file), m_file_write) != 0) {
+                // the truncated item will be overwritten
+            }
+        }
+        commit();
+    }
+
+    private:
+
+    /**
+     * Offset above which the popped items at the beginning of a log
+     * are discarded, when they take more space than the remaining ones.
+     */
+    static constexpr long s_compaction_threshold = 64L*1024*1024;
+
+    static bool writeLogHeader(std::FILE* file, const std::string& config, uint64_t head) {
+        log_header_t header;
+        std::memcpy(header.magic, "HQUEUELG", sizeof(header.magic));
+        header.head        = head;
+        header.config_size = config.size();
+        return std::fseek(file, 0, SEEK_SET) == 0
+            && std::fwrite(&header, sizeof(header), 1, file) == 1
+            && (config.empty() || std::fwrite(config.data(), config.size(), 1, file) == 1);
+    }
+
+    /**
+     * Checks whether a value of the given size would exceed the
+     * capacity. A value is always accepted in an empty queue.
+     */
+    bool full(size_t size) const {
+        if(m_content.empty()) return false;
+        return (m_max_items && m_content.size() >= m_max_items)
+            || (m_max_bytes && m_bytes + size > m_max_bytes);
+    }
+
+    bool store(std::string&& value, std::unique_lock<tl::mutex>& guard, bool wait) {
+        // once items are left in the file, new ones go after them to keep the order
+        if(m_unloaded == 0 && !full(value.size())) {
+            keep(std::move(value));
+            return true;
+        }
+        if(m_spill) {
+            append(value);
+            m_unloaded += 1;
+            return true;
+        }
+        if(!wait) return false;
+        // consumers may be waiting for the items stored so far
+        m_cv.notify_all();
+        while(!m_destroyed && (m_unloaded != 0 || full(value.size())))
+            m_cv_not_full.wait(guard);
+        if(m_destroyed)
+            throw std::runtime_error("Queue was destroyed");
+        keep(std::move(value));
+        return true;
+    }
+
+    /**
+     * Adds a value in memory, writing it to the log first
+     * if the queue is persistent.
+     */
+    void keep(std::string&& value) {
+        if(m_persistent) {
+            append(value);
+            m_file_read = m_file_write;
+        }
+        m_bytes += value.size();
+        m_content.push(std::move(value));
+    }
+
+    std::string take() {
+        auto result = m_content.pop();
+        m_bytes -= result.size();
+        if(m_persistent)
+            m_file_head += sizeof(uint64_t) + result.size();
+        try {
+            while(m_unloaded != 0 && load());
+        } catch(const std::exception&) {
+            // the items left in the file will be read on the next attempt
+        }
+        return result;
+    }
+
+    void append(const std::string& value) {
+        if(!m_file) {
+            m_file = std::fopen(m_file_path.c_str(), "w+b");
+            if(!m_file)
+                throw std::runtime_error("Could not open spill file " + m_file_path);
+        }
+        uint64_t size = value.size();
+        if(std::fseek(m_file, m_file_write, SEEK_SET) != 0
+        || std::fwrite(&size, sizeof(size), 1, m_file) != 1
+        || (size && std::fwrite(value.data(), size, 1, m_file) != 1))
+            throw std::runtime_error("Could not write to " + m_file_path);
+        m_file_write += sizeof(size) + size;
+    }
+
+    /**
+     * Moves the oldest item left in the file to memory if it fits.
+     */
+    bool load() {
+        uint64_t size;
+        if(std::fseek(m_file, m_file_read, SEEK_SET) != 0
+        || std::fread(&size, sizeof(size), 1, m_file) != 1)
+            throw std::runtime_error("Could not read from " + m_file_path);
+        if(full(size)) return false;
+        std::string value(size, '\0');
+        if(size && std::fread(const_cast<char*>(value.data()), size, 1, m_file) != 1)
+            throw std::runtime_error("Could not read from " + m_file_path);
+        m_file_read += sizeof(size) + size;
+        m_unloaded -= 1;
+        if(m_unloaded == 0 && !m_persistent) {
+            // reuse the spill file from the start
+            m_file_read = m_file_write = 0;
+            std::fflush(m_file);
+            if(ftruncate(fileno(m_file), 0) != 0) {
+                // the file simply keeps its size
+            }
+        }
+        m_bytes += value.size();
+        m_content.push(std::move(value));
+        return true;
+    }
+
+    /**
+     * Makes the items written to the log and the items popped since
+     * the last commit durable, with a single flush (and sync).
+     */
+    void commit() {
+        if(!m_persistent) return;
+        if(m_file_head == m_file_write) {
+            // everything was popped, reuse the log from the start
+            m_file_head = m_file_read = m_file_write = m_file_start;
+            std::fflush(m_file);
+            if(ftruncate(fileno(m_file), m_file_start) != 0) {
+                // the log simply keeps its size
+            }
+        } else if(m_file_head - m_file_start > s_compaction_threshold
+               && m_file_head - m_file_start > m_file_write - m_file_head) {
+            compact();
+        }
+        uint64_t head = m_file_head;
+        if(std::fseek(m_file, offsetof(log_header_t, head), SEEK_SET) != 0
+        || std::fwrite(&head, sizeof(head), 1, m_file) != 1
+        || std::fflush(m_file) != 0
+        || (m_sync && fdatasync(fileno(m_file)) != 0))
+            throw std::runtime_error("Could not write to queue log " + m_file_path);
+    }
+
+    /**
+     * Same as commit for pops, which cannot fail once items are taken.
+     */
+    void tryCommit() {
+        try {
+            commit();
+        } catch(const std::exception&) {
+            // the head will be written by the next commit
+        }
+    }
+
+    /**
+     * Rewrites the log without its popped items.
+     */
+    void compact() {
+        auto tmp_path = m_file_path + ".tmp";
+        auto tmp = std::fopen(tmp_path.c_str(), "w+b");
+        if(!tmp) return;
+        bool ok = writeLogHeader(tmp, m_config, m_file_start)
+               && std::fseek(m_file, m_file_head, SEEK_SET) == 0;
+        std::vector<char> buffer(1024*1024);
+        long remaining = m_file_write - m_file_head;
+        while(ok && remaining > 0) {
+            size_t n = std::min<long>(remaining, buffer.size());
+            ok = std::fread(buffer.data(), n, 1, m_file) == 1
+              && std::fwrite(buffer.data(), n, 1, tmp) == 1;
+            remaining -= n;
+        }
+        ok = ok && std::fflush(tmp) == 0
+                && (!m_sync || fdatasync(fileno(tmp)) == 0)
+                && std::rename(tmp_path.c_str(), m_file_path.c_str()) == 0;
+        if(!ok) {
+            std::fclose(tmp);
+            std::remove(tmp_path.c_str());
+            return;
+        }
+        std::fclose(m_file);
+        m_file = tmp;
+        long discarded = m_file_head - m_file_start;
+        m_file_head  -= discarded;
+        m_file_read  -= discarded;
+        m_file_write -= discarded;
+    }
+};
+
+}
+
+}
+
+#endif
@@ -218,6 +218,14 @@ Run::iterator Run::begin() {
 }
 
 Run::iterator Run::begin(const Prefetcher& prefetcher) {
+    std::shared_ptr<ItemImpl> first;
+    if(prefetcher.m_impl->takeLookahead(m_impl, first)) {
+        // subruns were already prefetched by a parent prefetcher
+        if(!first) return end();
+        iterator it(SubRun(std::move(first)));
+        it.m_impl->setPrefetcher(prefetcher.m_impl);
+        return it;
+    }
     auto it = begin();
     if(it != end()) {
         it.m_impl->setPrefetcher(prefetcher.m_impl);
@@ -223,6 +223,14 @@ SubRun::iterator SubRun::begin() {
 }
 
 SubRun::iterator SubRun::begin(const Prefetcher& prefetcher) {
+    std::shared_ptr<ItemImpl> first;
+    if(prefetcher.m_impl->takeLookahead(m_impl, first)) {
+        // events were already prefetched by a parent prefetcher
+        if(!first) return end();
+        iterator it(Event(std::move(first)));
+        it.m_impl->setPrefetcher(prefetcher.m_impl);
+        return it;
+    }
     auto it = begin();
     if(it != end()) {
         it.m_impl->setPrefetcher(prefetcher.m_impl);
@@ -7,6 +7,7 @@
 #define __HEPNOS_SYNC_PREFETCHER_IMPL_HPP
 
 #include <set>
+#include <algorithm>
 #include <unordered_set>
 #include <unordered_map>
 #include "ProductCacheImpl.hpp"
@@ -20,24 +21,36 @@ class SyncPrefetcherImpl : public PrefetcherImpl {
 
     public:
 
+    mutable bool m_exhausted = false; // the item cache contains all the remaining items
+
     SyncPrefetcherImpl(const std::shared_ptr<DataStoreImpl>& ds)
     : PrefetcherImpl(ds) {}
 
-    void fetchRequestedProducts(const std::shared_ptr<ItemImpl>& itemImpl) const override {
-        auto& descriptor = itemImpl->m_descriptor;
-        for(auto& key : m_active_product_keys) {
-            auto product_id = DataStoreImpl::makeProductID(
-                descriptor, key.label.c_str(), key.label.size(),
-                key.type.c_str(), key.type.size());
-            if(m_product_cache.m_impl->hasProduct(product_id))
-                continue;
-            std::string data;
-            bool ok = m_datastore->loadRawProduct(product_id, data);
-            if(ok) {
-                update_product_statistics(data.size());
-                m_product_cache.m_impl->addRawProduct(product_id, std::move(data));
-            }
-        }
+    using PrefetcherImpl::fetchRequestedProducts;
+
+    void fetchRequestedProducts(const std::vector<std::shared_ptr<ItemImpl>>& items) const override {
+        if(m_active_product_keys.empty()) return;
+        std::vector<ProductID> product_ids;
+        makeRequestedProductIDs(items, product_ids);
+        product_ids.erase(
+            std::remove_if(product_ids.begin(), product_ids.end(),
+                [this](const ProductID& product_id) {
+                    return m_product_cache.m_impl->hasProduct(product_id)
+                        || m_product_cache.m_impl->checkNotFound(product_id);
+                }),
+            product_ids.end());
+        size_t num_bytes = 0;
+        m_datastore->loadRawProductsPacked(product_ids,
+            [this, &num_bytes](const ProductID& product_id, bool found, std::string&& data) {
+                if(found) {
+                    num_bytes += data.size();
+                    update_product_statistics(data.size());
+                    m_product_cache.m_impl->assembleAndAddRawProduct(product_id, std::move(data));
+                } else {
+                    m_product_cache.m_impl->addNotFound(product_id);
+                }
+            });
+        record_product_bytes(items.size(), num_bytes);
     }
 
     void prefetchFrom(const ItemType& item_type,
@@ -46,19 +59,40 @@ class SyncPrefetcherImpl : public PrefetcherImpl {
             int target=-1) const override
     {
         auto last = current;
-        while(m_item_cache.size() != m_cache_size) {
+        m_exhausted = false;
+        while(m_item_cache.size() < m_cache_size) {
             std::vector<std::shared_ptr<ItemImpl>> items;
-            size_t s = m_datastore->nextItems(item_type, prefix_type, last, items, m_batch_size, target);
+            size_t batch_size = m_batch_size;
+            double t1 = wtime();
+            size_t s = m_datastore->nextItems(item_type, prefix_type, last, items, batch_size, target);
             if(s != 0) {
                 update_batch_statistics(s);
                 last = items[items.size()-1];
             }
+            fetchParentProducts(items);
+            fetchRequestedProducts(items);
+            // the consumer is blocked while items and products are fetched
+            record_item_fetch(s, wtime()-t1);
+            prefetchChildren(items);
             for(auto& item : items) {
-                fetchRequestedProducts(item);
                 m_item_cache.insert(std::move(item));
             }
-            if(s < m_batch_size) break;
+            if(s < batch_size) {
+                m_exhausted = true;
+                break;
+            }
+        }
+    }
+
+    void startFromItems(const std::shared_ptr<ItemImpl>&,
+                        std::vector<std::shared_ptr<ItemImpl>>&& items,
+                        bool complete) const override
+    {
+        m_item_cache.clear();
+        for(auto& item : items) {
+            m_item_cache.insert(std::move(item));
         }
+        m_exhausted = complete;
     }
 
     size_t nextItems(
@@ -69,9 +103,14 @@ class SyncPrefetcherImpl : public PrefetcherImpl {
             size_t maxItems,
             int target=-1) const override
     {
+        record_consumption_start();
         auto ub = m_item_cache.upper_bound(current);
         if(ub == m_item_cache.end()) {
             m_item_cache.clear();
+            if(m_exhausted) {
+                m_exhausted = false;
+                return 0;
+            }
             prefetchFrom(item_type, prefix_type, current, target);
         }
         ub = m_item_cache.upper_bound(current);
@@ -85,7 +124,9 @@ class SyncPrefetcherImpl : public PrefetcherImpl {
                 result.push_back(*it);
             }
             m_item_cache.erase(ub, it);
+            evictParentProducts(result.front()->m_descriptor);
         }
+        record_consumption_end(result.size());
         return result.size();
     }
 
@@ -95,6 +136,11 @@ class SyncPrefetcherImpl : public PrefetcherImpl {
             if(m_stats) m_stats->product_cache_hit += 1;
             m_product_cache.m_impl->removeRawProduct(product_id);
             return true;
+        } else if(m_product_cache.m_impl->checkNotFound(product_id)) {
+            // product was prefetched and is known not to exist
+            if(m_stats) m_stats->product_cache_hit += 1;
+            m_product_cache.m_impl->removeRawProduct(product_id);
+            return false;
         } else {
             if(m_stats) m_stats->product_cache_miss += 1;
             return m_datastore->loadRawProduct(product_id, data);
@@ -110,6 +156,11 @@ class SyncPrefetcherImpl : public PrefetcherImpl {
             if(*vsize) std::memcpy(value, data.data(), *vsize);
             m_product_cache.m_impl->removeRawProduct(product_id);
             return true;
+        } else if(m_product_cache.m_impl->checkNotFound(product_id)) {
+            // product was prefetched and is known not to exist
+            if(m_stats) m_stats->product_cache_hit += 1;
+            m_product_cache.m_impl->removeRawProduct(product_id);
+            return false;
         } else {
             if(m_stats) m_stats->product_cache_miss += 1;
             return m_datastore->loadRawProduct(product_id, value, vsize);
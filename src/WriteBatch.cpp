@@ -61,6 +61,10 @@ bool WriteBatch::loadRawData(const ProductID& key, char* value, size_t* vsize) c
     return m_impl->m_datastore->loadRawProduct(key, value, vsize);
 }
 
+bool WriteBatch::assembleChunks(const ProductID& key, std::string& buffer) const {
+    return m_impl->m_datastore->assembleChunks(key, buffer);
+}
+
 bool WriteBatch::valid() const {
     return static_cast<bool>(m_impl);
 }
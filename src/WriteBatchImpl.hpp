@@ -155,6 +155,7 @@ class WriteBatchImpl {
     ProductID storeRawProduct(const ProductID& product_id,
                               const char* value, size_t vsize)
     {
+        m_datastore->invalidateCachedProduct(product_id);
         // locate db
         auto& db = m_datastore->locateProductDb(product_id);
         // insert in the map of entries
@@ -0,0 +1,188 @@
+#include <algorithm>
+#include <thallium.hpp>
+#include "EventDispatcherTest.hpp"
+#include "CppUnitAdditionalMacros.hpp"
+
+CPPUNIT_TEST_SUITE_REGISTRATION( EventDispatcherTest );
+
+namespace tl = thallium;
+using namespace hepnos;
+
+void EventDispatcherTest::setUp() {
+    int rank;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    auto ds = datastore->root().createDataSet("dispatched");
+    auto run = ds.createRun(rank);
+    for(unsigned j = 0; j < 4; j++) {
+        auto subrun = run.createSubRun(j);
+        for(unsigned k = 0; k < 4; k++) {
+            subrun.createEvent(k);
+        }
+    }
+    MPI_Barrier(MPI_COMM_WORLD);
+}
+
+void EventDispatcherTest::tearDown() {
+    MPI_Barrier(MPI_COMM_WORLD);
+}
+
+void EventDispatcherTest::testEventDispatcherCreate() {
+    int rank;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    if(rank != 0) return;
+    auto ds = datastore->root()["dispatched"];
+    EventDispatcher dispatcher;
+    CPPUNIT_ASSERT(!dispatcher.valid());
+    CPPUNIT_ASSERT_NO_THROW(
+        dispatcher = datastore->createEventDispatcher("dispatcher_a", ds));
+    CPPUNIT_ASSERT(dispatcher.valid());
+    // same name as the one just created
+    CPPUNIT_ASSERT_THROW(
+        datastore->createEventDispatcher("dispatcher_a", ds),
+        hepnos::Exception);
+    CPPUNIT_ASSERT_NO_THROW(
+        datastore->destroyEventDispatcher("dispatcher_a"));
+    // acquiring from a destroyed dispatcher
+    EventBatch batch;
+    CPPUNIT_ASSERT_THROW(dispatcher.acquire(batch), hepnos::Exception);
+    CPPUNIT_ASSERT_THROW(
+        datastore->destroyEventDispatcher("dispatcher_a"),
+        hepnos::Exception);
+}
+
+void EventDispatcherTest::testEventDispatcherProcess() {
+    int rank, size;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &size);
+    auto ds = datastore->root()["dispatched"];
+
+    EventDispatcher dispatcher;
+    if(rank == 0) {
+        EventDispatcherOptions options;
+        options.batchSize = 4;
+        options.leaseDuration = 1.0;
+        CPPUNIT_ASSERT_NO_THROW(
+            dispatcher = datastore->createEventDispatcher("dispatcher_b", ds, options));
+    }
+    MPI_Barrier(MPI_COMM_WORLD);
+    if(rank != 0) {
+        CPPUNIT_ASSERT_NO_THROW(
+            dispatcher = datastore->openEventDispatcher("dispatcher_b"));
+    }
+
+    // the last rank acquires a batch and never completes it,
+    // so it must be handed out again once its lease expires
+    if(rank == size-1) {
+        EventBatch abandoned;
+        CPPUNIT_ASSERT(dispatcher.acquire(abandoned));
+        CPPUNIT_ASSERT_EQUAL((size_t)4, abandoned.events.size());
+        CPPUNIT_ASSERT(dispatcher.renew(abandoned));
+    }
+
+    uint64_t num_processed = 0;
+    std::vector<uint64_t> runs;
+    CPPUNIT_ASSERT_NO_THROW(
+        num_processed = dispatcher.process(
+            [&runs](const Event& ev) {
+                runs.push_back(ev.subrun().run().number());
+            }));
+    CPPUNIT_ASSERT_EQUAL((size_t)num_processed, runs.size());
+
+    uint64_t total = 0;
+    MPI_Allreduce(&num_processed, &total, 1, MPI_UINT64_T, MPI_SUM, MPI_COMM_WORLD);
+    CPPUNIT_ASSERT_EQUAL((uint64_t)(size*16), total);
+
+    // all the batches are completed
+    EventBatch batch;
+    CPPUNIT_ASSERT(!dispatcher.acquire(batch));
+
+    MPI_Barrier(MPI_COMM_WORLD);
+    if(rank == 0) {
+        CPPUNIT_ASSERT_NO_THROW(
+            datastore->destroyEventDispatcher("dispatcher_b"));
+    }
+}
+
+void EventDispatcherTest::testEventDispatcherRenewal() {
+    int rank, size;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &size);
+    auto ds = datastore->root()["dispatched"];
+
+    EventDispatcher dispatcher;
+    if(rank == 0) {
+        EventDispatcherOptions options;
+        options.batchSize = 8;
+        options.leaseDuration = 0.3;
+        CPPUNIT_ASSERT_NO_THROW(
+            dispatcher = datastore->createEventDispatcher("dispatcher_c", ds, options));
+    }
+    MPI_Barrier(MPI_COMM_WORLD);
+    if(rank != 0) {
+        CPPUNIT_ASSERT_NO_THROW(
+            dispatcher = datastore->openEventDispatcher("dispatcher_c"));
+    }
+
+    // a batch takes longer than the lease to process, so process
+    // must renew it for no batch to be handed out twice
+    uint64_t num_processed = 0;
+    CPPUNIT_ASSERT_NO_THROW(
+        num_processed = dispatcher.process(
+            [](const Event& ev) {
+                double t = tl::timer::wtime();
+                while(tl::timer::wtime() - t < 0.05) {}
+            }));
+
+    uint64_t total = 0;
+    MPI_Allreduce(&num_processed, &total, 1, MPI_UINT64_T, MPI_SUM, MPI_COMM_WORLD);
+    CPPUNIT_ASSERT_EQUAL((uint64_t)(size*16), total);
+
+    MPI_Barrier(MPI_COMM_WORLD);
+    if(rank == 0) {
+        CPPUNIT_ASSERT_NO_THROW(
+            datastore->destroyEventDispatcher("dispatcher_c"));
+    }
+}
+
+void EventDispatcherTest::testEventDispatcherDestroyWhileAcquiring() {
+    int rank;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    if(rank != 0) return;
+    auto ds = datastore->root()["dispatched"];
+
+    EventDispatcherOptions options;
+    options.batchSize = 1024;
+    options.leaseDuration = 60.0;
+    EventDispatcher dispatcher;
+    CPPUNIT_ASSERT_NO_THROW(
+        dispatcher = datastore->createEventDispatcher("dispatcher_d", ds, options));
+    // take the only batch, so that the next acquire waits for its lease
+    EventBatch held;
+    CPPUNIT_ASSERT(dispatcher.acquire(held));
+
+    bool acquire_threw = false;
+    tl::eventual<void> acquire_done;
+    auto pool = tl::xstream::self().get_main_pools(1)[0];
+    pool.make_thread([&]() {
+        EventBatch batch;
+        try {
+            dispatcher.acquire(batch);
+        } catch(const Exception&) {
+            acquire_threw = true;
+        }
+        acquire_done.set_value();
+    }, tl::anonymous());
+    // let the acquire reach the provider and start waiting
+    double t = tl::timer::wtime();
+    while(tl::timer::wtime() - t < 0.2) {
+        tl::thread::yield();
+    }
+
+    // destroying must not wait for the pending acquire,
+    // which is woken up with an error
+    CPPUNIT_ASSERT_NO_THROW(
+        datastore->destroyEventDispatcher("dispatcher_d"));
+    acquire_done.wait();
+    CPPUNIT_ASSERT(acquire_threw);
+    CPPUNIT_ASSERT(tl::timer::wtime() - t < options.leaseDuration);
+}
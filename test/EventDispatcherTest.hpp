@@ -0,0 +1,30 @@
+#ifndef __HEPNOS_TEST_EVENT_DISPATCHER_H
+#define __HEPNOS_TEST_EVENT_DISPATCHER_H
+
+#include <mpi.h>
+#include <cppunit/extensions/HelperMacros.h>
+#include <hepnos.hpp>
+
+extern hepnos::DataStore* datastore;
+
+class EventDispatcherTest : public CppUnit::TestFixture
+{
+    CPPUNIT_TEST_SUITE( EventDispatcherTest );
+    CPPUNIT_TEST( testEventDispatcherCreate );
+    CPPUNIT_TEST( testEventDispatcherProcess );
+    CPPUNIT_TEST( testEventDispatcherRenewal );
+    CPPUNIT_TEST( testEventDispatcherDestroyWhileAcquiring );
+    CPPUNIT_TEST_SUITE_END();
+
+    public:
+
+    void setUp();
+    void tearDown();
+
+    void testEventDispatcherCreate();
+    void testEventDispatcherProcess();
+    void testEventDispatcherRenewal();
+    void testEventDispatcherDestroyWhileAcquiring();
+};
+
+#endif
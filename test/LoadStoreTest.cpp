@@ -1,6 +1,7 @@
 #include "LoadStoreTest.hpp"
 #include "CppUnitAdditionalMacros.hpp"
 #include "TestObjects.hpp"
+#include <array>
 
 CPPUNIT_TEST_SUITE_REGISTRATION( LoadStoreTest );
 
@@ -484,10 +485,12 @@ void LoadStoreTest::testPrefetchLoadStore() {
         Prefetcher p(*datastore);
         p.fetchProduct<TestObjectA>(label);
         p.fetchProduct<TestObjectB>(label);
+        p.fetchProduct<TestObjectA>("missing");
         unsigned i = 0;
         for(auto& run : p(mds.runs())) {
             TestObjectA obj_a;
             TestObjectB obj_b;
+            CPPUNIT_ASSERT(!run.load(p, "missing", obj_a));
             run.load(p, label, obj_a);
             run.load(p, label, obj_b);
             CPPUNIT_ASSERT(obj_a.x() == i);
@@ -523,10 +526,12 @@ void LoadStoreTest::testAsyncPrefetchLoadStore() {
         Prefetcher p(async);
         p.fetchProduct<TestObjectA>(label);
         p.fetchProduct<TestObjectB>(label);
+        p.fetchProduct<TestObjectA>("missing");
         unsigned i = 0;
         for(auto& run : p(mds.runs())) {
             TestObjectA obj_a;
             TestObjectB obj_b;
+            CPPUNIT_ASSERT(!run.load(p, "missing", obj_a));
             run.load(p, label, obj_a);
             run.load(p, label, obj_b);
             CPPUNIT_ASSERT(obj_a.x() == i);
@@ -537,3 +542,390 @@ void LoadStoreTest::testAsyncPrefetchLoadStore() {
         }
     }
 }
+
+void LoadStoreTest::testPrefetchParentProducts() {
+    auto root = datastore->root();
+    auto mds = root.createDataSet("prefetch_parent");
+    std::string label = "conditions";
+    auto run = mds.createRun(0);
+    CPPUNIT_ASSERT(run.valid());
+    {
+        TestObjectA obj_a;
+        TestObjectB obj_b;
+        obj_b.a() = 42;
+        obj_b.b() = "matthieu";
+        run.store(label, obj_b);
+        for(unsigned i = 0; i < 4; i++) {
+            obj_a.x() = i;
+            obj_a.y() = 2*i;
+            auto sr = run.createSubRun(i);
+            CPPUNIT_ASSERT(sr.valid());
+            sr.store(label, obj_a);
+            for(unsigned j = 0; j < 10; j++) {
+                auto ev = sr.createEvent(j);
+                CPPUNIT_ASSERT(ev.valid());
+            }
+        }
+    }
+    {
+        // iterate through the events, loading the products of their parents
+        Prefetcher p(*datastore, 4, 2);
+        p.fetchParentProduct<TestObjectA>(label);
+        p.fetchParentProduct<TestObjectB>(label);
+        p.fetchParentProduct<TestObjectA>("missing");
+        p.activateStatistics();
+        for(unsigned i = 0; i < 4; i++) {
+            auto sr = run[i];
+            unsigned j = 0;
+            for(auto& ev : p(sr)) {
+                CPPUNIT_ASSERT(ev.number() == j);
+                TestObjectA obj_a;
+                TestObjectB obj_b;
+                // the products can be loaded multiple times
+                CPPUNIT_ASSERT(sr.load(p, label, obj_a));
+                CPPUNIT_ASSERT(sr.load(p, label, obj_a));
+                CPPUNIT_ASSERT(obj_a.x() == i);
+                CPPUNIT_ASSERT(obj_a.y() == 2*i);
+                CPPUNIT_ASSERT(run.load(p, label, obj_b));
+                CPPUNIT_ASSERT(obj_b.a() == 42);
+                CPPUNIT_ASSERT(obj_b.b() == "matthieu");
+                CPPUNIT_ASSERT(!sr.load(p, "missing", obj_a));
+                j += 1;
+            }
+            CPPUNIT_ASSERT(j == 10);
+        }
+        PrefetcherStatistics stats;
+        p.collectStatistics(stats);
+        CPPUNIT_ASSERT_EQUAL((size_t)0, stats.product_cache_miss);
+    }
+}
+
+void LoadStoreTest::testCustomSerializer() {
+    auto root = datastore->root();
+    auto mds = root.createDataSet("custom_serializer");
+    auto run = mds.createRun(0);
+    CPPUNIT_ASSERT(run.valid());
+
+    TestObjectFlat out_obj;
+    out_obj.energies() = { 1.0, 2.5, 4.0 };
+    out_obj.name() = "matthieu";
+    std::vector<TestObjectFlat> out_vec(3, out_obj);
+    out_vec[1].energies().clear();
+    out_vec[2].name() = "";
+
+    CPPUNIT_ASSERT(run.store("flat", out_obj).valid());
+    CPPUNIT_ASSERT(run.store("flat", out_vec).valid());
+
+    TestObjectFlat in_obj;
+    CPPUNIT_ASSERT(run.load("flat", in_obj));
+    CPPUNIT_ASSERT(in_obj == out_obj);
+
+    std::vector<TestObjectFlat> in_vec;
+    CPPUNIT_ASSERT(run.load("flat", in_vec));
+    CPPUNIT_ASSERT(in_vec == out_vec);
+
+    // elements whose size is not a multiple of 8 must not
+    // misalign the in-place access to the following ones
+    std::vector<TestObjectFlat> out_unaligned(3);
+    out_unaligned[0].energies() = { 1.0, 2.0 };
+    out_unaligned[0].name() = "muon";
+    out_unaligned[1].energies() = { 3.0 };
+    out_unaligned[1].name() = "x";
+    out_unaligned[2].energies() = { 4.0, 5.0, 6.0 };
+    out_unaligned[2].name() = "electron";
+    CPPUNIT_ASSERT(run.store("flat_unaligned", out_unaligned).valid());
+    std::vector<TestObjectFlat> in_unaligned;
+    CPPUNIT_ASSERT(run.load("flat_unaligned", in_unaligned));
+    CPPUNIT_ASSERT(in_unaligned == out_unaligned);
+
+    // read copies values regardless of the alignment of the buffer
+    std::string buffer(1, '\0');
+    FlatWriter writer(buffer);
+    writer.write(out_unaligned[2].energies());
+    FlatReader reader(buffer.data()+1, buffer.size()-1);
+    std::vector<double> energies;
+    reader.read(energies);
+    CPPUNIT_ASSERT(energies == out_unaligned[2].energies());
+    CPPUNIT_ASSERT_EQUAL((size_t)0, reader.remaining());
+}
+
+void LoadStoreTest::testRawStorage() {
+    static_assert(UseRawStorage<TestObjectRaw>::value,
+            "TestObjectRaw should be stored in raw form");
+    static_assert(UseRawStorage<std::array<int,4>>::value,
+            "std::array<int,4> should be stored in raw form");
+    static_assert(!UseRawStorage<TestObjectFlat>::value,
+            "TestObjectFlat should use its custom Serializer");
+
+    auto root = datastore->root();
+    auto mds = root.createDataSet("raw_storage");
+    auto run = mds.createRun(0);
+    CPPUNIT_ASSERT(run.valid());
+
+    TestObjectRaw out_obj;
+    out_obj.energy = 3.5;
+    std::strcpy(out_obj.tag, "muon");
+    std::array<int,4> out_array = {{ 1, 2, 3, 4 }};
+    std::vector<TestObjectRaw> out_vec(5, out_obj);
+    out_vec[3].id = 7;
+
+    CPPUNIT_ASSERT(run.store("raw", out_obj).valid());
+    CPPUNIT_ASSERT(run.store("raw", out_array).valid());
+    CPPUNIT_ASSERT(run.store("raw", out_vec).valid());
+
+    TestObjectRaw in_obj;
+    CPPUNIT_ASSERT(run.load("raw", in_obj));
+    CPPUNIT_ASSERT(in_obj == out_obj);
+
+    std::array<int,4> in_array = {{ 0, 0, 0, 0 }};
+    CPPUNIT_ASSERT(run.load("raw", in_array));
+    CPPUNIT_ASSERT(in_array == out_array);
+
+    std::vector<TestObjectRaw> in_vec;
+    CPPUNIT_ASSERT(run.load("raw", in_vec));
+    CPPUNIT_ASSERT(in_vec == out_vec);
+
+    // a sub-range of a vector
+    std::vector<TestObjectRaw> in_range;
+    CPPUNIT_ASSERT(run.store("raw_range", out_vec, 1, 4).valid());
+    CPPUNIT_ASSERT(run.load("raw_range", in_range));
+    CPPUNIT_ASSERT(in_range.size() == 3);
+    CPPUNIT_ASSERT(in_range[2].id == 7);
+}
+
+void LoadStoreTest::testCompression() {
+    datastore->setCompression("compressed", CompressionCodec::ZLIB_FAST, 1024);
+    datastore->setCompression<std::vector<double>>("compressed", CompressionCodec::ZLIB_BEST, 1024);
+
+    auto root = datastore->root();
+    auto mds = root.createDataSet("compression");
+    auto run = mds.createRun(0);
+    CPPUNIT_ASSERT(run.valid());
+
+    std::vector<double> out_doubles(4096);
+    for(size_t i = 0; i < out_doubles.size(); i++)
+        out_doubles[i] = (double)(i % 16);
+    std::string out_string(8192, 'x');
+    std::string out_small = "small";
+
+    StoreStatistics store_stats;
+    CPPUNIT_ASSERT(run.store("compressed", out_doubles, &store_stats).valid());
+    CPPUNIT_ASSERT(run.store("compressed", out_string, &store_stats).valid());
+    CPPUNIT_ASSERT_EQUAL((size_t)2, store_stats.compression_ratio.num);
+    CPPUNIT_ASSERT(store_stats.compression_ratio.min > 1.0);
+    // below the threshold, stored uncompressed
+    CPPUNIT_ASSERT(run.store("compressed_small", out_small, &store_stats).valid());
+    CPPUNIT_ASSERT(run.store("small", out_small).valid());
+    CPPUNIT_ASSERT_EQUAL((size_t)2, store_stats.compression_ratio.num);
+
+    LoadStatistics load_stats;
+    std::vector<double> in_doubles;
+    std::string in_string, in_small;
+    CPPUNIT_ASSERT(run.load("compressed", in_doubles, &load_stats));
+    CPPUNIT_ASSERT(in_doubles == out_doubles);
+    CPPUNIT_ASSERT(run.load("compressed", in_string, &load_stats));
+    CPPUNIT_ASSERT(in_string == out_string);
+    CPPUNIT_ASSERT_EQUAL((size_t)2, load_stats.decompression_time.num);
+    CPPUNIT_ASSERT(run.load("small", in_small));
+    CPPUNIT_ASSERT(in_small == out_small);
+
+    // compressed products remain readable once compression is disabled
+    datastore->setCompression("compressed", CompressionCodec::NONE);
+    datastore->setCompression<std::vector<double>>("compressed", CompressionCodec::NONE);
+    in_doubles.clear();
+    CPPUNIT_ASSERT(run.load("compressed", in_doubles));
+    CPPUNIT_ASSERT(in_doubles == out_doubles);
+}
+
+void LoadStoreTest::testColumns() {
+    auto root = datastore->root();
+    auto mds = root.createDataSet("columns");
+    auto run = mds.createRun(0);
+    auto subrun = run.createSubRun(0);
+    auto event = subrun.createEvent(0);
+    CPPUNIT_ASSERT(event.valid());
+
+    std::vector<TestObjectHit> out_hits(10);
+    for(int i = 0; i < 10; i++) {
+        out_hits[i].id       = i;
+        out_hits[i].energy   = 1.5*i;
+        out_hits[i].x        = 0.25f*i;
+        out_hits[i].detector = "det" + std::to_string(i%3);
+    }
+    CPPUNIT_ASSERT(event.storeColumns("hits", out_hits).valid());
+
+    // load only some of the columns
+    std::vector<double> energies;
+    CPPUNIT_ASSERT(event.loadColumn("hits", &TestObjectHit::energy, energies));
+    CPPUNIT_ASSERT_EQUAL((size_t)10, energies.size());
+    std::vector<std::string> detectors;
+    CPPUNIT_ASSERT(event.loadColumn("hits", &TestObjectHit::detector, detectors));
+    CPPUNIT_ASSERT_EQUAL((size_t)10, detectors.size());
+    for(int i = 0; i < 10; i++) {
+        CPPUNIT_ASSERT_EQUAL(out_hits[i].energy, energies[i]);
+        CPPUNIT_ASSERT_EQUAL(out_hits[i].detector, detectors[i]);
+    }
+
+    // reassemble all the columns
+    std::vector<TestObjectHit> in_hits;
+    CPPUNIT_ASSERT(event.loadColumns("hits", in_hits));
+    CPPUNIT_ASSERT(in_hits == out_hits);
+
+    std::vector<double> missing;
+    CPPUNIT_ASSERT(!event.loadColumn("missing", &TestObjectHit::energy, missing));
+}
+
+void LoadStoreTest::testPackedProducts() {
+    datastore->setPacking<double>("packed_energy");
+    datastore->setPacking<std::string>("packed_name");
+
+    auto root = datastore->root();
+    auto mds = root.createDataSet("packed_products");
+    auto run = mds.createRun(0);
+    auto subrun = run.createSubRun(0);
+    CPPUNIT_ASSERT(subrun.valid());
+
+    {
+        PackedWriter<double> energies(subrun, "packed_energy");
+        PackedWriter<std::string> names(subrun, "packed_name");
+        // events are added out of order and only even events have a product
+        for(EventNumber n = 20; n > 0; n--) {
+            auto event = subrun.createEvent(n-1);
+            if((n-1) % 2) continue;
+            energies.store(event, 0.5*(n-1));
+            names.store(n-1, "event" + std::to_string(n-1));
+        }
+        CPPUNIT_ASSERT_EQUAL((size_t)10, energies.size());
+        CPPUNIT_ASSERT(energies.flush().valid());
+        CPPUNIT_ASSERT(names.flush().valid());
+    }
+
+    // per-event loads
+    PackingStatistics before, after;
+    datastore->collectPackingStatistics(before);
+    for(auto& event : subrun) {
+        auto n = event.number();
+        double energy = -1.0;
+        std::string name;
+        bool b1 = event.load("packed_energy", energy);
+        bool b2 = event.load("packed_name", name);
+        CPPUNIT_ASSERT_EQUAL(n % 2 == 0, b1);
+        CPPUNIT_ASSERT_EQUAL(n % 2 == 0, b2);
+        if(n % 2 == 0) {
+            CPPUNIT_ASSERT_EQUAL(0.5*n, energy);
+            CPPUNIT_ASSERT_EQUAL("event" + std::to_string(n), name);
+        }
+    }
+    // each record is loaded once, by the first event; the other even
+    // events are served from memory without a lookup, and the odd events
+    // (which are not in the records) are looked up in their own key
+    datastore->collectPackingStatistics(after);
+    CPPUNIT_ASSERT_EQUAL((size_t)2, after.record_loads - before.record_loads);
+    CPPUNIT_ASSERT_EQUAL((size_t)2*9, after.hits - before.hits);
+    CPPUNIT_ASSERT_EQUAL((size_t)2*10, after.misses - before.misses);
+
+    // products stored in the Event are only used if they are not packed,
+    // whether or not the packed record is in memory
+    CPPUNIT_ASSERT(subrun[4].store("packed_energy", 99.0).valid());
+    CPPUNIT_ASSERT(subrun[5].store("packed_energy", 42.0).valid());
+    double energy = -1.0;
+    CPPUNIT_ASSERT(subrun[4].load("packed_energy", energy));
+    CPPUNIT_ASSERT_EQUAL(2.0, energy);
+    CPPUNIT_ASSERT(subrun[5].load("packed_energy", energy));
+    CPPUNIT_ASSERT_EQUAL(42.0, energy);
+
+    // storing a record again replaces the one in memory
+    {
+        PackedWriter<double> energies(subrun, "packed_energy");
+        for(EventNumber n = 0; n < 20; n += 2)
+            energies.store(subrun[n], 1.5*n);
+        CPPUNIT_ASSERT(energies.flush().valid());
+    }
+    datastore->collectPackingStatistics(before);
+    CPPUNIT_ASSERT(subrun[4].load("packed_energy", energy));
+    CPPUNIT_ASSERT_EQUAL(6.0, energy);
+    datastore->collectPackingStatistics(after);
+    CPPUNIT_ASSERT_EQUAL((size_t)1, after.record_loads - before.record_loads);
+
+    // bulk load
+    std::vector<EventNumber> events;
+    std::vector<double> values;
+    CPPUNIT_ASSERT(subrun.loadPacked("packed_energy", events, values));
+    CPPUNIT_ASSERT_EQUAL((size_t)10, events.size());
+    CPPUNIT_ASSERT_EQUAL((size_t)10, values.size());
+    for(size_t i = 0; i < events.size(); i++) {
+        CPPUNIT_ASSERT_EQUAL((EventNumber)(2*i), events[i]);
+        CPPUNIT_ASSERT_EQUAL(1.5*events[i], values[i]);
+    }
+    CPPUNIT_ASSERT(!subrun.loadPacked("packed_missing", events, values));
+}
+
+void LoadStoreTest::testChunkedProducts() {
+    datastore->setChunkSize(1024);
+
+    auto root = datastore->root();
+    auto mds = root.createDataSet("chunked_products");
+    auto run = mds.createRun(0);
+    auto subrun = run.createSubRun(0);
+    auto event = subrun.createEvent(0);
+    CPPUNIT_ASSERT(event.valid());
+
+    std::vector<double> out_doubles(10000);
+    for(size_t i = 0; i < out_doubles.size(); i++)
+        out_doubles[i] = 0.5*i;
+    std::string out_string(5000, 'c');
+    std::vector<double> out_small = { 1.0, 2.0 };
+
+    CPPUNIT_ASSERT(event.store("chunked", out_doubles).valid());
+    CPPUNIT_ASSERT(event.store("chunked", out_string).valid());
+    CPPUNIT_ASSERT(event.store("small", out_small).valid());
+    datastore->setChunkSize(0);
+
+    // chunks are not listed as products
+    CPPUNIT_ASSERT_EQUAL((size_t)3, event.listProducts().size());
+
+    std::vector<double> in_doubles;
+    std::string in_string;
+    CPPUNIT_ASSERT(event.load("chunked", in_doubles));
+    CPPUNIT_ASSERT(in_doubles == out_doubles);
+    CPPUNIT_ASSERT(event.load("chunked", in_string));
+    CPPUNIT_ASSERT(in_string == out_string);
+
+    // ranges
+    std::vector<double> range;
+    CPPUNIT_ASSERT(event.load("chunked", range, 1000, 1010));
+    CPPUNIT_ASSERT_EQUAL((size_t)10, range.size());
+    for(size_t i = 0; i < range.size(); i++)
+        CPPUNIT_ASSERT_EQUAL(out_doubles[1000+i], range[i]);
+    CPPUNIT_ASSERT(event.load("chunked", range, 9995, -1));
+    CPPUNIT_ASSERT_EQUAL((size_t)5, range.size());
+    CPPUNIT_ASSERT_EQUAL(out_doubles[9999], range[4]);
+    CPPUNIT_ASSERT(event.load("small", range, 1, 5));
+    CPPUNIT_ASSERT_EQUAL((size_t)1, range.size());
+    CPPUNIT_ASSERT_EQUAL(2.0, range[0]);
+
+    // prefetched chunked products are assembled before being cached
+    datastore->setChunkSize(1024);
+    for(EventNumber n = 1; n < 8; n++) {
+        auto e = subrun.createEvent(n);
+        std::vector<double> v(out_doubles.begin(), out_doubles.begin() + 1000*n);
+        CPPUNIT_ASSERT(e.store("chunked", v).valid());
+    }
+    datastore->setChunkSize(0);
+    Prefetcher prefetcher(*datastore);
+    prefetcher.setBatchSize(4);
+    prefetcher.fetchProduct<std::vector<double>>("chunked");
+    for(auto it = subrun.begin(prefetcher); it != subrun.end(); it++) {
+        auto n = it->number();
+        CPPUNIT_ASSERT(it->load(prefetcher, "chunked", in_doubles));
+        if(n == 0) {
+            CPPUNIT_ASSERT(in_doubles == out_doubles);
+        } else {
+            CPPUNIT_ASSERT_EQUAL((size_t)1000*n, in_doubles.size());
+            CPPUNIT_ASSERT_EQUAL(out_doubles[1000*n-1], in_doubles.back());
+        }
+        CPPUNIT_ASSERT(it->load(prefetcher, "chunked", range, 10, 20));
+        CPPUNIT_ASSERT_EQUAL((size_t)10, range.size());
+        CPPUNIT_ASSERT_EQUAL(out_doubles[10], range[0]);
+    }
+}
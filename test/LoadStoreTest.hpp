@@ -21,6 +21,13 @@ class LoadStoreTest : public CppUnit::TestFixture
     CPPUNIT_TEST( testAsyncLoadStoreEvent );
     CPPUNIT_TEST( testPrefetchLoadStore );
     CPPUNIT_TEST( testAsyncPrefetchLoadStore );
+    CPPUNIT_TEST( testPrefetchParentProducts );
+    CPPUNIT_TEST( testCustomSerializer );
+    CPPUNIT_TEST( testRawStorage );
+    CPPUNIT_TEST( testCompression );
+    CPPUNIT_TEST( testColumns );
+    CPPUNIT_TEST( testPackedProducts );
+    CPPUNIT_TEST( testChunkedProducts );
     CPPUNIT_TEST_SUITE_END();
 
     public:
@@ -40,6 +47,13 @@ class LoadStoreTest : public CppUnit::TestFixture
     void testAsyncLoadStoreEvent();
     void testPrefetchLoadStore();
     void testAsyncPrefetchLoadStore();
+    void testPrefetchParentProducts();
+    void testCustomSerializer();
+    void testRawStorage();
+    void testCompression();
+    void testColumns();
+    void testPackedProducts();
+    void testChunkedProducts();
 };
 
 #endif
@@ -286,3 +286,267 @@ void ParallelMPITest::testParallelEventProcessorWithProducts() {
         }
     }
 }
+
+void ParallelMPITest::testNodeCache() {
+    auto mds = datastore->root()["matthieu"];
+
+    int rank;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    datastore->enableNodeCache(MPI_COMM_WORLD, 1024*1024);
+    Run run = mds[(RunNumber)0];
+
+    if(rank == 0) {
+        TestObjectA a;
+        a.x() = 42;
+        a.y() = 3.5;
+        run.store("calibration", a);
+    }
+    MPI_Barrier(MPI_COMM_WORLD);
+
+    // load the same Run-level product from all the ranks, twice
+    for(unsigned i = 0; i < 2; i++) {
+        TestObjectA a;
+        CPPUNIT_ASSERT(run.load("calibration", a));
+        CPPUNIT_ASSERT(a.x() == 42);
+        CPPUNIT_ASSERT(a.y() == 3.5);
+        TestObjectB b;
+        CPPUNIT_ASSERT(!run.load("calibration", b));
+    }
+    // at least the second load of the TestObjectA is served by the cache
+    NodeCacheStatistics stats;
+    datastore->collectNodeCacheStatistics(stats);
+    CPPUNIT_ASSERT(stats.hits >= 1);
+    CPPUNIT_ASSERT(stats.entries >= 1);
+
+    // event-level products are not affected by the cache
+    size_t hits = stats.hits;
+    auto ev = mds[(RunNumber)rank][0][1];
+    TestObjectA a;
+    CPPUNIT_ASSERT(ev.load("abc", a));
+    CPPUNIT_ASSERT(a.x() == 1);
+    datastore->collectNodeCacheStatistics(stats);
+    CPPUNIT_ASSERT_EQUAL(hits, stats.hits);
+    MPI_Barrier(MPI_COMM_WORLD);
+
+    // overwriting the product invalidates it in the cache
+    if(rank == 0) {
+        TestObjectA a2;
+        a2.x() = 43;
+        a2.y() = 4.5;
+        run.store("calibration", a2);
+    }
+    MPI_Barrier(MPI_COMM_WORLD);
+    CPPUNIT_ASSERT(run.load("calibration", a));
+    CPPUNIT_ASSERT(a.x() == 43);
+    MPI_Barrier(MPI_COMM_WORLD);
+
+    // a product larger than the cache doesn't prevent smaller ones from being cached
+    if(rank == 0) {
+        std::vector<double> oversized(256*1024, 1.0);
+        run.store("oversized", oversized);
+        TestObjectB b;
+        b.a() = 7;
+        run.store("after_oversized", b);
+    }
+    MPI_Barrier(MPI_COMM_WORLD);
+    std::vector<double> oversized;
+    CPPUNIT_ASSERT(run.load("oversized", oversized));
+    CPPUNIT_ASSERT_EQUAL((size_t)256*1024, oversized.size());
+    datastore->collectNodeCacheStatistics(stats);
+    hits = stats.hits;
+    for(unsigned i = 0; i < 2; i++) {
+        TestObjectB b;
+        CPPUNIT_ASSERT(run.load("after_oversized", b));
+        CPPUNIT_ASSERT(b.a() == 7);
+    }
+    datastore->collectNodeCacheStatistics(stats);
+    CPPUNIT_ASSERT(stats.hits > hits);
+    MPI_Barrier(MPI_COMM_WORLD);
+
+    datastore->disableNodeCache();
+    datastore->collectNodeCacheStatistics(stats);
+    CPPUNIT_ASSERT_EQUAL((size_t)0, stats.hits);
+}
+
+void ParallelMPITest::testLoadCollective() {
+    auto mds = datastore->root()["matthieu"];
+
+    int rank;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+
+    Run run = mds[(RunNumber)0];
+    if(rank == 0) {
+        TestObjectB b;
+        b.a() = 12;
+        b.b() = "geometry";
+        run.store("collective", b);
+        std::vector<double> table = { 1.0, 2.0, 3.0 };
+        run.store("collective", table);
+    }
+    MPI_Barrier(MPI_COMM_WORLD);
+
+    TestObjectB b;
+    CPPUNIT_ASSERT(run.loadCollective(MPI_COMM_WORLD, "collective", b));
+    CPPUNIT_ASSERT(b.a() == 12);
+    CPPUNIT_ASSERT(b.b() == "geometry");
+
+    std::vector<double> table;
+    int size;
+    MPI_Comm_size(MPI_COMM_WORLD, &size);
+    int table_root = size > 1 ? 1 : 0;
+    CPPUNIT_ASSERT(run.loadCollective(MPI_COMM_WORLD, "collective", table, table_root));
+    CPPUNIT_ASSERT(table.size() == 3 && table[2] == 3.0);
+
+    TestObjectA a;
+    CPPUNIT_ASSERT(!run.loadCollective(MPI_COMM_WORLD, "collective", a));
+
+    // chunked products are assembled by the root before being broadcast
+    std::vector<double> large(4096);
+    for(size_t i = 0; i < large.size(); i++)
+        large[i] = 0.25*i;
+    if(rank == 0) {
+        datastore->setChunkSize(1024);
+        run.store("collective_chunked", large);
+        datastore->setChunkSize(0);
+    }
+    MPI_Barrier(MPI_COMM_WORLD);
+
+    std::vector<double> loaded;
+    CPPUNIT_ASSERT(run.loadCollective(MPI_COMM_WORLD, "collective_chunked", loaded, table_root));
+    CPPUNIT_ASSERT(loaded == large);
+}
+
+/**
+ * Gathers the items processed by all the ranks on rank 0 and
+ * checks that each event of the DataSet was processed exactly once.
+ */
+static void checkAllEventsProcessed(std::vector<item>& items) {
+    int rank, size;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &size);
+    if(rank != 0) {
+        int num_local_items = items.size();
+        MPI_Send(&num_local_items, 1, MPI_INT, 0, 0, MPI_COMM_WORLD);
+        if(num_local_items) {
+            MPI_Send(items.data(), items.size()*sizeof(item), MPI_BYTE, 0, 0, MPI_COMM_WORLD);
+        }
+        return;
+    }
+    for(unsigned j=1; j < size; j++) {
+        int num_items = 0;
+        MPI_Recv(&num_items, 1, MPI_INT, j, 0, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+        items.resize(items.size() + num_items);
+        if(num_items) {
+            MPI_Recv(&items[items.size() - num_items], sizeof(item)*num_items,
+                MPI_BYTE, j, 0, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+        }
+    }
+    std::sort(items.begin(), items.end());
+    CPPUNIT_ASSERT(items.size() == size*8*8);
+    unsigned x = 0;
+    for(unsigned i = 0; i < (unsigned)size; i++) {
+        for(unsigned j = 0; j < 8; j++) {
+            for(unsigned k = 0; k < 8; k++) {
+                auto& e = items[x];
+                CPPUNIT_ASSERT(e.run == i && e.subrun == j && e.event == k);
+                x += 1;
+            }
+        }
+    }
+}
+
+void ParallelMPITest::testLocalityAwareDispatch() {
+    auto mds = datastore->root()["matthieu"];
+
+    ParallelEventProcessorOptions options;
+    options.localityAware = true;
+    options.outputBatchSize = 4;
+    ParallelEventProcessorStatistics stats;
+    ParallelEventProcessor parallel_processor(*datastore, MPI_COMM_WORLD, options);
+    std::vector<item> items;
+    parallel_processor.process(mds,
+        [&items](const Event& ev) {
+            SubRun sr = ev.subrun();
+            Run r = sr.run();
+            items.emplace_back(r.number(), sr.number(), ev.number());
+        },
+        &stats
+    );
+    CPPUNIT_ASSERT_EQUAL(items.size(), stats.total_events_processed);
+    // all the databases of the test deployment are on this node
+    CPPUNIT_ASSERT_EQUAL(stats.total_events_processed, stats.colocated_events_processed);
+
+    checkAllEventsProcessed(items);
+}
+
+void ParallelMPITest::testSubRunAffinity() {
+    auto mds = datastore->root()["matthieu"];
+
+    int size;
+    MPI_Comm_size(MPI_COMM_WORLD, &size);
+
+    ParallelEventProcessorOptions options;
+    options.affinity = EventAffinity::SUBRUN;
+    options.outputBatchSize = 4;
+    ParallelEventProcessorStatistics stats;
+    ParallelEventProcessor parallel_processor(*datastore, MPI_COMM_WORLD, options);
+    std::vector<item> items;
+    parallel_processor.process(mds,
+        [&items](const Event& ev) {
+            SubRun sr = ev.subrun();
+            Run r = sr.run();
+            items.emplace_back(r.number(), sr.number(), ev.number());
+        },
+        &stats
+    );
+    CPPUNIT_ASSERT_EQUAL(items.size(), stats.total_events_processed);
+
+    // SubRuns have 8 events, fewer than maxAffinityBatchSize,
+    // so none of them should be spread over several processes
+    uint64_t subruns_processed = stats.subruns_processed;
+    uint64_t total_subruns_processed = 0;
+    MPI_Allreduce(&subruns_processed, &total_subruns_processed, 1,
+                  MPI_UINT64_T, MPI_SUM, MPI_COMM_WORLD);
+    CPPUNIT_ASSERT_EQUAL((uint64_t)(size*8), total_subruns_processed);
+
+    checkAllEventsProcessed(items);
+}
+
+void ParallelMPITest::testAdaptiveBatchSize() {
+    auto mds = datastore->root()["matthieu"];
+
+    ParallelEventProcessorOptions options;
+    options.adaptiveBatchSize = true;
+    options.outputBatchSize = 2;
+    options.minOutputBatchSize = 1;
+    options.maxOutputBatchSize = 32;
+    ParallelEventProcessorStatistics stats;
+    ParallelEventProcessor parallel_processor(*datastore, MPI_COMM_WORLD, options);
+    std::vector<item> items;
+    parallel_processor.process(mds,
+        [&items](const Event& ev) {
+            SubRun sr = ev.subrun();
+            Run r = sr.run();
+            items.emplace_back(r.number(), sr.number(), ev.number());
+            double t = tl::timer::wtime();
+            while(tl::timer::wtime() - t < 0.0001) {}
+        },
+        &stats
+    );
+    CPPUNIT_ASSERT_EQUAL(items.size(), stats.total_events_processed);
+    CPPUNIT_ASSERT(stats.batch_size_stats.num != 0);
+    CPPUNIT_ASSERT(stats.batch_size_stats.min >= 1);
+    CPPUNIT_ASSERT(stats.batch_size_stats.max <= 32);
+
+    // waiting for the first batch includes loading it, so the batches
+    // grow past outputBatchSize, and once all the events are loaded the
+    // guided batch sizes go down to single events
+    uint64_t min_batch_size = stats.batch_size_stats.min;
+    uint64_t max_batch_size = stats.batch_size_stats.max;
+    MPI_Allreduce(MPI_IN_PLACE, &min_batch_size, 1, MPI_UINT64_T, MPI_MIN, MPI_COMM_WORLD);
+    MPI_Allreduce(MPI_IN_PLACE, &max_batch_size, 1, MPI_UINT64_T, MPI_MAX, MPI_COMM_WORLD);
+    CPPUNIT_ASSERT(max_batch_size > options.outputBatchSize);
+    CPPUNIT_ASSERT_EQUAL((uint64_t)1, min_batch_size);
+
+    checkAllEventsProcessed(items);
+}
@@ -13,6 +13,11 @@ class ParallelMPITest : public CppUnit::TestFixture
     CPPUNIT_TEST( testParallelEventProcessor );
     CPPUNIT_TEST( testParallelEventProcessorAsync );
     CPPUNIT_TEST( testParallelEventProcessorWithProducts );
+    CPPUNIT_TEST( testNodeCache );
+    CPPUNIT_TEST( testLoadCollective );
+    CPPUNIT_TEST( testLocalityAwareDispatch );
+    CPPUNIT_TEST( testSubRunAffinity );
+    CPPUNIT_TEST( testAdaptiveBatchSize );
     CPPUNIT_TEST_SUITE_END();
 
     public:
@@ -23,6 +28,11 @@ class ParallelMPITest : public CppUnit::TestFixture
     void testParallelEventProcessor();
     void testParallelEventProcessorAsync();
     void testParallelEventProcessorWithProducts();
+    void testNodeCache();
+    void testLoadCollective();
+    void testLocalityAwareDispatch();
+    void testSubRunAffinity();
+    void testAdaptiveBatchSize();
 };
 
 #endif
@@ -150,3 +150,94 @@ void PtrTest::testPtrLoadFromArray() {
     CPPUNIT_ASSERT(vecA[1] == *ptrToVecAReloaded);
     CPPUNIT_ASSERT(mapA[1] == *ptrToMapAReloaded);
 }
+
+void PtrTest::testPtrSharedResolution() {
+    auto root = datastore->root();
+    auto mds = root["matthieu"];
+    auto run = mds[42];
+    auto subrun = run[3];
+    auto event = subrun[22];
+    CPPUNIT_ASSERT(event.valid());
+
+    std::vector<TestObjectA> vecA(100);
+    for(unsigned i = 0; i < vecA.size(); i++) {
+        vecA[i].x() = i;
+        vecA[i].y() = 0.5*i;
+    }
+    auto prodID = event.store("shared", vecA);
+    CPPUNIT_ASSERT(prodID.valid());
+
+    // Ptrs dereferenced one by one share the loaded vector
+    auto ptr1 = datastore->makePtr<TestObjectA>(prodID, 1);
+    auto ptr2 = datastore->makePtr<TestObjectA>(prodID, 2);
+    CPPUNIT_ASSERT(vecA[1] == *ptr1);
+    CPPUNIT_ASSERT(vecA[2] == *ptr2);
+    CPPUNIT_ASSERT(&*ptr1 + 1 == &*ptr2);
+
+    // association-like product holding many Ptrs into the vector
+    std::vector<Ptr<TestObjectA>> ptrs;
+    for(unsigned i = 0; i < vecA.size(); i++)
+        ptrs.push_back(datastore->makePtr<TestObjectA>(prodID, i));
+    CPPUNIT_ASSERT(event.store("assoc", ptrs));
+    ptr1.reset();
+    ptr2.reset();
+
+    std::vector<Ptr<TestObjectA>> loaded;
+    CPPUNIT_ASSERT(event.load("assoc", loaded));
+    CPPUNIT_ASSERT_EQUAL(vecA.size(), loaded.size());
+    datastore->resolvePtrs(loaded);
+    for(unsigned i = 0; i < loaded.size(); i++) {
+        CPPUNIT_ASSERT(loaded[i].resolved());
+        CPPUNIT_ASSERT(vecA[i] == *loaded[i]);
+        CPPUNIT_ASSERT(&*loaded[0] + i == &*loaded[i]);
+    }
+
+    // a Ptr resolved later shares the vector while it is in use
+    auto ptr3 = datastore->makePtr<TestObjectA>(prodID, 3);
+    CPPUNIT_ASSERT(&*ptr3 == &*loaded[3]);
+
+}
+
+void PtrTest::testPtrPrefetching() {
+    auto root = datastore->root();
+    auto mds = root["matthieu"];
+    auto run = mds[42];
+    auto subrun = run[3];
+    auto event = subrun[22];
+    CPPUNIT_ASSERT(event.valid());
+
+    std::vector<TestObjectA> vecA(10);
+    for(unsigned i = 0; i < vecA.size(); i++) {
+        vecA[i].x() = 2*i;
+        vecA[i].y() = 0.25*i;
+    }
+    TestObjectB objB;
+    objB.a() = 12;
+    objB.b() = "prefetched";
+    auto vecID = event.store("prefetched", vecA);
+    auto objID = event.store("prefetched", objB);
+    CPPUNIT_ASSERT(vecID.valid());
+    CPPUNIT_ASSERT(objID.valid());
+
+    std::vector<Ptr<TestObjectA>> ptrsA;
+    for(unsigned i = 0; i < vecA.size(); i++)
+        ptrsA.push_back(datastore->makePtr<TestObjectA>(vecID, i));
+    auto ptrB = datastore->makePtr<TestObjectB>(objID);
+    CPPUNIT_ASSERT(event.store("prefetched_assoc", ptrsA));
+    CPPUNIT_ASSERT(event.store("prefetched_ptr", ptrB));
+
+    datastore->enablePtrPrefetching(4);
+
+    std::vector<Ptr<TestObjectA>> loadedA;
+    Ptr<TestObjectB> loadedB;
+    CPPUNIT_ASSERT(event.load("prefetched_assoc", loadedA));
+    CPPUNIT_ASSERT(event.load("prefetched_ptr", loadedB));
+    CPPUNIT_ASSERT_EQUAL(vecA.size(), loadedA.size());
+    for(unsigned i = 0; i < loadedA.size(); i++) {
+        CPPUNIT_ASSERT(vecA[i] == *loadedA[i]);
+        CPPUNIT_ASSERT(&*loadedA[0] + i == &*loadedA[i]);
+    }
+    CPPUNIT_ASSERT(objB == *loadedB);
+
+    datastore->disablePtrPrefetching();
+}
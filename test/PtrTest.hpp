@@ -13,6 +13,8 @@ class PtrTest : public CppUnit::TestFixture
     CPPUNIT_TEST( testMakePtr );
     CPPUNIT_TEST( testPtrLoad );
     CPPUNIT_TEST( testPtrLoadFromArray );
+    CPPUNIT_TEST( testPtrSharedResolution );
+    CPPUNIT_TEST( testPtrPrefetching );
     CPPUNIT_TEST_SUITE_END();
 
     public:
@@ -24,6 +26,8 @@ class PtrTest : public CppUnit::TestFixture
     void testMakePtr();
     void testPtrLoad();
     void testPtrLoadFromArray();
+    void testPtrSharedResolution();
+    void testPtrPrefetching();
 };
 
 #endif
@@ -3,6 +3,7 @@
 #include "QueueTest.hpp"
 #include "TestObjects.hpp"
 #include "CppUnitAdditionalMacros.hpp"
+#include "../src/QueueProviderImpl.hpp"
 
 CPPUNIT_TEST_SUITE_REGISTRATION( QueueTest );
 
@@ -150,3 +151,391 @@ void QueueTest::testQueuePushPop() {
     CPPUNIT_ASSERT(total_reads == 20);
     MPI_Barrier(MPI_COMM_WORLD);
 }
+
+void QueueTest::testQueuePushPopMany() {
+    int rank, size;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &size);
+    hepnos::Queue queue;
+    int num_reads = 0;
+    if(rank < 2) { // producers
+        CPPUNIT_ASSERT_NO_THROW(
+            queue = datastore->openQueue<TestObjectB>(
+                "queue_b", hepnos::QueueAccessMode::PRODUCER));
+        MPI_Barrier(MPI_COMM_WORLD);
+        std::vector<TestObjectB> vec(10);
+        for(int i = 0; i < vec.size(); ++i) {
+            vec[i].a() = i;
+        }
+        // push a batch at once
+        CPPUNIT_ASSERT_NO_THROW(queue.pushMany(vec));
+        // push items one by one, sent in batches of 4
+        queue.setPushBuffering(4);
+        for(int i = 0; i < vec.size(); ++i) {
+            queue.push(vec[i]);
+        }
+        // the remaining items are sent when closing
+    } else { // consumers
+        CPPUNIT_ASSERT_NO_THROW(
+            queue = datastore->openQueue<TestObjectB>(
+                "queue_b", hepnos::QueueAccessMode::CONSUMER));
+        MPI_Barrier(MPI_COMM_WORLD);
+        std::vector<TestObjectA> invalid;
+        CPPUNIT_ASSERT_THROW(
+            queue.popMany(invalid, 3),
+            hepnos::Exception);
+        // alternate batched pops and prefetched single pops
+        queue.setPopPrefetch(4);
+        std::vector<TestObjectB> batch;
+        TestObjectB b;
+        while(true) {
+            size_t n = queue.popMany(batch, 3);
+            CPPUNIT_ASSERT(n <= 3);
+            CPPUNIT_ASSERT_EQUAL(n, batch.size());
+            num_reads += n;
+            if(n == 0 || !queue.pop(b)) break;
+            num_reads += 1;
+        }
+    }
+    CPPUNIT_ASSERT_NO_THROW(queue.close());
+    int total_reads = 0;
+    MPI_Allreduce(&num_reads, &total_reads, 1, MPI_INT, MPI_SUM, MPI_COMM_WORLD);
+    CPPUNIT_ASSERT(total_reads == 40);
+    MPI_Barrier(MPI_COMM_WORLD);
+}
+
+void QueueTest::testShardedQueue() {
+    int rank, size;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &size);
+    if(rank == 0) {
+        hepnos::QueueOptions options;
+        options.num_shards = 0;
+        CPPUNIT_ASSERT_THROW(
+            datastore->createQueue<TestObjectB>("sharded_b", options),
+            hepnos::Exception);
+        options.num_shards = 3;
+        CPPUNIT_ASSERT_NO_THROW(
+            datastore->createQueue<TestObjectB>("sharded_b", options));
+        options.num_shards = 2;
+        options.sharding = hepnos::QueueShardingPolicy::HASH;
+        CPPUNIT_ASSERT_NO_THROW(
+            datastore->createQueue<TestObjectB>("hashed_b", options));
+    }
+    MPI_Barrier(MPI_COMM_WORLD);
+    for(auto name : { "sharded_b", "hashed_b" }) {
+        hepnos::Queue queue;
+        int num_reads = 0;
+        if(rank < 2) { // producers
+            CPPUNIT_ASSERT_NO_THROW(
+                queue = datastore->openQueue<TestObjectB>(
+                    name, hepnos::QueueAccessMode::PRODUCER));
+            MPI_Barrier(MPI_COMM_WORLD);
+            std::vector<TestObjectB> vec(10);
+            for(int i = 0; i < vec.size(); ++i) {
+                vec[i].a() = i;
+                queue.push(vec[i]);
+            }
+            CPPUNIT_ASSERT_NO_THROW(queue.pushMany(vec));
+        } else { // consumers
+            CPPUNIT_ASSERT_NO_THROW(
+                queue = datastore->openQueue<TestObjectB>(
+                    name, hepnos::QueueAccessMode::CONSUMER));
+            MPI_Barrier(MPI_COMM_WORLD);
+            TestObjectB b;
+            while(queue.pop(b)) {
+                num_reads += 1;
+            }
+        }
+        CPPUNIT_ASSERT_NO_THROW(queue.close());
+        int total_reads = 0;
+        MPI_Allreduce(&num_reads, &total_reads, 1, MPI_INT, MPI_SUM, MPI_COMM_WORLD);
+        CPPUNIT_ASSERT(total_reads == 40);
+        MPI_Barrier(MPI_COMM_WORLD);
+    }
+    if(rank == 0) {
+        CPPUNIT_ASSERT_NO_THROW(datastore->destroyQueue<TestObjectB>("sharded_b"));
+        CPPUNIT_ASSERT_NO_THROW(datastore->destroyQueue<TestObjectB>("hashed_b"));
+    }
+    MPI_Barrier(MPI_COMM_WORLD);
+}
+
+void QueueTest::testBoundedQueue() {
+    int rank;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    if(rank == 0) {
+        hepnos::QueueOptions options;
+        options.max_items = 2;
+        CPPUNIT_ASSERT_NO_THROW(
+            datastore->createQueue<TestObjectB>("bounded_b", options));
+        options.spill = true;
+        CPPUNIT_ASSERT_NO_THROW(
+            datastore->createQueue<TestObjectB>("spilled_b", options));
+        for(auto name : { "bounded_b", "spilled_b" }) {
+            bool spill = std::string(name) == "spilled_b";
+            hepnos::Queue producer, consumer;
+            CPPUNIT_ASSERT_NO_THROW(
+                producer = datastore->openQueue<TestObjectB>(
+                    name, hepnos::QueueAccessMode::PRODUCER));
+            CPPUNIT_ASSERT_NO_THROW(
+                consumer = datastore->openQueue<TestObjectB>(
+                    name, hepnos::QueueAccessMode::CONSUMER));
+            TestObjectB b;
+            int num_pushed = 0;
+            for(int i = 0; i < 5; ++i) {
+                b.a() = i;
+                if(producer.tryPush(b)) num_pushed += 1;
+            }
+            // without spill, only max_items items fit in the queue
+            CPPUNIT_ASSERT_EQUAL(spill ? 5 : 2, num_pushed);
+            CPPUNIT_ASSERT(consumer.pop(b));
+            CPPUNIT_ASSERT_EQUAL(0, b.a());
+            // space was made, a blocking push now succeeds
+            b.a() = 5;
+            CPPUNIT_ASSERT_NO_THROW(producer.push(b));
+            CPPUNIT_ASSERT_NO_THROW(producer.close());
+            int num_reads = 1;
+            int last = 0;
+            while(consumer.pop(b)) {
+                // spilled items come back in order
+                CPPUNIT_ASSERT(b.a() > last);
+                last = b.a();
+                num_reads += 1;
+            }
+            CPPUNIT_ASSERT_EQUAL(num_pushed + 1, num_reads);
+            CPPUNIT_ASSERT_NO_THROW(consumer.close());
+        }
+        CPPUNIT_ASSERT_NO_THROW(datastore->destroyQueue<TestObjectB>("bounded_b"));
+        CPPUNIT_ASSERT_NO_THROW(datastore->destroyQueue<TestObjectB>("spilled_b"));
+    }
+    MPI_Barrier(MPI_COMM_WORLD);
+}
+
+void QueueTest::testQueueBulkTransfer() {
+    int rank;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    if(rank == 0) {
+        CPPUNIT_ASSERT_NO_THROW(
+            datastore->createQueue<TestObjectB>("bulk_b"));
+        hepnos::Queue producer, consumer;
+        CPPUNIT_ASSERT_NO_THROW(
+            producer = datastore->openQueue<TestObjectB>(
+                "bulk_b", hepnos::QueueAccessMode::PRODUCER));
+        CPPUNIT_ASSERT_NO_THROW(
+            consumer = datastore->openQueue<TestObjectB>(
+                "bulk_b", hepnos::QueueAccessMode::CONSUMER));
+        producer.setBulkThreshold(1024);
+        consumer.setBulkThreshold(1024);
+        consumer.setPopPrefetch(4);
+        // mix of small and large items, with growing sizes
+        std::vector<TestObjectB> vec(8);
+        for(int i = 0; i < vec.size(); ++i) {
+            vec[i].a() = i;
+            vec[i].c().resize(i % 2 ? 512*(i+1) : 16, 'A' + i);
+        }
+        for(int i = 0; i < 4; ++i)
+            CPPUNIT_ASSERT_NO_THROW(producer.push(vec[i]));
+        std::vector<TestObjectB> rest(vec.begin()+4, vec.end());
+        CPPUNIT_ASSERT_NO_THROW(producer.pushMany(rest));
+        CPPUNIT_ASSERT_NO_THROW(producer.close());
+        TestObjectB b;
+        int num_reads = 0;
+        while(consumer.pop(b)) {
+            CPPUNIT_ASSERT(num_reads < vec.size());
+            CPPUNIT_ASSERT(b == vec[num_reads]);
+            num_reads += 1;
+        }
+        CPPUNIT_ASSERT_EQUAL((int)vec.size(), num_reads);
+        CPPUNIT_ASSERT_NO_THROW(consumer.close());
+        CPPUNIT_ASSERT_NO_THROW(datastore->destroyQueue<TestObjectB>("bulk_b"));
+    }
+    MPI_Barrier(MPI_COMM_WORLD);
+}
+
+void QueueTest::testQueueTimedAndAsync() {
+    int rank;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    if(rank == 0) {
+        CPPUNIT_ASSERT_NO_THROW(
+            datastore->createQueue<TestObjectB>("async_b"));
+        hepnos::Queue producer, consumer;
+        CPPUNIT_ASSERT_NO_THROW(
+            producer = datastore->openQueue<TestObjectB>(
+                "async_b", hepnos::QueueAccessMode::PRODUCER));
+        CPPUNIT_ASSERT_NO_THROW(
+            consumer = datastore->openQueue<TestObjectB>(
+                "async_b", hepnos::QueueAccessMode::CONSUMER));
+        TestObjectB in, out;
+        // nothing to pop yet
+        CPPUNIT_ASSERT(consumer.tryPop(out) == hepnos::QueuePopStatus::TIMEOUT);
+        CPPUNIT_ASSERT(consumer.timedPop(out, 0.1) == hepnos::QueuePopStatus::TIMEOUT);
+        // asynchronous push
+        in.a() = 1;
+        auto push_future = producer.pushAsync(in);
+        CPPUNIT_ASSERT(push_future.valid());
+        CPPUNIT_ASSERT(push_future.wait());
+        CPPUNIT_ASSERT(consumer.timedPop(out, 1.0) == hepnos::QueuePopStatus::POPPED);
+        CPPUNIT_ASSERT_EQUAL(1, out.a());
+        // asynchronous pop completed by a later push; while it waits,
+        // other pops from the same handle return without waiting for it
+        auto pop_future = consumer.popAsync(out);
+        tl::thread::yield();
+        TestObjectB other;
+        CPPUNIT_ASSERT(consumer.tryPop(other) == hepnos::QueuePopStatus::TIMEOUT);
+        CPPUNIT_ASSERT(consumer.timedPop(other, 0.1) == hepnos::QueuePopStatus::TIMEOUT);
+        CPPUNIT_ASSERT(!pop_future.completed());
+        in.a() = 2;
+        CPPUNIT_ASSERT_NO_THROW(producer.push(in));
+        CPPUNIT_ASSERT(pop_future.wait());
+        CPPUNIT_ASSERT(pop_future.completed());
+        CPPUNIT_ASSERT_EQUAL(2, out.a());
+        // asynchronous pop completed by the producer closing the queue
+        pop_future = consumer.popAsync(out);
+        CPPUNIT_ASSERT_NO_THROW(producer.close());
+        CPPUNIT_ASSERT(!pop_future.wait());
+        CPPUNIT_ASSERT(consumer.tryPop(out) == hepnos::QueuePopStatus::FINISHED);
+        CPPUNIT_ASSERT_NO_THROW(consumer.close());
+        CPPUNIT_ASSERT_NO_THROW(datastore->destroyQueue<TestObjectB>("async_b"));
+    }
+    MPI_Barrier(MPI_COMM_WORLD);
+}
+
+void QueueTest::testQueuePushBufferingDelay() {
+    int rank;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    if(rank == 0) {
+        CPPUNIT_ASSERT_NO_THROW(
+            datastore->createQueue<TestObjectB>("delayed_b"));
+        hepnos::Queue producer, consumer;
+        CPPUNIT_ASSERT_NO_THROW(
+            producer = datastore->openQueue<TestObjectB>(
+                "delayed_b", hepnos::QueueAccessMode::PRODUCER));
+        CPPUNIT_ASSERT_NO_THROW(
+            consumer = datastore->openQueue<TestObjectB>(
+                "delayed_b", hepnos::QueueAccessMode::CONSUMER));
+        producer.setPushBuffering(100, 0.2);
+        TestObjectB in, out;
+        in.a() = 7;
+        double t = tl::timer::wtime();
+        CPPUNIT_ASSERT_NO_THROW(producer.push(in));
+        // the item stays buffered until max_delay has elapsed
+        CPPUNIT_ASSERT(consumer.tryPop(out) == hepnos::QueuePopStatus::TIMEOUT);
+        // and is then sent without the producer pushing again or closing
+        CPPUNIT_ASSERT(consumer.timedPop(out, 5.0) == hepnos::QueuePopStatus::POPPED);
+        CPPUNIT_ASSERT_EQUAL(7, out.a());
+        double elapsed = tl::timer::wtime() - t;
+        CPPUNIT_ASSERT(elapsed >= 0.2);
+        CPPUNIT_ASSERT(elapsed < 5.0);
+        CPPUNIT_ASSERT_NO_THROW(producer.close());
+        CPPUNIT_ASSERT_NO_THROW(consumer.close());
+        CPPUNIT_ASSERT_NO_THROW(datastore->destroyQueue<TestObjectB>("delayed_b"));
+    }
+    MPI_Barrier(MPI_COMM_WORLD);
+}
+
+void QueueTest::testPersistentQueue() {
+    int rank;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    if(rank == 0) {
+        hepnos::QueueOptions options;
+        options.persistent = true;
+        CPPUNIT_ASSERT_NO_THROW(
+            datastore->createQueue<TestObjectB>("persistent_b", options));
+        // with a capacity, the overflow stays in the log
+        options.max_items = 2;
+        options.spill = true;
+        CPPUNIT_ASSERT_NO_THROW(
+            datastore->createQueue<TestObjectB>("persistent_spilled_b", options));
+        for(auto name : { "persistent_b", "persistent_spilled_b" }) {
+            hepnos::Queue producer, consumer;
+            CPPUNIT_ASSERT_NO_THROW(
+                producer = datastore->openQueue<TestObjectB>(
+                    name, hepnos::QueueAccessMode::PRODUCER));
+            CPPUNIT_ASSERT_NO_THROW(
+                consumer = datastore->openQueue<TestObjectB>(
+                    name, hepnos::QueueAccessMode::CONSUMER));
+            std::vector<TestObjectB> vec(6);
+            for(int i = 0; i < vec.size(); ++i) {
+                vec[i].a() = i;
+                vec[i].b() = "item" + std::to_string(i);
+            }
+            CPPUNIT_ASSERT_NO_THROW(producer.push(vec[0]));
+            CPPUNIT_ASSERT_NO_THROW(producer.pushMany(vec));
+            CPPUNIT_ASSERT_NO_THROW(producer.close());
+            TestObjectB b;
+            CPPUNIT_ASSERT(consumer.pop(b));
+            CPPUNIT_ASSERT(b == vec[0]);
+            int num_reads = 0;
+            while(consumer.pop(b)) {
+                CPPUNIT_ASSERT(b == vec[num_reads]);
+                num_reads += 1;
+            }
+            CPPUNIT_ASSERT_EQUAL((int)vec.size(), num_reads);
+            CPPUNIT_ASSERT_NO_THROW(consumer.close());
+        }
+        CPPUNIT_ASSERT_NO_THROW(datastore->destroyQueue<TestObjectB>("persistent_b"));
+        CPPUNIT_ASSERT_NO_THROW(datastore->destroyQueue<TestObjectB>("persistent_spilled_b"));
+    }
+    MPI_Barrier(MPI_COMM_WORLD);
+}
+
+void QueueTest::testQueueLogRecovery() {
+    int rank;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    if(rank == 0) {
+        using queue_provider::queue_t;
+        // names of logs that are not valid encodings are rejected
+        std::string name;
+        CPPUNIT_ASSERT(queue_provider::decodeQueueName(
+                    queue_provider::encodeQueueName("my/queue"), name));
+        CPPUNIT_ASSERT_EQUAL(std::string("my/queue"), name);
+        CPPUNIT_ASSERT(!queue_provider::decodeQueueName("6g", name));
+        CPPUNIT_ASSERT(!queue_provider::decodeQueueName("616", name));
+
+        auto tmpdir = std::getenv("TMPDIR");
+        auto path = std::string(tmpdir ? tmpdir : "/tmp")
+                  + "/hepnos-queue-test-" + std::to_string(getpid()) + ".log";
+        {
+            // the log is closed while items are left in it
+            queue_t queue;
+            queue.m_config = "{}";
+            queue.m_file_path = path;
+            CPPUNIT_ASSERT_NO_THROW(queue.createLog());
+            CPPUNIT_ASSERT(queue.push("a", true));
+            CPPUNIT_ASSERT(queue.push("bb", true));
+            CPPUNIT_ASSERT(queue.push("ccc", true));
+            CPPUNIT_ASSERT_EQUAL(std::string("a"), queue.pop());
+        }
+        {
+            // simulate a crash in the middle of writing an item
+            auto file = std::fopen(path.c_str(), "ab");
+            CPPUNIT_ASSERT(file != nullptr);
+            uint64_t size = 100;
+            std::fwrite(&size, sizeof(size), 1, file);
+            std::fwrite("truncated", 9, 1, file);
+            std::fclose(file);
+        }
+        {
+            queue_t queue;
+            queue.m_file_path = path;
+            CPPUNIT_ASSERT_NO_THROW(queue.openLog());
+            CPPUNIT_ASSERT_EQUAL(std::string("{}"), queue.m_config);
+            CPPUNIT_ASSERT_NO_THROW(queue.recover());
+            CPPUNIT_ASSERT_EQUAL(std::string("bb"), queue.pop());
+            // an item pushed after recovery replaces the truncated one
+            CPPUNIT_ASSERT(queue.push("dddd", true));
+        }
+        {
+            queue_t queue;
+            queue.m_file_path = path;
+            CPPUNIT_ASSERT_NO_THROW(queue.openLog());
+            CPPUNIT_ASSERT_NO_THROW(queue.recover());
+            CPPUNIT_ASSERT_EQUAL(std::string("ccc"), queue.pop());
+            CPPUNIT_ASSERT_EQUAL(std::string("dddd"), queue.pop());
+            CPPUNIT_ASSERT(queue.empty());
+            queue.m_keep_file = false;
+        }
+        CPPUNIT_ASSERT(access(path.c_str(), F_OK) != 0);
+    }
+    MPI_Barrier(MPI_COMM_WORLD);
+}
@@ -14,6 +14,14 @@ class QueueTest : public CppUnit::TestFixture
     CPPUNIT_TEST( testQueueOpen );
     CPPUNIT_TEST( testQueueEmpty );
     CPPUNIT_TEST( testQueuePushPop );
+    CPPUNIT_TEST( testQueuePushPopMany );
+    CPPUNIT_TEST( testShardedQueue );
+    CPPUNIT_TEST( testBoundedQueue );
+    CPPUNIT_TEST( testQueueBulkTransfer );
+    CPPUNIT_TEST( testQueueTimedAndAsync );
+    CPPUNIT_TEST( testQueuePushBufferingDelay );
+    CPPUNIT_TEST( testPersistentQueue );
+    CPPUNIT_TEST( testQueueLogRecovery );
     CPPUNIT_TEST_SUITE_END();
 
     public:
@@ -25,6 +33,14 @@ class QueueTest : public CppUnit::TestFixture
     void testQueueOpen();
     void testQueueEmpty();
     void testQueuePushPop();
+    void testQueuePushPopMany();
+    void testShardedQueue();
+    void testBoundedQueue();
+    void testQueueBulkTransfer();
+    void testQueueTimedAndAsync();
+    void testQueuePushBufferingDelay();
+    void testPersistentQueue();
+    void testQueueLogRecovery();
 };
 
 #endif
@@ -294,3 +294,44 @@ void RunTest::testAsyncPrefetcher() {
         CPPUNIT_ASSERT(i == 20);
     }
 }
+
+void RunTest::testChildPrefetcher() {
+    auto root = datastore->root();
+    DataSet mds = root.createDataSet("matthieu_child_prefetch");
+    CPPUNIT_ASSERT(mds.valid());
+    Run r = mds.createRun(42);
+    CPPUNIT_ASSERT(r.valid());
+
+    for(unsigned i=0; i < 20; i++) {
+        SubRun sr = r.createSubRun(i);
+        CPPUNIT_ASSERT(sr.valid());
+        for(unsigned j=0; j < 10; j++) {
+            Event ev = sr.createEvent(j);
+            CPPUNIT_ASSERT(ev.valid());
+        }
+    }
+
+    Prefetcher subrun_prefetcher(*datastore, 8, 4);
+    Prefetcher event_prefetcher(*datastore, 4, 2);
+    subrun_prefetcher.setChild(event_prefetcher);
+    CPPUNIT_ASSERT_THROW(event_prefetcher.setChild(subrun_prefetcher), hepnos::Exception);
+
+    unsigned i=0;
+    for(auto it = r.begin(subrun_prefetcher); it != r.end(); it++) {
+        CPPUNIT_ASSERT(it->valid());
+        CPPUNIT_ASSERT(it->number() == i);
+        unsigned j=0;
+        for(auto ev = it->begin(event_prefetcher); ev != it->end(); ev++) {
+            CPPUNIT_ASSERT(ev->valid());
+            CPPUNIT_ASSERT(ev->number() == j);
+            j += 1;
+        }
+        CPPUNIT_ASSERT_EQUAL(10, (int)j);
+        i += 1;
+    }
+    CPPUNIT_ASSERT_EQUAL(20, (int)i);
+
+    // once detached, the child can become the parent
+    subrun_prefetcher.removeChild();
+    CPPUNIT_ASSERT_NO_THROW(event_prefetcher.setChild(subrun_prefetcher));
+}
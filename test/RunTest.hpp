@@ -19,6 +19,7 @@ class RunTest : public CppUnit::TestFixture
     CPPUNIT_TEST( testAsync );
     CPPUNIT_TEST( testPrefetcher );
     CPPUNIT_TEST( testAsyncPrefetcher );
+    CPPUNIT_TEST( testChildPrefetcher );
     CPPUNIT_TEST_SUITE_END();
 
     public:
@@ -36,6 +37,7 @@ class RunTest : public CppUnit::TestFixture
     void testAsync();
     void testPrefetcher();
     void testAsyncPrefetcher();
+    void testChildPrefetcher();
 };
 
 #endif
@@ -296,3 +296,40 @@ void SubRunTest::testAsyncPrefetcher() {
         CPPUNIT_ASSERT(i == 20);
     }
 }
+
+void SubRunTest::testAdaptivePrefetcher() {
+    auto root = datastore->root();
+    DataSet mds = root.createDataSet("matthieu_adaptive");
+    CPPUNIT_ASSERT(mds.valid());
+    Run r = mds.createRun(42);
+    SubRun sr = r.createSubRun(3);
+
+    std::vector<double> product(128, 1.0);
+    for(unsigned i=0; i < 64; i++) {
+        Event e = sr.createEvent(i);
+        CPPUNIT_ASSERT(e.valid());
+        CPPUNIT_ASSERT(e.store("adaptive", product));
+    }
+
+    Prefetcher prefetcher(*datastore);
+    prefetcher.setBatchSize(8);
+    prefetcher.setCacheSize(16);
+    prefetcher.fetchProduct<std::vector<double>>("adaptive");
+    prefetcher.activateStatistics();
+    // each product takes more than 1KB, so at most 4 fit in the memory limit
+    prefetcher.setAdaptive(true, 4096);
+    unsigned i=0;
+    for(auto it = sr.begin(prefetcher); it != sr.end(); it++) {
+        std::vector<double> loaded;
+        CPPUNIT_ASSERT(it->load(prefetcher, "adaptive", loaded));
+        CPPUNIT_ASSERT(loaded == product);
+        i += 1;
+    }
+    CPPUNIT_ASSERT_EQUAL(64, (int)i);
+
+    PrefetcherStatistics stats;
+    prefetcher.collectStatistics(stats);
+    CPPUNIT_ASSERT(stats.adjustments > 0);
+    CPPUNIT_ASSERT(stats.cache_size <= 4);
+    CPPUNIT_ASSERT(stats.batch_size < 8);
+}
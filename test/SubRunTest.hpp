@@ -19,6 +19,7 @@ class SubRunTest : public CppUnit::TestFixture
     CPPUNIT_TEST( testAsync );
     CPPUNIT_TEST( testPrefetcher );
     CPPUNIT_TEST( testAsyncPrefetcher );
+    CPPUNIT_TEST( testAdaptivePrefetcher );
     CPPUNIT_TEST_SUITE_END();
 
     public:
@@ -36,6 +37,7 @@ class SubRunTest : public CppUnit::TestFixture
     void testAsync();
     void testPrefetcher();
     void testAsyncPrefetcher();
+    void testAdaptivePrefetcher();
 };
 
 #endif
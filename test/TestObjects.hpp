@@ -3,6 +3,10 @@
 
 #include <boost/serialization/access.hpp>
 #include <boost/serialization/string.hpp>
+#include <hepnos/Serializer.hpp>
+#include <hepnos/ColumnLayout.hpp>
+#include <vector>
+#include <cstring>
 
 class TestObjectA {
 
@@ -82,4 +86,82 @@ class TestObjectC {
     }
 };
 
+class TestObjectFlat {
+
+    public:
+
+    std::vector<double>& energies() { return _energies; }
+    std::string& name() { return _name; }
+
+    bool operator==(const TestObjectFlat& other) const {
+        return _energies == other._energies && _name == other._name;
+    }
+
+    private:
+
+    friend struct hepnos::Serializer<TestObjectFlat>;
+
+    std::vector<double> _energies;
+    std::string         _name;
+};
+
+struct TestObjectRaw {
+
+    int    id       = 42;
+    double energy   = 0.0;
+    char   tag[6]   = {};
+
+    bool operator==(const TestObjectRaw& other) const {
+        return id == other.id && energy == other.energy
+            && std::memcmp(tag, other.tag, sizeof(tag)) == 0;
+    }
+};
+
+struct TestObjectHit {
+
+    int         id     = 0;
+    double      energy = 0.0;
+    float       x      = 0.0f;
+    std::string detector;
+
+    bool operator==(const TestObjectHit& other) const {
+        return id == other.id && energy == other.energy
+            && x == other.x && detector == other.detector;
+    }
+};
+
+namespace hepnos {
+
+template<>
+struct Serializer<TestObjectFlat> {
+
+    static void serialize(const TestObjectFlat& value, std::string& buffer) {
+        FlatWriter writer(buffer);
+        writer.write(value._energies);
+        writer.write(value._name);
+    }
+
+    static bool deserialize(const char* data, size_t size, TestObjectFlat& value) {
+        FlatReader reader(data, size);
+        size_t count = 0;
+        const double* energies = reader.view<double>(&count);
+        value._energies.assign(energies, energies + count);
+        reader.read(value._name);
+        return reader.remaining() == 0;
+    }
+};
+
+template<>
+struct ColumnLayout<TestObjectHit> {
+
+    static auto columns() {
+        return std::make_tuple(column("id", &TestObjectHit::id),
+                               column("energy", &TestObjectHit::energy),
+                               column("x", &TestObjectHit::x),
+                               column("detector", &TestObjectHit::detector));
+    }
+};
+
+}
+
 #endif
@@ -15,7 +15,7 @@ CON_FILE=$TEST_DIR/connection.json
 CFG_FILE=$TEST_DIR/config.json
 
 cp config.json $CFG_FILE
-sed -i -e "s|XXX|${SSG_FILE}|g" $CFG_FILE
+sed -i -e "s|XXX|${SSG_FILE}|g" -e "s|YYY|${TEST_DIR}|g" $CFG_FILE
 
 hepnos_test_start_servers 2 2 ${timeout_sec} $CFG_FILE $CON_FILE $SSG_FILE
 